@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ack_window.h"
+
+#include <algorithm>
+
+static AckWindowStats& global_stats_ref() {
+    static auto& stats = *new AckWindowStats();
+    return stats;
+}
+
+AckWindowStats AckWindow::global_stats() {
+    return global_stats_ref();
+}
+
+AckWindow::AckWindow(AckWindowBudget* budget) : budget_(budget) {
+    ++budget_->windows_;
+    SetWindow(std::min(kInitialWindow, std::max(kMinWindow, budget_->budget_ -
+                                                                    budget_->total_window_)));
+}
+
+AckWindow::~AckWindow() {
+    SetWindow(0);
+    --budget_->windows_;
+}
+
+std::optional<AckWindow::clock::duration> AckWindow::min_rtt() const {
+    return min_rtt_;
+}
+
+std::optional<AckWindow::clock::duration> AckWindow::smoothed_rtt() const {
+    return smoothed_rtt_;
+}
+
+void AckWindow::OnSend(size_t bytes, clock::time_point now) {
+    if (sent_bytes_ == acked_bytes_) {
+        // We were idle, so the time since the last rate sample doesn't say anything about how
+        // fast the other end is.
+        rate_start_bytes_ = acked_bytes_;
+        rate_start_time_ = now;
+    }
+
+    sent_bytes_ += bytes;
+    in_flight_ = sent_bytes_ - acked_bytes_;
+
+    if (!rtt_probe_end_) {
+        rtt_probe_end_ = sent_bytes_;
+        rtt_probe_sent_ = now;
+    }
+}
+
+void AckWindow::OnAck(int64_t bytes, clock::time_point now) {
+    // Acks can be negative, to take back credit; that doesn't change what's in flight.
+    if (bytes <= 0) {
+        return;
+    }
+
+    acked_bytes_ = std::min(sent_bytes_, acked_bytes_ + bytes);
+    in_flight_ = sent_bytes_ - acked_bytes_;
+
+    if (rtt_probe_end_ && acked_bytes_ >= *rtt_probe_end_) {
+        clock::duration rtt = now - rtt_probe_sent_;
+        rtt_probe_end_.reset();
+
+        if (!min_rtt_ || rtt < *min_rtt_ || now - min_rtt_measured_ > kMinRttExpiry) {
+            min_rtt_ = rtt;
+            min_rtt_measured_ = now;
+        }
+        smoothed_rtt_ = smoothed_rtt_ ? (*smoothed_rtt_ * 7 + rtt) / 8 : rtt;
+    }
+
+    // Take a rate sample about once per round trip.
+    if (!min_rtt_) {
+        return;
+    }
+    clock::duration interval = now - rate_start_time_;
+    if (interval < std::max<clock::duration>(*min_rtt_, std::chrono::milliseconds(1))) {
+        return;
+    }
+
+    double seconds = std::chrono::duration<double>(interval).count();
+    double rate = (acked_bytes_ - rate_start_bytes_) / seconds;
+    delivery_rate_ = delivery_rate_ ? (delivery_rate_ * 3 + rate) / 4 : rate;
+    rate_start_bytes_ = acked_bytes_;
+    rate_start_time_ = now;
+
+    UpdateWindow();
+}
+
+void AckWindow::UpdateWindow() {
+    double min_rtt_seconds = std::chrono::duration<double>(*min_rtt_).count();
+    int64_t target = std::clamp<int64_t>(2 * delivery_rate_ * min_rtt_seconds, kMinWindow,
+                                         kMaxWindow);
+
+    int64_t window;
+    if (target > window_) {
+        // Grow quickly: while the window is what limits us, the measured rate (and thus the
+        // target) can only ever be slightly larger than the current window.
+        window = std::min(target, window_ * 2);
+    } else {
+        window = window_ - (window_ - target) / 4;
+    }
+
+    if (window > window_) {
+        // Don't take more than a fair share of the budget, or more than what's left of it.
+        int64_t fair_share = budget_->budget_ / static_cast<int64_t>(budget_->windows_);
+        int64_t remaining = budget_->budget_ - budget_->total_window_ + window_;
+        int64_t limit = std::max(window_, std::min(fair_share, remaining));
+        if (window > limit) {
+            window = limit;
+            ++global_stats_ref().budget_limited;
+        }
+    }
+
+    window = std::max(window, kMinWindow);
+    if (window > window_) {
+        ++global_stats_ref().window_increases;
+    } else if (window < window_) {
+        ++global_stats_ref().window_decreases;
+    }
+    SetWindow(window);
+}
+
+void AckWindow::SetWindow(int64_t window) {
+    AckWindowStats& stats = global_stats_ref();
+    budget_->total_window_ += window - window_;
+    stats.total_window_bytes += window - window_;
+    stats.max_total_window_bytes = std::max(stats.max_total_window_bytes, stats.total_window_bytes);
+    window_ = window;
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <optional>
+
+struct AckWindowStats {
+    // Number of times a socket's window was grown or shrunk.
+    uint64_t window_increases = 0;
+    uint64_t window_decreases = 0;
+
+    // Number of times a socket's window was held back by its transport's budget.
+    uint64_t budget_limited = 0;
+
+    // The sum of all socket windows, now and at its highest.
+    int64_t total_window_bytes = 0;
+    int64_t max_total_window_bytes = 0;
+};
+
+// The memory that all of a transport's sockets can have in flight at once.
+class AckWindowBudget {
+  public:
+    explicit AckWindowBudget(int64_t budget) : budget_(budget) {}
+
+    AckWindowBudget(const AckWindowBudget& copy) = delete;
+    AckWindowBudget& operator=(const AckWindowBudget& copy) = delete;
+
+    int64_t budget() const { return budget_; }
+    int64_t total_window() const { return total_window_; }
+    size_t windows() const { return windows_; }
+
+  private:
+    friend class AckWindow;
+
+    int64_t budget_;
+    int64_t total_window_ = 0;
+    size_t windows_ = 0;
+};
+
+// Limits the number of bytes a socket has sent but which haven't been acknowledged yet, on top of
+// the limit imposed by delayed acks. The other end gives us a fixed INITIAL_DELAYED_ACK_BYTES of
+// credit per socket, which is far more than it takes to keep most links busy, and which the other
+// end has to be prepared to buffer if its reader is slow.
+//
+// The window starts small and moves towards twice the bandwidth-delay product, measured from the
+// rate at which our data is acknowledged and the round trip time of acks. A socket's window can't
+// grow beyond its share of its transport's budget, but it never shrinks below kMinWindow, so every
+// socket can always make progress.
+//
+// Everything happens on the looper thread.
+class AckWindow {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr int64_t kMinWindow = 64 * 1024;
+    static constexpr int64_t kInitialWindow = 2 * 1024 * 1024;
+    static constexpr int64_t kMaxWindow = 32 * 1024 * 1024;
+
+    // How long a minimum RTT measurement is trusted for before it's replaced by a fresh one.
+    static constexpr std::chrono::seconds kMinRttExpiry{10};
+
+    explicit AckWindow(AckWindowBudget* budget);
+    ~AckWindow();
+
+    AckWindow(const AckWindow& copy) = delete;
+    AckWindow& operator=(const AckWindow& copy) = delete;
+
+    // Whether the socket may send more data. A single send can overshoot the window.
+    bool CanSend() const { return in_flight_ < window_; }
+
+    void OnSend(size_t bytes, clock::time_point now);
+    void OnAck(int64_t bytes, clock::time_point now);
+
+    int64_t window() const { return window_; }
+    int64_t in_flight() const { return in_flight_; }
+    std::optional<clock::duration> min_rtt() const;
+    std::optional<clock::duration> smoothed_rtt() const;
+
+    // Bytes acknowledged per second.
+    double delivery_rate() const { return delivery_rate_; }
+
+    // Stats for every AckWindow in the process, including ones that have been destroyed.
+    static AckWindowStats global_stats();
+
+  private:
+    void UpdateWindow();
+    void SetWindow(int64_t window);
+
+    AckWindowBudget* budget_;
+    int64_t window_ = 0;
+
+    uint64_t sent_bytes_ = 0;
+    uint64_t acked_bytes_ = 0;
+    int64_t in_flight_ = 0;
+
+    // Only one send is timed at a time: the one that ended at |rtt_probe_end_|.
+    std::optional<uint64_t> rtt_probe_end_;
+    clock::time_point rtt_probe_sent_;
+
+    std::optional<clock::duration> min_rtt_;
+    clock::time_point min_rtt_measured_;
+    std::optional<clock::duration> smoothed_rtt_;
+
+    uint64_t rate_start_bytes_ = 0;
+    clock::time_point rate_start_time_;
+    double delivery_rate_ = 0;
+};
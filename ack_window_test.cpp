@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ack_window.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <functional>
+#include <queue>
+#include <vector>
+
+using namespace std::chrono_literals;
+using clock_type = AckWindow::clock;
+
+// Runs senders that always have something to send over a link that is shared between them, which
+// delivers |rate| bytes per second and adds |rtt| of latency, for |duration| of simulated time.
+static void Simulate(const std::vector<AckWindow*>& windows, double rate, clock_type::duration rtt,
+                     clock_type::duration duration) {
+    constexpr size_t kPacketSize = 64 * 1024;
+    const auto per_packet = std::chrono::duration_cast<clock_type::duration>(
+            std::chrono::duration<double>(kPacketSize / rate));
+
+    struct Ack {
+        clock_type::time_point when;
+        AckWindow* window;
+        bool operator>(const Ack& rhs) const { return when > rhs.when; }
+    };
+    std::priority_queue<Ack, std::vector<Ack>, std::greater<Ack>> acks;
+
+    clock_type::time_point now;
+    const clock_type::time_point end = now + duration;
+    clock_type::time_point link_free = now;
+    while (now < end) {
+        for (AckWindow* window : windows) {
+            while (window->CanSend()) {
+                window->OnSend(kPacketSize, now);
+                link_free = std::max(link_free, now) + per_packet;
+                acks.push({link_free + rtt, window});
+            }
+        }
+
+        ASSERT_FALSE(acks.empty());
+        Ack ack = acks.top();
+        acks.pop();
+        now = ack.when;
+        ack.window->OnAck(kPacketSize, now);
+    }
+}
+
+TEST(AckWindow, grows_towards_bdp) {
+    AckWindowBudget budget(256 * 1024 * 1024);
+    AckWindow window(&budget);
+    ASSERT_EQ(AckWindow::kInitialWindow, window.window());
+
+    // 400MB/s with a 20ms round trip: 8MB in flight keeps the link busy.
+    Simulate({&window}, 400e6, 20ms, 5s);
+    EXPECT_GE(window.window(), 8'000'000);
+    EXPECT_LE(window.window(), AckWindow::kMaxWindow);
+    ASSERT_TRUE(window.min_rtt().has_value());
+    EXPECT_GE(*window.min_rtt(), 20ms);
+    EXPECT_NEAR(400e6, window.delivery_rate(), 40e6);
+}
+
+TEST(AckWindow, shrinks_on_slow_link) {
+    AckWindowBudget budget(256 * 1024 * 1024);
+    AckWindow window(&budget);
+
+    // At 10MB/s, sending a 64KiB packet takes longer than the round trip, so there's no need for
+    // more than a couple of them in flight.
+    Simulate({&window}, 10e6, 1ms, 5s);
+    EXPECT_LE(window.window(), 4 * AckWindow::kMinWindow);
+    EXPECT_EQ(window.window(), budget.total_window());
+}
+
+TEST(AckWindow, budget) {
+    constexpr int64_t kBudget = 4 * 1024 * 1024;
+    AckWindowBudget budget(kBudget);
+    uint64_t budget_limited = AckWindow::global_stats().budget_limited;
+    {
+        AckWindow first(&budget);
+        AckWindow second(&budget);
+        ASSERT_EQ(2U, budget.windows());
+        EXPECT_EQ(AckWindow::kInitialWindow, first.window());
+        EXPECT_EQ(kBudget - AckWindow::kInitialWindow, second.window());
+
+        Simulate({&first, &second}, 400e6, 20ms, 5s);
+        EXPECT_LE(budget.total_window(), kBudget);
+        EXPECT_EQ(first.window() + second.window(), budget.total_window());
+        EXPECT_GT(AckWindow::global_stats().budget_limited, budget_limited);
+
+        // Sockets always get their minimum window, even when the budget has run out.
+        AckWindow third(&budget);
+        EXPECT_EQ(AckWindow::kMinWindow, third.window());
+    }
+    EXPECT_EQ(0U, budget.windows());
+    EXPECT_EQ(0, budget.total_window());
+}
+
+TEST(AckWindow, in_flight) {
+    AckWindowBudget budget(256 * 1024 * 1024);
+    AckWindow window(&budget);
+    auto now = clock_type::now();
+
+    window.OnSend(AckWindow::kInitialWindow - 1, now);
+    EXPECT_TRUE(window.CanSend());
+    window.OnSend(1, now);
+    EXPECT_FALSE(window.CanSend());
+    EXPECT_EQ(AckWindow::kInitialWindow, window.in_flight());
+
+    // Negative acks take back credit from available_send_bytes, but don't acknowledge anything.
+    window.OnAck(-100, now + 1ms);
+    EXPECT_EQ(AckWindow::kInitialWindow, window.in_flight());
+    EXPECT_FALSE(window.min_rtt().has_value());
+
+    window.OnAck(100, now + 1ms);
+    EXPECT_TRUE(window.CanSend());
+    EXPECT_EQ(AckWindow::kInitialWindow - 100, window.in_flight());
+
+    // The RTT is measured once everything sent at the time has been acknowledged. Acks for more
+    // than what was sent are ignored.
+    window.OnAck(AckWindow::kInitialWindow * 2, now + 2ms);
+    EXPECT_EQ(0, window.in_flight());
+    ASSERT_TRUE(window.min_rtt().has_value());
+    EXPECT_EQ(2ms, *window.min_rtt());
+}
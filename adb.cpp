@@ -53,12 +53,15 @@
 #include <build/version.h>
 #include <platform_tools_version.h>
 
+#include "ack_window.h"
 #include "adb_auth.h"
 #include "adb_io.h"
 #include "adb_listeners.h"
 #include "adb_mdns.h"
 #include "adb_unique_fd.h"
 #include "adb_utils.h"
+#include "checksum.h"
+#include "packet_queue.h"
 #include "socket_spec.h"
 #include "sysdeps/chrono.h"
 #include "transport.h"
@@ -111,11 +114,7 @@ std::string adb_version() {
 }
 
 uint32_t calculate_apacket_checksum(const apacket* p) {
-    uint32_t sum = 0;
-    for (size_t i = 0; i < p->msg.data_length; ++i) {
-        sum += static_cast<uint8_t>(p->payload[i]);
-    }
-    return sum;
+    return adb_checksum(p->payload.data(), p->msg.data_length);
 }
 
 std::string command_to_string(uint32_t cmd) {
@@ -172,6 +171,7 @@ std::string to_string(ConnectionState state) {
     }
 }
 
+// apackets and their payloads are recycled through the free lists in types.cpp.
 apacket* get_apacket() {
     apacket* p = new apacket();
     if (p == nullptr) {
@@ -538,8 +538,11 @@ void handle_packet(apacket* p, atransport* t) {
         if (t->SupportsDelayedAck()) {
             VLOG(PACKETS) << "delayed ack available: send buffer = " << send_bytes;
             s->available_send_bytes = send_bytes;
+            s->send_window = std::make_unique<AckWindow>(t->ack_window_budget());
 
-            // TODO: Make this adjustable at connection time?
+            // The full credit is still advertised: the window is deliberately limited on the
+            // sending side only, by the other end's AckWindow, which can grow up to this much on
+            // a long fat link. Older adbs without one use all of it, as they always have.
             send_ready(s->id, s->peer->id, t, INITIAL_DELAYED_ACK_BYTES);
         } else {
             VLOG(PACKETS) << "delayed ack unavailable";
@@ -1373,6 +1376,30 @@ HostRequestResult handle_host_request(std::string_view service, TransportType ty
         status.set_keystore_path(adb_auth_get_userkey_path());
         status.set_known_hosts_path(known_wifi_hosts_file.KeyStorePath());
 
+        auto fill_pool_stats = [](adb::proto::AllocatorPoolStats* out,
+                                  const AllocatorPoolStats& stats) {
+            out->set_hits(stats.hits);
+            out->set_misses(stats.misses);
+            out->set_cached_bytes(stats.cached_bytes);
+        };
+        fill_pool_stats(status.mutable_block_pool(), block_pool_stats());
+        fill_pool_stats(status.mutable_apacket_pool(), apacket_pool_stats());
+
+        PacketQueueStats queue_stats = PacketQueue::global_stats();
+        auto* inbound_packet_queue = status.mutable_inbound_packet_queue();
+        inbound_packet_queue->set_packets(queue_stats.packets);
+        inbound_packet_queue->set_batches(queue_stats.batches);
+        inbound_packet_queue->set_max_batch_size(queue_stats.max_batch_size);
+        inbound_packet_queue->set_max_queue_depth(queue_stats.max_depth);
+
+        AckWindowStats ack_stats = AckWindow::global_stats();
+        auto* delayed_ack = status.mutable_delayed_ack();
+        delayed_ack->set_window_increases(ack_stats.window_increases);
+        delayed_ack->set_window_decreases(ack_stats.window_decreases);
+        delayed_ack->set_budget_limited(ack_stats.budget_limited);
+        delayed_ack->set_total_window_bytes(ack_stats.total_window_bytes);
+        delayed_ack->set_max_total_window_bytes(ack_stats.max_total_window_bytes);
+
         std::string server_status_string;
         status.SerializeToString(&server_status_string);
         SendOkay(reply_fd, server_status_string);
@@ -37,6 +37,14 @@ constexpr size_t MAX_PAYLOAD = 1024 * 1024;
 // receive on a socket before the other side should block.
 constexpr size_t INITIAL_DELAYED_ACK_BYTES = 32 * 1024 * 1024;
 
+// When delayed acks are supported, the most unacknowledged bytes that all of a transport's sockets
+// are allowed to send before their windows stop growing. See AckWindow.
+#if ADB_HOST
+constexpr size_t DELAYED_ACK_WINDOW_BUDGET = 256 * 1024 * 1024;
+#else
+constexpr size_t DELAYED_ACK_WINDOW_BUDGET = 64 * 1024 * 1024;
+#endif
+
 constexpr size_t LINUX_MAX_SOCKET_SIZE = 4194304;
 
 #define A_SYNC 0x434e5953
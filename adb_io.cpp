@@ -25,6 +25,7 @@
 #include <sys/un.h>
 #endif
 
+#include <algorithm>
 #include <thread>
 
 #include <android-base/stringprintf.h>
@@ -129,6 +130,47 @@ bool WriteFdExactly(borrowed_fd fd, const void* buf, size_t len) {
     return true;
 }
 
+bool WritevFdExactly(borrowed_fd fd, adb_iovec* iov, int iovcnt) {
+    VLOG(RWX) << "writevx: fd=" << fd.get() << " iovcnt=" << iovcnt;
+
+    while (iovcnt > 0) {
+        if (iov->iov_len == 0) {
+            ++iov;
+            --iovcnt;
+            continue;
+        }
+
+        ssize_t r = adb_writev(fd, iov, iovcnt);
+        if (r == -1) {
+            D("writevx: fd=%d error %d: %s", fd.get(), errno, strerror(errno));
+            if (errno == EAGAIN) {
+                std::this_thread::yield();
+                continue;
+            } else if (errno == EPIPE) {
+                D("writevx: fd=%d disconnected", fd.get());
+                errno = 0;
+                return false;
+            } else {
+                return false;
+            }
+        }
+
+        // Skip over what was written, which may end partway through a buffer.
+        size_t written = r;
+        while (written > 0) {
+            size_t n = std::min<size_t>(written, iov->iov_len);
+            iov->iov_base = reinterpret_cast<char*>(iov->iov_base) + n;
+            iov->iov_len -= n;
+            written -= n;
+            if (iov->iov_len == 0) {
+                ++iov;
+                --iovcnt;
+            }
+        }
+    }
+    return true;
+}
+
 bool WriteFdExactly(borrowed_fd fd, const char* str) {
     return WriteFdExactly(fd, str, strlen(str));
 }
@@ -23,6 +23,7 @@
 #include <string_view>
 
 #include "adb_unique_fd.h"
+#include "sysdeps/uio.h"
 
 // Sends the protocol "OKAY" message.
 bool SendOkay(borrowed_fd fd);
@@ -73,6 +74,11 @@ bool WriteFdExactly(borrowed_fd fd, const void* buf, size_t len);
 bool WriteFdExactly(borrowed_fd fd, const char* s);
 bool WriteFdExactly(borrowed_fd fd, const std::string& s);
 
+// Same as above, but gathers the data from iovcnt buffers, in as few writev calls as possible.
+// The iovecs are advanced past whatever has been written, so their contents are undefined
+// afterwards.
+bool WritevFdExactly(borrowed_fd fd, adb_iovec* iov, int iovcnt);
+
 // Same as above, but formats the string to send.
 bool WriteFdFmt(borrowed_fd fd, const char* fmt, ...) __attribute__((__format__(__printf__, 2, 3)));
 #endif /* ADB_IO_H */
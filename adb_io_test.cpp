@@ -21,11 +21,13 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include <string>
+#include <thread>
 
 #include <android-base/file.h>
 
@@ -145,6 +147,36 @@ POSIX_TEST(io, WriteFdExactly_string) {
   EXPECT_STREQ(str, s.c_str());
 }
 
+POSIX_TEST(io, WritevFdExactly) {
+  int fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  unique_fd reader(fds[0]);
+  unique_fd writer(fds[1]);
+
+  // The middle buffer is larger than the socket buffer, so writev returns partway through it.
+  std::string header = "header";
+  std::string empty;
+  std::string payload(4 * 1024 * 1024, 'x');
+  std::string trailer = "trailer";
+  std::string expected = header + payload + trailer;
+
+  std::string received;
+  std::thread thread([&]() {
+    received.resize(expected.size());
+    ASSERT_TRUE(ReadFdExactly(reader.get(), received.data(), received.size()));
+  });
+
+  adb_iovec iovs[4];
+  std::string* buffers[4] = {&header, &empty, &payload, &trailer};
+  for (size_t i = 0; i < 4; ++i) {
+    iovs[i].iov_base = buffers[i]->data();
+    iovs[i].iov_len = buffers[i]->size();
+  }
+  ASSERT_TRUE(WritevFdExactly(writer.get(), iovs, 4)) << strerror(errno);
+  thread.join();
+  EXPECT_TRUE(expected == received);
+}
+
 POSIX_TEST(io, WriteFdFmt) {
     TemporaryFile tf;
     ASSERT_NE(-1, tf.fd);
@@ -25,6 +25,7 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
 #include <vector>
 
 #include <android-base/file.h>
@@ -158,6 +159,43 @@ bool mkdirs(const std::string& path) {
   return true;
 }
 
+std::string hex_encode(const void* data, size_t byte_count) {
+    static constexpr char kHexDigits[] = "0123456789abcdef";
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+
+    std::string result;
+    result.reserve(byte_count * 2);
+    for (size_t i = 0; i < byte_count; ++i) {
+        result.push_back(kHexDigits[p[i] >> 4]);
+        result.push_back(kHexDigits[p[i] & 0xf]);
+    }
+    return result;
+}
+
+bool write_file_atomically(const std::string& path, const std::string& content) {
+    static std::atomic<uint32_t> next_id = 0;
+    std::string temp_path =
+            android::base::StringPrintf("%s.%d.%u.tmp", path.c_str(), getpid(), next_id++);
+
+    if (!android::base::WriteStringToFile(content, temp_path)) {
+        int saved_errno = errno;
+        adb_unlink(temp_path.c_str());
+        errno = saved_errno;
+        return false;
+    }
+    if (adb_rename(temp_path.c_str(), path.c_str()) != 0) {
+        // Windows won't rename over an existing file.
+        adb_unlink(path.c_str());
+        if (adb_rename(temp_path.c_str(), path.c_str()) != 0) {
+            int saved_errno = errno;
+            adb_unlink(temp_path.c_str());
+            errno = saved_errno;
+            return false;
+        }
+    }
+    return true;
+}
+
 std::string dump_hex(const void* data, size_t byte_count) {
     size_t truncate_len = 16;
     bool truncated = false;
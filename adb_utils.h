@@ -44,6 +44,15 @@ bool mkdirs(const std::string& path);
 
 std::string escape_arg(const std::string& s);
 
+// Returns the |byte_count| bytes at |data| as lowercase hex, without truncating.
+std::string hex_encode(const void* data, size_t byte_count);
+
+// Replaces the contents of |path| with |content| by writing a new file alongside it and renaming
+// that into place, so that readers never see a partially written file. Each call writes to a
+// temporary file of its own, so concurrent callers (including other adb processes) can't clobber
+// each other's writes. On failure, returns false with errno set.
+bool write_file_atomically(const std::string& path, const std::string& content);
+
 std::string dump_hex(const void* ptr, size_t byte_count);
 std::string dump_header(const amessage* msg);
 std::string dump_packet(const char* name, const char* func, const apacket* p);
@@ -21,10 +21,13 @@
 #include <userenv.h>
 #endif
 
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <gtest/gtest.h>
 
+#include <dirent.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -146,6 +149,41 @@ TEST(adb_utils, mkdirs) {
   test_mkdirs(std::string("relative/subrel"));
 }
 
+TEST(adb_utils, hex_encode) {
+    ASSERT_EQ("", hex_encode("", 0));
+    const uint8_t bytes[] = {0x00, 0x01, 0x7f, 0x80, 0xab, 0xff};
+    ASSERT_EQ("00017f80abff", hex_encode(bytes, sizeof(bytes)));
+
+    // Unlike dump_hex, long inputs aren't truncated.
+    std::string long_input(32, '\x11');
+    ASSERT_EQ(std::string(64, '1'), hex_encode(long_input.data(), long_input.size()));
+}
+
+TEST(adb_utils, write_file_atomically) {
+    TemporaryDir td;
+    std::string path = std::string(td.path) + "/file";
+
+    ASSERT_TRUE(write_file_atomically(path, "first"));
+    ASSERT_TRUE(write_file_atomically(path, "second"));
+    std::string content;
+    ASSERT_TRUE(android::base::ReadFileToString(path, &content));
+    ASSERT_EQ("second", content);
+
+    // No temporary files are left behind.
+    std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(td.path), closedir);
+    ASSERT_NE(nullptr, dir);
+    std::vector<std::string> names;
+    while (dirent* entry = readdir(dir.get())) {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            names.push_back(entry->d_name);
+        }
+    }
+    ASSERT_EQ(std::vector<std::string>{"file"}, names);
+
+    // A missing directory is reported, rather than silently ignored.
+    ASSERT_FALSE(write_file_atomically(std::string(td.path) + "/missing/file", "x"));
+}
+
 #if !defined(_WIN32)
 TEST(adb_utils, set_file_block_mode) {
     unique_fd fd(adb_open("/dev/null", O_RDWR | O_APPEND));
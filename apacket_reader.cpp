@@ -71,8 +71,8 @@ APacketReader::AddResult APacketReader::add_bytes(Block&& block) noexcept {
         return OK;
     }
 
-    // We just received the first block for the packet payload. We may be able to use
-    // std::move (fast). If we can't std::move it, we allocate to store the payload as a fallback
+    // We just received the first block for the packet payload. If it contains the whole payload,
+    // we can use it directly (fast). Otherwise, we allocate to store the payload as a fallback
     // mechanism (slow).
     if (!packet_) {
         packet_ = std::make_unique<apacket>();
@@ -85,6 +85,14 @@ APacketReader::AddResult APacketReader::add_bytes(Block&& block) noexcept {
             packet_->payload = std::move(block);
             add_packet(std::move(packet_));
             return OK;
+        } else if (block.remaining() >= packet_->msg.data_length) {
+            // The block holds the whole payload, and probably the start of the next packet.
+            // Split the payload off, sharing the block's storage, and keep parsing the rest.
+            VLOG(USB) << "Zero-copy split";
+            block.drop_front(block.position());
+            packet_->payload = block.split_front(packet_->msg.data_length);
+            add_packet(std::move(packet_));
+            return add_bytes(std::move(block));
         } else {
             VLOG(USB) << "Falling back: Allocating block " << packet_->msg.data_length;
             packet_->payload.resize(packet_->msg.data_length);
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "checksum.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ADB_CHECKSUM_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define ADB_CHECKSUM_NEON 1
+#endif
+
+// All of the vector implementations accumulate into lanes that are at least 32 bits wide, and the
+// sum wraps around exactly like the scalar uint32_t one does, so the results are identical for any
+// input.
+
+namespace internal {
+
+uint32_t checksum_scalar(const uint8_t* data, size_t len) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < len; ++i) {
+        sum += data[i];
+    }
+    return sum;
+}
+
+#if defined(ADB_CHECKSUM_X86)
+
+// SSE2 is part of the baseline for both x86 ABIs that we build for, so this doesn't need a
+// runtime check.
+__attribute__((target("sse2"))) static uint32_t checksum_sse2(const uint8_t* data, size_t len) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = _mm_setzero_si128();
+    __m128i acc1 = _mm_setzero_si128();
+
+    // psadbw against zero sums each group of 8 bytes into a 64-bit lane.
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 16));
+        acc0 = _mm_add_epi64(acc0, _mm_sad_epu8(a, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_sad_epu8(b, zero));
+    }
+    for (; i + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        acc0 = _mm_add_epi64(acc0, _mm_sad_epu8(a, zero));
+    }
+
+    __m128i acc = _mm_add_epi64(acc0, acc1);
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc));
+    uint32_t sum = static_cast<uint32_t>(_mm_cvtsi128_si32(acc));
+    return sum + checksum_scalar(data + i, len - i);
+}
+
+__attribute__((target("avx2"))) static uint32_t checksum_avx2(const uint8_t* data, size_t len) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 32));
+        acc0 = _mm256_add_epi64(acc0, _mm256_sad_epu8(a, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_sad_epu8(b, zero));
+    }
+    for (; i + 32 <= len; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        acc0 = _mm256_add_epi64(acc0, _mm256_sad_epu8(a, zero));
+    }
+
+    __m256i acc256 = _mm256_add_epi64(acc0, acc1);
+    __m128i acc = _mm_add_epi64(_mm256_castsi256_si128(acc256),
+                                _mm256_extracti128_si256(acc256, 1));
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc));
+    uint32_t sum = static_cast<uint32_t>(_mm_cvtsi128_si32(acc));
+    return sum + checksum_scalar(data + i, len - i);
+}
+
+static bool cpu_supports_avx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#elif defined(ADB_CHECKSUM_NEON)
+
+static uint32_t checksum_neon(const uint8_t* data, size_t len) {
+    uint32x4_t acc = vdupq_n_u32(0);
+
+    size_t i = 0;
+    while (i + 16 <= len) {
+        // Pairwise add bytes into 16-bit lanes. Each step adds at most 2 * 255 to a lane, so we
+        // can do 128 of them before the 16-bit lanes could overflow.
+        uint16x8_t acc16 = vdupq_n_u16(0);
+        for (size_t n = 0; n < 128 && i + 16 <= len; ++n, i += 16) {
+            acc16 = vpadalq_u8(acc16, vld1q_u8(data + i));
+        }
+        acc = vpadalq_u16(acc, acc16);
+    }
+
+    return vaddvq_u32(acc) + checksum_scalar(data + i, len - i);
+}
+
+#endif
+
+std::vector<ChecksumImplementation> available_checksum_implementations() {
+    std::vector<ChecksumImplementation> result;
+    result.push_back({"scalar", checksum_scalar});
+#if defined(ADB_CHECKSUM_X86)
+    result.push_back({"sse2", checksum_sse2});
+    if (cpu_supports_avx2()) {
+        result.push_back({"avx2", checksum_avx2});
+    }
+#elif defined(ADB_CHECKSUM_NEON)
+    result.push_back({"neon", checksum_neon});
+#endif
+    return result;
+}
+
+}  // namespace internal
+
+uint32_t adb_checksum(const void* data, size_t len) {
+    // The last implementation is the fastest one that this CPU supports.
+    static const internal::ChecksumFunction checksum =
+            internal::available_checksum_implementations().back().function;
+    return checksum(static_cast<const uint8_t*>(data), len);
+}
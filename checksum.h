@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string_view>
+#include <vector>
+
+// Returns the sum of all of the bytes in |data|, modulo 2^32. This is the checksum used for
+// apackets exchanged with devices older than A_VERSION_SKIP_CHECKSUM, and for CNXN/AUTH.
+//
+// The implementation is picked at runtime based on what the CPU supports.
+uint32_t adb_checksum(const void* data, size_t len);
+
+// Internal functions that are only made available here for testing purposes.
+namespace internal {
+
+using ChecksumFunction = uint32_t (*)(const uint8_t* data, size_t len);
+
+struct ChecksumImplementation {
+    std::string_view name;
+    ChecksumFunction function;
+};
+
+// The reference implementation, one byte at a time.
+uint32_t checksum_scalar(const uint8_t* data, size_t len);
+
+// All of the implementations that can run on this CPU, starting with the scalar one.
+std::vector<ChecksumImplementation> available_checksum_implementations();
+
+}  // namespace internal
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "adb.h"
+#include "checksum.h"
+
+static void BM_Checksum(benchmark::State& state, internal::ChecksumFunction function) {
+    std::vector<uint8_t> data(state.range(0));
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<uint8_t>(i * 31);
+    }
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(function(data.data(), data.size()));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * data.size());
+}
+
+static void RegisterChecksumBenchmarks() {
+    for (const auto& impl : internal::available_checksum_implementations()) {
+        std::string name = "BM_Checksum/" + std::string(impl.name);
+        benchmark::RegisterBenchmark(name.c_str(), BM_Checksum, impl.function)
+                ->RangeMultiplier(4)
+                ->Range(1, MAX_PAYLOAD);
+    }
+}
+
+static int checksum_benchmarks = (RegisterChecksumBenchmarks(), 0);
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "checksum.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+#include "adb.h"
+
+using internal::available_checksum_implementations;
+using internal::checksum_scalar;
+
+static std::vector<uint8_t> random_bytes(size_t len) {
+    std::mt19937 rng(len);
+    std::uniform_int_distribution<int> dist(0, 255);
+    std::vector<uint8_t> result(len);
+    for (auto& byte : result) {
+        byte = dist(rng);
+    }
+    return result;
+}
+
+TEST(checksum, scalar) {
+    ASSERT_EQ(0U, checksum_scalar(nullptr, 0));
+
+    std::vector<uint8_t> data = {1, 2, 3, 0xff};
+    ASSERT_EQ(261U, checksum_scalar(data.data(), data.size()));
+}
+
+TEST(checksum, apacket) {
+    apacket p;
+    p.payload = Block(std::string("\x01\x02\x03\xff"));
+    p.msg.data_length = 3;
+    ASSERT_EQ(6U, calculate_apacket_checksum(&p));
+}
+
+TEST(checksum, default_matches_scalar) {
+    auto data = random_bytes(MAX_PAYLOAD);
+    ASSERT_EQ(checksum_scalar(data.data(), data.size()), adb_checksum(data.data(), data.size()));
+}
+
+// Every length and alignment up to a few vector widths, to cover all of the head/tail handling.
+TEST(checksum, all_lengths_and_alignments) {
+    auto data = random_bytes(1024 + 64);
+    for (const auto& impl : available_checksum_implementations()) {
+        SCOPED_TRACE(impl.name);
+        for (size_t offset = 0; offset < 64; ++offset) {
+            for (size_t len = 0; len <= 1024; ++len) {
+                ASSERT_EQ(checksum_scalar(data.data() + offset, len),
+                          impl.function(data.data() + offset, len))
+                        << "offset = " << offset << ", len = " << len;
+            }
+        }
+    }
+}
+
+// All bytes set, so the sum is as large as it can get and wraps around for large inputs.
+TEST(checksum, saturated) {
+    std::vector<uint8_t> data(32 * 1024 * 1024 + 17, 0xff);
+    for (const auto& impl : available_checksum_implementations()) {
+        SCOPED_TRACE(impl.name);
+        for (size_t len : {size_t(1), size_t(4095), MAX_PAYLOAD, data.size()}) {
+            ASSERT_EQ(checksum_scalar(data.data(), len), impl.function(data.data(), len))
+                    << "len = " << len;
+        }
+    }
+}
+
+TEST(checksum, large_random) {
+    auto data = random_bytes(MAX_PAYLOAD + 3);
+    for (const auto& impl : available_checksum_implementations()) {
+        SCOPED_TRACE(impl.name);
+        for (size_t offset = 0; offset < 4; ++offset) {
+            ASSERT_EQ(checksum_scalar(data.data() + offset, MAX_PAYLOAD),
+                      impl.function(data.data() + offset, MAX_PAYLOAD));
+        }
+    }
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "client/adaptive_compression.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+#include <lz4.h>
+#include <zstd.h>
+
+// How much weight a new measurement gets against the ones before it.
+static constexpr double kRateSmoothing = 0.3;
+
+// Data that doesn't compress better than this is sent as it is.
+static constexpr double kMinUsefulRatio = 0.95;
+
+// A heavier codec has to be predicted to be this much faster to be picked over a lighter one.
+static constexpr double kHysteresis = 1.05;
+
+std::string CompressionChoice::ToString() const {
+    switch (type) {
+        case CompressionType::None:
+            return "none";
+        case CompressionType::Brotli:
+            return "brotli";
+        case CompressionType::LZ4:
+            return "lz4";
+        case CompressionType::Zstd:
+            return android::base::StringPrintf("zstd-%d", level);
+        case CompressionType::Any:
+        case CompressionType::Adaptive:
+            break;
+    }
+    return "?";
+}
+
+bool is_compressed_file_name(std::string_view path) {
+    // APKs aren't on the list: their native libraries and resources are often stored uncompressed.
+    static constexpr const char* kCompressedExtensions[] = {
+            ".7z",  ".avif", ".br",  ".bz2", ".gif",  ".gz",   ".heic", ".jar", ".jpeg",
+            ".jpg", ".lz4",  ".m4a", ".mkv", ".mp3",  ".mp4",  ".ogg",  ".opus", ".png",
+            ".tgz", ".webm", ".webp", ".xz", ".zip",  ".zst",
+    };
+    std::string lower(path.substr(path.size() - std::min<size_t>(path.size(), 8)));
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    for (const char* extension : kCompressedExtensions) {
+        if (android::base::EndsWith(lower, extension)) return true;
+    }
+    return false;
+}
+
+namespace internal {
+
+size_t trial_compress(const CompressionChoice& choice, const char* data, size_t size) {
+    size_t result = size;
+    if (choice.type == CompressionType::LZ4) {
+        std::vector<char> output(LZ4_compressBound(size));
+        int rc = LZ4_compress_default(data, output.data(), size, output.size());
+        if (rc > 0) result = rc;
+    } else if (choice.type == CompressionType::Zstd) {
+        std::vector<char> output(ZSTD_compressBound(size));
+        size_t rc = ZSTD_compress(output.data(), output.size(), data, size, choice.level);
+        if (!ZSTD_isError(rc)) result = rc;
+    }
+    return std::min(result, size);
+}
+
+}  // namespace internal
+
+std::optional<AdaptiveCompression::Codec> AdaptiveCompression::CodecFor(
+        const CompressionChoice& choice) {
+    if (choice.type == CompressionType::LZ4) return kLZ4;
+    if (choice.type == CompressionType::Zstd) return choice.level >= 3 ? kZstd3 : kZstd1;
+    return std::nullopt;
+}
+
+CompressionChoice AdaptiveCompression::Choose(std::string_view path, const char* sample,
+                                              size_t sample_size, size_t threads, bool have_lz4,
+                                              bool have_zstd) {
+    CompressionChoice none;
+    if (sample_size == 0 || is_compressed_file_name(path)) return none;
+
+    std::vector<CompressionChoice> candidates;
+    if (have_lz4) candidates.push_back({CompressionType::LZ4, 0});
+    if (have_zstd) {
+        candidates.push_back({CompressionType::Zstd, 1});
+        candidates.push_back({CompressionType::Zstd, 3});
+    }
+
+    double link_rate;
+    double compression_rates[kCodecCount];
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        link_rate = link_rate_;
+        std::copy(std::begin(compression_rates_), std::end(compression_rates_), compression_rates);
+    }
+
+    // Sending uncompressed data goes at the speed of the link. Otherwise, whichever of the
+    // compressor and the link is slower sets the pace.
+    CompressionChoice best = none;
+    double best_rate = link_rate;
+    for (const CompressionChoice& candidate : candidates) {
+        double ratio =
+                static_cast<double>(internal::trial_compress(candidate, sample, sample_size)) /
+                sample_size;
+        if (ratio > kMinUsefulRatio) continue;
+
+        double compressor_rate = compression_rates[*CodecFor(candidate)] * threads;
+        double rate = std::min(compressor_rate, link_rate / ratio);
+        if (rate > best_rate * kHysteresis) {
+            best = candidate;
+            best_rate = rate;
+        }
+    }
+    return best;
+}
+
+CompressionChoice AdaptiveCompression::ChooseWithoutSample(std::string_view path, bool have_lz4,
+                                                           bool have_zstd) {
+    if (is_compressed_file_name(path)) return {};
+    if (have_zstd) return {CompressionType::Zstd, 1};
+    if (have_lz4) return {CompressionType::LZ4, 0};
+    return {};
+}
+
+void AdaptiveCompression::RecordCompression(const CompressionChoice& choice, uint64_t bytes,
+                                            size_t threads, double seconds) {
+    std::optional<Codec> codec = CodecFor(choice);
+    if (!codec || seconds <= 0 || threads == 0) return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    double rate = bytes / seconds / threads;
+    compression_rates_[*codec] += kRateSmoothing * (rate - compression_rates_[*codec]);
+}
+
+void AdaptiveCompression::RecordLink(uint64_t bytes, double seconds, double blocked_seconds) {
+    static constexpr double kMinBlockedSeconds = 0.01;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (blocked_seconds >= kMinBlockedSeconds) {
+        link_rate_ += kRateSmoothing * (bytes / blocked_seconds - link_rate_);
+    } else if (seconds > 0) {
+        // Writes that hardly ever had to wait only say that the link kept up with everything else.
+        link_rate_ = std::max(link_rate_, bytes / seconds);
+    }
+}
+
+double AdaptiveCompression::link_rate() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return link_rate_;
+}
+
+double AdaptiveCompression::compression_rate(const CompressionChoice& choice) const {
+    std::optional<Codec> codec = CodecFor(choice);
+    if (!codec) return 0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    return compression_rates_[*codec];
+}
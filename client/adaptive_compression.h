@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "file_sync_protocol.h"
+
+// The codec and zstd level that a file is sent with.
+struct CompressionChoice {
+    CompressionType type = CompressionType::None;
+    int level = 0;
+
+    std::string ToString() const;
+    bool operator==(const CompressionChoice& rhs) const {
+        return type == rhs.type && level == rhs.level;
+    }
+};
+
+// Picks how to compress each file for `-z adaptive`. Compression only pays off when the link is
+// slower than the compressor, and when the data compresses at all, so each file gets whichever
+// of no compression, LZ4 and zstd at a couple of levels is predicted to get its data across
+// soonest: the compression ratio comes from trial-compressing the start of the file, and the
+// compressor and link throughputs are measured from the files sent so far.
+//
+// The protocol only lets the codec change between files, not within one.
+class AdaptiveCompression {
+  public:
+    // The amount of a file to trial-compress.
+    static constexpr size_t kSampleSize = 64 * 1024;
+
+    AdaptiveCompression() = default;
+
+    AdaptiveCompression(const AdaptiveCompression& copy) = delete;
+    AdaptiveCompression& operator=(const AdaptiveCompression& copy) = delete;
+
+    // Picks how to compress the file at |path|, which will be compressed on |threads| threads,
+    // given up to kSampleSize bytes from its start.
+    CompressionChoice Choose(std::string_view path, const char* sample, size_t sample_size,
+                             size_t threads, bool have_lz4, bool have_zstd);
+
+    // Picks how the device should compress a file that's being pulled, which can only go on the
+    // file's name.
+    CompressionChoice ChooseWithoutSample(std::string_view path, bool have_lz4, bool have_zstd);
+
+    // Records how long it took to compress |bytes| bytes on |threads| threads.
+    void RecordCompression(const CompressionChoice& choice, uint64_t bytes, size_t threads,
+                           double seconds);
+
+    // Records that sending |bytes| bytes took |seconds|, of which writes to the link spent
+    // |blocked_seconds| blocked.
+    void RecordLink(uint64_t bytes, double seconds, double blocked_seconds);
+
+    // Bytes per second, per thread for compressors.
+    double link_rate() const;
+    double compression_rate(const CompressionChoice& choice) const;
+
+  private:
+    // Indices into compression_rates_.
+    enum Codec { kLZ4, kZstd1, kZstd3, kCodecCount };
+    static std::optional<Codec> CodecFor(const CompressionChoice& choice);
+
+    mutable std::mutex mutex_;
+    double link_rate_ = 40e6;
+    double compression_rates_[kCodecCount] = {500e6, 250e6, 120e6};
+};
+
+// Whether the file's name says that its contents are already compressed.
+bool is_compressed_file_name(std::string_view path);
+
+namespace internal {
+
+// The size that |data| compresses to with |choice|, or |size| if it doesn't compress.
+size_t trial_compress(const CompressionChoice& choice, const char* data, size_t size);
+
+}  // namespace internal
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "client/adaptive_compression.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+
+static std::string RandomData(size_t size) {
+    std::mt19937 rng(1);
+    std::string data(size, '\0');
+    for (char& c : data) c = rng();
+    return data;
+}
+
+static std::string RepetitiveData(size_t size) {
+    std::string data;
+    while (data.size() < size) data += "adb sync sends this line over and over again. ";
+    data.resize(size);
+    return data;
+}
+
+TEST(AdaptiveCompression, trial_compress) {
+    std::string random = RandomData(AdaptiveCompression::kSampleSize);
+    std::string repetitive = RepetitiveData(AdaptiveCompression::kSampleSize);
+    for (CompressionChoice choice : {CompressionChoice{CompressionType::LZ4, 0},
+                                     CompressionChoice{CompressionType::Zstd, 1}}) {
+        // Data that doesn't compress is reported at its own size, rather than what the
+        // compressor's framing would add to it.
+        EXPECT_EQ(random.size(), internal::trial_compress(choice, random.data(), random.size()));
+        EXPECT_LT(internal::trial_compress(choice, repetitive.data(), repetitive.size()),
+                  repetitive.size() / 10);
+    }
+    EXPECT_EQ(repetitive.size(),
+              internal::trial_compress({}, repetitive.data(), repetitive.size()));
+}
+
+TEST(AdaptiveCompression, compressed_file_name) {
+    EXPECT_TRUE(is_compressed_file_name("/out/system/media/bootanimation.zip"));
+    EXPECT_TRUE(is_compressed_file_name("photo.JPG"));
+    EXPECT_TRUE(is_compressed_file_name("a.tar.zst"));
+    EXPECT_FALSE(is_compressed_file_name("/out/system/app/Foo/Foo.apk"));
+    EXPECT_FALSE(is_compressed_file_name("/out/system/lib64/libc.so"));
+    EXPECT_FALSE(is_compressed_file_name("zip"));
+    EXPECT_FALSE(is_compressed_file_name(""));
+}
+
+TEST(AdaptiveCompression, choose) {
+    AdaptiveCompression adaptive;
+    std::string random = RandomData(AdaptiveCompression::kSampleSize);
+    std::string repetitive = RepetitiveData(AdaptiveCompression::kSampleSize);
+
+    EXPECT_EQ(CompressionType::None,
+              adaptive.Choose("random", random.data(), random.size(), 1, true, true).type);
+    EXPECT_EQ(CompressionType::None,
+              adaptive.Choose("a.zip", repetitive.data(), repetitive.size(), 1, true, true).type);
+    EXPECT_EQ(CompressionType::None,
+              adaptive.Choose("text", repetitive.data(), repetitive.size(), 1, false, false).type);
+    EXPECT_NE(CompressionType::None,
+              adaptive.Choose("text", repetitive.data(), repetitive.size(), 1, true, true).type);
+    EXPECT_EQ(CompressionType::LZ4,
+              adaptive.Choose("text", repetitive.data(), repetitive.size(), 1, true, false).type);
+}
+
+TEST(AdaptiveCompression, fast_link) {
+    AdaptiveCompression adaptive;
+    std::string repetitive = RepetitiveData(AdaptiveCompression::kSampleSize);
+
+    // Once the link turns out to be faster than any compressor, data is sent as it is.
+    for (int i = 0; i < 20; ++i) adaptive.RecordLink(1'000'000'000, 0.1, 0.1);
+    EXPECT_GT(adaptive.link_rate(), 5e9);
+    EXPECT_EQ(CompressionType::None,
+              adaptive.Choose("text", repetitive.data(), repetitive.size(), 1, true, true).type);
+
+    // Unless there are enough threads to keep up with it.
+    EXPECT_NE(CompressionType::None,
+              adaptive.Choose("text", repetitive.data(), repetitive.size(), 64, true, true).type);
+}
+
+TEST(AdaptiveCompression, slow_compressor) {
+    AdaptiveCompression adaptive;
+    std::string repetitive = RepetitiveData(AdaptiveCompression::kSampleSize);
+
+    CompressionChoice zstd1{CompressionType::Zstd, 1};
+    CompressionChoice zstd3{CompressionType::Zstd, 3};
+    for (int i = 0; i < 20; ++i) {
+        adaptive.RecordCompression(zstd1, 1'000'000, 1, 1.0);
+        adaptive.RecordCompression(zstd3, 1'000'000, 1, 1.0);
+    }
+    EXPECT_LT(adaptive.compression_rate(zstd1), 2e6);
+    EXPECT_EQ(CompressionType::LZ4,
+              adaptive.Choose("text", repetitive.data(), repetitive.size(), 1, true, true).type);
+}
+
+TEST(AdaptiveCompression, choose_without_sample) {
+    AdaptiveCompression adaptive;
+    EXPECT_EQ(CompressionType::None, adaptive.ChooseWithoutSample("a.png", true, true).type);
+    EXPECT_EQ(CompressionType::Zstd, adaptive.ChooseWithoutSample("a.so", true, true).type);
+    EXPECT_EQ(CompressionType::LZ4, adaptive.ChooseWithoutSample("a.so", true, false).type);
+    EXPECT_EQ(CompressionType::None, adaptive.ChooseWithoutSample("a.so", false, false).type);
+}
@@ -22,8 +22,11 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <vector>
 
 #include <android-base/file.h>
@@ -528,6 +531,106 @@ int install_app(int argc, const char** argv) {
     return res;
 }
 
+namespace {
+
+// A file to stream into an install session with install-write.
+struct SplitWrite {
+    std::string file;
+    std::string session_id;
+    std::string name;
+};
+
+}  // namespace
+
+// How many splits are streamed at once. Each install-write is its own connection, so adbd and the
+// package manager can be reading one split while the host is still sending the next.
+static constexpr size_t kMaxConcurrentSplitWrites = 4;
+
+static bool write_split(const std::string& install_cmd, const SplitWrite& split) {
+    using clock = std::chrono::steady_clock;
+    const auto start = clock::now();
+
+    const char* file = split.file.c_str();
+    struct stat sb;
+    if (stat(file, &sb) == -1) {
+        fprintf(stderr, "adb: failed to stat \"%s\": %s\n", file, strerror(errno));
+        return false;
+    }
+
+    std::vector<std::string> cmd_args = {
+            install_cmd,
+            "install-write",
+            "-S",
+            std::to_string(sb.st_size),
+            split.session_id,
+            split.name,
+            "-",
+    };
+
+    unique_fd local_fd(adb_open(file, O_RDONLY | O_CLOEXEC));
+    if (local_fd < 0) {
+        fprintf(stderr, "adb: failed to open \"%s\": %s\n", file, strerror(errno));
+        return false;
+    }
+
+    std::string error;
+    unique_fd remote_fd = send_command(cmd_args, &error);
+    if (remote_fd < 0) {
+        fprintf(stderr, "adb: connect error for write: %s\n", error.c_str());
+        return false;
+    }
+
+    if (!copy_to_file(local_fd.get(), remote_fd.get())) {
+        fprintf(stderr, "adb: failed to write \"%s\": %s\n", file, strerror(errno));
+        return false;
+    }
+
+    char buf[BUFSIZ];
+    read_status_line(remote_fd.get(), buf, sizeof(buf));
+
+    if (strncmp("Success", buf, 7)) {
+        // One call, so that the reason doesn't get separated from the file by another split.
+        fprintf(stderr, "adb: failed to write \"%s\"\n%s", file, buf);
+        return false;
+    }
+
+    VLOG(ADB) << "wrote " << file << " (" << sb.st_size << " bytes) to session "
+              << split.session_id << " in " << ms_between(start, clock::now()) << " ms";
+    return true;
+}
+
+// Streams |splits| into their sessions, up to kMaxConcurrentSplitWrites at a time. Once one fails,
+// no more are started.
+static bool write_splits(const std::string& install_cmd, const std::vector<SplitWrite>& splits) {
+    using clock = std::chrono::steady_clock;
+    const auto start = clock::now();
+
+    std::atomic<size_t> next_split = 0;
+    std::atomic<bool> failed = false;
+    auto write_next_splits = [&]() {
+        while (!failed) {
+            size_t i = next_split++;
+            if (i >= splits.size()) return;
+            if (!write_split(install_cmd, splits[i])) {
+                failed = true;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < std::min(kMaxConcurrentSplitWrites, splits.size()); ++i) {
+        threads.emplace_back(write_next_splits);
+    }
+    write_next_splits();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    VLOG(ADB) << "wrote " << splits.size() << " splits in " << ms_between(start, clock::now())
+              << " ms";
+    return !failed;
+}
+
 static int install_multiple_app_streamed(int argc, const char** argv) {
     // Find all APK arguments starting at end.
     // All other arguments passed through verbatim.
@@ -599,58 +702,12 @@ static int install_multiple_app_streamed(int argc, const char** argv) {
     const auto session_id_str = std::to_string(session_id);
 
     // Valid session, now stream the APKs
-    bool success = true;
+    std::vector<SplitWrite> splits;
     for (int i = first_apk; i < argc; i++) {
-        const char* file = argv[i];
-        struct stat sb;
-        if (stat(file, &sb) == -1) {
-            fprintf(stderr, "adb: failed to stat \"%s\": %s\n", file, strerror(errno));
-            success = false;
-            goto finalize_session;
-        }
-
-        std::vector<std::string> cmd_args = {
-                install_cmd,
-                "install-write",
-                "-S",
-                std::to_string(sb.st_size),
-                session_id_str,
-                android::base::Basename(file),
-                "-",
-        };
-
-        unique_fd local_fd(adb_open(file, O_RDONLY | O_CLOEXEC));
-        if (local_fd < 0) {
-            fprintf(stderr, "adb: failed to open \"%s\": %s\n", file, strerror(errno));
-            success = false;
-            goto finalize_session;
-        }
-
-        std::string error;
-        unique_fd remote_fd = send_command(cmd_args, &error);
-        if (remote_fd < 0) {
-            fprintf(stderr, "adb: connect error for write: %s\n", error.c_str());
-            success = false;
-            goto finalize_session;
-        }
-
-        if (!copy_to_file(local_fd.get(), remote_fd.get())) {
-            fprintf(stderr, "adb: failed to write \"%s\": %s\n", file, strerror(errno));
-            success = false;
-            goto finalize_session;
-        }
-
-        read_status_line(remote_fd.get(), buf, sizeof(buf));
-
-        if (strncmp("Success", buf, 7)) {
-            fprintf(stderr, "adb: failed to write \"%s\"\n", file);
-            fputs(buf, stderr);
-            success = false;
-            goto finalize_session;
-        }
+        splits.push_back({argv[i], session_id_str, android::base::Basename(argv[i])});
     }
+    bool success = write_splits(install_cmd, splits);
 
-finalize_session:
     // Commit session if we streamed everything okay; otherwise abandon.
     std::vector<std::string> service_args = {
             install_cmd,
@@ -790,6 +847,7 @@ int install_multi_package(int argc, const char** argv) {
     fprintf(stdout, "Created parent session ID %d.\n", parent_session_id);
 
     std::vector<int> session_ids;
+    std::vector<SplitWrite> writes;
 
     // Valid session, now create the individual sessions and stream the APKs
     int success = EXIT_FAILURE;
@@ -859,51 +917,18 @@ int install_multi_package(int argc, const char** argv) {
         std::vector<std::string> splits = android::base::Split(file, ENV_PATH_SEPARATOR_STR);
 
         for (const std::string& split : splits) {
-            struct stat sb;
-            if (stat(split.c_str(), &sb) == -1) {
-                fprintf(stderr, "adb: failed to stat %s: %s\n", split.c_str(), strerror(errno));
-                goto finalize_multi_package_session;
-            }
-
-            std::vector<std::string> cmd_args = {
-                    install_cmd,
-                    "install-write",
-                    "-S",
-                    std::to_string(sb.st_size),
-                    session_id_str,
-                    android::base::StringPrintf("%d_%s", i, android::base::Basename(split).c_str()),
-                    "-",
-            };
-
-            unique_fd local_fd(adb_open(split.c_str(), O_RDONLY | O_CLOEXEC));
-            if (local_fd < 0) {
-                fprintf(stderr, "adb: failed to open %s: %s\n", split.c_str(), strerror(errno));
-                goto finalize_multi_package_session;
-            }
-
-            std::string error;
-            unique_fd remote_fd = send_command(cmd_args, &error);
-            if (remote_fd < 0) {
-                fprintf(stderr, "adb: connect error for write: %s\n", error.c_str());
-                goto finalize_multi_package_session;
-            }
-
-            if (!copy_to_file(local_fd.get(), remote_fd.get())) {
-                fprintf(stderr, "adb: failed to write %s: %s\n", split.c_str(), strerror(errno));
-                goto finalize_multi_package_session;
-            }
-
-            read_status_line(remote_fd.get(), buf, sizeof(buf));
-
-            if (strncmp("Success", buf, 7)) {
-                fprintf(stderr, "adb: failed to write %s\n", split.c_str());
-                fputs(buf, stderr);
-                goto finalize_multi_package_session;
-            }
+            writes.push_back({split, session_id_str,
+                              android::base::StringPrintf("%d_%s", i,
+                                                          android::base::Basename(split).c_str())});
         }
         add_session_cmd_args.push_back(std::to_string(session_id));
     }
 
+    // Every session exists, so their splits can all be streamed together.
+    if (!write_splits(install_cmd, writes)) {
+        goto finalize_multi_package_session;
+    }
+
     {
         unique_fd fd = send_command(add_session_cmd_args, &error);
         if (fd < 0) {
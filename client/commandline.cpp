@@ -142,26 +142,30 @@ static void help() {
         " mdns services            list all discovered services\n"
         "\n"
         "file transfer:\n"
-        " push [--sync] [-z ALGORITHM] [-Z] LOCAL... REMOTE\n"
+        " push [--sync] [-j N] [-z ALGORITHM] [-Z] LOCAL... REMOTE\n"
         "     copy local files/directories to device\n"
+        "     -j: copy the contents of directories over N connections at once\n"
         "     -n: dry run: push files to device without storing to the filesystem\n"
         "     -q: suppress progress messages\n"
         "     -Z: disable compression\n"
-        "     -z: enable compression with a specified algorithm (any/none/brotli/lz4/zstd)\n"
+        "     -z: enable compression with a specified algorithm (any/none/brotli/lz4/zstd/adaptive)\n"
         "     --sync: only push files that have different timestamps on the host than the device\n"
-        " pull [-a] [-z ALGORITHM] [-Z] REMOTE... LOCAL\n"
+        " pull [-a] [-j N] [-z ALGORITHM] [-Z] REMOTE... LOCAL\n"
         "     copy files/dirs from device\n"
         "     -a: preserve file timestamp and mode\n"
+        "     -j: copy the contents of directories, or large files, over N connections at once\n"
         "     -q: suppress progress messages\n"
         "     -Z: disable compression\n"
-        "     -z: enable compression with a specified algorithm (any/none/brotli/lz4/zstd)\n"
-        " sync [-l] [-z ALGORITHM] [-Z] [all|data|odm|oem|product|system|system_ext|vendor]\n"
+        "     -z: enable compression with a specified algorithm (any/none/brotli/lz4/zstd/adaptive)\n"
+        " sync [-l] [-j N] [-z ALGORITHM] [-Z]"
+        " [all|data|odm|oem|product|system|system_ext|vendor]\n"
         "     sync a local build from $ANDROID_PRODUCT_OUT to the device (default all)\n"
+        "     -j: copy files over N connections at once\n"
         "     -l: list files that would be copied, but don't copy them\n"
         "     -n: dry run: push files to device without storing to the filesystem\n"
         "     -q: suppress progress messages\n"
         "     -Z: disable compression\n"
-        "     -z: enable compression with a specified algorithm (any/none/brotli/lz4/zstd)\n"
+        "     -z: enable compression with a specified algorithm (any/none/brotli/lz4/zstd/adaptive)\n"
         "\n"
         "shell:\n"
         " shell [-e ESCAPE] [-n] [-Tt] [-x] [COMMAND...]\n"
@@ -1304,14 +1308,24 @@ static CompressionType parse_compression_type(const std::string& str, bool allow
         return CompressionType::LZ4;
     } else if (str == "zstd") {
         return CompressionType::Zstd;
+    } else if (str == "adaptive") {
+        return CompressionType::Adaptive;
     }
 
     error_exit("unexpected compression type %s", str.c_str());
 }
 
+static size_t parse_jobs(const char* str) {
+    size_t jobs;
+    if (!android::base::ParseUint(str, &jobs, size_t(64)) || jobs == 0) {
+        error_exit("-j requires a number of connections between 1 and 64, got '%s'", str);
+    }
+    return jobs;
+}
+
 static void parse_push_pull_args(const char** arg, int narg, std::vector<const char*>* srcs,
                                  const char** dst, bool* copy_attrs, bool* sync, bool* quiet,
-                                 CompressionType* compression, bool* dry_run) {
+                                 CompressionType* compression, bool* dry_run, size_t* jobs) {
     *copy_attrs = false;
     if (const char* adb_compression = getenv("ADB_COMPRESSION")) {
         *compression = parse_compression_type(adb_compression, true);
@@ -1335,6 +1349,12 @@ static void parse_push_pull_args(const char** arg, int narg, std::vector<const c
                 --narg;
             } else if (!strcmp(*arg, "-Z")) {
                 *compression = CompressionType::None;
+            } else if (!strcmp(*arg, "-j")) {
+                if (narg < 2) {
+                    error_exit("-j requires an argument");
+                }
+                *jobs = parse_jobs(*++arg);
+                --narg;
             } else if (dry_run && !strcmp(*arg, "-n")) {
                 *dry_run = true;
             } else if (!strcmp(*arg, "--sync")) {
@@ -1985,28 +2005,30 @@ int adb_commandline(int argc, const char** argv) {
         bool sync = false;
         bool dry_run = false;
         bool quiet = false;
+        size_t jobs = 1;
         CompressionType compression = CompressionType::Any;
         std::vector<const char*> srcs;
         const char* dst = nullptr;
 
         parse_push_pull_args(&argv[1], argc - 1, &srcs, &dst, &copy_attrs, &sync, &quiet,
-                             &compression, &dry_run);
+                             &compression, &dry_run, &jobs);
         if (srcs.empty() || !dst) {
             error_exit("push requires <source> and <destination> arguments");
         }
 
-        return do_sync_push(srcs, dst, sync, compression, dry_run, quiet) ? 0 : 1;
+        return do_sync_push(srcs, dst, sync, compression, dry_run, quiet, jobs) ? 0 : 1;
     } else if (!strcmp(argv[0], "pull")) {
         bool copy_attrs = false;
         bool quiet = false;
+        size_t jobs = 1;
         CompressionType compression = CompressionType::None;
         std::vector<const char*> srcs;
         const char* dst = ".";
 
         parse_push_pull_args(&argv[1], argc - 1, &srcs, &dst, &copy_attrs, nullptr, &quiet,
-                             &compression, nullptr);
+                             &compression, nullptr, &jobs);
         if (srcs.empty()) error_exit("pull requires an argument");
-        return do_sync_pull(srcs, dst, copy_attrs, compression, nullptr, quiet) ? 0 : 1;
+        return do_sync_pull(srcs, dst, copy_attrs, compression, nullptr, quiet, jobs) ? 0 : 1;
     } else if (!strcmp(argv[0], "install")) {
         if (argc < 2) error_exit("install requires an argument");
         return install_app(argc, argv);
@@ -2024,6 +2046,7 @@ int adb_commandline(int argc, const char** argv) {
         bool list_only = false;
         bool dry_run = false;
         bool quiet = false;
+        size_t jobs = 1;
         CompressionType compression = CompressionType::Any;
 
         if (const char* adb_compression = getenv("ADB_COMPRESSION"); adb_compression) {
@@ -2031,8 +2054,11 @@ int adb_commandline(int argc, const char** argv) {
         }
 
         int opt;
-        while ((opt = getopt(argc, const_cast<char**>(argv), "lnz:Zq")) != -1) {
+        while ((opt = getopt(argc, const_cast<char**>(argv), "j:lnz:Zq")) != -1) {
             switch (opt) {
+                case 'j':
+                    jobs = parse_jobs(optarg);
+                    break;
                 case 'l':
                     list_only = true;
                     break;
@@ -2049,7 +2075,8 @@ int adb_commandline(int argc, const char** argv) {
                     quiet = true;
                     break;
                 default:
-                    error_exit("usage: adb sync [-l] [-n]  [-z ALGORITHM] [-Z] [-q] [PARTITION]");
+                    error_exit(
+                            "usage: adb sync [-l] [-n] [-j N] [-z ALGORITHM] [-Z] [-q] [PARTITION]");
             }
         }
 
@@ -2058,7 +2085,7 @@ int adb_commandline(int argc, const char** argv) {
         } else if (optind + 1 == argc) {
             src = argv[optind];
         } else {
-            error_exit("usage: adb sync [-l] [-n] [-z ALGORITHM] [-Z] [-q] [PARTITION]");
+            error_exit("usage: adb sync [-l] [-n] [-j N] [-z ALGORITHM] [-Z] [-q] [PARTITION]");
         }
 
         std::vector<std::string> partitions{"data",   "odm",        "oem",   "product",
@@ -2069,7 +2096,8 @@ int adb_commandline(int argc, const char** argv) {
                 std::string src_dir{product_file(partition)};
                 if (!directory_exists(src_dir)) continue;
                 found = true;
-                if (!do_sync_sync(src_dir, "/" + partition, list_only, compression, dry_run, quiet)) {
+                if (!do_sync_sync(src_dir, "/" + partition, list_only, compression, dry_run, quiet,
+                                  jobs)) {
                     return 1;
                 }
             }
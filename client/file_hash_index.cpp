@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "client/file_hash_index.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <chrono>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+
+#include "adb_utils.h"
+#include "sysdeps.h"
+
+// Each line after the header is "<sha256 in hex> <size> <mtime ns> <ctime ns> <inode>
+// <hashed at ns> <remote mtime> <remote path length> <remote path> <path>", with an empty remote
+// path if the file hasn't matched one. Indexes from older versions are ignored.
+static constexpr char kIndexHeader[] = "adb sync hash index v2";
+static constexpr size_t kNumberFields = 8;
+
+static constexpr int64_t kNanosPerSecond = 1'000'000'000;
+
+static bool HexToHash(std::string_view hex, FileHash* hash) {
+    if (hex.size() != hash->size() * 2) return false;
+    auto nibble = [](char c) -> int {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        return -1;
+    };
+    for (size_t i = 0; i < hash->size(); ++i) {
+        int high = nibble(hex[2 * i]);
+        int low = nibble(hex[2 * i + 1]);
+        if (high < 0 || low < 0) return false;
+        (*hash)[i] = (high << 4) | low;
+    }
+    return true;
+}
+
+FileStamp FileStamp::FromStat(const struct stat& st) {
+    FileStamp stamp;
+    stamp.size = st.st_size;
+#if defined(__APPLE__)
+    stamp.mtime_ns = st.st_mtimespec.tv_sec * kNanosPerSecond + st.st_mtimespec.tv_nsec;
+    stamp.ctime_ns = st.st_ctimespec.tv_sec * kNanosPerSecond + st.st_ctimespec.tv_nsec;
+#elif defined(_WIN32)
+    // Windows only gives us seconds, and its st_ctime is the creation time.
+    stamp.mtime_ns = st.st_mtime * kNanosPerSecond;
+    stamp.ctime_ns = st.st_ctime * kNanosPerSecond;
+#else
+    stamp.mtime_ns = st.st_mtim.tv_sec * kNanosPerSecond + st.st_mtim.tv_nsec;
+    stamp.ctime_ns = st.st_ctim.tv_sec * kNanosPerSecond + st.st_ctim.tv_nsec;
+#endif
+    stamp.ino = st.st_ino;
+    return stamp;
+}
+
+std::string FileHashIndex::DefaultPath() {
+    return adb_get_android_dir_path() + OS_PATH_SEPARATOR + "adb_sync_hash_index";
+}
+
+int64_t FileHashIndex::Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::system_clock::now().time_since_epoch())
+            .count();
+}
+
+void FileHashIndex::Load() {
+    entries_.clear();
+    dirty_ = false;
+
+    std::string content;
+    if (!android::base::ReadFileToString(path_, &content)) {
+        return;
+    }
+
+    std::vector<std::string> lines = android::base::Split(content, "\n");
+    if (lines.empty() || lines[0] != kIndexHeader) {
+        LOG(WARNING) << "ignoring sync hash index with unknown format: " << path_;
+        return;
+    }
+
+    for (size_t i = 1; i < lines.size(); ++i) {
+        if (lines[i].empty()) continue;
+
+        // Paths can contain spaces, so only split off the leading fields.
+        std::vector<std::string> fields;
+        std::string_view rest = lines[i];
+        for (size_t field = 0; field < kNumberFields; ++field) {
+            size_t space = rest.find(' ');
+            if (space == std::string_view::npos) break;
+            fields.emplace_back(rest.substr(0, space));
+            rest.remove_prefix(space + 1);
+        }
+
+        Entry entry;
+        size_t remote_path_length;
+        if (fields.size() != kNumberFields || !HexToHash(fields[0], &entry.hash) ||
+            !android::base::ParseUint(fields[1], &entry.stamp.size) ||
+            !android::base::ParseInt(fields[2], &entry.stamp.mtime_ns) ||
+            !android::base::ParseInt(fields[3], &entry.stamp.ctime_ns) ||
+            !android::base::ParseUint(fields[4], &entry.stamp.ino) ||
+            !android::base::ParseInt(fields[5], &entry.hashed_at) ||
+            !android::base::ParseInt(fields[6], &entry.remote_mtime) ||
+            !android::base::ParseUint(fields[7], &remote_path_length) ||
+            rest.size() <= remote_path_length + 1 || rest[remote_path_length] != ' ') {
+            LOG(WARNING) << "ignoring corrupt sync hash index: " << path_;
+            entries_.clear();
+            return;
+        }
+        entry.remote_path = rest.substr(0, remote_path_length);
+        rest.remove_prefix(remote_path_length + 1);
+        entries_[std::string(rest)] = std::move(entry);
+    }
+}
+
+bool FileHashIndex::Save() {
+    if (!dirty_) return true;
+
+    std::string content = kIndexHeader;
+    content.push_back('\n');
+    for (const auto& [path, entry] : entries_) {
+        // Newlines would break the format, and those paths can simply be hashed every time.
+        if (path.find('\n') != std::string::npos ||
+            entry.remote_path.find('\n') != std::string::npos) {
+            continue;
+        }
+        content += android::base::StringPrintf(
+                "%s %" PRIu64 " %" PRId64 " %" PRId64 " %" PRIu64 " %" PRId64 " %" PRId64
+                " %zu %s %s\n",
+                hex_encode(entry.hash.data(), entry.hash.size()).c_str(), entry.stamp.size,
+                entry.stamp.mtime_ns, entry.stamp.ctime_ns, entry.stamp.ino, entry.hashed_at,
+                entry.remote_mtime, entry.remote_path.size(), entry.remote_path.c_str(),
+                path.c_str());
+    }
+
+    if (!write_file_atomically(path_, content)) {
+        PLOG(WARNING) << "failed to write sync hash index: " << path_;
+        return false;
+    }
+    dirty_ = false;
+    return true;
+}
+
+const FileHashIndex::Entry* FileHashIndex::Find(const std::string& path,
+                                                const FileStamp& stamp) const {
+    auto it = entries_.find(path);
+    if (it == entries_.end() || it->second.stamp != stamp) {
+        return nullptr;
+    }
+    // The file might have been written again in the second it was hashed without its stamp
+    // changing, so it has to be hashed again to be sure.
+    if (stamp.mtime_ns / kNanosPerSecond >= it->second.hashed_at / kNanosPerSecond) {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+std::optional<FileHash> FileHashIndex::Lookup(const std::string& path,
+                                              const FileStamp& stamp) const {
+    const Entry* entry = Find(path, stamp);
+    if (!entry) return std::nullopt;
+    return entry->hash;
+}
+
+void FileHashIndex::Update(const std::string& path, const FileStamp& stamp, int64_t hashed_at,
+                           const FileHash& hash) {
+    entries_[path] = {.stamp = stamp, .hashed_at = hashed_at, .hash = hash};
+    dirty_ = true;
+}
+
+bool FileHashIndex::Matches(const std::string& path, const FileStamp& stamp,
+                            const std::string& remote_path, int64_t remote_mtime) const {
+    const Entry* entry = Find(path, stamp);
+    return entry && !entry->remote_path.empty() && entry->remote_path == remote_path &&
+           entry->remote_mtime == remote_mtime;
+}
+
+void FileHashIndex::RecordMatch(const std::string& path, const std::string& remote_path,
+                                int64_t remote_mtime) {
+    auto it = entries_.find(path);
+    CHECK(it != entries_.end()) << "no sync hash index entry for " << path;
+    if (it->second.remote_path == remote_path && it->second.remote_mtime == remote_mtime) {
+        return;
+    }
+    it->second.remote_path = remote_path;
+    it->second.remote_mtime = remote_mtime;
+    dirty_ = true;
+}
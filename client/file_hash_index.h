@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include "file_hash.h"
+#include "sysdeps/stat.h"
+
+// What a local file looked like when it was hashed. If any of this has changed, so may have the
+// file's contents.
+struct FileStamp {
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+    int64_t ctime_ns = 0;
+    uint64_t ino = 0;
+
+    static FileStamp FromStat(const struct stat& st);
+
+    bool operator==(const FileStamp& other) const = default;
+};
+
+// A cache of the hashes of local files, so that `adb sync` only has to hash the files that have
+// changed since it last looked at them. An entry is only used if the file's stamp hasn't changed
+// since it was hashed, and the file was last modified before the second in which it was hashed:
+// on filesystems with coarse timestamps, a file that was written again in that same second could
+// still have the same stamp.
+//
+// An entry can also record that the file matched a file on the device, so that later syncs can
+// skip it without hashing either side for as long as neither file changes.
+class FileHashIndex {
+  public:
+    // The index is kept in |path|, which doesn't need to exist yet.
+    explicit FileHashIndex(std::string path) : path_(std::move(path)) {}
+
+    FileHashIndex(const FileHashIndex& copy) = delete;
+    FileHashIndex& operator=(const FileHashIndex& copy) = delete;
+
+    // Where `adb sync` keeps its index, in the adb user directory.
+    static std::string DefaultPath();
+
+    // Returns the current time in nanoseconds since the epoch, for Update's |hashed_at|.
+    static int64_t Now();
+
+    // Reads the index from disk. A missing or unreadable index is treated as an empty one.
+    void Load();
+
+    // Writes the index to disk, if anything has changed since it was loaded.
+    bool Save();
+
+    std::optional<FileHash> Lookup(const std::string& path, const FileStamp& stamp) const;
+
+    // Records the hash of |path|, which had |stamp| before it was read. |hashed_at| is the time
+    // from before it was read, too.
+    void Update(const std::string& path, const FileStamp& stamp, int64_t hashed_at,
+                const FileHash& hash);
+
+    // Whether |path| is known to match |remote_path| on the device, which still has the mtime
+    // |remote_mtime|.
+    bool Matches(const std::string& path, const FileStamp& stamp, const std::string& remote_path,
+                 int64_t remote_mtime) const;
+
+    // Records that |path|, which must have an entry, matched |remote_path| on the device while
+    // that had the mtime |remote_mtime|.
+    void RecordMatch(const std::string& path, const std::string& remote_path,
+                     int64_t remote_mtime);
+
+    size_t size() const { return entries_.size(); }
+
+  private:
+    struct Entry {
+        FileStamp stamp;
+        int64_t hashed_at;
+        FileHash hash;
+
+        // The device file that this file last matched, if any.
+        std::string remote_path;
+        int64_t remote_mtime = 0;
+    };
+
+    const Entry* Find(const std::string& path, const FileStamp& stamp) const;
+
+    std::string path_;
+    std::unordered_map<std::string, Entry> entries_;
+    bool dirty_ = false;
+};
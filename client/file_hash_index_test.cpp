@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "client/file_hash_index.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <android-base/file.h>
+
+static FileHash MakeHash(uint8_t value) {
+    FileHash hash;
+    hash.fill(value);
+    return hash;
+}
+
+static constexpr int64_t kSecond = 1'000'000'000;
+
+// A stamp for a file last modified at |mtime| seconds, which is well before kHashedAt.
+static FileStamp MakeStamp(uint64_t size, int64_t mtime) {
+    return {.size = size, .mtime_ns = mtime * kSecond, .ctime_ns = mtime * kSecond, .ino = 42};
+}
+
+static constexpr int64_t kHashedAt = 1000 * kSecond;
+
+TEST(FileHashIndex, lookup) {
+    TemporaryDir td;
+    FileHashIndex index(std::string(td.path) + "/index");
+    EXPECT_FALSE(index.Lookup("/out/a", MakeStamp(10, 100)).has_value());
+
+    index.Update("/out/a", MakeStamp(10, 100), kHashedAt, MakeHash(1));
+    EXPECT_EQ(MakeHash(1), index.Lookup("/out/a", MakeStamp(10, 100)));
+
+    // Entries for a file that has changed since it was hashed are ignored.
+    EXPECT_FALSE(index.Lookup("/out/a", MakeStamp(11, 100)).has_value());
+    EXPECT_FALSE(index.Lookup("/out/a", MakeStamp(10, 101)).has_value());
+    FileStamp stamp = MakeStamp(10, 100);
+    stamp.mtime_ns += 1;
+    EXPECT_FALSE(index.Lookup("/out/a", stamp).has_value());
+    stamp = MakeStamp(10, 100);
+    stamp.ctime_ns += 1;
+    EXPECT_FALSE(index.Lookup("/out/a", stamp).has_value());
+    stamp = MakeStamp(10, 100);
+    stamp.ino += 1;
+    EXPECT_FALSE(index.Lookup("/out/a", stamp).has_value());
+
+    index.Update("/out/a", MakeStamp(11, 101), kHashedAt, MakeHash(2));
+    EXPECT_EQ(MakeHash(2), index.Lookup("/out/a", MakeStamp(11, 101)));
+    EXPECT_EQ(1U, index.size());
+}
+
+TEST(FileHashIndex, racily_clean) {
+    TemporaryDir td;
+    FileHashIndex index(std::string(td.path) + "/index");
+
+    // A file modified in the same second as it was hashed could have been written again
+    // afterwards without its stamp changing, so its entry can't be trusted...
+    FileStamp stamp = MakeStamp(10, 1000);
+    index.Update("/out/a", stamp, kHashedAt + kSecond / 2, MakeHash(1));
+    EXPECT_FALSE(index.Lookup("/out/a", stamp).has_value());
+
+    // ...until it's been hashed again in a later second.
+    index.Update("/out/a", stamp, kHashedAt + kSecond, MakeHash(1));
+    EXPECT_EQ(MakeHash(1), index.Lookup("/out/a", stamp));
+}
+
+TEST(FileHashIndex, matches) {
+    TemporaryDir td;
+    FileHashIndex index(std::string(td.path) + "/index");
+
+    index.Update("/out/a", MakeStamp(10, 100), kHashedAt, MakeHash(1));
+    EXPECT_FALSE(index.Matches("/out/a", MakeStamp(10, 100), "/data/a", 500));
+
+    index.RecordMatch("/out/a", "/data/a", 500);
+    EXPECT_TRUE(index.Matches("/out/a", MakeStamp(10, 100), "/data/a", 500));
+
+    // A change on either side, or a different device file, means it has to be hashed again.
+    EXPECT_FALSE(index.Matches("/out/a", MakeStamp(10, 101), "/data/a", 500));
+    EXPECT_FALSE(index.Matches("/out/a", MakeStamp(10, 100), "/data/a", 501));
+    EXPECT_FALSE(index.Matches("/out/a", MakeStamp(10, 100), "/data/b", 500));
+
+    // Hashing the file again forgets the match.
+    index.Update("/out/a", MakeStamp(10, 100), kHashedAt, MakeHash(1));
+    EXPECT_FALSE(index.Matches("/out/a", MakeStamp(10, 100), "/data/a", 500));
+}
+
+TEST(FileHashIndex, save_and_load) {
+    TemporaryDir td;
+    std::string path = std::string(td.path) + "/index";
+    {
+        FileHashIndex index(path);
+        index.Load();
+        index.Update("/out/a", MakeStamp(10, 100), kHashedAt, MakeHash(1));
+        index.Update("/out/with spaces/b", MakeStamp(0, -5), kHashedAt, MakeHash(0xff));
+        index.RecordMatch("/out/with spaces/b", "/data/with spaces/b", 500);
+        ASSERT_TRUE(index.Save());
+    }
+
+    FileHashIndex index(path);
+    index.Load();
+    EXPECT_EQ(2U, index.size());
+    EXPECT_EQ(MakeHash(1), index.Lookup("/out/a", MakeStamp(10, 100)));
+    EXPECT_EQ(MakeHash(0xff), index.Lookup("/out/with spaces/b", MakeStamp(0, -5)));
+    EXPECT_FALSE(index.Matches("/out/a", MakeStamp(10, 100), "", 0));
+    EXPECT_TRUE(
+            index.Matches("/out/with spaces/b", MakeStamp(0, -5), "/data/with spaces/b", 500));
+}
+
+TEST(FileHashIndex, corrupt) {
+    TemporaryDir td;
+    std::string path = std::string(td.path) + "/index";
+
+    ASSERT_TRUE(android::base::WriteStringToFile("something else\n", path));
+    FileHashIndex index(path);
+    index.Load();
+    EXPECT_EQ(0U, index.size());
+
+    ASSERT_TRUE(android::base::WriteStringToFile("adb sync hash index v2\nnot a hash 1 2 /a\n",
+                                                 path));
+    index.Load();
+    EXPECT_EQ(0U, index.size());
+
+    // A remote path length that runs past the end of the line.
+    std::string hash(64, '0');
+    ASSERT_TRUE(android::base::WriteStringToFile(
+            "adb sync hash index v2\n" + hash + " 1 2 3 4 5 6 100 /a /b\n", path));
+    index.Load();
+    EXPECT_EQ(0U, index.size());
+
+    // Indexes from before inodes and change times were recorded are ignored.
+    ASSERT_TRUE(android::base::WriteStringToFile(
+            "adb sync hash index v1\n" + hash + " 10 100 /out/a\n", path));
+    index.Load();
+    EXPECT_EQ(0U, index.size());
+}
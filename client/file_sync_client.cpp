@@ -28,12 +28,20 @@
 #include <unistd.h>
 #include <utime.h>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <deque>
 #include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <variant>
 #include <vector>
 
@@ -43,13 +51,18 @@
 #include "adb_client.h"
 #include "adb_io.h"
 #include "adb_utils.h"
+#include "compression_pipeline.h"
 #include "compression_utils.h"
+#include "file_hash.h"
+#include "file_sync_delta.h"
 #include "file_sync_protocol.h"
 #include "line_printer.h"
 #include "sysdeps/errno.h"
 #include "sysdeps/stat.h"
 
+#include "client/adaptive_compression.h"
 #include "client/commandline.h"
+#include "client/file_hash_index.h"
 
 #include <android-base/file.h>
 #include <android-base/strings.h>
@@ -58,6 +71,7 @@
 using namespace std::literals;
 
 typedef void(sync_ls_cb)(unsigned mode, uint64_t size, uint64_t time, const char* name);
+typedef void(sync_ls_recursive_cb)(const std::string& path, const sync_dent_v2& dent);
 
 struct syncsendbuf {
     unsigned id;
@@ -90,6 +104,12 @@ struct copyinfo {
     uint64_t size = 0;
     bool skip = false;
 
+    // Whether there's a regular file at rpath already, which a delta can be sent against.
+    bool remote_is_file = false;
+
+    // The mtime of the file at rpath, if we've stat'ed it.
+    int64_t remote_time = 0;
+
     copyinfo(const std::string& local_path,
              const std::string& remote_path,
              const std::string& name,
@@ -110,12 +130,20 @@ enum class TransferDirection {
 };
 
 struct TransferLedger {
+    // The files that adaptive compression sent with one choice of codec.
+    struct CompressionTally {
+        uint64_t files = 0;
+        uint64_t bytes_in = 0;
+        uint64_t bytes_out = 0;
+    };
+
     std::chrono::steady_clock::time_point start_time;
     uint64_t files_transferred;
     uint64_t files_skipped;
     uint64_t bytes_transferred;
     uint64_t bytes_expected;
     bool expect_multiple_files;
+    std::map<std::string, CompressionTally> compression_choices;
 
   private:
     std::string last_progress_str;
@@ -141,6 +169,7 @@ struct TransferLedger {
         files_skipped = 0;
         bytes_transferred = 0;
         bytes_expected = 0;
+        compression_choices.clear();
         last_progress_str.clear();
         last_progress_time = {};
     }
@@ -220,12 +249,34 @@ struct TransferLedger {
 
         lp.Print(ss.str(), LinePrinter::LineType::INFO);
         lp.KeepInfoLine();
+
+        if (!compression_choices.empty()) {
+            std::vector<std::string> choices;
+            for (const auto& [choice, tally] : compression_choices) {
+                double ratio = tally.bytes_in == 0 ? 1.0
+                                                   : static_cast<double>(tally.bytes_out) /
+                                                             tally.bytes_in;
+                choices.push_back(android::base::StringPrintf(
+                        "%s %" PRIu64 " file%s (%.2f)", choice.c_str(), tally.files,
+                        tally.files == 1 ? "" : "s", ratio));
+            }
+            lp.Print("adaptive compression: " + android::base::Join(choices, ", "),
+                     LinePrinter::LineType::INFO);
+            lp.KeepInfoLine();
+        }
     }
 };
 
 class SyncConnection {
   public:
-    SyncConnection() : acknowledgement_buffer_(sizeof(sync_status) + SYNC_DATA_MAX) {
+    SyncConnection() : SyncConnection(nullptr) {}
+
+    // Opens a connection of its own, which records its transfers in |reporter|'s ledgers and
+    // prints through |reporter|'s line printer, so that several connections used at once show up
+    // as a single transfer. This connection may be used on a different thread than |reporter|.
+    explicit SyncConnection(SyncConnection* reporter)
+        : acknowledgement_buffer_(sizeof(sync_status) + SYNC_DATA_MAX),
+          reporter_(reporter ? reporter : this) {
         acknowledgement_buffer_.resize(0);
         max = SYNC_DATA_MAX; // TODO: decide at runtime.
 
@@ -242,6 +293,11 @@ class SyncConnection {
             have_sendrecv_v2_lz4_ = CanUseFeature(*features, kFeatureSendRecv2LZ4);
             have_sendrecv_v2_zstd_ = CanUseFeature(*features, kFeatureSendRecv2Zstd);
             have_sendrecv_v2_dry_run_send_ = CanUseFeature(*features, kFeatureSendRecv2DryRunSend);
+            have_hash_v1_ = CanUseFeature(*features, kFeatureSyncHash);
+            have_send_v3_delta_ = CanUseFeature(*features, kFeatureSendV3Delta);
+            have_send_batch_ = CanUseFeature(*features, kFeatureSendBatch);
+            have_ls_recursive_ = CanUseFeature(*features, kFeatureLsRecursive);
+            have_recv_range_ = CanUseFeature(*features, kFeatureRecvRange);
             std::string error;
             fd.reset(adb_connect("sync:", &error));
             if (fd < 0) {
@@ -271,10 +327,22 @@ class SyncConnection {
     bool HaveSendRecv2LZ4() const { return have_sendrecv_v2_lz4_; }
     bool HaveSendRecv2Zstd() const { return have_sendrecv_v2_zstd_; }
     bool HaveSendRecv2DryRunSend() const { return have_sendrecv_v2_dry_run_send_; }
-
-    // Resolve a compression type which might be CompressionType::Any to a specific compression
-    // algorithm.
-    CompressionType ResolveCompressionType(CompressionType compression) const {
+    bool HaveHashV1() const { return have_hash_v1_; }
+    bool HaveSendV3Delta() const { return have_send_v3_delta_; }
+    bool HaveSendBatch() const { return have_send_batch_; }
+    bool HaveLsRecursive() const { return have_ls_recursive_; }
+    bool HaveRecvRange() const { return have_recv_range_; }
+
+    // Resolve a compression type which might be CompressionType::Any or CompressionType::Adaptive
+    // to a specific compression algorithm. Adaptive compression can only go on the file's name
+    // here; pushes look at the data themselves.
+    CompressionType ResolveCompressionType(CompressionType compression,
+                                           std::string_view path = {}) {
+        if (compression == CompressionType::Adaptive) {
+            return Adaptive()
+                    .ChooseWithoutSample(path, HaveSendRecv2LZ4(), HaveSendRecv2Zstd())
+                    .type;
+        }
         if (compression == CompressionType::Any) {
             if (HaveSendRecv2Zstd()) {
                 return CompressionType::Zstd;
@@ -301,8 +369,9 @@ class SyncConnection {
     }
 
     void RecordBytesTransferred(size_t bytes) {
-        current_ledger_.bytes_transferred += bytes;
-        global_ledger_.bytes_transferred += bytes;
+        std::lock_guard<std::mutex> lock(reporter_->report_mutex_);
+        reporter_->current_ledger_.bytes_transferred += bytes;
+        reporter_->global_ledger_.bytes_transferred += bytes;
     }
 
     void RecordFileSent(std::string from, std::string to) {
@@ -311,18 +380,36 @@ class SyncConnection {
     }
 
     void RecordFilesTransferred(size_t files) {
-        current_ledger_.files_transferred += files;
-        global_ledger_.files_transferred += files;
+        std::lock_guard<std::mutex> lock(reporter_->report_mutex_);
+        reporter_->current_ledger_.files_transferred += files;
+        reporter_->global_ledger_.files_transferred += files;
     }
 
+    void RecordCompressionChoice(const CompressionChoice& choice, size_t files, uint64_t bytes_in,
+                                 uint64_t bytes_out) {
+        std::lock_guard<std::mutex> lock(reporter_->report_mutex_);
+        for (TransferLedger* ledger : {&reporter_->current_ledger_, &reporter_->global_ledger_}) {
+            auto& tally = ledger->compression_choices[choice.ToString()];
+            tally.files += files;
+            tally.bytes_in += bytes_in;
+            tally.bytes_out += bytes_out;
+        }
+    }
+
+    // Adaptive compression's measurements, which are shared by all of the connections in use.
+    AdaptiveCompression& Adaptive() { return reporter_->adaptive_compression_; }
+
     void RecordFilesSkipped(size_t files) {
-        current_ledger_.files_skipped += files;
-        global_ledger_.files_skipped += files;
+        std::lock_guard<std::mutex> lock(reporter_->report_mutex_);
+        reporter_->current_ledger_.files_skipped += files;
+        reporter_->global_ledger_.files_skipped += files;
     }
 
     void ReportProgress(const std::string& file, uint64_t file_copied_bytes,
                         uint64_t file_total_bytes) {
-        current_ledger_.ReportProgress(line_printer_, file, file_copied_bytes, file_total_bytes);
+        std::lock_guard<std::mutex> lock(reporter_->report_mutex_);
+        reporter_->current_ledger_.ReportProgress(reporter_->line_printer_, file,
+                                                  file_copied_bytes, file_total_bytes);
     }
 
     void ReportTransferRate(const std::string& file, TransferDirection direction) {
@@ -387,7 +474,8 @@ class SyncConnection {
                 break;
 
             case CompressionType::Any:
-                LOG(FATAL) << "unexpected CompressionType::Any";
+            case CompressionType::Adaptive:
+                LOG(FATAL) << "unexpected unresolved CompressionType";
         }
 
         if (dry_run) {
@@ -420,26 +508,7 @@ class SyncConnection {
 
         syncmsg msg;
         msg.recv_v2_setup.id = ID_RECV_V2;
-        msg.recv_v2_setup.flags = 0;
-        switch (compression) {
-            case CompressionType::None:
-                break;
-
-            case CompressionType::Brotli:
-                msg.recv_v2_setup.flags |= kSyncFlagBrotli;
-                break;
-
-            case CompressionType::LZ4:
-                msg.recv_v2_setup.flags |= kSyncFlagLZ4;
-                break;
-
-            case CompressionType::Zstd:
-                msg.recv_v2_setup.flags |= kSyncFlagZstd;
-                break;
-
-            case CompressionType::Any:
-                LOG(FATAL) << "unexpected CompressionType::Any";
-        }
+        msg.recv_v2_setup.flags = RecvFlags(compression);
 
         buf.resize(sizeof(SyncRequest) + path.length() + sizeof(msg.recv_v2_setup));
 
@@ -452,6 +521,30 @@ class SyncConnection {
         return WriteFdExactly(fd, buf.data(), buf.size());
     }
 
+    // Requests |length| bytes of |path| from |offset|. The response is the same as for SendRecv2.
+    bool SendRecvRange(const std::string& path, CompressionType compression, uint64_t offset,
+                       uint64_t length) {
+        if (path.length() > 1024) {
+            Error("SendRequest failed: path too long: %zu", path.length());
+            errno = ENAMETOOLONG;
+            return false;
+        }
+
+        SyncRequest req = {.id = ID_RECV_RANGE,
+                           .path_length = static_cast<uint32_t>(path.length())};
+        sync_recv_range setup = {.id = ID_RECV_RANGE,
+                                 .flags = RecvFlags(compression),
+                                 .offset = offset,
+                                 .length = length};
+
+        Block buf(sizeof(req) + path.length() + sizeof(setup));
+        void* p = buf.data();
+        p = mempcpy(p, &req, sizeof(req));
+        p = mempcpy(p, path.data(), path.length());
+        p = mempcpy(p, &setup, sizeof(setup));
+        return WriteFdExactly(fd, buf.data(), buf.size());
+    }
+
     bool SendStat(const std::string& path) {
         if (!have_stat_v2_) {
             errno = ENOTSUP;
@@ -523,11 +616,85 @@ class SyncConnection {
         return true;
     }
 
+    bool SendHash(const std::vector<std::string>& paths) {
+        if (paths.size() > SYNC_HASH_MAX_PATHS) {
+            Error("SendHash failed: too many paths: %zu", paths.size());
+            errno = EINVAL;
+            return false;
+        }
+
+        size_t size = sizeof(SyncRequest) + sizeof(sync_hash_v1_request);
+        for (const std::string& path : paths) {
+            if (path.length() > 1024) {
+                Error("SendHash failed: path too long: %zu", path.length());
+                errno = ENAMETOOLONG;
+                return false;
+            }
+            size += sizeof(SyncRequest) + path.length();
+        }
+
+        std::vector<char> buf(size);
+        SyncRequest req = {.id = ID_HASH_V1, .path_length = 0};
+        sync_hash_v1_request hash_req = {.id = ID_HASH_V1,
+                                         .count = static_cast<uint32_t>(paths.size())};
+        char* p = static_cast<char*>(mempcpy(buf.data(), &req, sizeof(req)));
+        p = static_cast<char*>(mempcpy(p, &hash_req, sizeof(hash_req)));
+        for (const std::string& path : paths) {
+            req.path_length = path.length();
+            p = static_cast<char*>(mempcpy(p, &req, sizeof(req)));
+            p = static_cast<char*>(mempcpy(p, path.data(), path.length()));
+        }
+        return WriteFdExactly(fd, buf.data(), buf.size());
+    }
+
+    bool FinishHash(size_t count, std::vector<FileHashResult>* results) {
+        std::vector<sync_hash_v1> response(count);
+        if (!ReadFdExactly(fd, response.data(), response.size() * sizeof(sync_hash_v1))) {
+            Error("failed to read hash response: %s", strerror(errno));
+            return false;
+        }
+
+        results->resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            if (response[i].id != ID_HASH_V1) {
+                Error("protocol fault: hash response has wrong message id: %" PRIx32,
+                      response[i].id);
+                return false;
+            }
+            FileHashResult& result = (*results)[i];
+            result.error = response[i].error ? errno_from_wire(response[i].error) : 0;
+            result.size = response[i].size;
+            memcpy(result.hash.data(), response[i].sha256, result.hash.size());
+        }
+        return true;
+    }
+
     bool SendLs(const std::string& path) {
         return SendRequest(have_ls_v2_ ? ID_LIST_V2 : ID_LIST_V1, path);
     }
 
   private:
+    static uint32_t RecvFlags(CompressionType compression) {
+        switch (compression) {
+            case CompressionType::None:
+                return kSyncFlagNone;
+
+            case CompressionType::Brotli:
+                return kSyncFlagBrotli;
+
+            case CompressionType::LZ4:
+                return kSyncFlagLZ4;
+
+            case CompressionType::Zstd:
+                return kSyncFlagZstd;
+
+            case CompressionType::Any:
+            case CompressionType::Adaptive:
+                LOG(FATAL) << "unexpected unresolved CompressionType";
+        }
+        return kSyncFlagNone;
+    }
+
     template <bool v2>
     static bool FinishLsImpl(borrowed_fd fd, const std::function<sync_ls_cb>& callback) {
         using dent_type =
@@ -572,6 +739,34 @@ class SyncConnection {
         }
     }
 
+    bool SendLsRecursive(const std::string& path) {
+        return SendRequest(ID_LIST_RECURSIVE, path);
+    }
+
+    // Reads the response to SendLsRecursive, passing each entry to |callback| as it arrives, with
+    // its path relative to the directory that was listed.
+    bool FinishLsRecursive(const std::function<sync_ls_recursive_cb>& callback) {
+        while (true) {
+            sync_dent_v2 dent;
+            if (!ReadFdExactly(fd, &dent, sizeof(dent))) return false;
+            if (dent.id == ID_DONE) return true;
+            if (dent.id != ID_DENT_V2) return false;
+
+            if (dent.namelen > PATH_MAX) return false;
+            std::string path(dent.namelen, '\0');
+            if (!ReadFdExactly(fd, path.data(), path.size())) return false;
+
+            // As for FinishLs, don't let the device name anything outside the directory.
+            for (std::string_view component : android::base::Split(path, "/")) {
+                if (component.empty() || component == "." || component == "..") return false;
+#if defined(_WIN32)
+                if (component.find_first_of("\\:") != std::string_view::npos) return false;
+#endif
+            }
+            callback(path, dent);
+        }
+    }
+
     // Sending header, payload, and footer in a single write makes a huge
     // difference to "adb sync" performance.
     bool SendSmallFile(const std::string& path, mode_t mode, const std::string& lpath,
@@ -620,6 +815,180 @@ class SyncConnection {
         return true;
     }
 
+    // Sends |files|, which are small regular files under the directory |lroot|, as one send_batch
+    // to the corresponding paths under |rroot|. Like a file, the batch is acknowledged later.
+    bool SendBatch(const std::string& lroot, const std::string& rroot,
+                   const std::vector<const copyinfo*>& files, CompressionType compression,
+                   bool dry_run) {
+        if (rroot.length() > 1024) {
+            Error("SendBatch failed: path too long: %zu", rroot.length());
+            errno = ENAMETOOLONG;
+            return false;
+        }
+
+        // The uncompressed stream, which is read ahead far enough for adaptive compression to
+        // sample it before anything is sent.
+        std::vector<char> stream;
+        size_t next_file = 0;
+        auto read_next_file = [&]() {
+            const copyinfo* ci = files[next_file++];
+            std::string data;
+            if (!android::base::ReadFileToString(ci->lpath, &data, true)) {
+                Error("failed to read all of '%s': %s", ci->lpath.c_str(), strerror(errno));
+                return false;
+            }
+            std::string_view path = std::string_view(ci->rpath).substr(rroot.size());
+            sync_send_batch_entry entry = {.mode = ci->mode,
+                                           .mtime = static_cast<uint32_t>(ci->time),
+                                           .path_length = static_cast<uint32_t>(path.size()),
+                                           .size = static_cast<uint32_t>(data.size())};
+            stream.insert(stream.end(), reinterpret_cast<const char*>(&entry),
+                          reinterpret_cast<const char*>(&entry + 1));
+            stream.insert(stream.end(), path.begin(), path.end());
+            stream.insert(stream.end(), data.begin(), data.end());
+            RecordBytesTransferred(data.size());
+            ReportProgress(ci->rpath, data.size(), data.size());
+            return true;
+        };
+
+        const bool adaptive = compression == CompressionType::Adaptive;
+        CompressionChoice choice;
+        if (adaptive) {
+            while (next_file < files.size() && stream.size() < AdaptiveCompression::kSampleSize) {
+                if (!read_next_file()) return false;
+            }
+            size_t sample_size = std::min(stream.size(), AdaptiveCompression::kSampleSize);
+            choice = Adaptive().Choose(rroot, stream.data(), sample_size, 1, HaveSendRecv2LZ4(),
+                                       HaveSendRecv2Zstd());
+        } else {
+            choice.type = ResolveCompressionType(compression);
+            choice.level = 1;
+        }
+
+        SyncRequest req;
+        req.id = ID_SEND_BATCH;
+        req.path_length = rroot.length();
+
+        syncmsg msg;
+        msg.send_batch_setup.id = ID_SEND_BATCH;
+        msg.send_batch_setup.flags = dry_run ? kSyncFlagDryRun : kSyncFlagNone;
+        msg.send_batch_setup.count = files.size();
+
+        std::variant<std::monostate, NullEncoder, BrotliEncoder, LZ4Encoder, ZstdEncoder>
+                encoder_storage;
+        Encoder* encoder = nullptr;
+        switch (choice.type) {
+            case CompressionType::None:
+                encoder = &encoder_storage.emplace<NullEncoder>(SYNC_DATA_MAX);
+                break;
+
+            case CompressionType::Brotli:
+                msg.send_batch_setup.flags |= kSyncFlagBrotli;
+                encoder = &encoder_storage.emplace<BrotliEncoder>(SYNC_DATA_MAX);
+                break;
+
+            case CompressionType::LZ4:
+                msg.send_batch_setup.flags |= kSyncFlagLZ4;
+                encoder = &encoder_storage.emplace<LZ4Encoder>(SYNC_DATA_MAX);
+                break;
+
+            case CompressionType::Zstd:
+                msg.send_batch_setup.flags |= kSyncFlagZstd;
+                encoder = &encoder_storage.emplace<ZstdEncoder>(SYNC_DATA_MAX, 1, choice.level);
+                break;
+
+            case CompressionType::Any:
+            case CompressionType::Adaptive:
+                LOG(FATAL) << "unexpected unresolved CompressionType";
+        }
+
+        std::vector<char> output;
+        output.reserve(2 * SYNC_DATA_MAX);
+        output.insert(output.end(), reinterpret_cast<const char*>(&req),
+                      reinterpret_cast<const char*>(&req + 1));
+        output.insert(output.end(), rroot.begin(), rroot.end());
+        output.insert(output.end(), reinterpret_cast<const char*>(&msg.send_batch_setup),
+                      reinterpret_cast<const char*>(&msg.send_batch_setup + 1));
+
+        // Adaptive compression learns from how long compressing and writing take.
+        using clock = std::chrono::steady_clock;
+        const clock::time_point start = clock::now();
+        clock::duration encode_time{};
+        clock::duration write_time{};
+        uint64_t bytes_in = 0;
+        uint64_t bytes_sent = 0;
+
+        auto flush = [&]() {
+            clock::time_point write_start = clock::now();
+            bool result = WriteOrDie(lroot, rroot, output.data(), output.size());
+            write_time += clock::now() - write_start;
+            output.clear();
+            return result;
+        };
+
+        bool sending = true;
+        while (sending) {
+            while (next_file < files.size() && stream.size() < SYNC_DATA_MAX) {
+                if (!read_next_file()) return false;
+            }
+
+            if (stream.empty()) {
+                encoder->Finish();
+            } else {
+                size_t size = std::min<size_t>(stream.size(), SYNC_DATA_MAX);
+                Block input(size);
+                memcpy(input.data(), stream.data(), size);
+                stream.erase(stream.begin(), stream.begin() + size);
+                encoder->Append(std::move(input));
+                bytes_in += size;
+            }
+
+            while (true) {
+                Block block;
+                clock::time_point encode_start = clock::now();
+                EncodeResult result = encoder->Encode(&block);
+                encode_time += clock::now() - encode_start;
+                if (result == EncodeResult::Error) {
+                    Error("compressing '%s' locally failed", lroot.c_str());
+                    return false;
+                }
+
+                if (!block.empty()) {
+                    sync_data header = {.id = ID_DATA, .size = static_cast<uint32_t>(block.size())};
+                    output.insert(output.end(), reinterpret_cast<const char*>(&header),
+                                  reinterpret_cast<const char*>(&header + 1));
+                    output.insert(output.end(), block.data(), block.data() + block.size());
+                    bytes_sent += block.size();
+                    if (output.size() >= SYNC_DATA_MAX && !flush()) return false;
+                }
+
+                if (result == EncodeResult::Done) {
+                    sending = false;
+                    break;
+                } else if (result == EncodeResult::NeedInput) {
+                    break;
+                }
+            }
+        }
+
+        sync_data done = {.id = ID_DONE, .size = 0};
+        output.insert(output.end(), reinterpret_cast<const char*>(&done),
+                      reinterpret_cast<const char*>(&done + 1));
+        if (!flush()) return false;
+
+        if (adaptive) {
+            using seconds = std::chrono::duration<double>;
+            Adaptive().RecordCompression(choice, bytes_in, 1, seconds(encode_time).count());
+            Adaptive().RecordLink(bytes_sent, seconds(clock::now() - start).count(),
+                                  seconds(write_time).count());
+            RecordCompressionChoice(choice, files.size(), bytes_in, bytes_sent);
+        }
+
+        RecordFilesTransferred(files.size());
+        deferred_acknowledgements_.emplace_back(lroot, rroot);
+        return true;
+    }
+
     bool SendLargeFile(const std::string& path, mode_t mode, const std::string& lpath,
                        const std::string& rpath, unsigned mtime, CompressionType compression,
                        bool dry_run) {
@@ -632,13 +1001,6 @@ class SyncConnection {
             return SendLargeFileLegacy(path, mode, lpath, rpath, mtime);
         }
 
-        compression = ResolveCompressionType(compression);
-
-        if (!SendSend2(path, mode, compression, dry_run)) {
-            Error("failed to send ID_SEND_V2 message '%s': %s", path.c_str(), strerror(errno));
-            return false;
-        }
-
         struct stat st;
         if (stat(lpath.c_str(), &st) == -1) {
             Error("cannot stat '%s': %s", lpath.c_str(), strerror(errno));
@@ -654,10 +1016,34 @@ class SyncConnection {
             return false;
         }
 
+        size_t threads = compression_threads(total_size);
+        const bool adaptive = compression == CompressionType::Adaptive;
+        CompressionChoice choice;
+        if (adaptive) {
+            std::vector<char> sample(
+                    std::min<uint64_t>(total_size, AdaptiveCompression::kSampleSize));
+            if (!android::base::ReadFullyAtOffset(lfd, sample.data(), sample.size(), 0)) {
+                Error("reading '%s' locally failed: %s", lpath.c_str(), strerror(errno));
+                return false;
+            }
+            choice = Adaptive().Choose(lpath, sample.data(), sample.size(), threads,
+                                       HaveSendRecv2LZ4(), HaveSendRecv2Zstd());
+        } else {
+            choice.type = ResolveCompressionType(compression);
+            choice.level = 1;
+        }
+        compression = choice.type;
+
+        if (!SendSend2(path, mode, compression, dry_run)) {
+            Error("failed to send ID_SEND_V2 message '%s': %s", path.c_str(), strerror(errno));
+            return false;
+        }
+
         syncsendbuf sbuf;
         sbuf.id = ID_DATA;
 
-        std::variant<std::monostate, NullEncoder, BrotliEncoder, LZ4Encoder, ZstdEncoder>
+        std::variant<std::monostate, NullEncoder, BrotliEncoder, LZ4Encoder, LZ4ParallelEncoder,
+                     ZstdEncoder>
                 encoder_storage;
         Encoder* encoder = nullptr;
         switch (compression) {
@@ -670,17 +1056,30 @@ class SyncConnection {
                 break;
 
             case CompressionType::LZ4:
-                encoder = &encoder_storage.emplace<LZ4Encoder>(SYNC_DATA_MAX);
+                if (threads > 1) {
+                    encoder = &encoder_storage.emplace<LZ4ParallelEncoder>(SYNC_DATA_MAX, threads);
+                } else {
+                    encoder = &encoder_storage.emplace<LZ4Encoder>(SYNC_DATA_MAX);
+                }
                 break;
 
             case CompressionType::Zstd:
-                encoder = &encoder_storage.emplace<ZstdEncoder>(SYNC_DATA_MAX);
+                encoder = &encoder_storage.emplace<ZstdEncoder>(SYNC_DATA_MAX, threads,
+                                                                choice.level);
                 break;
 
             case CompressionType::Any:
-                LOG(FATAL) << "unexpected CompressionType::Any";
+            case CompressionType::Adaptive:
+                LOG(FATAL) << "unexpected unresolved CompressionType";
         }
 
+        // Adaptive compression learns from how long compressing and writing take.
+        using clock = std::chrono::steady_clock;
+        const clock::time_point start = clock::now();
+        clock::duration encode_time{};
+        clock::duration write_time{};
+        uint64_t bytes_sent = 0;
+
         bool sending = true;
         while (sending) {
             Block input(SYNC_DATA_MAX);
@@ -702,7 +1101,9 @@ class SyncConnection {
 
             while (true) {
                 Block output;
+                clock::time_point encode_start = clock::now();
                 EncodeResult result = encoder->Encode(&output);
+                encode_time += clock::now() - encode_start;
                 if (result == EncodeResult::Error) {
                     Error("compressing '%s' locally failed", lpath.c_str());
                     return false;
@@ -711,7 +1112,10 @@ class SyncConnection {
                 if (!output.empty()) {
                     sbuf.size = output.size();
                     memcpy(sbuf.data, output.data(), output.size());
+                    clock::time_point write_start = clock::now();
                     WriteOrDie(lpath, rpath, &sbuf, sizeof(SyncRequest) + output.size());
+                    write_time += clock::now() - write_start;
+                    bytes_sent += output.size();
                 }
 
                 if (result == EncodeResult::Done) {
@@ -725,6 +1129,15 @@ class SyncConnection {
             }
         }
 
+        if (adaptive) {
+            using seconds = std::chrono::duration<double>;
+            Adaptive().RecordCompression(choice, bytes_copied, threads,
+                                         seconds(encode_time).count());
+            Adaptive().RecordLink(bytes_sent, seconds(clock::now() - start).count(),
+                                  seconds(write_time).count());
+            RecordCompressionChoice(choice, 1, bytes_copied, bytes_sent);
+        }
+
         syncmsg msg;
         msg.data.id = ID_DONE;
         msg.data.size = mtime;
@@ -763,24 +1176,224 @@ class SyncConnection {
             int bytes_read = adb_read(lfd, sbuf.data, max);
             if (bytes_read == -1) {
                 Error("reading '%s' locally failed: %s", lpath.c_str(), strerror(errno));
-                return false;
-            } else if (bytes_read == 0) {
-                break;
+                return false;
+            } else if (bytes_read == 0) {
+                break;
+            }
+
+            sbuf.size = bytes_read;
+            WriteOrDie(lpath, rpath, &sbuf, sizeof(SyncRequest) + bytes_read);
+
+            RecordBytesTransferred(bytes_read);
+            bytes_copied += bytes_read;
+            ReportProgress(rpath, bytes_copied, total_size);
+        }
+
+        syncmsg msg;
+        msg.data.id = ID_DONE;
+        msg.data.size = mtime;
+        RecordFileSent(lpath, rpath);
+        return WriteOrDie(lpath, rpath, &msg.data, sizeof(msg.data));
+    }
+
+    // Sends a file as a delta against the regular file that's already at |path| on the device.
+    bool SendDeltaFile(const std::string& path, mode_t mode, const std::string& lpath,
+                       const std::string& rpath, unsigned mtime, CompressionType compression) {
+        if (path.length() > 1024) {
+            Error("SendDeltaFile failed: path too long: %zu", path.length());
+            errno = ENAMETOOLONG;
+            return false;
+        }
+
+        struct stat st;
+        if (stat(lpath.c_str(), &st) == -1) {
+            Error("cannot stat '%s': %s", lpath.c_str(), strerror(errno));
+            return false;
+        }
+
+        unique_fd lfd(adb_open(lpath.c_str(), O_RDONLY | O_CLOEXEC));
+        if (lfd < 0) {
+            Error("opening '%s' locally failed: %s", lpath.c_str(), strerror(errno));
+            return false;
+        }
+
+        // There's no telling yet how much of the file will be sent as literal data, so adaptive
+        // compression samples the start of the file, as for send_v2.
+        CompressionChoice choice;
+        if (compression == CompressionType::Adaptive) {
+            std::vector<char> sample(
+                    std::min<uint64_t>(st.st_size, AdaptiveCompression::kSampleSize));
+            if (!android::base::ReadFullyAtOffset(lfd, sample.data(), sample.size(), 0)) {
+                Error("reading '%s' locally failed: %s", lpath.c_str(), strerror(errno));
+                return false;
+            }
+            choice = Adaptive().Choose(lpath, sample.data(), sample.size(), 1,
+                                       HaveSendRecv2LZ4(), HaveSendRecv2Zstd());
+        } else {
+            choice.type = ResolveCompressionType(compression);
+            choice.level = 1;
+        }
+
+        SyncRequest req;
+        req.id = ID_SEND_V3;
+        req.path_length = path.length();
+
+        syncmsg msg;
+        msg.send_v2_setup.id = ID_SEND_V3;
+        msg.send_v2_setup.mode = mode;
+        msg.send_v2_setup.flags = kSyncFlagNone;
+
+        std::variant<std::monostate, NullEncoder, BrotliEncoder, LZ4Encoder, ZstdEncoder>
+                encoder_storage;
+        Encoder* encoder = nullptr;
+        switch (choice.type) {
+            case CompressionType::None:
+                encoder = &encoder_storage.emplace<NullEncoder>(SYNC_DATA_MAX);
+                break;
+
+            case CompressionType::Brotli:
+                msg.send_v2_setup.flags = kSyncFlagBrotli;
+                encoder = &encoder_storage.emplace<BrotliEncoder>(SYNC_DATA_MAX);
+                break;
+
+            case CompressionType::LZ4:
+                msg.send_v2_setup.flags = kSyncFlagLZ4;
+                encoder = &encoder_storage.emplace<LZ4Encoder>(SYNC_DATA_MAX);
+                break;
+
+            case CompressionType::Zstd:
+                msg.send_v2_setup.flags = kSyncFlagZstd;
+                encoder = &encoder_storage.emplace<ZstdEncoder>(SYNC_DATA_MAX, 1, choice.level);
+                break;
+
+            case CompressionType::Any:
+            case CompressionType::Adaptive:
+                LOG(FATAL) << "unexpected unresolved CompressionType";
+        }
+
+        std::vector<char> buf(sizeof(SyncRequest) + path.length() + sizeof(msg.send_v2_setup));
+        void* p = buf.data();
+        p = mempcpy(p, &req, sizeof(SyncRequest));
+        p = mempcpy(p, path.data(), path.length());
+        p = mempcpy(p, &msg.send_v2_setup, sizeof(msg.send_v2_setup));
+        if (!WriteOrDie(lpath, rpath, buf.data(), buf.size())) {
+            return false;
+        }
+
+        // adbd replies in order, so the acknowledgements of the files sent before this one come
+        // ahead of its signatures. They're read as they arrive, while adbd works on the request.
+        if (!ReadAcknowledgements(true)) {
+            return false;
+        }
+
+        // adbd replies with either the signatures, or a failure.
+        if (!ReadFdExactly(fd, &msg.status, sizeof(msg.status))) {
+            Error("failed to read send_v3 response: %s", strerror(errno));
+            return false;
+        }
+        if (msg.status.id == ID_FAIL) {
+            return ReportCopyFailure(lpath, rpath, msg);
+        } else if (msg.status.id != ID_SIGS) {
+            Error("unexpected send_v3 response from daemon: id = %#" PRIx32, msg.status.id);
+            return false;
+        }
+        if (!ReadFdExactly(fd, &msg.delta_signatures.block_count,
+                           sizeof(msg.delta_signatures.block_count))) {
+            Error("failed to read send_v3 response: %s", strerror(errno));
+            return false;
+        }
+        uint32_t block_size = msg.delta_signatures.block_size;
+        uint64_t block_count = msg.delta_signatures.block_count;
+        if (block_size < kDeltaMinBlockSize || block_size > kDeltaMaxBlockSize ||
+            block_count > kDeltaMaxBlocks) {
+            Error("invalid send_v3 signatures: block size %" PRIu32 ", %" PRIu64 " blocks",
+                  block_size, block_count);
+            return false;
+        }
+        std::vector<sync_delta_block> signatures(block_count);
+        if (!ReadFdExactly(fd, signatures.data(), block_count * sizeof(sync_delta_block))) {
+            Error("failed to read send_v3 signatures: %s", strerror(errno));
+            return false;
+        }
+
+        // The encoder's literal data and copies go into one stream, which is compressed and sent
+        // as ID_DATA packets, as for a send_batch.
+        uint64_t total_size = st.st_size;
+        uint64_t bytes_copied = 0;
+        std::vector<char> stream;
+        std::vector<char> output;
+        output.reserve(2 * SYNC_DATA_MAX);
+        auto flush = [&]() {
+            bool result = WriteOrDie(lpath, rpath, output.data(), output.size());
+            output.clear();
+            ReportProgress(rpath, bytes_copied, total_size);
+            return result;
+        };
+        auto encode = [&](bool finish) {
+            if (!stream.empty()) {
+                Block input(stream.size());
+                memcpy(input.data(), stream.data(), stream.size());
+                stream.clear();
+                encoder->Append(std::move(input));
+            }
+            if (finish) {
+                encoder->Finish();
+            }
+            while (true) {
+                Block block;
+                EncodeResult result = encoder->Encode(&block);
+                if (result == EncodeResult::Error) {
+                    Error("compressing '%s' locally failed", lpath.c_str());
+                    return false;
+                }
+                if (!block.empty()) {
+                    sync_data header = {.id = ID_DATA, .size = static_cast<uint32_t>(block.size())};
+                    output.insert(output.end(), reinterpret_cast<const char*>(&header),
+                                  reinterpret_cast<const char*>(&header + 1));
+                    output.insert(output.end(), block.data(), block.data() + block.size());
+                    if (output.size() >= SYNC_DATA_MAX && !flush()) return false;
+                }
+                if (result == EncodeResult::Done || result == EncodeResult::NeedInput) {
+                    return true;
+                }
+            }
+        };
+        auto literal = [&](const char* data, size_t size) {
+            sync_data header = {.id = ID_DATA, .size = static_cast<uint32_t>(size)};
+            stream.insert(stream.end(), reinterpret_cast<const char*>(&header),
+                          reinterpret_cast<const char*>(&header + 1));
+            stream.insert(stream.end(), data, data + size);
+            RecordBytesTransferred(size);
+            bytes_copied += size;
+            return stream.size() < SYNC_DATA_MAX || encode(false);
+        };
+        auto copy = [&](uint64_t first_block, uint32_t count) {
+            sync_delta_copy copy = {
+                    .id = ID_COPY, .block_count = count, .first_block = first_block};
+            stream.insert(stream.end(), reinterpret_cast<const char*>(&copy),
+                          reinterpret_cast<const char*>(&copy + 1));
+            RecordBytesTransferred(static_cast<size_t>(count) * block_size);
+            bytes_copied += static_cast<uint64_t>(count) * block_size;
+            return stream.size() < SYNC_DATA_MAX || encode(false);
+        };
+
+        DeltaEncoder delta(block_size, std::move(signatures));
+        errno = 0;
+        if (!delta.Encode(lfd, literal, copy)) {
+            if (errno != 0) {
+                Error("reading '%s' locally failed: %s", lpath.c_str(), strerror(errno));
             }
-
-            sbuf.size = bytes_read;
-            WriteOrDie(lpath, rpath, &sbuf, sizeof(SyncRequest) + bytes_read);
-
-            RecordBytesTransferred(bytes_read);
-            bytes_copied += bytes_read;
-            ReportProgress(rpath, bytes_copied, total_size);
+            return false;
+        }
+        if (!encode(true)) {
+            return false;
         }
 
-        syncmsg msg;
-        msg.data.id = ID_DONE;
-        msg.data.size = mtime;
+        sync_data done = {.id = ID_DONE, .size = mtime};
+        output.insert(output.end(), reinterpret_cast<const char*>(&done),
+                      reinterpret_cast<const char*>(&done + 1));
         RecordFileSent(lpath, rpath);
-        return WriteOrDie(lpath, rpath, &msg.data, sizeof(msg.data));
+        return flush();
     }
 
     bool ReportCopyFailure(const std::string& from, const std::string& to, const syncmsg& msg) {
@@ -899,7 +1512,7 @@ class SyncConnection {
         android::base::StringAppendV(&s, fmt, ap);
         va_end(ap);
 
-        line_printer_.Print(s, LinePrinter::INFO);
+        Print(s, LinePrinter::INFO);
     }
 
     void Println(const char* fmt, ...) __attribute__((__format__(__printf__, 2, 3))) {
@@ -910,8 +1523,7 @@ class SyncConnection {
         android::base::StringAppendV(&s, fmt, ap);
         va_end(ap);
 
-        line_printer_.Print(s, LinePrinter::INFO);
-        line_printer_.KeepInfoLine();
+        Print(s, LinePrinter::INFO, true);
     }
 
     void Error(const char* fmt, ...) __attribute__((__format__(__printf__, 2, 3))) {
@@ -922,7 +1534,7 @@ class SyncConnection {
         android::base::StringAppendV(&s, fmt, ap);
         va_end(ap);
 
-        line_printer_.Print(s, LinePrinter::ERROR);
+        Print(s, LinePrinter::ERROR);
     }
 
     void Warning(const char* fmt, ...) __attribute__((__format__(__printf__, 2, 3))) {
@@ -933,7 +1545,7 @@ class SyncConnection {
         android::base::StringAppendV(&s, fmt, ap);
         va_end(ap);
 
-        line_printer_.Print(s, LinePrinter::WARNING);
+        Print(s, LinePrinter::WARNING);
     }
 
     void ComputeExpectedTotalBytes(const std::vector<copyinfo>& file_list) {
@@ -946,6 +1558,13 @@ class SyncConnection {
         current_ledger_.expect_multiple_files = true;
     }
 
+    // For a transfer whose files are still being found while it runs.
+    void AddExpectedTotalBytes(uint64_t bytes) {
+        std::lock_guard<std::mutex> lock(reporter_->report_mutex_);
+        reporter_->current_ledger_.bytes_expected += bytes;
+        reporter_->current_ledger_.expect_multiple_files = true;
+    }
+
     void SetExpectedTotalBytes(uint64_t expected_total_bytes) {
         current_ledger_.bytes_expected = expected_total_bytes;
         current_ledger_.expect_multiple_files = false;
@@ -956,6 +1575,12 @@ class SyncConnection {
     size_t max;
 
   private:
+    void Print(const std::string& s, LinePrinter::LineType type, bool keep = false) {
+        std::lock_guard<std::mutex> lock(reporter_->report_mutex_);
+        reporter_->line_printer_.Print(s, type);
+        if (keep) reporter_->line_printer_.KeepInfoLine();
+    }
+
     std::deque<std::pair<std::string, std::string>> deferred_acknowledgements_;
     Block acknowledgement_buffer_;
     const FeatureSet* features_ = nullptr;
@@ -966,10 +1591,20 @@ class SyncConnection {
     bool have_sendrecv_v2_lz4_;
     bool have_sendrecv_v2_zstd_;
     bool have_sendrecv_v2_dry_run_send_;
+    bool have_hash_v1_;
+    bool have_send_v3_delta_;
+    bool have_send_batch_;
+    bool have_ls_recursive_;
+    bool have_recv_range_;
+
+    // The connection whose ledgers and line printer this one uses, which is usually itself.
+    SyncConnection* reporter_;
+    std::mutex report_mutex_;
 
     TransferLedger global_ledger_;
     TransferLedger current_ledger_;
     LinePrinter line_printer_;
+    AdaptiveCompression adaptive_compression_;
 
     bool SendQuit() {
         return SendRequest(ID_QUIT, ""); // TODO: add a SendResponse?
@@ -1046,9 +1681,13 @@ static bool sync_stat_fallback(SyncConnection& sc, const std::string& path, stru
     return true;
 }
 
+// Files smaller than this are always sent whole: the round trip for the signatures costs more
+// than a delta could save.
+static constexpr off_t kDeltaMinFileSize = 1024 * 1024;
+
 static bool sync_send(SyncConnection& sc, const std::string& lpath, const std::string& rpath,
                       unsigned mtime, mode_t mode, bool sync, CompressionType compression,
-                      bool dry_run) {
+                      bool dry_run, bool remote_is_file = false) {
     if (sync) {
         struct stat st;
         if (sync_lstat(sc, rpath, &st)) {
@@ -1056,6 +1695,7 @@ static bool sync_send(SyncConnection& sc, const std::string& lpath, const std::s
                 sc.RecordFilesSkipped(1);
                 return true;
             }
+            remote_is_file = S_ISREG(st.st_mode);
         }
     }
 
@@ -1091,6 +1731,11 @@ static bool sync_send(SyncConnection& sc, const std::string& lpath, const std::s
                               dry_run)) {
             return false;
         }
+    } else if (remote_is_file && !dry_run && st.st_size >= kDeltaMinFileSize &&
+               sc.HaveSendV3Delta()) {
+        if (!sc.SendDeltaFile(rpath, mode, lpath, rpath, mtime, compression)) {
+            return false;
+        }
     } else {
         if (!sc.SendLargeFile(rpath, mode, lpath, rpath, mtime, compression, dry_run)) {
             return false;
@@ -1099,10 +1744,9 @@ static bool sync_send(SyncConnection& sc, const std::string& lpath, const std::s
     return sc.ReadAcknowledgements(sync);
 }
 
-static bool sync_recv_v1(SyncConnection& sc, const char* rpath, const char* lpath, const char* name,
-                         uint64_t expected_size) {
-    if (!sc.SendRequest(ID_RECV_V1, rpath)) return false;
-
+// Reads the response to a RECV_V1 request that has already been sent.
+static bool sync_finish_recv_v1(SyncConnection& sc, const char* rpath, const char* lpath,
+                                const char* name, uint64_t expected_size) {
     adb_unlink(lpath);
     unique_fd lfd(adb_creat(lpath, 0644));
     if (lfd < 0) {
@@ -1154,12 +1798,11 @@ static bool sync_recv_v1(SyncConnection& sc, const char* rpath, const char* lpat
     return true;
 }
 
-static bool sync_recv_v2(SyncConnection& sc, const char* rpath, const char* lpath, const char* name,
-                         uint64_t expected_size, CompressionType compression) {
-    compression = sc.ResolveCompressionType(compression);
-
-    if (!sc.SendRecv2(rpath, compression)) return false;
-
+// Reads the response to a RECV_V2 request that has already been sent. |compression| must be the
+// resolved compression type that the request was sent with.
+static bool sync_finish_recv_v2(SyncConnection& sc, const char* rpath, const char* lpath,
+                                const char* name, uint64_t expected_size,
+                                CompressionType compression) {
     adb_unlink(lpath);
     unique_fd lfd(adb_creat(lpath, 0644));
     if (lfd < 0) {
@@ -1168,6 +1811,7 @@ static bool sync_recv_v2(SyncConnection& sc, const char* rpath, const char* lpat
     }
 
     uint64_t bytes_copied = 0;
+    AsyncWriter writer(lfd);
 
     Block buffer(SYNC_DATA_MAX);
     std::variant<std::monostate, NullDecoder, BrotliDecoder, LZ4Decoder, ZstdDecoder>
@@ -1193,7 +1837,8 @@ static bool sync_recv_v2(SyncConnection& sc, const char* rpath, const char* lpat
             break;
 
         case CompressionType::Any:
-            LOG(FATAL) << "unexpected CompressionType::Any";
+        case CompressionType::Adaptive:
+            LOG(FATAL) << "unexpected unresolved CompressionType";
     }
 
     while (true) {
@@ -1238,7 +1883,7 @@ static bool sync_recv_v2(SyncConnection& sc, const char* rpath, const char* lpat
             }
 
             if (!output.empty()) {
-                if (!WriteFdExactly(lfd, output.data(), output.size())) {
+                if (!writer.Write(output.data(), output.size())) {
                     sc.Error("cannot write '%s': %s", lpath, strerror(errno));
                     adb_unlink(lpath);
                     return false;
@@ -1254,6 +1899,11 @@ static bool sync_recv_v2(SyncConnection& sc, const char* rpath, const char* lpat
             } else if (result == DecodeResult::MoreOutput) {
                 continue;
             } else if (result == DecodeResult::Done) {
+                if (!writer.Finish()) {
+                    sc.Error("cannot write '%s': %s", lpath, strerror(errno));
+                    adb_unlink(lpath);
+                    return false;
+                }
                 sc.RecordFilesTransferred(1);
                 return true;
             } else {
@@ -1263,13 +1913,223 @@ static bool sync_recv_v2(SyncConnection& sc, const char* rpath, const char* lpat
     }
 }
 
-static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath, const char* name,
-                      uint64_t expected_size, CompressionType compression) {
+// Sends a request to pull |rpath|, without waiting for the response. |compression| is updated to
+// the compression type that the response will use.
+static bool sync_start_recv(SyncConnection& sc, const char* rpath, CompressionType* compression) {
+    if (sc.HaveSendRecv2()) {
+        *compression = sc.ResolveCompressionType(*compression, rpath);
+        return sc.SendRecv2(rpath, *compression);
+    } else {
+        *compression = CompressionType::None;
+        return sc.SendRequest(ID_RECV_V1, rpath);
+    }
+}
+
+// Reads the response to a request sent by sync_start_recv. Responses arrive in the same order as
+// the requests were sent.
+static bool sync_finish_recv(SyncConnection& sc, const char* rpath, const char* lpath,
+                             const char* name, uint64_t expected_size,
+                             CompressionType compression) {
     if (sc.HaveSendRecv2()) {
-        return sync_recv_v2(sc, rpath, lpath, name, expected_size, compression);
+        return sync_finish_recv_v2(sc, rpath, lpath, name, expected_size, compression);
     } else {
-        return sync_recv_v1(sc, rpath, lpath, name, expected_size);
+        return sync_finish_recv_v1(sc, rpath, lpath, name, expected_size);
+    }
+}
+
+static bool sync_recv(SyncConnection& sc, const char* rpath, const char* lpath, const char* name,
+                      uint64_t expected_size, CompressionType compression) {
+    if (!sync_start_recv(sc, rpath, &compression)) return false;
+    return sync_finish_recv(sc, rpath, lpath, name, expected_size, compression);
+}
+
+// Files at least this big are pulled in ranges of kRangedPullChunkSize over several connections at
+// once, if the device supports it and more than one job was asked for.
+static constexpr uint64_t kRangedPullMinSize = 64 * 1024 * 1024;
+static constexpr uint64_t kRangedPullChunkSize = 16 * 1024 * 1024;
+
+// Reads the response to a SendRecvRange, and writes it to |lfd| at |offset|. |bytes_copied| counts
+// the bytes written for the whole file, for the progress report.
+static bool sync_finish_recv_range(SyncConnection& sc, const char* rpath, const char* lpath,
+                                   const char* name, borrowed_fd lfd, uint64_t offset,
+                                   uint64_t length, uint64_t file_size,
+                                   CompressionType compression,
+                                   std::atomic<uint64_t>* bytes_copied) {
+    Block buffer(SYNC_DATA_MAX);
+    std::variant<std::monostate, NullDecoder, BrotliDecoder, LZ4Decoder, ZstdDecoder>
+            decoder_storage;
+    Decoder* decoder = nullptr;
+
+    std::span buffer_span(buffer.data(), buffer.size());
+    switch (compression) {
+        case CompressionType::None:
+            decoder = &decoder_storage.emplace<NullDecoder>(buffer_span);
+            break;
+
+        case CompressionType::Brotli:
+            decoder = &decoder_storage.emplace<BrotliDecoder>(buffer_span);
+            break;
+
+        case CompressionType::LZ4:
+            decoder = &decoder_storage.emplace<LZ4Decoder>(buffer_span);
+            break;
+
+        case CompressionType::Zstd:
+            decoder = &decoder_storage.emplace<ZstdDecoder>(buffer_span);
+            break;
+
+        case CompressionType::Any:
+        case CompressionType::Adaptive:
+            LOG(FATAL) << "unexpected unresolved CompressionType";
+    }
+
+    uint64_t received = 0;
+    while (true) {
+        syncmsg msg;
+        if (!ReadFdExactly(sc.fd, &msg.data, sizeof(msg.data))) return false;
+
+        if (msg.data.id == ID_DONE) {
+            if (!decoder->Finish()) {
+                sc.Error("unexpected ID_DONE");
+                return false;
+            }
+        } else if (msg.data.id != ID_DATA) {
+            sc.ReportCopyFailure(rpath, lpath, msg);
+            return false;
+        } else {
+            if (msg.data.size > sc.max) {
+                sc.Error("msg.data.size too large: %u (max %zu)", msg.data.size, sc.max);
+                return false;
+            }
+
+            Block block(msg.data.size);
+            if (!ReadFdExactly(sc.fd, block.data(), msg.data.size)) return false;
+            decoder->Append(std::move(block));
+        }
+
+        while (true) {
+            std::span<char> output;
+            DecodeResult result = decoder->Decode(&output);
+            if (result == DecodeResult::Error) {
+                sc.Error("decompress failed");
+                return false;
+            }
+
+            if (output.size() > length - received) {
+                sc.Error("'%s' sent more than was asked for", rpath);
+                return false;
+            }
+            if (!output.empty() && adb_pwrite(lfd.get(), output.data(), output.size(),
+                                              offset + received) != int(output.size())) {
+                sc.Error("cannot write '%s': %s", lpath, strerror(errno));
+                return false;
+            }
+            received += output.size();
+            sc.RecordBytesTransferred(output.size());
+            sc.ReportProgress(name != nullptr ? name : rpath, *bytes_copied += output.size(),
+                              file_size);
+
+            if (result == DecodeResult::NeedInput) {
+                break;
+            } else if (result == DecodeResult::MoreOutput) {
+                continue;
+            } else if (result == DecodeResult::Done) {
+                if (received != length) {
+                    sc.Error("'%s' got shorter while it was being pulled", rpath);
+                    return false;
+                }
+                return true;
+            } else {
+                LOG(FATAL) << "invalid DecodeResult: " << static_cast<int>(result);
+            }
+        }
+    }
+}
+
+// Pulls the regular file |rpath| in ranges over up to |jobs| connections at once, rather than as a
+// single stream, which is limited by one thread on each side. The ranges are written in place into
+// |lpath|. Once they're all done, the file is checked against the device's copy, in case it changed
+// while it was being pulled.
+static bool sync_recv_ranged(SyncConnection& sc, const char* rpath, const char* lpath,
+                             const char* name, const struct stat& st, CompressionType compression,
+                             size_t jobs) {
+    const uint64_t size = st.st_size;
+    const uint64_t chunks = (size + kRangedPullChunkSize - 1) / kRangedPullChunkSize;
+
+    adb_unlink(lpath);
+    unique_fd lfd(adb_creat(lpath, 0644));
+    if (lfd < 0) {
+        sc.Error("cannot create '%s': %s", lpath, strerror(errno));
+        return false;
+    }
+#if defined(__linux__)
+    // Failing to preallocate is fine: the file will just grow as the ranges are written.
+    posix_fallocate(lfd.get(), 0, size);
+#endif
+
+    std::vector<std::unique_ptr<SyncConnection>> workers;
+    while (workers.size() + 1 < std::min<uint64_t>(jobs, chunks)) {
+        auto worker = std::make_unique<SyncConnection>(&sc);
+        if (!worker->IsValid()) break;
+        workers.push_back(std::move(worker));
+    }
+
+    std::atomic<uint64_t> next_chunk = 0;
+    std::atomic<uint64_t> bytes_copied = 0;
+    std::atomic<bool> failed = false;
+    auto pull_chunks = [&](SyncConnection& conn) {
+        while (!failed) {
+            uint64_t chunk = next_chunk++;
+            if (chunk >= chunks) return;
+
+            uint64_t offset = chunk * kRangedPullChunkSize;
+            uint64_t length = std::min(kRangedPullChunkSize, size - offset);
+            CompressionType chunk_compression = conn.ResolveCompressionType(compression, rpath);
+            if (!conn.SendRecvRange(rpath, chunk_compression, offset, length) ||
+                !sync_finish_recv_range(conn, rpath, lpath, name, lfd, offset, length, size,
+                                        chunk_compression, &bytes_copied)) {
+                failed = true;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (auto& worker : workers) {
+        threads.emplace_back(pull_chunks, std::ref(*worker));
+    }
+    pull_chunks(sc);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    lfd.reset();
+
+    bool success = !failed;
+    if (success && sc.HaveHashV1()) {
+        // Hash the local copy while adbd hashes the original.
+        std::vector<FileHashResult> remote;
+        success = sc.SendHash({rpath});
+        FileHashResult local = hash_file(lpath);
+        success = success && sc.FinishHash(1, &remote);
+        if (success && (remote[0].error != 0 || local.error != 0 || remote[0].size != size ||
+                        local.size != size || remote[0].hash != local.hash)) {
+            sc.Error("'%s' changed while it was being pulled", rpath);
+            success = false;
+        }
+    } else if (success) {
+        struct stat after;
+        if (!sync_stat_fallback(sc, rpath, &after) ||
+            static_cast<uint64_t>(after.st_size) != size || after.st_mtime != st.st_mtime) {
+            sc.Error("'%s' changed while it was being pulled", rpath);
+            success = false;
+        }
     }
+
+    if (!success) {
+        adb_unlink(lpath);
+        return false;
+    }
+    sc.RecordFilesTransferred(1);
+    return true;
 }
 
 bool do_sync_ls(const char* path) {
@@ -1345,9 +2205,192 @@ static bool is_root_dir(std::string_view path) {
     return true;
 }
 
+// Marks the files in |candidates| that already have the same contents on the device as skipped.
+// Rebuilds touch the timestamps of many files without changing them, so this saves pushing them
+// again. Local hashes are cached in a FileHashIndex, and adbd hashes its side of each batch while
+// we look up or compute ours. The index also remembers which files matched, so that they can be
+// skipped without hashing either side until one of them changes again.
+static bool skip_identical_files(SyncConnection& sc, const std::vector<copyinfo*>& candidates) {
+    FileHashIndex index(FileHashIndex::DefaultPath());
+    index.Load();
+
+    // Taken before any of the files are stat'ed, so that it's also from before they're read.
+    int64_t hashed_at = FileHashIndex::Now();
+
+    std::vector<copyinfo*> unmatched;
+    std::vector<FileStamp> stamps;
+    for (copyinfo* ci : candidates) {
+        struct stat st;
+        if (lstat(ci->lpath.c_str(), &st) != 0 || static_cast<uint64_t>(st.st_size) != ci->size) {
+            // It's changed since we listed it, so it'll be pushed anyway.
+            continue;
+        }
+        FileStamp stamp = FileStamp::FromStat(st);
+        if (index.Matches(ci->lpath, stamp, ci->rpath, ci->remote_time)) {
+            ci->skip = true;
+        } else {
+            unmatched.push_back(ci);
+            stamps.push_back(stamp);
+        }
+    }
+
+    for (size_t start = 0; start < unmatched.size(); start += SYNC_HASH_MAX_PATHS) {
+        size_t count = std::min(unmatched.size() - start, size_t(SYNC_HASH_MAX_PATHS));
+        std::span batch(unmatched.begin() + start, count);
+        std::span batch_stamps(stamps.begin() + start, count);
+
+        std::vector<std::string> remote_paths;
+        for (const copyinfo* ci : batch) {
+            remote_paths.push_back(ci->rpath);
+        }
+        if (!sc.SendHash(remote_paths)) {
+            sc.Error("failed to send hash request: %s", strerror(errno));
+            return false;
+        }
+
+        std::vector<std::optional<FileHash>> local_hashes(batch.size());
+        std::vector<std::string> unindexed_paths;
+        std::vector<size_t> unindexed;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            local_hashes[i] = index.Lookup(batch[i]->lpath, batch_stamps[i]);
+            if (!local_hashes[i]) {
+                unindexed_paths.push_back(batch[i]->lpath);
+                unindexed.push_back(i);
+            }
+        }
+        std::vector<FileHashResult> computed =
+                hash_files(unindexed_paths, std::thread::hardware_concurrency());
+        for (size_t i = 0; i < computed.size(); ++i) {
+            const copyinfo* ci = batch[unindexed[i]];
+            // Only trust a hash of the file we stat'ed: a file that changed while we were hashing
+            // it will be pushed anyway.
+            if (computed[i].error == 0 && computed[i].size == ci->size) {
+                local_hashes[unindexed[i]] = computed[i].hash;
+                index.Update(ci->lpath, batch_stamps[unindexed[i]], hashed_at, computed[i].hash);
+            }
+        }
+
+        std::vector<FileHashResult> remote_hashes;
+        if (!sc.FinishHash(batch.size(), &remote_hashes)) {
+            return false;
+        }
+        for (size_t i = 0; i < batch.size(); ++i) {
+            const FileHashResult& remote = remote_hashes[i];
+            if (local_hashes[i] && remote.error == 0 && remote.size == batch[i]->size &&
+                remote.hash == *local_hashes[i]) {
+                batch[i]->skip = true;
+                index.RecordMatch(batch[i]->lpath, batch[i]->rpath, batch[i]->remote_time);
+            }
+        }
+    }
+
+    index.Save();
+    return true;
+}
+
+// Splits |files| into |shards| lists of roughly equal cost. Besides its size, every file costs
+// about as much as sending kPerFileCost bytes, so that a shard of many small files is balanced
+// against one with a few large ones. Each shard keeps the files in their original order.
+static std::vector<std::vector<const copyinfo*>> shard_file_list(
+        const std::vector<const copyinfo*>& files, size_t shards) {
+    static constexpr uint64_t kPerFileCost = 32 * 1024;
+
+    std::vector<size_t> order(files.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(),
+                     [&](size_t lhs, size_t rhs) { return files[lhs]->size > files[rhs]->size; });
+
+    // Hand out the most expensive files first, each to the shard with the least work so far.
+    std::vector<uint64_t> costs(shards);
+    std::vector<std::vector<size_t>> assignments(shards);
+    for (size_t i : order) {
+        size_t shard = std::min_element(costs.begin(), costs.end()) - costs.begin();
+        costs[shard] += files[i]->size + kPerFileCost;
+        assignments[shard].push_back(i);
+    }
+
+    std::vector<std::vector<const copyinfo*>> result(shards);
+    for (size_t shard = 0; shard < shards; ++shard) {
+        std::sort(assignments[shard].begin(), assignments[shard].end());
+        for (size_t i : assignments[shard]) {
+            result[shard].push_back(files[i]);
+        }
+    }
+    return result;
+}
+
+// Copies |files| with |copy|, spread over up to |jobs| sync connections: |sc| and as many more as
+// can be opened, each driven by a thread of its own. adbd serves each connection on its own thread,
+// so this lets a transfer use more than one core on the device for compression and I/O.
+static bool copy_sharded(
+        SyncConnection& sc, const std::vector<const copyinfo*>& files, size_t jobs,
+        const std::function<bool(SyncConnection&, const std::vector<const copyinfo*>&)>& copy) {
+    std::vector<std::unique_ptr<SyncConnection>> workers;
+    while (workers.size() + 1 < std::min(jobs, files.size())) {
+        auto worker = std::make_unique<SyncConnection>(&sc);
+        if (!worker->IsValid()) break;
+        workers.push_back(std::move(worker));
+    }
+
+    if (workers.empty()) {
+        return copy(sc, files);
+    }
+
+    auto shards = shard_file_list(files, workers.size() + 1);
+    std::vector<char> results(workers.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < workers.size(); ++i) {
+        threads.emplace_back([&, i]() { results[i] = copy(*workers[i], shards[i + 1]); });
+    }
+
+    bool success = copy(sc, shards[0]);
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+        success &= static_cast<bool>(results[i]);
+    }
+    return success;
+}
+
+// Small files are pushed in batches of up to this many files and bytes, if the device supports it,
+// rather than with a request and an acknowledgement each.
+static constexpr size_t kSendBatchMaxFiles = 1024;
+static constexpr uint64_t kSendBatchMaxBytes = 4 * 1024 * 1024;
+
+// Pushes |files| from the directory |lpath| to the directory |rpath|, and waits for them all to be
+// acknowledged.
+static bool sync_send_files(SyncConnection& sc, const std::string& lpath, const std::string& rpath,
+                            const std::vector<const copyinfo*>& files, CompressionType compression,
+                            bool dry_run) {
+    std::vector<const copyinfo*> batch;
+    uint64_t batch_bytes = 0;
+    auto send_batch = [&]() {
+        if (batch.empty()) return true;
+        bool result = sc.SendBatch(lpath, rpath, batch, compression, dry_run) &&
+                      sc.ReadAcknowledgements();
+        batch.clear();
+        batch_bytes = 0;
+        return result;
+    };
+
+    for (const copyinfo* ci : files) {
+        if (sc.HaveSendBatch() && S_ISREG(ci->mode) && ci->size < SYNC_DATA_MAX &&
+            ci->rpath.size() - rpath.size() <= 1024) {
+            batch.push_back(ci);
+            batch_bytes += ci->size;
+            if (batch.size() >= kSendBatchMaxFiles || batch_bytes >= kSendBatchMaxBytes) {
+                if (!send_batch()) return false;
+            }
+        } else if (!sync_send(sc, ci->lpath, ci->rpath, ci->time, ci->mode, false, compression,
+                              dry_run, ci->remote_is_file)) {
+            return false;
+        }
+    }
+    return send_batch() && sc.ReadAcknowledgements(true);
+}
+
 static bool copy_local_dir_remote(SyncConnection& sc, std::string lpath, std::string rpath,
                                   bool check_timestamps, bool list_only,
-                                  CompressionType compression, bool dry_run) {
+                                  CompressionType compression, bool dry_run, size_t jobs) {
     sc.NewTransfer();
 
     // Make sure that both directory paths end in a slash.
@@ -1412,41 +2455,52 @@ static bool copy_local_dir_remote(SyncConnection& sc, std::string lpath, std::st
                 return false;
             }
         }
+        std::vector<copyinfo*> same_size;
         for (copyinfo& ci : file_list) {
             struct stat st;
             if (sc.FinishStat(&st)) {
+                ci.remote_is_file = S_ISREG(st.st_mode);
+                ci.remote_time = st.st_mtime;
                 if (st.st_size == static_cast<off_t>(ci.size) && st.st_mtime == ci.time) {
                     ci.skip = true;
+                } else if (st.st_size == static_cast<off_t>(ci.size) && S_ISREG(ci.mode) &&
+                           S_ISREG(st.st_mode) && !ci.skip) {
+                    same_size.push_back(&ci);
                 }
             }
         }
+        if (sc.HaveHashV1() && !same_size.empty() && !skip_identical_files(sc, same_size)) {
+            return false;
+        }
     }
 
     sc.ComputeExpectedTotalBytes(file_list);
 
+    std::vector<const copyinfo*> files;
     for (const copyinfo& ci : file_list) {
         if (!ci.skip) {
             if (list_only) {
                 sc.Println("would push: %s -> %s", ci.lpath.c_str(), ci.rpath.c_str());
             } else {
-                if (!sync_send(sc, ci.lpath, ci.rpath, ci.time, ci.mode, false, compression,
-                               dry_run)) {
-                    return false;
-                }
+                files.push_back(&ci);
             }
         } else {
             skipped++;
         }
     }
 
+    bool success = copy_sharded(
+            sc, files, jobs, [&](SyncConnection& conn, const std::vector<const copyinfo*>& shard) {
+                return sync_send_files(conn, lpath, rpath, shard, compression, dry_run);
+            });
+
     sc.RecordFilesSkipped(skipped);
-    bool success = sc.ReadAcknowledgements(true);
     sc.ReportTransferRate(lpath, TransferDirection::push);
     return success;
 }
 
 bool do_sync_push(const std::vector<const char*>& srcs, const char* dst, bool sync,
-                  CompressionType compression, bool dry_run, bool quiet) {
+                  CompressionType compression, bool dry_run, bool quiet, size_t jobs) {
     SyncConnection sc;
     if (!sc.IsValid()) return false;
     sc.SetQuiet(quiet);
@@ -1512,8 +2566,8 @@ bool do_sync_push(const std::vector<const char*>& srcs, const char* dst, bool sy
                 dst_dir.append(android::base::Basename(src_path));
             }
 
-            success &=
-                    copy_local_dir_remote(sc, src_path, dst_dir, sync, false, compression, dry_run);
+            success &= copy_local_dir_remote(sc, src_path, dst_dir, sync, false, compression,
+                                             dry_run, jobs);
             continue;
         } else if (!should_push_file(st.st_mode)) {
             sc.Warning("skipping special file '%s' (mode = 0o%o)", src_path, st.st_mode);
@@ -1620,14 +2674,182 @@ static int set_time_and_mode(const std::string& lpath, time_t time,
     return r1 ? r1 : r2;
 }
 
+// Returns the next file to pull, or nullptr if there are no more. If |wait| is false, it may also
+// return nullptr if the next file isn't known yet.
+using NextFileFunction = std::function<const copyinfo*(bool wait)>;
+
+// Pulls files from |next_file| over |sc|. adbd handles requests one at a time, so rather than
+// waiting a round trip for each file, keep several requests in flight and read their responses in
+// order. Requests are at most a little over 1KiB, so the window is small enough that the unread
+// ones always fit in the socket buffers, and neither side can block writing while the other is
+// blocked writing too.
+static bool pull_files(SyncConnection& sc, const NextFileFunction& next_file, bool copy_attrs,
+                       CompressionType compression) {
+    constexpr size_t max_pending_recvs = 32;
+    struct PendingRecv {
+        const copyinfo* ci;
+        CompressionType compression;
+    };
+    std::deque<PendingRecv> pending;
+
+    auto finish_recv = [&]() {
+        const PendingRecv recv = pending.front();
+        pending.pop_front();
+        const copyinfo& ci = *recv.ci;
+        if (!sync_finish_recv(sc, ci.rpath.c_str(), ci.lpath.c_str(), nullptr, ci.size,
+                              recv.compression)) {
+            return false;
+        }
+        if (copy_attrs && set_time_and_mode(ci.lpath, ci.time, ci.mode)) {
+            return false;
+        }
+        return true;
+    };
+
+    while (true) {
+        // Only wait for the next file if there's nothing to read in the meantime.
+        const copyinfo* ci = next_file(pending.empty());
+        if (!ci) {
+            if (pending.empty()) return true;
+            if (!finish_recv()) return false;
+            continue;
+        }
+
+        CompressionType file_compression = compression;
+        if (!sync_start_recv(sc, ci->rpath.c_str(), &file_compression)) {
+            return false;
+        }
+        pending.push_back({ci, file_compression});
+
+        if (pending.size() >= max_pending_recvs && !finish_recv()) {
+            return false;
+        }
+    }
+}
+
+// Files found by a recursive listing, for other connections to pull while it's still arriving.
+class PullQueue {
+  public:
+    void Push(const copyinfo* ci) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        files_.push_back(ci);
+        cv_.notify_one();
+    }
+
+    // Called once everything has been pushed.
+    void Close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        cv_.notify_all();
+    }
+
+    const copyinfo* Pop(bool wait) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (wait) {
+            cv_.wait(lock, [this]() { return closed_ || !files_.empty(); });
+        }
+        if (files_.empty()) return nullptr;
+        const copyinfo* ci = files_.front();
+        files_.pop_front();
+        return ci;
+    }
+
+  private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<const copyinfo*> files_;
+    bool closed_ = false;
+};
+
+// Pulls the directory |rpath| to |lpath| with a single list_recursive, rather than a list for
+// each directory. The files are pulled over other connections while the listing is still arriving,
+// and |sc| joins them once it's done if |jobs| allows.
+static bool pull_remote_dir_streaming(SyncConnection& sc, const std::string& rpath,
+                                      const std::string& lpath, bool copy_attrs,
+                                      CompressionType compression, size_t jobs) {
+    if (!mkdirs(lpath)) {
+        sc.Error("failed to create directory '%s': %s", lpath.c_str(), strerror(errno));
+        return false;
+    }
+
+    PullQueue queue;
+    auto next_file = [&queue](bool wait) { return queue.Pop(wait); };
+
+    std::vector<std::unique_ptr<SyncConnection>> workers;
+    while (workers.size() < std::max<size_t>(jobs, 2) - 1) {
+        auto worker = std::make_unique<SyncConnection>(&sc);
+        if (!worker->IsValid()) break;
+        workers.push_back(std::move(worker));
+    }
+    std::vector<char> results(workers.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < workers.size(); ++i) {
+        threads.emplace_back([&, i]() {
+            results[i] = pull_files(*workers[i], next_file, copy_attrs, compression);
+        });
+    }
+
+    // copyinfos stay where they are in a deque, so the workers can use them while it grows.
+    std::deque<copyinfo> entries;
+    size_t skipped = 0;
+    bool mkdirs_failed = false;
+    bool success = sc.SendLsRecursive(rpath) &&
+                   sc.FinishLsRecursive([&](const std::string& path, const sync_dent_v2& dent) {
+                       if (mkdirs_failed) return;
+
+                       copyinfo& ci = entries.emplace_back(lpath, rpath, path, dent.mode);
+                       if (dent.error != 0) {
+                           sc.Warning("stat failed for path %s: %s", ci.rpath.c_str(),
+                                      strerror(errno_from_wire(dent.error)));
+                       } else if (S_ISDIR(ci.mode)) {
+                           // The listing always has a directory before its contents.
+                           // TODO(b/25457350): We don't preserve permissions on directories.
+                           if (!mkdirs(ci.lpath)) {
+                               sc.Error("failed to create directory '%s': %s", ci.lpath.c_str(),
+                                        strerror(errno));
+                               mkdirs_failed = true;
+                           }
+                       } else if (!should_pull_file(ci.mode)) {
+                           sc.Warning("skipping special file '%s' (mode = 0o%o)",
+                                      ci.rpath.c_str(), ci.mode);
+                           ++skipped;
+                       } else {
+                           ci.time = dent.mtime;
+                           ci.size = dent.size;
+                           sc.AddExpectedTotalBytes(ci.size);
+                           queue.Push(&ci);
+                       }
+                   });
+    queue.Close();
+
+    if (success && !mkdirs_failed && (workers.empty() || jobs > 1)) {
+        success = pull_files(sc, next_file, copy_attrs, compression);
+    }
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+        success &= static_cast<bool>(results[i]);
+    }
+
+    sc.RecordFilesSkipped(skipped);
+    return success && !mkdirs_failed;
+}
+
 static bool copy_remote_dir_local(SyncConnection& sc, std::string rpath, std::string lpath,
-                                  bool copy_attrs, CompressionType compression) {
+                                  bool copy_attrs, CompressionType compression, size_t jobs) {
     sc.NewTransfer();
 
     // Make sure that both directory paths end in a slash.
     // Both paths are known to be nonempty, so we don't need to check.
     ensure_trailing_separators(lpath, rpath);
 
+    if (sc.HaveLsRecursive()) {
+        if (!pull_remote_dir_streaming(sc, rpath, lpath, copy_attrs, compression, jobs)) {
+            return false;
+        }
+        sc.ReportTransferRate(rpath, TransferDirection::pull);
+        return true;
+    }
+
     // Recursively build the list of files to copy.
     sc.Printf("pull: building file list...");
     std::vector<copyinfo> file_list;
@@ -1637,6 +2859,9 @@ static bool copy_remote_dir_local(SyncConnection& sc, std::string rpath, std::st
 
     sc.ComputeExpectedTotalBytes(file_list);
 
+    // Directories come before their contents in the list, so creating all of them up front means
+    // the files can be pulled in any order.
+    std::vector<const copyinfo*> files;
     int skipped = 0;
     for (const copyinfo &ci : file_list) {
         if (!ci.skip) {
@@ -1651,25 +2876,30 @@ static bool copy_remote_dir_local(SyncConnection& sc, std::string rpath, std::st
                 continue;
             }
 
-            if (!sync_recv(sc, ci.rpath.c_str(), ci.lpath.c_str(), nullptr, ci.size, compression)) {
-                return false;
-            }
-
-            if (copy_attrs && set_time_and_mode(ci.lpath, ci.time, ci.mode)) {
-                return false;
-            }
+            files.push_back(&ci);
         } else {
             skipped++;
         }
     }
 
+    if (!copy_sharded(sc, files, jobs,
+                      [&](SyncConnection& conn, const std::vector<const copyinfo*>& shard) {
+                          size_t next = 0;
+                          auto next_file = [&](bool) {
+                              return next < shard.size() ? shard[next++] : nullptr;
+                          };
+                          return pull_files(conn, next_file, copy_attrs, compression);
+                      })) {
+        return false;
+    }
+
     sc.RecordFilesSkipped(skipped);
     sc.ReportTransferRate(rpath, TransferDirection::pull);
     return true;
 }
 
 bool do_sync_pull(const std::vector<const char*>& srcs, const char* dst, bool copy_attrs,
-                  CompressionType compression, const char* name, bool quiet) {
+                  CompressionType compression, const char* name, bool quiet, size_t jobs) {
     SyncConnection sc;
     if (!sc.IsValid()) return false;
     sc.SetQuiet(quiet);
@@ -1744,7 +2974,8 @@ bool do_sync_pull(const std::vector<const char*>& srcs, const char* dst, bool co
                 dst_dir.append(android::base::Basename(src_path));
             }
 
-            success &= copy_remote_dir_local(sc, src_path, dst_dir, copy_attrs, compression);
+            success &=
+                    copy_remote_dir_local(sc, src_path, dst_dir, copy_attrs, compression, jobs);
             continue;
         } else if (!should_pull_file(src_st.st_mode)) {
             sc.Warning("skipping special file '%s' (mode = 0o%o)", src_path, src_st.st_mode);
@@ -1763,7 +2994,10 @@ bool do_sync_pull(const std::vector<const char*>& srcs, const char* dst, bool co
 
         sc.NewTransfer();
         sc.SetExpectedTotalBytes(src_st.st_size);
-        if (!sync_recv(sc, src_path, dst_path, name, src_st.st_size, compression)) {
+        bool ranged = jobs > 1 && sc.HaveRecvRange() && S_ISREG(src_st.st_mode) &&
+                      static_cast<uint64_t>(src_st.st_size) >= kRangedPullMinSize;
+        if (ranged ? !sync_recv_ranged(sc, src_path, dst_path, name, src_st, compression, jobs)
+                   : !sync_recv(sc, src_path, dst_path, name, src_st.st_size, compression)) {
             success = false;
             continue;
         }
@@ -1780,12 +3014,13 @@ bool do_sync_pull(const std::vector<const char*>& srcs, const char* dst, bool co
 }
 
 bool do_sync_sync(const std::string& lpath, const std::string& rpath, bool list_only,
-                  CompressionType compression, bool dry_run, bool quiet) {
+                  CompressionType compression, bool dry_run, bool quiet, size_t jobs) {
     SyncConnection sc;
     if (!sc.IsValid()) return false;
     sc.SetQuiet(quiet);
 
-    bool success = copy_local_dir_remote(sc, lpath, rpath, true, list_only, compression, dry_run);
+    bool success = copy_local_dir_remote(sc, lpath, rpath, true, list_only, compression, dry_run,
+                                         jobs);
     if (!list_only) {
         sc.ReportOverallTransferRate(TransferDirection::push);
     }
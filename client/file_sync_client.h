@@ -22,10 +22,12 @@
 #include "file_sync_protocol.h"
 
 bool do_sync_ls(const char* path);
+// |jobs| is the number of sync connections that the contents of a directory are spread over.
 bool do_sync_push(const std::vector<const char*>& srcs, const char* dst, bool sync,
-                  CompressionType compression, bool dry_run, bool quiet);
+                  CompressionType compression, bool dry_run, bool quiet, size_t jobs = 1);
 bool do_sync_pull(const std::vector<const char*>& srcs, const char* dst, bool copy_attrs,
-                  CompressionType compression, const char* name = nullptr, bool quiet = false);
+                  CompressionType compression, const char* name = nullptr, bool quiet = false,
+                  size_t jobs = 1);
 
 bool do_sync_sync(const std::string& lpath, const std::string& rpath, bool list_only,
-                  CompressionType compression, bool dry_run, bool quiet);
+                  CompressionType compression, bool dry_run, bool quiet, size_t jobs = 1);
@@ -0,0 +1,397 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "client/file_sync_client.h"
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <utime.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+#include <gtest/gtest.h>
+
+#include "adb.h"
+#include "adb_client.h"
+#include "adb_io.h"
+#include "adb_unique_fd.h"
+#include "client/commandline.h"
+#include "file_hash.h"
+#include "file_sync_protocol.h"
+#include "socket_spec.h"
+#include "sysdeps.h"
+#include "sysdeps/errno.h"
+#include "transport.h"
+
+// Stand-ins so that the test doesn't need to be linked against main.cpp and commandline.cpp.
+const char** __adb_argv;
+const char** __adb_envp;
+
+int send_shell_command(const std::string& command, bool disable_shell_protocol,
+                       StandardStreamsCallbackInterface* callback) {
+    ADD_FAILURE() << "send_shell_command() shouldn't be called";
+    return -1;
+}
+
+// Stands in for both the adb server and adbd, serving sync connections from the local filesystem,
+// so that the client's side of the sync protocol can be run end to end.
+class FakeSyncServer {
+  public:
+    // adb_set_socket_spec can only be called once, so every test shares a server.
+    static FakeSyncServer& Instance() {
+        static FakeSyncServer* server = new FakeSyncServer();
+        return *server;
+    }
+
+    void Reset() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        hash_requests_.clear();
+        range_requests_ = 0;
+        corrupt_hashes_ = false;
+    }
+
+    // The paths of each hash request since the last call.
+    std::vector<std::vector<std::string>> TakeHashRequests() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return std::move(hash_requests_);
+    }
+
+    // The number of recv_range requests since the last call.
+    size_t TakeRangeRequests() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return std::exchange(range_requests_, 0);
+    }
+
+    // Report every file's hash wrongly, as if it had changed since the client read it.
+    void SetCorruptHashes(bool corrupt) { corrupt_hashes_ = corrupt; }
+
+  private:
+    FakeSyncServer() {
+        std::string error;
+        int port;
+        listener_.reset(socket_spec_listen("tcp:0", &error, &port));
+        CHECK(listener_ >= 0) << error;
+        spec_ = android::base::StringPrintf("tcp:%d", port);
+        adb_set_socket_spec(spec_.c_str());
+        std::thread([this]() { Accept(); }).detach();
+    }
+
+    void Accept() {
+        while (true) {
+            unique_fd fd(adb_socket_accept(listener_, nullptr, nullptr));
+            if (fd < 0) return;
+            std::thread([this, fd = std::move(fd)]() mutable { Serve(std::move(fd)); }).detach();
+        }
+    }
+
+    void Serve(unique_fd fd) {
+        std::string service;
+        std::string error;
+        if (!ReadProtocolString(fd, &service, &error)) return;
+
+        if (service == "host:version") {
+            WriteFdExactly(fd, "OKAY");
+            SendProtocolString(fd, android::base::StringPrintf("%04x", ADB_SERVER_VERSION));
+            return;
+        }
+        if (service == "host:features") {
+            WriteFdExactly(fd, "OKAY");
+            SendProtocolString(fd, android::base::Join(std::vector<std::string>{kFeatureStat2,
+                                                                                kFeatureSyncHash,
+                                                                                kFeatureRecvRange},
+                                                       ','));
+            return;
+        }
+        if (service.starts_with("host:tport:")) {
+            TransportId id = 1;
+            if (!WriteFdExactly(fd, "OKAY") || !WriteFdExactly(fd, &id, sizeof(id)) ||
+                !ReadProtocolString(fd, &service, &error)) {
+                return;
+            }
+        }
+        if (service != "sync:") {
+            ADD_FAILURE() << "unexpected service: " << service;
+            WriteFdExactly(fd, "FAIL");
+            SendProtocolString(fd, "unknown service");
+            return;
+        }
+        WriteFdExactly(fd, "OKAY");
+
+        while (true) {
+            SyncRequest request;
+            if (!ReadFdExactly(fd, &request, sizeof(request))) return;
+            std::string path(request.path_length, '\0');
+            if (!ReadFdExactly(fd, path.data(), path.size())) return;
+
+            bool ok = false;
+            switch (request.id) {
+                case ID_STAT_V2:
+                case ID_LSTAT_V2:
+                    ok = Stat(fd, request.id, path);
+                    break;
+                case ID_HASH_V1:
+                    ok = Hash(fd);
+                    break;
+                case ID_RECV_RANGE:
+                    ok = RecvRange(fd, path);
+                    break;
+                case ID_QUIT:
+                    return;
+                default:
+                    ADD_FAILURE() << "unexpected sync request: " << std::hex << request.id;
+                    return;
+            }
+            if (!ok) return;
+        }
+    }
+
+    bool Stat(borrowed_fd fd, uint32_t id, const std::string& path) {
+        sync_stat_v2 msg = {.id = id};
+        struct stat st;
+        if (stat(path.c_str(), &st) == -1) {
+            msg.error = errno_to_wire(errno);
+        } else {
+            msg.dev = st.st_dev;
+            msg.ino = st.st_ino;
+            msg.mode = st.st_mode;
+            msg.nlink = st.st_nlink;
+            msg.uid = st.st_uid;
+            msg.gid = st.st_gid;
+            msg.size = st.st_size;
+            msg.atime = st.st_atime;
+            msg.mtime = st.st_mtime;
+            msg.ctime = st.st_ctime;
+        }
+        return WriteFdExactly(fd, &msg, sizeof(msg));
+    }
+
+    bool RecvRange(borrowed_fd fd, const std::string& path) {
+        sync_recv_range setup;
+        if (!ReadFdExactly(fd, &setup, sizeof(setup))) return false;
+        EXPECT_EQ(static_cast<uint32_t>(ID_RECV_RANGE), setup.id);
+        EXPECT_EQ(0U, setup.flags);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++range_requests_;
+        }
+
+        unique_fd file(adb_open(path.c_str(), O_RDONLY));
+        if (file < 0) {
+            ADD_FAILURE() << "failed to open " << path << ": " << strerror(errno);
+            return false;
+        }
+        std::vector<char> buffer(SYNC_DATA_MAX);
+        for (uint64_t sent = 0; sent < setup.length;) {
+            size_t length = std::min<uint64_t>(buffer.size(), setup.length - sent);
+            ssize_t rc = adb_pread(file.get(), buffer.data(), length, setup.offset + sent);
+            if (rc < 0) return false;
+            if (rc == 0) break;
+            sync_data msg = {.id = ID_DATA, .size = static_cast<uint32_t>(rc)};
+            if (!WriteFdExactly(fd, &msg, sizeof(msg)) || !WriteFdExactly(fd, buffer.data(), rc)) {
+                return false;
+            }
+            sent += rc;
+        }
+        sync_data done = {.id = ID_DONE, .size = 0};
+        return WriteFdExactly(fd, &done, sizeof(done));
+    }
+
+    bool Hash(borrowed_fd fd) {
+        sync_hash_v1_request setup;
+        if (!ReadFdExactly(fd, &setup, sizeof(setup))) return false;
+        EXPECT_EQ(static_cast<uint32_t>(ID_HASH_V1), setup.id);
+
+        std::vector<std::string> paths;
+        for (uint32_t i = 0; i < setup.count; ++i) {
+            SyncRequest request;
+            if (!ReadFdExactly(fd, &request, sizeof(request))) return false;
+            EXPECT_EQ(static_cast<uint32_t>(ID_HASH_V1), request.id);
+            std::string path(request.path_length, '\0');
+            if (!ReadFdExactly(fd, path.data(), path.size())) return false;
+            paths.push_back(std::move(path));
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            hash_requests_.push_back(paths);
+        }
+
+        for (const std::string& path : paths) {
+            FileHashResult result = hash_file(path);
+            sync_hash_v1 msg = {.id = ID_HASH_V1,
+                                .error = static_cast<uint32_t>(
+                                        result.error ? errno_to_wire(result.error) : 0),
+                                .size = result.size};
+            memcpy(msg.sha256, result.hash.data(), sizeof(msg.sha256));
+            if (corrupt_hashes_) msg.sha256[0] ^= 1;
+            if (!WriteFdExactly(fd, &msg, sizeof(msg))) return false;
+        }
+        return true;
+    }
+
+    unique_fd listener_;
+    std::string spec_;
+
+    std::mutex mutex_;
+    std::vector<std::vector<std::string>> hash_requests_;
+    size_t range_requests_ = 0;
+    std::atomic<bool> corrupt_hashes_ = false;
+};
+
+class FileSyncClientTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        server_ = &FakeSyncServer::Instance();
+        server_->Reset();
+
+        // Keep `adb sync`'s hash index out of the real home directory.
+        const char* home = getenv("HOME");
+        if (home) saved_home_ = home;
+        setenv("HOME", home_.path, 1);
+    }
+
+    void TearDown() override {
+        if (saved_home_) {
+            setenv("HOME", saved_home_->c_str(), 1);
+        } else {
+            unsetenv("HOME");
+        }
+    }
+
+    static void SetMtime(const std::string& path, time_t mtime) {
+        struct utimbuf times = {.actime = mtime, .modtime = mtime};
+        ASSERT_EQ(0, utime(path.c_str(), &times));
+    }
+
+    FakeSyncServer* server_;
+    TemporaryDir home_;
+    std::optional<std::string> saved_home_;
+};
+
+TEST_F(FileSyncClientTest, sync_hashes_files_with_different_mtimes) {
+    TemporaryDir local;
+    TemporaryDir remote;
+    std::vector<std::string> remote_paths;
+    for (const char* name : {"a", "b", "c"}) {
+        std::string contents = android::base::StringPrintf("contents of %s", name);
+        std::string local_path = android::base::StringPrintf("%s/%s", local.path, name);
+        std::string remote_path = android::base::StringPrintf("%s/%s", remote.path, name);
+        ASSERT_TRUE(android::base::WriteStringToFile(contents, local_path));
+        ASSERT_TRUE(android::base::WriteStringToFile(contents, remote_path));
+        SetMtime(remote_path, 1234567890);
+        remote_paths.push_back(remote_path);
+    }
+
+    // All three files are the same size as the device's copies but have different mtimes, so
+    // they're hashed in one request. They all match, so nothing is pushed: the fake server fails
+    // the test if anything is sent.
+    ASSERT_TRUE(do_sync_sync(local.path, remote.path, false, CompressionType::None, false, true));
+
+    std::vector<std::vector<std::string>> requests = server_->TakeHashRequests();
+    ASSERT_EQ(1U, requests.size());
+    std::sort(requests[0].begin(), requests[0].end());
+    EXPECT_EQ(remote_paths, requests[0]);
+}
+
+TEST_F(FileSyncClientTest, sync_remembers_matching_files) {
+    TemporaryDir local;
+    TemporaryDir remote;
+    std::string local_path = android::base::StringPrintf("%s/a", local.path);
+    std::string remote_path = android::base::StringPrintf("%s/a", remote.path);
+    ASSERT_TRUE(android::base::WriteStringToFile("contents", local_path));
+    ASSERT_TRUE(android::base::WriteStringToFile("contents", remote_path));
+    // The local file has to have been modified before the second it's hashed in for its hash to
+    // be trusted later.
+    SetMtime(local_path, 1234567000);
+    SetMtime(remote_path, 1234567890);
+
+    ASSERT_TRUE(do_sync_sync(local.path, remote.path, false, CompressionType::None, false, true));
+    ASSERT_EQ(1U, server_->TakeHashRequests().size());
+
+    // Neither side has changed since they matched, so neither needs hashing again.
+    ASSERT_TRUE(do_sync_sync(local.path, remote.path, false, CompressionType::None, false, true));
+    EXPECT_EQ(0U, server_->TakeHashRequests().size());
+
+    // Once the device's copy has been touched, it's checked again.
+    SetMtime(remote_path, 1234567891);
+    ASSERT_TRUE(do_sync_sync(local.path, remote.path, false, CompressionType::None, false, true));
+    EXPECT_EQ(1U, server_->TakeHashRequests().size());
+}
+
+// Makes a file at |path| that's big enough to be pulled in ranges, with different contents in each
+// range.
+static void MakeLargeFile(const std::string& path) {
+    static constexpr off_t kSize = 64 * 1024 * 1024 + 12345;
+    unique_fd fd(adb_open_mode(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+    ASSERT_GE(fd.get(), 0);
+    ASSERT_EQ(0, ftruncate(fd.get(), kSize));
+    for (off_t offset = 0; offset < kSize; offset += 1024 * 1024) {
+        std::string marker = android::base::StringPrintf("offset %lld", (long long)offset);
+        ASSERT_EQ(static_cast<ssize_t>(marker.size()),
+                  adb_pwrite(fd.get(), marker.data(), marker.size(), offset));
+    }
+}
+
+TEST_F(FileSyncClientTest, pull_ranged_verifies_file) {
+    TemporaryDir local;
+    TemporaryDir remote;
+    std::string remote_path = android::base::StringPrintf("%s/large", remote.path);
+    std::string local_path = android::base::StringPrintf("%s/large", local.path);
+    MakeLargeFile(remote_path);
+
+    ASSERT_TRUE(do_sync_pull({remote_path.c_str()}, local_path.c_str(), false,
+                             CompressionType::None, nullptr, true, 4));
+
+    // The file is pulled as five 16MiB ranges, and then checked against the device's copy.
+    EXPECT_EQ(5U, server_->TakeRangeRequests());
+    EXPECT_EQ(std::vector<std::vector<std::string>>{{remote_path}}, server_->TakeHashRequests());
+
+    FileHashResult remote_hash = hash_file(remote_path);
+    FileHashResult local_hash = hash_file(local_path);
+    ASSERT_EQ(0, local_hash.error);
+    EXPECT_EQ(remote_hash.size, local_hash.size);
+    EXPECT_EQ(remote_hash.hash, local_hash.hash);
+}
+
+TEST_F(FileSyncClientTest, pull_ranged_fails_if_file_changed) {
+    TemporaryDir local;
+    TemporaryDir remote;
+    std::string remote_path = android::base::StringPrintf("%s/large", remote.path);
+    std::string local_path = android::base::StringPrintf("%s/large", local.path);
+    MakeLargeFile(remote_path);
+
+    // The device reports a different hash, as if the file changed while it was being pulled, so
+    // the pull fails and doesn't leave a corrupt copy behind.
+    server_->SetCorruptHashes(true);
+    ASSERT_FALSE(do_sync_pull({remote_path.c_str()}, local_path.c_str(), false,
+                              CompressionType::None, nullptr, true, 4));
+    EXPECT_EQ(5U, server_->TakeRangeRequests());
+    EXPECT_EQ(1U, server_->TakeHashRequests().size());
+
+    struct stat st;
+    EXPECT_EQ(-1, stat(local_path.c_str(), &st));
+    EXPECT_EQ(ENOENT, errno);
+}
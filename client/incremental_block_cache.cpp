@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TRACE_TAG INCREMENTAL
+
+#include "client/incremental_block_cache.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <utime.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <utility>
+#include <vector>
+
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+
+#include "adb_trace.h"
+#include "adb_unique_fd.h"
+#include "adb_utils.h"
+#include "client/incremental_utils.h"
+#include "sysdeps.h"
+
+namespace incremental {
+
+static constexpr char kMagic[8] = {'A', 'D', 'B', 'I', 'N', 'C', 'C', '2'};
+// Caches are named "<root hash in hex>-<file size>-<file mtime>-<file inode>.cache".
+static constexpr std::string_view kCacheSuffix = ".cache";
+
+// Entries for blocks that aren't cached yet are 0, and those for blocks that aren't worth
+// compressing are kEntryNotCompressed. Any other entry has the size of the block's compressed data
+// in its low 16 bits, and the CRC32 of that data in its high 32 bits.
+static constexpr uint64_t kEntryNotCached = 0;
+static constexpr uint64_t kEntryNotCompressed = 0xffff;
+
+static uint64_t MakeEntry(const char* data, int size) {
+    uint32_t crc = crc32(0, reinterpret_cast<const Bytef*>(data), size);
+    return uint64_t(crc) << 32 | uint64_t(size);
+}
+
+struct BlockCacheHeader {
+    char magic[sizeof(kMagic)];
+    int64_t file_size;
+    int64_t file_mtime_ns;
+    uint64_t file_ino;
+    int32_t root_hash_size;
+    char root_hash[64];
+};
+static_assert(sizeof(BlockCacheHeader) <= kBlockSize);
+
+static int64_t EntriesOffset() {
+    return kBlockSize;
+}
+
+static int64_t SlotsOffset(int32_t blockCount) {
+    return EntriesOffset() +
+           (int64_t(blockCount) * sizeof(uint64_t) + kBlockSize - 1) / kBlockSize * kBlockSize;
+}
+
+// Makes the newly created cache |fd| |size| bytes long, allocating only its first |allocated|
+// bytes. The rest stays a hole until blocks are stored in it.
+static bool Allocate(borrowed_fd fd, int64_t allocated, int64_t size) {
+#if defined(__linux__)
+    // The header and entries are written through the mapping, so allocate them up front, so that
+    // running out of space shows up here rather than as a SIGBUS.
+    if (posix_fallocate(fd.get(), 0, allocated) != 0) {
+        return false;
+    }
+#else
+    std::vector<char> zeroes(allocated);
+    if (adb_pwrite(fd, zeroes.data(), allocated, 0) != allocated) {
+        return false;
+    }
+#endif
+#if defined(_WIN32)
+    return adb_pwrite(fd, "", 1, size - 1) == 1;
+#else
+    return ftruncate(fd.get(), size) == 0;
+#endif
+}
+
+// Removes the least recently opened caches in |dir| but |keep| if there are more than
+// kMaxBlockCaches.
+static void RemoveOldCaches(const std::string& dir, const std::string& keep) {
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        return;
+    }
+    std::vector<std::pair<int64_t, std::string>> caches;
+    while (dirent* de = readdir(d)) {
+        if (!android::base::EndsWith(de->d_name, kCacheSuffix)) continue;
+        std::string path = dir + OS_PATH_SEPARATOR + de->d_name;
+        struct stat st;
+        if (path != keep && stat(path.c_str(), &st) == 0) {
+            caches.emplace_back(st.st_mtime, std::move(path));
+        }
+    }
+    closedir(d);
+
+    // |keep| is one of the kMaxBlockCaches.
+    if (caches.size() >= kMaxBlockCaches) {
+        std::sort(caches.begin(), caches.end());
+        for (size_t i = 0; i <= caches.size() - kMaxBlockCaches; ++i) {
+            D("Removing old block cache '%s'", caches[i].second.c_str());
+            adb_unlink(caches[i].second.c_str());
+        }
+    }
+}
+
+std::unique_ptr<BlockCache> BlockCache::Open(const std::string& dir, std::string_view rootHash,
+                                             const FileStamp& file) {
+    const int64_t fileSize = file.size;
+    if (rootHash.empty() || rootHash.size() > sizeof(BlockCacheHeader::root_hash) ||
+        fileSize <= 0) {
+        return nullptr;
+    }
+    if (!mkdirs(dir)) {
+        D("Failed to create block cache directory '%s': %s", dir.c_str(), strerror(errno));
+        return nullptr;
+    }
+
+    // The file's ctime is left out, since it also changes when the file is only renamed.
+    std::string path = android::base::StringPrintf(
+            "%s%c%s-%" PRId64 "-%" PRId64 "-%" PRIu64 "%s", dir.c_str(), OS_PATH_SEPARATOR,
+            hex_encode(rootHash.data(), rootHash.size()).c_str(), fileSize, file.mtime_ns,
+            file.ino, std::string(kCacheSuffix).c_str());
+    unique_fd fd(adb_open_mode(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644));
+    if (fd < 0) {
+        D("Failed to open block cache '%s': %s", path.c_str(), strerror(errno));
+        return nullptr;
+    }
+
+    const int32_t blockCount = (fileSize + kBlockSize - 1) / kBlockSize;
+    const int64_t size = SlotsOffset(blockCount) + int64_t(blockCount) * kBlockSize;
+    const int64_t existingSize = adb_lseek(fd, 0, SEEK_END);
+    if (existingSize == 0) {
+        if (!Allocate(fd, SlotsOffset(blockCount), size)) {
+            D("Failed to allocate block cache '%s': %s", path.c_str(), strerror(errno));
+            adb_unlink(path.c_str());
+            return nullptr;
+        }
+    } else if (existingSize != size) {
+        D("Ignoring block cache '%s' of the wrong size %" PRId64, path.c_str(), existingSize);
+        return nullptr;
+    }
+
+    auto mapping = android::base::MappedFile::Create(adb_get_os_handle(fd), 0, size,
+                                                     PROT_READ | PROT_WRITE);
+    if (!mapping) {
+        D("Failed to map block cache '%s': %s", path.c_str(), strerror(errno));
+        return nullptr;
+    }
+
+    auto header = reinterpret_cast<BlockCacheHeader*>(mapping->data());
+    if (memcmp(header->magic, kMagic, sizeof(kMagic)) != 0) {
+        // A new cache, unless another adb is writing its header at the same time. The header only
+        // depends on the file, so it doesn't matter which of them does.
+        header->file_size = fileSize;
+        header->file_mtime_ns = file.mtime_ns;
+        header->file_ino = file.ino;
+        header->root_hash_size = rootHash.size();
+        memcpy(header->root_hash, rootHash.data(), rootHash.size());
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(header->magic, kMagic, sizeof(kMagic));
+    } else if (header->file_size != fileSize || header->file_mtime_ns != file.mtime_ns ||
+               header->file_ino != file.ino || header->root_hash_size != int(rootHash.size()) ||
+               memcmp(header->root_hash, rootHash.data(), rootHash.size()) != 0) {
+        D("Ignoring block cache '%s' for another file", path.c_str());
+        return nullptr;
+    }
+
+    // Caches are removed least recently opened first, whether or not anything was stored in them.
+    utime(path.c_str(), nullptr);
+    RemoveOldCaches(dir, path);
+
+    return std::unique_ptr<BlockCache>(
+            new BlockCache(std::move(fd), std::move(*mapping), blockCount));
+}
+
+BlockCache::BlockCache(unique_fd fd, android::base::MappedFile mapping, int32_t blockCount)
+    : fd_(std::move(fd)),
+      mapping_(std::move(mapping)),
+      blockCount_(blockCount),
+      entries_(reinterpret_cast<uint64_t*>(mapping_->data() + EntriesOffset())) {}
+
+int64_t BlockCache::SlotOffset(int32_t blockIdx) const {
+    return SlotsOffset(blockCount_) + int64_t(blockIdx) * kBlockSize;
+}
+
+int BlockCache::Lookup(int32_t blockIdx, char* data) const {
+    if (blockIdx < 0 || blockIdx >= blockCount_) {
+        return kNotCached;
+    }
+    // Another adb may be storing this block right now: its data is written before its entry.
+    uint64_t entry = __atomic_load_n(&entries_[blockIdx], __ATOMIC_ACQUIRE);
+    if (entry == kEntryNotCompressed) {
+        return kNotCompressed;
+    }
+    const int size = entry & 0xffff;
+    if (entry == kEntryNotCached || size == 0 || size >= kBlockSize) {
+        return kNotCached;
+    }
+    memcpy(data, mapping_->data() + SlotOffset(blockIdx), size);
+    if (MakeEntry(data, size) != entry) {
+        D("Block %d in the block cache doesn't match its CRC", blockIdx);
+        // Let the block be stored again, unless someone else already has.
+        __atomic_compare_exchange_n(&entries_[blockIdx], &entry, kEntryNotCached, false,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        return kNotCached;
+    }
+    return size;
+}
+
+void BlockCache::Store(int32_t blockIdx, const char* data, int size) {
+    if (blockIdx < 0 || blockIdx >= blockCount_ || size <= 0 || size >= kBlockSize) {
+        return;
+    }
+    if (__atomic_load_n(&entries_[blockIdx], __ATOMIC_RELAXED) != kEntryNotCached) {
+        return;
+    }
+    // The slot may still be a hole, so it's written with pwrite, which fails if there's no space
+    // left to allocate it, rather than through the mapping, which would raise SIGBUS.
+    if (adb_pwrite(fd_, data, size, SlotOffset(blockIdx)) != size) {
+        D("Failed to store block %d in the block cache: %s", blockIdx, strerror(errno));
+        return;
+    }
+    __atomic_store_n(&entries_[blockIdx], MakeEntry(data, size), __ATOMIC_RELEASE);
+}
+
+void BlockCache::StoreNotCompressed(int32_t blockIdx) {
+    if (blockIdx < 0 || blockIdx >= blockCount_) {
+        return;
+    }
+    __atomic_store_n(&entries_[blockIdx], kEntryNotCompressed, __ATOMIC_RELAXED);
+}
+
+}  // namespace incremental
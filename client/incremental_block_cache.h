@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <android-base/mapped_file.h>
+
+#include "adb_unique_fd.h"
+#include "client/file_hash_index.h"
+
+namespace incremental {
+
+// At most this many block caches are kept in a cache directory.
+constexpr size_t kMaxBlockCaches = 8;
+
+// An on-disk cache of the LZ4-compressed data blocks of a file served for an incremental install,
+// so that serving the same file again, or to several devices at once, doesn't compress every
+// block again. Each cache is keyed by the root hash of the file's verity tree, and by the file's
+// size, mtime and inode, so that a file that's been rebuilt without its signature being updated
+// doesn't get blocks of the old one. Caches are mapped shared, so that concurrent adb processes
+// serving the same file use and fill in the same cache. Only the kMaxBlockCaches most recently
+// opened caches are kept.
+//
+// A cache file is a block-sized header, then a 64-bit entry for each block of the file, then a
+// block-sized slot for each block, which holds its compressed data if it compresses. Each entry
+// has a CRC32 of its slot, so that a slot that was torn or corrupted isn't served. The slots are
+// left sparse until blocks are stored in them, so a cache only takes up the space of the blocks
+// that were served.
+class BlockCache {
+  public:
+    // Returned by Lookup() for blocks that haven't been cached yet.
+    static constexpr int kNotCached = -1;
+    // Returned by Lookup() for blocks that aren't worth compressing.
+    static constexpr int kNotCompressed = 0;
+
+    BlockCache(const BlockCache& copy) = delete;
+    BlockCache& operator=(const BlockCache& copy) = delete;
+
+    // Opens the cache in |dir| for the file with stamp |file| whose verity tree has the root hash
+    // |rootHash|, creating it if it doesn't exist yet, and removing the least recently opened
+    // caches in |dir| if there are more than kMaxBlockCaches. Returns nullptr if it can't be used.
+    static std::unique_ptr<BlockCache> Open(const std::string& dir, std::string_view rootHash,
+                                            const FileStamp& file);
+
+    // Copies the compressed data of block |blockIdx| to |data|, which must have room for a whole
+    // block, and returns its size. Returns kNotCompressed or kNotCached if it has none, or if what
+    // it has doesn't match its CRC, in which case the block can be stored again.
+    int Lookup(int32_t blockIdx, char* data) const;
+
+    // Records the compressed data of block |blockIdx|.
+    void Store(int32_t blockIdx, const char* data, int size);
+    // Records that block |blockIdx| isn't worth compressing.
+    void StoreNotCompressed(int32_t blockIdx);
+
+  private:
+    BlockCache(unique_fd fd, android::base::MappedFile mapping, int32_t blockCount);
+
+    int64_t SlotOffset(int32_t blockIdx) const;
+
+    unique_fd fd_;
+    std::optional<android::base::MappedFile> mapping_;
+    const int32_t blockCount_;
+    uint64_t* entries_;
+};
+
+}  // namespace incremental
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "client/incremental_block_cache.h"
+
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <utime.h>
+
+#include <string>
+
+#include <android-base/file.h>
+
+#include "client/incremental_utils.h"
+#include "sysdeps.h"
+
+namespace incremental {
+
+static constexpr int64_t kFileSize = 3 * kBlockSize + 100;
+static constexpr FileStamp kFile = {.size = kFileSize, .mtime_ns = 1234, .ino = 56};
+
+// Caches are named after the hex of their root hash, and the file's size, mtime and inode.
+static std::string CachePath(const TemporaryDir& td, uint64_t ino = kFile.ino) {
+    return std::string(td.path) + "/726f6f742068617368-12388-1234-" + std::to_string(ino) +
+           ".cache";
+}
+
+TEST(BlockCache, store_and_lookup) {
+    TemporaryDir td;
+    auto cache = BlockCache::Open(td.path, "root hash", kFile);
+    ASSERT_NE(nullptr, cache);
+
+    char data[kBlockSize];
+    EXPECT_EQ(BlockCache::kNotCached, cache->Lookup(0, data));
+
+    cache->Store(0, "compressed", 10);
+    cache->StoreNotCompressed(3);
+    ASSERT_EQ(10, cache->Lookup(0, data));
+    EXPECT_EQ("compressed", std::string(data, 10));
+    EXPECT_EQ(BlockCache::kNotCompressed, cache->Lookup(3, data));
+    EXPECT_EQ(BlockCache::kNotCached, cache->Lookup(1, data));
+
+    // Blocks past the end of the file are never cached.
+    cache->Store(4, "compressed", 10);
+    EXPECT_EQ(BlockCache::kNotCached, cache->Lookup(4, data));
+}
+
+TEST(BlockCache, shared) {
+    TemporaryDir td;
+    auto first = BlockCache::Open(td.path, "root hash", kFile);
+    auto second = BlockCache::Open(td.path, "root hash", kFile);
+    ASSERT_NE(nullptr, first);
+    ASSERT_NE(nullptr, second);
+
+    char data[kBlockSize];
+    first->Store(2, "block 2", 7);
+    ASSERT_EQ(7, second->Lookup(2, data));
+    EXPECT_EQ("block 2", std::string(data, 7));
+
+    // The cache outlives the servers that filled it in.
+    first.reset();
+    second.reset();
+    auto third = BlockCache::Open(td.path, "root hash", kFile);
+    ASSERT_NE(nullptr, third);
+    ASSERT_EQ(7, third->Lookup(2, data));
+    EXPECT_EQ("block 2", std::string(data, 7));
+}
+
+TEST(BlockCache, keyed_by_file) {
+    TemporaryDir td;
+    auto cache = BlockCache::Open(td.path, "root hash", kFile);
+    ASSERT_NE(nullptr, cache);
+    cache->Store(0, "compressed", 10);
+
+    char data[kBlockSize];
+    auto other_hash = BlockCache::Open(td.path, "other root hash", kFile);
+    ASSERT_NE(nullptr, other_hash);
+    EXPECT_EQ(BlockCache::kNotCached, other_hash->Lookup(0, data));
+
+    FileStamp file = kFile;
+    file.size += 1;
+    auto other_size = BlockCache::Open(td.path, "root hash", file);
+    ASSERT_NE(nullptr, other_size);
+    EXPECT_EQ(BlockCache::kNotCached, other_size->Lookup(0, data));
+
+    // A file that's been rebuilt without its signature being updated doesn't get the old blocks.
+    file = kFile;
+    file.mtime_ns += 1;
+    auto other_mtime = BlockCache::Open(td.path, "root hash", file);
+    ASSERT_NE(nullptr, other_mtime);
+    EXPECT_EQ(BlockCache::kNotCached, other_mtime->Lookup(0, data));
+
+    file = kFile;
+    file.ino += 1;
+    auto other_ino = BlockCache::Open(td.path, "root hash", file);
+    ASSERT_NE(nullptr, other_ino);
+    EXPECT_EQ(BlockCache::kNotCached, other_ino->Lookup(0, data));
+}
+
+TEST(BlockCache, corrupt) {
+    TemporaryDir td;
+    auto cache = BlockCache::Open(td.path, "root hash", kFile);
+    ASSERT_NE(nullptr, cache);
+    cache.reset();
+
+    // A cache file that's been truncated is left alone.
+    std::string path = CachePath(td);
+    ASSERT_TRUE(android::base::WriteStringToFile("truncated", path));
+    EXPECT_EQ(nullptr, BlockCache::Open(td.path, "root hash", kFile));
+}
+
+TEST(BlockCache, corrupt_slot) {
+    TemporaryDir td;
+    auto cache = BlockCache::Open(td.path, "root hash", kFile);
+    ASSERT_NE(nullptr, cache);
+    cache->Store(1, "compressed", 10);
+    cache.reset();
+
+    // Damage the data in block 1's slot, which is the second slot after the header and entries.
+    std::string path = CachePath(td);
+    std::string content;
+    ASSERT_TRUE(android::base::ReadFileToString(path, &content));
+    const size_t slot = content.size() - 3 * kBlockSize;
+    ASSERT_EQ("compressed", content.substr(slot, 10));
+    content[slot] = 'C';
+    ASSERT_TRUE(android::base::WriteStringToFile(content, path));
+
+    // It isn't served, and can be stored again.
+    cache = BlockCache::Open(td.path, "root hash", kFile);
+    ASSERT_NE(nullptr, cache);
+    char data[kBlockSize];
+    EXPECT_EQ(BlockCache::kNotCached, cache->Lookup(1, data));
+    cache->Store(1, "compressed", 10);
+    ASSERT_EQ(10, cache->Lookup(1, data));
+    EXPECT_EQ("compressed", std::string(data, 10));
+}
+
+TEST(BlockCache, oldest_removed) {
+    TemporaryDir td;
+    FileStamp file = kFile;
+    for (size_t i = 0; i < kMaxBlockCaches; ++i) {
+        file.ino = i;
+        ASSERT_NE(nullptr, BlockCache::Open(td.path, "root hash", file));
+        struct utimbuf times = {time_t(1000 + i), time_t(1000 + i)};
+        ASSERT_EQ(0, utime(CachePath(td, i).c_str(), &times));
+    }
+
+    // Opening a cache makes it the most recently used one.
+    file.ino = 0;
+    ASSERT_NE(nullptr, BlockCache::Open(td.path, "root hash", file));
+    file.ino = kMaxBlockCaches;
+    ASSERT_NE(nullptr, BlockCache::Open(td.path, "root hash", file));
+
+    struct stat st;
+    EXPECT_EQ(0, stat(CachePath(td, 0).c_str(), &st));
+    EXPECT_EQ(-1, stat(CachePath(td, 1).c_str(), &st));
+    EXPECT_EQ(0, stat(CachePath(td, 2).c_str(), &st));
+    EXPECT_EQ(0, stat(CachePath(td, kMaxBlockCaches).c_str(), &st));
+}
+
+}  // namespace incremental
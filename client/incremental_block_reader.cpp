@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TRACE_TAG INCREMENTAL
+
+#include "client/incremental_block_reader.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
+
+#include <algorithm>
+
+#include "adb_trace.h"
+#include "client/incremental_utils.h"
+#include "sysdeps.h"
+
+namespace incremental {
+
+static std::optional<android::base::MappedFile> Map(borrowed_fd fd, int64_t offset, int64_t size,
+                                                    bool map) {
+#ifndef __LP64__
+    // Leave the address space of a 32-bit adb alone.
+    if (size >= INT_MAX) {
+        return std::nullopt;
+    }
+#endif
+    if (!map || size <= 0) {
+        return std::nullopt;
+    }
+    auto mapping =
+            android::base::MappedFile::Create(adb_get_os_handle(fd), offset, size, PROT_READ);
+    if (!mapping) {
+        D("Failed to map %" PRId64 " bytes at %" PRId64 ", falling back to pread: %s", size,
+          offset, strerror(errno));
+    }
+    return mapping;
+}
+
+BlockReader::BlockReader(borrowed_fd fd, int64_t offset, int64_t size, bool map)
+    : fd_(fd), offset_(offset), size_(size), mapping_(Map(fd, offset, size, map)) {}
+
+const char* BlockReader::Block(int32_t blockIdx, char* buf, int64_t* size) const {
+    const int64_t offset = int64_t(blockIdx) * kBlockSize;
+    const int64_t blockSize = std::clamp<int64_t>(size_ - offset, 0, kBlockSize);
+    if (mapping_ && !__atomic_load_n(&truncated_, __ATOMIC_RELAXED)) {
+        *size = blockSize;
+        return *size > 0 ? mapping_->data() + offset : buf;
+    }
+    *size = blockSize > 0 ? adb_pread(fd_, buf, blockSize, offset_ + offset) : 0;
+    return buf;
+}
+
+void BlockReader::CheckSize() const {
+#if !defined(_WIN32)
+    if (!mapping_ || __atomic_load_n(&truncated_, __ATOMIC_RELAXED)) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd_.get(), &st) == 0 && st.st_size < offset_ + size_) {
+        D("File is %" PRId64 " bytes, shorter than its mapping, falling back to pread",
+          int64_t(st.st_size));
+        __atomic_store_n(&truncated_, true, __ATOMIC_RELAXED);
+    }
+#endif
+}
+
+void BlockReader::WillNeed(int32_t first, int32_t count) const {
+    const int64_t offset = int64_t(first) * kBlockSize;
+    const int64_t length = std::min<int64_t>(int64_t(count) * kBlockSize, size_ - offset);
+    if (offset < 0 || length <= 0) {
+        return;
+    }
+#if !defined(_WIN32)
+    if (mapping_) {
+        // madvise wants a page-aligned address, and the mapping itself starts on a page boundary
+        // at or before the start of the region.
+        static const uintptr_t kPageMask = sysconf(_SC_PAGESIZE) - 1;
+        const uintptr_t start = reinterpret_cast<uintptr_t>(mapping_->data() + offset);
+        const uintptr_t aligned = start & ~kPageMask;
+        madvise(reinterpret_cast<void*>(aligned), length + (start - aligned), MADV_WILLNEED);
+        return;
+    }
+#endif
+#if defined(__linux__)
+    posix_fadvise(fd_.get(), offset_ + offset, length, POSIX_FADV_WILLNEED);
+#endif
+}
+
+}  // namespace incremental
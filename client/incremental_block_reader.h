@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <optional>
+
+#include <android-base/mapped_file.h>
+
+#include "adb_unique_fd.h"
+
+namespace incremental {
+
+// Reads a file, or a region of one, a block at a time for the incremental server. The file is
+// mapped where that's possible, so that blocks can be compressed or copied straight from the page
+// cache without a syscall for each one. Where it isn't, blocks are read with pread, as they are
+// once CheckSize() finds that the file has been truncated since it was mapped.
+class BlockReader {
+  public:
+    // Reads the |size| bytes of |fd| from |offset| on, which must stay open while the reader is in
+    // use. Only maps it if |map| is true.
+    BlockReader(borrowed_fd fd, int64_t offset, int64_t size, bool map = true);
+
+    // Returns block |blockIdx|: straight from the mapping if there is one, and otherwise read into
+    // |buf|, which must have room for a whole block. Sets |size| to the size of the block, or to
+    // -1, with errno set, if it couldn't be read.
+    const char* Block(int32_t blockIdx, char* buf, int64_t* size) const;
+
+    // Stops reading from the mapping if the file has become shorter than it, as it can if the APK
+    // is rebuilt while it's being served: reading a page of a mapping past the end of its file
+    // raises SIGBUS. This costs a syscall, so it's called once for each batch of blocks rather than
+    // for each block, and on the thread that schedules them. Windows won't truncate a mapped file.
+    void CheckSize() const;
+
+    // Tells the kernel that blocks [first, first + count) are about to be read.
+    void WillNeed(int32_t first, int32_t count) const;
+
+    bool mapped() const { return mapping_.has_value(); }
+
+  private:
+    borrowed_fd fd_;
+    int64_t offset_;
+    int64_t size_;
+    std::optional<android::base::MappedFile> mapping_;
+    // Set by CheckSize(), and read by Block() on any thread.
+    mutable bool truncated_ = false;
+};
+
+}  // namespace incremental
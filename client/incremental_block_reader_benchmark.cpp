@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// How fast the incremental server can read and compress the blocks of a large APK, with the file
+// mapped and with a pread for each block. The file is in the page cache, so this measures the cost
+// of getting at the data rather than the disk.
+
+#include <lz4.h>
+#include <string.h>
+
+#include <random>
+#include <string>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+
+#include "client/incremental_block_reader.h"
+#include "client/incremental_utils.h"
+
+using incremental::BlockReader;
+using incremental::kBlockSize;
+
+static constexpr int64_t kBenchmarkApkSize = 256 * 1024 * 1024;
+
+// Something like an APK: compressed entries, which look random, between stored ones that
+// compress well.
+static const TemporaryFile& BenchmarkApk() {
+    static TemporaryFile file;
+    static const bool written = []() {
+        std::mt19937 rng(42);
+        std::string data(kBenchmarkApkSize, '\0');
+        for (size_t i = 0; i < data.size(); ++i) {
+            data[i] = (i / (64 * 1024)) % 3 == 0 ? static_cast<char>(i / 7)
+                                                 : static_cast<char>(rng());
+        }
+        return android::base::WriteStringToFd(data, file.fd);
+    }();
+    CHECK(written);
+    return file;
+}
+
+static void BM_IncrementalReadBlocks(benchmark::State& state, bool map) {
+    const TemporaryFile& apk = BenchmarkApk();
+    const int64_t size = kBenchmarkApkSize;
+    const bool compress = state.range(0);
+    char buf[LZ4_COMPRESSBOUND(kBlockSize)];
+    char compressed[LZ4_COMPRESSBOUND(kBlockSize)];
+
+    for (auto _ : state) {
+        BlockReader reader(apk.fd, 0, size, map);
+        if (map && !reader.mapped()) {
+            state.SkipWithError("mapping failed");
+            return;
+        }
+        for (int32_t blockIdx = 0; blockIdx < size / kBlockSize; ++blockIdx) {
+            int64_t blockSize;
+            const char* data = reader.Block(blockIdx, buf, &blockSize);
+            if (blockSize != kBlockSize) {
+                state.SkipWithError("read failed");
+                return;
+            }
+            if (compress) {
+                benchmark::DoNotOptimize(LZ4_compress_default(data, compressed, blockSize,
+                                                              sizeof(compressed)));
+            } else {
+                // The server copies blocks that don't compress into its own buffer.
+                memcpy(compressed, data, blockSize);
+                benchmark::DoNotOptimize(compressed);
+            }
+        }
+    }
+
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * size);
+}
+
+BENCHMARK_CAPTURE(BM_IncrementalReadBlocks, pread, false)->ArgName("compress")->Arg(0)->Arg(1);
+BENCHMARK_CAPTURE(BM_IncrementalReadBlocks, mmap, true)->ArgName("compress")->Arg(0)->Arg(1);
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "client/incremental_block_reader.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <android-base/file.h>
+
+#include "client/incremental_utils.h"
+#include "sysdeps.h"
+
+namespace incremental {
+
+static constexpr int64_t kFileSize = 3 * kBlockSize + 100;
+
+static std::string Contents() {
+    std::string data(kFileSize, '\0');
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<char>(i / 7);
+    }
+    return data;
+}
+
+static std::string ReadBlock(const BlockReader& reader, int32_t blockIdx) {
+    char buf[kBlockSize];
+    int64_t size;
+    const char* data = reader.Block(blockIdx, buf, &size);
+    return size < 0 ? "error" : std::string(data, size);
+}
+
+static void ReadBlocks(bool map) {
+    TemporaryFile tf;
+    const std::string data = Contents();
+    ASSERT_TRUE(android::base::WriteStringToFd(data, tf.fd));
+
+    BlockReader reader(tf.fd, 0, kFileSize, map);
+    EXPECT_EQ(map, reader.mapped());
+    for (int32_t blockIdx = 0; blockIdx < 3; ++blockIdx) {
+        EXPECT_EQ(data.substr(blockIdx * kBlockSize, kBlockSize), ReadBlock(reader, blockIdx));
+    }
+    EXPECT_EQ(data.substr(3 * kBlockSize), ReadBlock(reader, 3));
+    EXPECT_EQ("", ReadBlock(reader, 4));
+
+    BlockReader region(tf.fd, kBlockSize, kBlockSize + 10, map);
+    EXPECT_EQ(data.substr(kBlockSize, kBlockSize), ReadBlock(region, 0));
+    EXPECT_EQ(data.substr(2 * kBlockSize, 10), ReadBlock(region, 1));
+}
+
+TEST(BlockReader, read_mapped) {
+    ReadBlocks(true);
+}
+
+TEST(BlockReader, read_without_mapping) {
+    ReadBlocks(false);
+}
+
+#if !defined(_WIN32)
+// Windows won't truncate a file while it's mapped.
+TEST(BlockReader, truncated) {
+    TemporaryFile tf;
+    const std::string data = Contents();
+    ASSERT_TRUE(android::base::WriteStringToFd(data, tf.fd));
+    BlockReader reader(tf.fd, 0, kFileSize);
+
+    // The file is emptied while it's mapped, as it can be if the APK is rebuilt while it's being
+    // served, and the server checks it before reading the next batch of blocks.
+    ASSERT_EQ(0, ftruncate(tf.fd, 0));
+    reader.CheckSize();
+    for (int32_t blockIdx = 0; blockIdx < 4; ++blockIdx) {
+        EXPECT_EQ("", ReadBlock(reader, blockIdx));
+    }
+
+    // Once it's written again, blocks are read from it as it is now.
+    ASSERT_EQ(kBlockSize, adb_pwrite(tf.fd, data.data(), kBlockSize, 0));
+    EXPECT_EQ(data.substr(0, kBlockSize), ReadBlock(reader, 0));
+}
+#endif
+
+}  // namespace incremental
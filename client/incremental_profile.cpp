@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TRACE_TAG INCREMENTAL
+
+#include "client/incremental_profile.h"
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+
+#include "adb_trace.h"
+#include "adb_utils.h"
+#include "sysdeps.h"
+
+namespace incremental {
+
+// The line after the header is the size of the file, and each line after that is the index of a
+// block.
+static constexpr char kProfileHeader[] = "adb incremental profile v2";
+// Profiles are named "<file name>.<root hash in hex>.profile".
+static constexpr std::string_view kProfileSuffix = ".profile";
+
+static std::string ProfilePath(const std::string& dir, std::string_view rootHash,
+                               std::string_view name) {
+    return dir + OS_PATH_SEPARATOR + std::string(name) + "." +
+           hex_encode(rootHash.data(), rootHash.size()) + std::string(kProfileSuffix);
+}
+
+// Calls |callback| with the path, file name and mtime of each profile in |dir|.
+static void ForEachProfile(
+        const std::string& dir,
+        const std::function<void(const std::string& path, std::string_view name, int64_t mtime)>&
+                callback) {
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        return;
+    }
+    while (dirent* de = readdir(d)) {
+        std::string_view entry = de->d_name;
+        if (!android::base::ConsumeSuffix(&entry, kProfileSuffix)) continue;
+        size_t dot = entry.rfind('.');
+        if (dot == std::string_view::npos) continue;
+
+        std::string path = dir + OS_PATH_SEPARATOR + de->d_name;
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0) {
+            callback(path, entry.substr(0, dot), st.st_mtime);
+        }
+    }
+    closedir(d);
+}
+
+static bool ReadProfile(const std::string& path, int64_t* fileSize, std::vector<int32_t>* blocks) {
+    std::string content;
+    if (!android::base::ReadFileToString(path, &content)) {
+        return false;
+    }
+    std::vector<std::string> lines = android::base::Split(content, "\n");
+    if (lines.empty() || lines[0] != kProfileHeader) {
+        LOG(WARNING) << "ignoring incremental profile with unknown format: " << path;
+        return false;
+    }
+    if (lines.size() < 2 || !android::base::ParseInt(lines[1], fileSize, int64_t(0))) {
+        LOG(WARNING) << "ignoring corrupt incremental profile: " << path;
+        return false;
+    }
+    blocks->clear();
+    for (size_t i = 2; i < lines.size() && blocks->size() < kMaxBlockProfileBlocks; ++i) {
+        if (lines[i].empty()) continue;
+        int32_t block;
+        if (!android::base::ParseInt(lines[i], &block, 0)) {
+            LOG(WARNING) << "ignoring corrupt incremental profile: " << path;
+            blocks->clear();
+            return false;
+        }
+        blocks->push_back(block);
+    }
+    return true;
+}
+
+std::string DefaultBlockProfileDir() {
+    return adb_get_android_dir_path() + OS_PATH_SEPARATOR + "incremental_profiles";
+}
+
+BlockProfile LoadBlockProfile(const std::string& dir, std::string_view rootHash,
+                              std::string_view name, int64_t fileSize) {
+    BlockProfile profile;
+    int64_t profileFileSize;
+    if (ReadProfile(ProfilePath(dir, rootHash, name), &profileFileSize, &profile.blocks)) {
+        profile.source = BlockProfile::Source::SameFile;
+        return profile;
+    }
+
+    std::vector<std::pair<int64_t, std::string>> candidates;
+    ForEachProfile(dir, [&](const std::string& path, std::string_view profileName, int64_t mtime) {
+        if (profileName == name) {
+            candidates.emplace_back(mtime, path);
+        }
+    });
+    std::sort(candidates.rbegin(), candidates.rend());
+    for (const auto& [mtime, path] : candidates) {
+        if (ReadProfile(path, &profileFileSize, &profile.blocks) &&
+            std::abs(profileFileSize - fileSize) <= fileSize / 8) {
+            D("Using incremental profile '%s' for '%.*s'", path.c_str(), int(name.size()),
+              name.data());
+            profile.source = BlockProfile::Source::SameName;
+            return profile;
+        }
+    }
+    profile.blocks.clear();
+    return profile;
+}
+
+bool SaveBlockProfile(const std::string& dir, std::string_view rootHash, std::string_view name,
+                      int64_t fileSize, const std::vector<int32_t>& blocks) {
+    if (!mkdirs(dir)) {
+        PLOG(WARNING) << "failed to create incremental profile directory: " << dir;
+        return false;
+    }
+
+    std::string content = kProfileHeader;
+    content.push_back('\n');
+    content += std::to_string(fileSize);
+    content.push_back('\n');
+    for (size_t i = 0; i < blocks.size() && i < kMaxBlockProfileBlocks; ++i) {
+        content += std::to_string(blocks[i]);
+        content.push_back('\n');
+    }
+
+    // A concurrent install never sees a partially written profile.
+    std::string path = ProfilePath(dir, rootHash, name);
+    if (!write_file_atomically(path, content)) {
+        PLOG(WARNING) << "failed to write incremental profile: " << path;
+        return false;
+    }
+
+    std::vector<std::pair<int64_t, std::string>> profiles;
+    ForEachProfile(dir, [&](const std::string& profilePath, std::string_view, int64_t mtime) {
+        profiles.emplace_back(mtime, profilePath);
+    });
+    if (profiles.size() > kMaxBlockProfiles) {
+        std::sort(profiles.begin(), profiles.end());
+        for (size_t i = 0; i < profiles.size() - kMaxBlockProfiles; ++i) {
+            adb_unlink(profiles[i].second.c_str());
+        }
+    }
+    return true;
+}
+
+}  // namespace incremental
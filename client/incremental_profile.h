@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace incremental {
+
+// The order in which the device asked for the blocks of a file it was missing during an
+// incremental install, kept so that later installs of the same file, or of a newer build of it,
+// can send those blocks first.
+struct BlockProfile {
+    enum class Source {
+        None,
+        // Recorded for this file.
+        SameFile,
+        // Recorded for another file with the same name and a similar size.
+        SameName,
+    };
+    Source source = Source::None;
+    std::vector<int32_t> blocks;
+};
+
+// At most this many profiles are kept, and at most this many blocks in each.
+constexpr size_t kMaxBlockProfiles = 100;
+constexpr size_t kMaxBlockProfileBlocks = 16 * 1024;
+
+// Where profiles are kept, in the adb user directory.
+std::string DefaultBlockProfileDir();
+
+// Loads the profile in |dir| of the file whose verity tree has the root hash |rootHash|, or if
+// there isn't one, the most recent profile of a file called |name| whose size was within an eighth
+// of |fileSize|. Another file of the same name could be a different app altogether, but a new
+// build of the same app is usually much the same size.
+BlockProfile LoadBlockProfile(const std::string& dir, std::string_view rootHash,
+                              std::string_view name, int64_t fileSize);
+
+// Saves |blocks| as the profile of the file of |fileSize| bytes with root hash |rootHash| called
+// |name|, removing the oldest profiles in |dir| if there are more than kMaxBlockProfiles.
+bool SaveBlockProfile(const std::string& dir, std::string_view rootHash, std::string_view name,
+                      int64_t fileSize, const std::vector<int32_t>& blocks);
+
+}  // namespace incremental
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "client/incremental_profile.h"
+
+#include <gtest/gtest.h>
+#include <utime.h>
+
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+
+#include "sysdeps.h"
+
+namespace incremental {
+
+static constexpr int64_t kSize = 8 * 1024 * 1024;
+
+// Sets the mtime of the profile of |name| whose root hash, in hex, is |hex|.
+static void SetMtime(const TemporaryDir& td, const std::string& name, const std::string& hex,
+                     time_t mtime) {
+    std::string path = std::string(td.path) + "/" + name + "." + hex + ".profile";
+    struct utimbuf times = {mtime, mtime};
+    ASSERT_EQ(0, utime(path.c_str(), &times));
+}
+
+TEST(BlockProfile, save_and_load) {
+    TemporaryDir td;
+    BlockProfile profile = LoadBlockProfile(td.path, "hash", "app.apk", kSize);
+    EXPECT_EQ(BlockProfile::Source::None, profile.source);
+    EXPECT_TRUE(profile.blocks.empty());
+
+    ASSERT_TRUE(SaveBlockProfile(td.path, "hash", "app.apk", kSize, {7, 3, 100}));
+    profile = LoadBlockProfile(td.path, "hash", "app.apk", kSize);
+    EXPECT_EQ(BlockProfile::Source::SameFile, profile.source);
+    EXPECT_EQ(std::vector<int32_t>({7, 3, 100}), profile.blocks);
+
+    EXPECT_EQ(BlockProfile::Source::None,
+              LoadBlockProfile(td.path, "other hash", "other.apk", kSize).source);
+}
+
+TEST(BlockProfile, same_name) {
+    TemporaryDir td;
+    ASSERT_TRUE(SaveBlockProfile(td.path, "old", "app.apk", kSize, {1}));
+    ASSERT_TRUE(SaveBlockProfile(td.path, "new", "app.apk", kSize, {2}));
+    ASSERT_TRUE(SaveBlockProfile(td.path, "newest", "other.apk", kSize, {3}));
+    SetMtime(td, "app.apk", "6f6c64", 1000);
+    SetMtime(td, "app.apk", "6e6577", 2000);
+    SetMtime(td, "other.apk", "6e6577657374", 3000);
+
+    // A new build of app.apk gets the most recent profile of app.apk.
+    BlockProfile profile = LoadBlockProfile(td.path, "newer", "app.apk", kSize);
+    EXPECT_EQ(BlockProfile::Source::SameName, profile.source);
+    EXPECT_EQ(std::vector<int32_t>({2}), profile.blocks);
+}
+
+TEST(BlockProfile, same_name_different_size) {
+    TemporaryDir td;
+    ASSERT_TRUE(SaveBlockProfile(td.path, "old", "app.apk", kSize, {1}));
+    ASSERT_TRUE(SaveBlockProfile(td.path, "new", "app.apk", kSize * 2, {2}));
+    SetMtime(td, "app.apk", "6f6c64", 1000);
+    SetMtime(td, "app.apk", "6e6577", 2000);
+
+    // The most recent profile of app.apk was of a file twice the size, so the older one is used.
+    BlockProfile profile = LoadBlockProfile(td.path, "newer", "app.apk", kSize + kSize / 8);
+    EXPECT_EQ(BlockProfile::Source::SameName, profile.source);
+    EXPECT_EQ(std::vector<int32_t>({1}), profile.blocks);
+
+    // No profile of app.apk is of a file anything like this size.
+    profile = LoadBlockProfile(td.path, "newer", "app.apk", kSize / 2);
+    EXPECT_EQ(BlockProfile::Source::None, profile.source);
+    EXPECT_TRUE(profile.blocks.empty());
+}
+
+TEST(BlockProfile, oldest_removed) {
+    TemporaryDir td;
+    for (size_t i = 0; i < kMaxBlockProfiles; ++i) {
+        std::string name = std::to_string(i) + ".apk";
+        ASSERT_TRUE(SaveBlockProfile(td.path, "hash", name, kSize, {int32_t(i)}));
+        SetMtime(td, name, "68617368", 1000 + i);
+    }
+    ASSERT_TRUE(SaveBlockProfile(td.path, "hash", "new.apk", kSize, {1}));
+
+    EXPECT_EQ(BlockProfile::Source::None, LoadBlockProfile(td.path, "hash", "0.apk", kSize).source);
+    EXPECT_EQ(BlockProfile::Source::SameFile,
+              LoadBlockProfile(td.path, "hash", "1.apk", kSize).source);
+    EXPECT_EQ(BlockProfile::Source::SameFile,
+              LoadBlockProfile(td.path, "hash", "new.apk", kSize).source);
+}
+
+TEST(BlockProfile, corrupt) {
+    TemporaryDir td;
+    std::string path = std::string(td.path) + "/app.apk.68617368.profile";
+    ASSERT_TRUE(android::base::WriteStringToFile("something else\n1\n", path));
+    EXPECT_EQ(BlockProfile::Source::None,
+              LoadBlockProfile(td.path, "hash", "app.apk", kSize).source);
+
+    ASSERT_TRUE(android::base::WriteStringToFile("adb incremental profile v1\n1\n", path));
+    EXPECT_EQ(BlockProfile::Source::None,
+              LoadBlockProfile(td.path, "hash", "app.apk", kSize).source);
+
+    ASSERT_TRUE(android::base::WriteStringToFile("adb incremental profile v2\n8\n1\nx\n", path));
+    EXPECT_EQ(BlockProfile::Source::None,
+              LoadBlockProfile(td.path, "hash", "app.apk", kSize).source);
+}
+
+}  // namespace incremental
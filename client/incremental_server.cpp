@@ -25,14 +25,20 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
+#include <condition_variable>
 #include <deque>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <thread>
 #include <type_traits>
 #include <unordered_set>
 
 #include <android-base/endian.h>
+#include <android-base/file.h>
 #include <android-base/strings.h>
 
 #include "adb.h"
@@ -41,6 +47,9 @@
 #include "adb_trace.h"
 #include "adb_unique_fd.h"
 #include "adb_utils.h"
+#include "incremental_block_cache.h"
+#include "incremental_block_reader.h"
+#include "incremental_profile.h"
 #include "incremental_utils.h"
 #include "sysdeps.h"
 
@@ -56,6 +65,15 @@ static constexpr int kCompressBound = std::max(kBlockSize, LZ4_COMPRESSBOUND(kBl
 static constexpr auto kReadBufferSize = 128 * 1024;
 static constexpr int kPollTimeoutMillis = 300000;  // 5 minutes
 
+// Prefetched blocks are read and compressed on up to this many threads besides the serving thread,
+// at most this many blocks ahead of what has been sent.
+static constexpr unsigned kPrefetchThreadsMax = 4;
+static constexpr size_t kPrefetchBlocksAhead = 256;
+// How long the serving thread spends on prefetched blocks before checking for requests again, and
+// how often it checks whether one has arrived while it's waiting for the workers.
+static constexpr auto kPrefetchWait = std::chrono::microseconds(100);
+static constexpr auto kRequestCheckInterval = std::chrono::microseconds(10);
+
 using BlockSize = int16_t;
 using FileId = int16_t;
 using BlockIdx = int32_t;
@@ -152,34 +170,84 @@ class File {
   public:
     // Plain file
     File(const char* filepath, FileId id, int64_t size, unique_fd fd, int64_t tree_offset,
-         unique_fd tree_fd)
+         unique_fd tree_fd, std::string root_hash, std::unique_ptr<BlockCache> block_cache,
+         BlockProfile profile)
         : File(filepath, id, size, tree_offset) {
         this->fd_ = std::move(fd);
         this->tree_fd_ = std::move(tree_fd);
-        priority_blocks_ = PriorityBlocksForFile(filepath, fd_.get(), size);
+        this->root_hash_ = std::move(root_hash);
+        this->block_cache_ = std::move(block_cache);
+        this->profile_ = std::move(profile);
+        data_reader_.emplace(fd_, 0, size);
+        if (tree_fd_.ok()) {
+            tree_reader_.emplace(tree_fd_, tree_offset_, blockIndexToOffset(sentTreeBlocks.size()));
+        }
+
+        // The blocks the device asked for when the profile was recorded go first.
+        std::unordered_set<BlockIdx> prioritized;
+        in_profile_.resize(sentBlocks.size());
+        for (BlockIdx blockIdx : profile_.blocks) {
+            if (blockIdx >= 0 && blockIdx < (BlockIdx)sentBlocks.size() &&
+                prioritized.insert(blockIdx).second) {
+                priority_blocks_.push_back(blockIdx);
+                in_profile_[blockIdx] = true;
+            }
+        }
+        for (BlockIdx blockIdx : PriorityBlocksForFile(filepath, fd_.get(), size)) {
+            if (prioritized.insert(blockIdx).second) {
+                priority_blocks_.push_back(blockIdx);
+            }
+        }
     }
-    int64_t ReadDataBlock(BlockIdx block_idx, void* buf, bool* is_zip_compressed) const {
-        int64_t bytes_read = -1;
-        const off64_t offsetStart = blockIndexToOffset(block_idx);
-        bytes_read = adb_pread(fd_, buf, kBlockSize, offsetStart);
-        return bytes_read;
+    // Returns data block |block_idx|, straight from the file's mapping if it's mapped, or read
+    // into |buf| if not. Sets |size| to its size, or to -1 if it can't be read.
+    const char* DataBlock(BlockIdx block_idx, char* buf, int64_t* size,
+                          bool* is_zip_compressed) const {
+        return data_reader_->Block(block_idx, buf, size);
     }
     int64_t ReadTreeBlock(BlockIdx block_idx, void* buf) const {
         int64_t bytes_read = -1;
-        const off64_t offsetStart = tree_offset_ + blockIndexToOffset(block_idx);
-        bytes_read = adb_pread(tree_fd_, buf, kBlockSize, offsetStart);
+        const char* data = tree_reader_->Block(block_idx, static_cast<char*>(buf), &bytes_read);
+        if (bytes_read > 0 && data != buf) {
+            memcpy(buf, data, bytes_read);
+        }
         return bytes_read;
     }
+    // Lets the kernel know that data blocks [first, first + count) are about to be read.
+    void WillNeed(BlockIdx first, int32_t count) const { data_reader_->WillNeed(first, count); }
+    // Stops reading blocks from the file's mappings if it's been truncated. Called before each
+    // batch of blocks is read (see BlockReader::CheckSize).
+    void CheckSize() const {
+        data_reader_->CheckSize();
+        if (tree_reader_) {
+            tree_reader_->CheckSize();
+        }
+    }
 
     const std::vector<BlockIdx>& PriorityBlocks() const { return priority_blocks_; }
 
     bool hasTree() const { return tree_fd_.ok(); }
 
+    // The root hash of the file's verity tree, if it has a signature.
+    const std::string& rootHash() const { return root_hash_; }
+    // The cache of this file's compressed blocks, if there is one.
+    BlockCache* blockCache() const { return block_cache_.get(); }
+    const BlockProfile& profile() const { return profile_; }
+    bool InProfile(BlockIdx blockIdx) const { return in_profile_[blockIdx]; }
+
     std::vector<bool> sentBlocks;
     NumBlocks sentBlocksCount = 0;
 
     std::vector<bool> sentTreeBlocks;
 
+    // The blocks the device asked for, in the order it did.
+    std::vector<BlockIdx> missedBlocks;
+
+    // How many blocks of the profile were sent before the device asked for them, in all and as of
+    // the last time it asked for one of this file's blocks.
+    int32_t profileBlocksPrefetched = 0;
+    int32_t profileBlocksPrefetchedBeforeLastMiss = 0;
+
     const char* const filepath;
     const FileId id;
     const int64_t size;
@@ -195,12 +263,189 @@ class File {
 
     unique_fd tree_fd_;
     const int64_t tree_offset_;
+
+    std::optional<BlockReader> data_reader_;
+    std::optional<BlockReader> tree_reader_;
+
+    std::string root_hash_;
+    std::unique_ptr<BlockCache> block_cache_;
+    BlockProfile profile_;
+    std::vector<bool> in_profile_;
+};
+
+// A data block, read and compressed if that's worth it, with its header filled in.
+struct PreparedBlock {
+    FileId fileId;
+    BlockIdx blockIdx;
+    // The size of the block's data, or -1 if it couldn't be read, with the errno in |error|.
+    int64_t size;
+    int error;
+    bool fromCache;
+    BlockBuffer<kCompressBound> buffer;
+};
+
+// Reads data block |blockIdx| of |file| into |block|, or takes it from the file's block cache.
+// Safe to call on any thread.
+static void PrepareDataBlock(const File& file, BlockIdx blockIdx, PreparedBlock* block) {
+    block->fileId = file.id;
+    block->blockIdx = blockIdx;
+
+    ResponseHeader& header = block->buffer.header;
+    header.block_type = kTypeData;
+    header.file_id = toBigEndian(file.id);
+    header.block_idx = toBigEndian(blockIdx);
+
+    BlockCache* cache = file.blockCache();
+    const int cachedSize =
+            cache ? cache->Lookup(blockIdx, block->buffer.data) : BlockCache::kNotCached;
+    block->fromCache = cachedSize != BlockCache::kNotCached;
+    if (cachedSize > 0) {
+        block->size = cachedSize;
+        header.compression_type = kCompressionLZ4;
+        header.block_size = toBigEndian(BlockSize(block->size));
+        return;
+    }
+
+    // If the file is mapped, the block is compressed or copied straight from the mapping.
+    bool isZipCompressed = false;
+    char* const out = block->buffer.data;
+    const char* data = file.DataBlock(blockIdx, out, &block->size, &isZipCompressed);
+    if (block->size < 0) {
+        block->error = errno;
+        return;
+    }
+
+    header.compression_type = kCompressionNone;
+    if (!isZipCompressed && cachedSize != BlockCache::kNotCompressed) {
+        char compressedBuffer[kCompressBound];
+        char* compressed = data == out ? compressedBuffer : out;
+        int compressedSize =
+                LZ4_compress_default(data, compressed, block->size, kCompressBound);
+        if (compressedSize > 0 && compressedSize < kCompressedSizeMax) {
+            if (compressed != out) {
+                memcpy(out, compressed, compressedSize);
+            }
+            block->size = compressedSize;
+            header.compression_type = kCompressionLZ4;
+            if (cache) {
+                cache->Store(blockIdx, out, compressedSize);
+            }
+        } else if (cache) {
+            cache->StoreNotCompressed(blockIdx);
+        }
+    }
+    if (header.compression_type == kCompressionNone && data != out) {
+        memcpy(out, data, block->size);
+    }
+
+    header.block_size = toBigEndian(BlockSize(block->size));
+}
+
+// Prepares prefetched blocks on worker threads, so that the serving thread is free to answer the
+// device's requests for missing blocks as soon as they arrive, rather than after compressing the
+// rest of a prefetch batch. The serving thread also prepares blocks itself one at a time when it's
+// not busy, so this works without any workers.
+class PrefetchPool {
+  public:
+    explicit PrefetchPool(unsigned threads) {
+        for (unsigned i = 0; i < threads; ++i) {
+            threads_.emplace_back(&PrefetchPool::Work, this);
+        }
+    }
+
+    ~PrefetchPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        work_cv_.notify_all();
+        for (std::thread& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    void Schedule(const File& file, BlockIdx blockIdx) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            scheduled_.emplace_back(&file, blockIdx);
+            ++pending_;
+        }
+        work_cv_.notify_one();
+    }
+
+    // Returns the blocks that have been prepared since the last call. Rather than wait up to
+    // |timeout| for the workers, the caller prepares blocks itself for that long, and only waits
+    // if the workers already have all of them. It stops early once |interrupted| returns true,
+    // which is checked after each block, and every kRequestCheckInterval while waiting.
+    std::deque<std::unique_ptr<PreparedBlock>> TakeReady(std::chrono::microseconds timeout,
+                                                         const std::function<bool()>& interrupted) {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        std::unique_lock<std::mutex> lock(mutex_);
+        do {
+            if (!scheduled_.empty()) {
+                PrepareNext(lock);
+            } else {
+                const auto checkAt = std::chrono::steady_clock::now() + kRequestCheckInterval;
+                ready_cv_.wait_until(lock, std::min(deadline, checkAt),
+                                     [this]() { return !ready_.empty() || pending_ == 0; });
+            }
+            if (ready_.size() < pending_) {
+                lock.unlock();
+                bool stop = interrupted();
+                lock.lock();
+                if (stop) break;
+            }
+        } while (ready_.size() < pending_ && std::chrono::steady_clock::now() < deadline);
+        pending_ -= ready_.size();
+        return std::exchange(ready_, {});
+    }
+
+    // The number of blocks scheduled that haven't been taken yet.
+    size_t pending() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return pending_;
+    }
+
+  private:
+    void Work() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            work_cv_.wait(lock, [this]() { return stopping_ || !scheduled_.empty(); });
+            if (stopping_) return;
+            PrepareNext(lock);
+            ready_cv_.notify_one();
+        }
+    }
+
+    // Prepares the first scheduled block, with |lock| released while it does.
+    void PrepareNext(std::unique_lock<std::mutex>& lock) {
+        auto [file, blockIdx] = scheduled_.front();
+        scheduled_.pop_front();
+        lock.unlock();
+        auto block = std::make_unique<PreparedBlock>();
+        PrepareDataBlock(*file, blockIdx, block.get());
+        lock.lock();
+        ready_.push_back(std::move(block));
+    }
+
+    mutable std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable ready_cv_;
+    std::deque<std::pair<const File*, BlockIdx>> scheduled_;
+    std::deque<std::unique_ptr<PreparedBlock>> ready_;
+    size_t pending_ = 0;
+    bool stopping_ = false;
+    std::vector<std::thread> threads_;
 };
 
 class IncrementalServer {
   public:
     IncrementalServer(unique_fd adb_fd, unique_fd output_fd, std::vector<File> files)
-        : adb_fd_(std::move(adb_fd)), output_fd_(std::move(output_fd)), files_(std::move(files)) {
+        : adb_fd_(std::move(adb_fd)),
+          output_fd_(std::move(output_fd)),
+          files_(std::move(files)),
+          prefetchPool_(std::min(std::max(std::thread::hardware_concurrency(), 1U) - 1,
+                                 kPrefetchThreadsMax)) {
         buffer_.reserve(kReadBufferSize);
         pendingBlocksBuffer_.resize(kChunkFlushSize + 2 * kBlockSize);
         pendingBlocks_ = pendingBlocksBuffer_.data() + sizeof(ChunkHeader);
@@ -233,12 +478,19 @@ class IncrementalServer {
     };
 
     bool SkipToRequest(void* buffer, size_t* size, bool blocking);
-    std::optional<RequestCommand> ReadRequest(bool blocking);
+    std::optional<RequestCommand> ReadRequest(
+            bool blocking, std::chrono::high_resolution_clock::time_point* seenAt);
+    bool DeviceDataWaiting();
+    bool HaveBufferedRequest() const {
+        return buffer_.size() >= sizeof(INCR) + sizeof(RequestCommand);
+    }
 
     void erase_buffer_head(int count) { buffer_.erase(buffer_.begin(), buffer_.begin() + count); }
 
     enum class SendResult { Sent, Skipped, Error };
     SendResult SendDataBlock(FileId fileId, BlockIdx blockIdx, bool flush = false);
+    SendResult SendPreparedBlock(const PreparedBlock& block, bool flush = false);
+    void SendReadyBlocks(std::chrono::microseconds timeout);
 
     bool SendTreeBlock(FileId fileId, int32_t fileBlockIdx, BlockIdx blockIdx);
     bool SendTreeBlocksForDataBlock(FileId fileId, BlockIdx blockIdx);
@@ -250,6 +502,8 @@ class IncrementalServer {
     void Flush();
     using TimePoint = decltype(std::chrono::high_resolution_clock::now());
     bool ServingComplete(std::optional<TimePoint> startTime, int missesCount, int missesSent);
+    void DumpStats(std::optional<TimePoint> startTime, int missesCount, int missesSent);
+    void SaveProfiles();
 
     unique_fd const adb_fd_;
     unique_fd const output_fd_;
@@ -259,8 +513,23 @@ class IncrementalServer {
     std::vector<char> buffer_;
 
     std::deque<PrefetchState> prefetches_;
+    PrefetchPool prefetchPool_;
     int compressed_ = 0, uncompressed_ = 0;
     long long sentSize_ = 0;
+    int prefetchesSent_ = 0, prefetchesSkipped_ = 0;
+    int cacheHits_ = 0;
+
+    // When unread data from the device was first seen, which is when the latency of a missing
+    // block is counted from.
+    std::optional<TimePoint> dataSeenAt_;
+
+    // How long each missing block that was sent took, from receiving the request to sending it.
+    struct MissLatency {
+        FileId fileId;
+        BlockIdx blockIdx;
+        std::chrono::microseconds latency;
+    };
+    std::vector<MissLatency> missLatencies_;
 
     static constexpr auto kChunkFlushSize = 31 * kBlockSize;
 
@@ -300,6 +569,9 @@ bool IncrementalServer::SkipToRequest(void* buffer, size_t* size, bool blocking)
 
         adb_pollfd pfd = {adb_fd_.get(), POLLIN, 0};
         auto res = adb_poll(&pfd, 1, blocking ? kPollTimeoutMillis : 0);
+        if (res == 1 && !dataSeenAt_) {
+            dataSeenAt_ = std::chrono::high_resolution_clock::now();
+        }
 
         if (res != 1) {
             auto err = errno;
@@ -341,10 +613,19 @@ bool IncrementalServer::SkipToRequest(void* buffer, size_t* size, bool blocking)
     return false;
 }
 
-std::optional<RequestCommand> IncrementalServer::ReadRequest(bool blocking) {
+// Also returns when the request was first seen in |seenAt|, which may have been while the serving
+// thread was busy with something else.
+std::optional<RequestCommand> IncrementalServer::ReadRequest(
+        bool blocking, std::chrono::high_resolution_clock::time_point* seenAt) {
     uint8_t commandBuf[sizeof(RequestCommand)];
     auto size = sizeof(commandBuf);
-    if (!SkipToRequest(&commandBuf, &size, blocking)) {
+    bool ok = SkipToRequest(&commandBuf, &size, blocking);
+    *seenAt = dataSeenAt_.value_or(std::chrono::high_resolution_clock::now());
+    // Another request that arrived along with this one was seen at the same time.
+    if (!HaveBufferedRequest()) {
+        dataSeenAt_.reset();
+    }
+    if (!ok) {
         return {{DESTROY}};
     }
     if (size < sizeof(RequestCommand)) {
@@ -426,50 +707,76 @@ auto IncrementalServer::SendDataBlock(FileId fileId, BlockIdx blockIdx, bool flu
         return SendResult::Skipped;
     }
 
-    if (!SendTreeBlocksForDataBlock(fileId, blockIdx)) {
+    file.CheckSize();
+    PreparedBlock block;
+    PrepareDataBlock(file, blockIdx, &block);
+    return SendPreparedBlock(block, flush);
+}
+
+auto IncrementalServer::SendPreparedBlock(const PreparedBlock& block, bool flush) -> SendResult {
+    auto& file = files_[block.fileId];
+    if (file.sentBlocks[block.blockIdx]) {
+        return SendResult::Skipped;
+    }
+    if (block.size < 0) {
+        fprintf(stderr, "Failed to get data for %s at blockIdx=%d (%d).\n", file.filepath,
+                block.blockIdx, block.error);
         return SendResult::Error;
     }
 
-    BlockBuffer raw;
-    bool isZipCompressed = false;
-    const int64_t bytesRead = file.ReadDataBlock(blockIdx, raw.data, &isZipCompressed);
-    if (bytesRead < 0) {
-        fprintf(stderr, "Failed to get data for %s at blockIdx=%d (%d).\n", file.filepath, blockIdx,
-                errno);
+    if (!SendTreeBlocksForDataBlock(block.fileId, block.blockIdx)) {
         return SendResult::Error;
     }
 
-    BlockBuffer<kCompressBound> compressed;
-    int16_t compressedSize = 0;
-    if (!isZipCompressed) {
-        compressedSize = LZ4_compress_default(raw.data, compressed.data, bytesRead, kCompressBound);
-    }
-    int16_t blockSize;
-    ResponseHeader* header;
-    if (compressedSize > 0 && compressedSize < kCompressedSizeMax) {
+    if (block.buffer.header.compression_type == kCompressionLZ4) {
         ++compressed_;
-        blockSize = compressedSize;
-        header = &compressed.header;
-        header->compression_type = kCompressionLZ4;
     } else {
         ++uncompressed_;
-        blockSize = bytesRead;
-        header = &raw.header;
-        header->compression_type = kCompressionNone;
+    }
+    if (block.fromCache) {
+        ++cacheHits_;
     }
 
-    header->block_type = kTypeData;
-    header->file_id = toBigEndian(fileId);
-    header->block_size = toBigEndian(blockSize);
-    header->block_idx = toBigEndian(blockIdx);
-
-    file.sentBlocks[blockIdx] = true;
+    file.sentBlocks[block.blockIdx] = true;
     file.sentBlocksCount += 1;
-    Send(header, ResponseHeader::responseSizeFor(blockSize), flush);
+    Send(&block.buffer, ResponseHeader::responseSizeFor(block.size), flush);
 
     return SendResult::Sent;
 }
 
+// Whether the device has sent anything that hasn't been read yet.
+bool IncrementalServer::DeviceDataWaiting() {
+    if (HaveBufferedRequest()) {
+        return true;
+    }
+    adb_pollfd pfd = {adb_fd_.get(), POLLIN, 0};
+    if (adb_poll(&pfd, 1, 0) != 1) {
+        return false;
+    }
+    if (!dataSeenAt_) {
+        dataSeenAt_ = std::chrono::high_resolution_clock::now();
+    }
+    return true;
+}
+
+// Sends the prefetched blocks that are ready, after spending up to |timeout| preparing or waiting
+// for them. It stops early if a request arrives, so that the request isn't kept waiting.
+void IncrementalServer::SendReadyBlocks(std::chrono::microseconds timeout) {
+    for (const auto& block :
+         prefetchPool_.TakeReady(timeout, [this]() { return DeviceDataWaiting(); })) {
+        if (auto res = SendPreparedBlock(*block); res == SendResult::Sent) {
+            ++prefetchesSent_;
+            if (File& file = files_[block->fileId]; file.InProfile(block->blockIdx)) {
+                ++file.profileBlocksPrefetched;
+            }
+        } else if (res == SendResult::Skipped) {
+            ++prefetchesSkipped_;
+        } else {
+            fprintf(stderr, "Failed to send block %" PRId32 "\n", block->blockIdx);
+        }
+    }
+}
+
 bool IncrementalServer::SendDone() {
     ResponseHeader header;
     header.file_id = -1;
@@ -481,36 +788,51 @@ bool IncrementalServer::SendDone() {
     return true;
 }
 
+// Schedules prefetched blocks on prefetchPool_, until it has kPrefetchBlocksAhead of them. They're
+// sent by SendReadyBlocks once they're ready.
 void IncrementalServer::RunPrefetching() {
-    constexpr auto kPrefetchBlocksPerIteration = 128;
+    size_t blocksToSchedule = kPrefetchBlocksAhead - std::min(kPrefetchBlocksAhead,
+                                                              prefetchPool_.pending());
+    // Each run of consecutive blocks is passed on to the kernel, so that it can read them in
+    // ahead of the workers.
+    const File* runFile = nullptr;
+    BlockIdx runStart = 0, runEnd = 0;
+    auto flushRun = [&]() {
+        if (runFile) {
+            runFile->CheckSize();
+            runFile->WillNeed(runStart, runEnd - runStart);
+        }
+    };
+    auto schedule = [&](const File& file, BlockIdx blockIdx) {
+        if (blockIdx < (BlockIdx)file.sentBlocks.size() && !file.sentBlocks[blockIdx]) {
+            if (&file != runFile || blockIdx != runEnd) {
+                flushRun();
+                runFile = &file;
+                runStart = blockIdx;
+            }
+            runEnd = blockIdx + 1;
+            prefetchPool_.Schedule(file, blockIdx);
+            --blocksToSchedule;
+        }
+    };
 
-    int blocksToSend = kPrefetchBlocksPerIteration;
-    while (!prefetches_.empty() && blocksToSend > 0) {
+    while (!prefetches_.empty() && blocksToSchedule > 0) {
         auto& prefetch = prefetches_.front();
         const auto& file = *prefetch.file;
         const auto& priority_blocks = file.PriorityBlocks();
-        if (!priority_blocks.empty()) {
-            for (auto& i = prefetch.priorityIndex;
-                 blocksToSend > 0 && i < (BlockIdx)priority_blocks.size(); ++i) {
-                if (auto res = SendDataBlock(file.id, priority_blocks[i]);
-                    res == SendResult::Sent) {
-                    --blocksToSend;
-                } else if (res == SendResult::Error) {
-                    fprintf(stderr, "Failed to send priority block %" PRId32 "\n", i);
-                }
-            }
+        for (auto& i = prefetch.priorityIndex;
+             blocksToSchedule > 0 && i < (BlockIdx)priority_blocks.size(); ++i) {
+            schedule(file, priority_blocks[i]);
         }
-        for (auto& i = prefetch.overallIndex; blocksToSend > 0 && i < prefetch.overallEnd; ++i) {
-            if (auto res = SendDataBlock(file.id, i); res == SendResult::Sent) {
-                --blocksToSend;
-            } else if (res == SendResult::Error) {
-                fprintf(stderr, "Failed to send block %" PRId32 "\n", i);
-            }
+        for (auto& i = prefetch.overallIndex; blocksToSchedule > 0 && i < prefetch.overallEnd;
+             ++i) {
+            schedule(file, i);
         }
         if (prefetch.done()) {
             prefetches_.pop_front();
         }
     }
+    flushRun();
 }
 
 void IncrementalServer::Send(const void* data, size_t size, bool flush) {
@@ -549,6 +871,86 @@ bool IncrementalServer::ServingComplete(std::optional<TimePoint> startTime, int
     return true;
 }
 
+// Writes a summary of the session, how well each file's profile worked, and how long each missing
+// block took to serve, to the file named by $ADB_INCREMENTAL_STATS, if it's set.
+void IncrementalServer::DumpStats(std::optional<TimePoint> startTime, int missesCount,
+                                  int missesSent) {
+    const char* path = getenv("ADB_INCREMENTAL_STATS");
+    if (!path) {
+        return;
+    }
+    std::ofstream out(path);
+    if (!out) {
+        fprintf(stderr, "Failed to open stats file '%s'.\n", path);
+        return;
+    }
+
+    using namespace std::chrono;
+    auto endTime = high_resolution_clock::now();
+    std::vector<microseconds> latencies;
+    for (const MissLatency& miss : missLatencies_) {
+        latencies.push_back(miss.latency);
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](int p) {
+        return latencies.empty() ? 0 : latencies[(latencies.size() - 1) * p / 100].count();
+    };
+
+    out << "time_ms " << duration_cast<milliseconds>(endTime - startTime.value_or(endTime)).count()
+        << "\nsent_bytes " << sentSize_ << "\ncompressed_blocks " << compressed_
+        << "\nuncompressed_blocks " << uncompressed_ << "\nmisses " << missesCount
+        << "\nmisses_sent " << missesSent << "\nprefetches_sent " << prefetchesSent_
+        << "\nprefetches_skipped " << prefetchesSkipped_ << "\ncache_hits " << cacheHits_
+        << "\nmiss_latency_us_p50 "
+        << percentile(50) << "\nmiss_latency_us_p90 " << percentile(90)
+        << "\nmiss_latency_us_p99 " << percentile(99) << "\nmiss_latency_us_max "
+        << percentile(100) << "\n\n";
+
+    // The misses a file's profile avoided are the blocks of it that were prefetched before the
+    // device's last miss in the file. The device doesn't say when it reads a block it already has,
+    // so this stands in for the prefetched blocks it went on to read: it was still reading blocks
+    // it didn't have after they arrived. Blocks prefetched after that aren't counted, which makes
+    // this a lower bound; a profile that avoids every miss counts none.
+    out << "file_id profile profile_blocks misses misses_avoided\n";
+    for (const File& file : files_) {
+        static constexpr const char* kSources[] = {"none", "same_file", "same_name"};
+        const std::unordered_set<BlockIdx> missed(file.missedBlocks.begin(),
+                                                  file.missedBlocks.end());
+        out << file.id << " " << kSources[int(file.profile().source)] << " "
+            << file.profile().blocks.size() << " " << missed.size() << " "
+            << file.profileBlocksPrefetchedBeforeLastMiss << "\n";
+    }
+    out << "\n";
+
+    out << "file_id block_idx latency_us\n";
+    for (const MissLatency& miss : missLatencies_) {
+        out << miss.fileId << " " << miss.blockIdx << " " << miss.latency.count() << "\n";
+    }
+}
+
+// Saves the order in which the device asked for the blocks of each file, followed by the rest of
+// the blocks in the profile it was served with, as the file's profile for next time.
+void IncrementalServer::SaveProfiles() {
+    for (const File& file : files_) {
+        if (file.rootHash().empty() ||
+            (file.missedBlocks.empty() &&
+             file.profile().source != BlockProfile::Source::SameName)) {
+            continue;
+        }
+        std::vector<BlockIdx> blocks;
+        std::unordered_set<BlockIdx> seen;
+        for (const auto* list : {&file.missedBlocks, &file.profile().blocks}) {
+            for (BlockIdx blockIdx : *list) {
+                if (seen.insert(blockIdx).second) {
+                    blocks.push_back(blockIdx);
+                }
+            }
+        }
+        SaveBlockProfile(DefaultBlockProfileDir(), file.rootHash(),
+                         android::base::Basename(file.filepath), file.size, blocks);
+    }
+}
+
 bool IncrementalServer::Serve() {
     // Initial handshake to verify connection is still alive
     if (!SendOkay(adb_fd_)) {
@@ -565,7 +967,9 @@ bool IncrementalServer::Serve() {
     std::optional<TimePoint> startTime;
 
     while (true) {
-        if (!doneSent && prefetches_.empty() &&
+        SendReadyBlocks(kPrefetchWait);
+
+        if (!doneSent && prefetches_.empty() && prefetchPool_.pending() == 0 &&
             std::all_of(files_.begin(), files_.end(), [](const File& f) {
                 return f.sentBlocksCount == NumBlocks(f.sentBlocks.size());
             })) {
@@ -574,12 +978,13 @@ bool IncrementalServer::Serve() {
             doneSent = true;
         }
 
-        const bool blocking = prefetches_.empty();
+        const bool blocking = prefetches_.empty() && prefetchPool_.pending() == 0;
         if (blocking) {
             // We've no idea how long the blocking call is, so let's flush whatever is still unsent.
             Flush();
         }
-        auto request = ReadRequest(blocking);
+        TimePoint requestTime;
+        auto request = ReadRequest(blocking, &requestTime);
 
         if (!startTime) {
             startTime = high_resolution_clock::now();
@@ -592,6 +997,8 @@ bool IncrementalServer::Serve() {
             switch (request->request_type) {
                 case DESTROY: {
                     // Stop everything.
+                    SaveProfiles();
+                    DumpStats(startTime, missesCount, missesSent);
                     return true;
                 }
                 case SERVING_COMPLETE: {
@@ -610,6 +1017,9 @@ bool IncrementalServer::Serve() {
                                 fileId, blockIdx);
                         break;
                     }
+                    files_[fileId].missedBlocks.push_back(blockIdx);
+                    files_[fileId].profileBlocksPrefetchedBeforeLastMiss =
+                            files_[fileId].profileBlocksPrefetched;
 
                     if (VLOG_IS_ON(INCREMENTAL)) {
                         auto& file = files_[fileId];
@@ -628,6 +1038,10 @@ bool IncrementalServer::Serve() {
                         fprintf(stderr, "Failed to send block %" PRId32 ".\n", blockIdx);
                     } else if (res == SendResult::Sent) {
                         ++missesSent;
+                        missLatencies_.push_back(
+                                {fileId, blockIdx,
+                                 duration_cast<microseconds>(high_resolution_clock::now() -
+                                                             requestTime)});
                         // Make sure we send more pages from this place onward, in case if the OS is
                         // reading a bigger block.
                         prefetches_.emplace_front(files_[fileId], blockIdx + 1, 7);
@@ -708,9 +1122,23 @@ static std::pair<unique_fd, int64_t> open_signature(int64_t file_size, const cha
     return {std::move(fd), tree_offset};
 }
 
+static std::string read_root_hash(const char* filepath, borrowed_fd sign_fd) {
+    if (sign_fd.get() < 0) {
+        return {};
+    }
+    std::string error;
+    auto root_hash = read_id_sig_root_hash(sign_fd, &error);
+    if (!root_hash) {
+        D("No root hash for '%s': %s", filepath, error.c_str());
+        return {};
+    }
+    return std::move(*root_hash);
+}
+
 bool serve(int connection_fd, int output_fd, int argc, const char** argv) {
     auto connection_ufd = unique_fd(connection_fd);
     auto output_ufd = unique_fd(output_fd);
+    const char* cache_dir = getenv("ADB_INCREMENTAL_CACHE");
 
     std::vector<File> files;
     files.reserve(argc);
@@ -720,8 +1148,22 @@ bool serve(int connection_fd, int output_fd, int argc, const char** argv) {
         auto [file_fd, file_size] = open_fd(filepath);
         auto [sign_fd, sign_offset] = open_signature(file_size, filepath);
 
+        // The block cache and profile of a file are keyed by its root hash.
+        std::string root_hash = read_root_hash(filepath, sign_fd);
+        std::unique_ptr<BlockCache> block_cache;
+        BlockProfile profile;
+        if (!root_hash.empty()) {
+            struct stat st;
+            if (cache_dir && *cache_dir && stat(filepath, &st) == 0) {
+                block_cache = BlockCache::Open(cache_dir, root_hash, FileStamp::FromStat(st));
+            }
+            profile = LoadBlockProfile(DefaultBlockProfileDir(), root_hash,
+                                       android::base::Basename(filepath), file_size);
+        }
+
         files.emplace_back(filepath, i, file_size, std::move(file_fd), sign_offset,
-                           std::move(sign_fd));
+                           std::move(sign_fd), std::move(root_hash), std::move(block_cache),
+                           std::move(profile));
     }
 
     IncrementalServer server(std::move(connection_ufd), std::move(output_ufd), std::move(files));
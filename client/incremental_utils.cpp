@@ -183,6 +183,40 @@ std::optional<std::pair<off64_t, ssize_t>> skip_id_sig_headers(borrowed_fd fd, s
     return std::make_pair(offset, tree_size);
 }
 
+std::optional<std::string> read_id_sig_root_hash(borrowed_fd fd, std::string* error) {
+    // The hashing info follows the version and its own size. It's the hash algorithm, log2 of the
+    // block size, then the salt and the root hash, each preceded by its size.
+    off64_t offset = 3 * sizeof(int32_t) + sizeof(int8_t);
+    auto read_at = [&](void* buf, int32_t size) {
+        if (int r = adb_pread(fd, buf, size, offset); r != size) {
+            *error = std::format("Failed to read signature: {}",
+                                 r < 0 ? strerror(errno) : "End of file");
+            return false;
+        }
+        offset += size;
+        return true;
+    };
+    auto read_bytes_with_size = [&](std::string* bytes) {
+        int32_t le_size;
+        if (!read_at(&le_size, sizeof(le_size))) {
+            return false;
+        }
+        int32_t size = int32_t(le32toh(le_size));
+        if (size < 0 || size > kMaxSignatureSize) {
+            *error = std::format("Invalid size {}", size);
+            return false;
+        }
+        bytes->resize(size);
+        return read_at(bytes->data(), size);
+    };
+
+    std::string salt, root_hash;
+    if (!read_bytes_with_size(&salt) || !read_bytes_with_size(&root_hash)) {
+        return {};
+    }
+    return root_hash;
+}
+
 template <class T>
 static T valueAt(borrowed_fd fd, off64_t offset) {
     T t;
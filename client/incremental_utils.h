@@ -48,4 +48,7 @@ std::optional<std::pair<std::vector<char>, int32_t>> read_id_sig_headers(borrowe
                                                                          std::string* error);
 std::optional<std::pair<off64_t, ssize_t>> skip_id_sig_headers(borrowed_fd fd, std::string* error);
 
+// Returns the root hash of the verity tree, from the hashing info of the v4 signature file |fd|.
+std::optional<std::string> read_id_sig_root_hash(borrowed_fd fd, std::string* error);
+
 }  // namespace incremental
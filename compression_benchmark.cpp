@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Throughput of the encoders that push and pull use, for each codec and number of threads. The
+// input is fed through in SYNC_DATA_MAX reads and the output is thrown away, so this measures how
+// fast the compression stage can go when neither the disk nor the link is the bottleneck.
+
+#include <random>
+#include <string>
+#include <variant>
+
+#include <benchmark/benchmark.h>
+
+#include "compression_pipeline.h"
+#include "compression_utils.h"
+#include "file_sync_protocol.h"
+
+// Something like a build's output: runs of repeated data, interrupted by noise.
+static const std::string& BenchmarkData() {
+    static const std::string data = []() {
+        std::mt19937 rng(42);
+        std::string result(32 * 1024 * 1024, '\0');
+        for (size_t i = 0; i < result.size();) {
+            size_t run = 1 + rng() % 256;
+            char c = static_cast<char>(rng());
+            for (size_t j = 0; j < run && i < result.size(); ++j, ++i) {
+                result[i] = (rng() % 4 == 0) ? static_cast<char>(rng()) : c;
+            }
+        }
+        return result;
+    }();
+    return data;
+}
+
+static void BM_Compress(benchmark::State& state, CompressionType compression) {
+    const std::string& data = BenchmarkData();
+    const size_t threads = state.range(0);
+    uint64_t compressed_bytes = 0;
+
+    for (auto _ : state) {
+        std::variant<std::monostate, NullEncoder, BrotliEncoder, LZ4Encoder, LZ4ParallelEncoder,
+                     ZstdEncoder>
+                encoder_storage;
+        Encoder* encoder = nullptr;
+        switch (compression) {
+            case CompressionType::Brotli:
+                encoder = &encoder_storage.emplace<BrotliEncoder>(SYNC_DATA_MAX);
+                break;
+            case CompressionType::LZ4:
+                if (threads > 1) {
+                    encoder = &encoder_storage.emplace<LZ4ParallelEncoder>(SYNC_DATA_MAX, threads);
+                } else {
+                    encoder = &encoder_storage.emplace<LZ4Encoder>(SYNC_DATA_MAX);
+                }
+                break;
+            case CompressionType::Zstd:
+                encoder = &encoder_storage.emplace<ZstdEncoder>(SYNC_DATA_MAX, threads);
+                break;
+            default:
+                encoder = &encoder_storage.emplace<NullEncoder>(SYNC_DATA_MAX);
+                break;
+        }
+
+        size_t offset = 0;
+        bool sending = true;
+        while (sending) {
+            size_t len = std::min<size_t>(SYNC_DATA_MAX, data.size() - offset);
+            if (len == 0) {
+                encoder->Finish();
+            } else {
+                encoder->Append(Block(data.begin() + offset, data.begin() + offset + len));
+                offset += len;
+            }
+
+            while (true) {
+                Block output;
+                EncodeResult result = encoder->Encode(&output);
+                if (result == EncodeResult::Error) {
+                    state.SkipWithError("compression failed");
+                    return;
+                }
+                compressed_bytes += output.size();
+                if (result == EncodeResult::Done) {
+                    sending = false;
+                    break;
+                } else if (result == EncodeResult::NeedInput) {
+                    break;
+                }
+            }
+        }
+    }
+
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * data.size());
+    state.counters["ratio"] =
+            static_cast<double>(compressed_bytes) / (state.iterations() * data.size());
+}
+
+// Real time, since the work is spread over other threads.
+BENCHMARK_CAPTURE(BM_Compress, none, CompressionType::None)
+        ->ArgName("threads")
+        ->Arg(1)
+        ->UseRealTime();
+BENCHMARK_CAPTURE(BM_Compress, brotli, CompressionType::Brotli)
+        ->ArgName("threads")
+        ->Arg(1)
+        ->UseRealTime();
+BENCHMARK_CAPTURE(BM_Compress, lz4, CompressionType::LZ4)
+        ->ArgName("threads")
+        ->Arg(1)
+        ->Arg(2)
+        ->Arg(4)
+        ->UseRealTime();
+BENCHMARK_CAPTURE(BM_Compress, zstd, CompressionType::Zstd)
+        ->ArgName("threads")
+        ->Arg(1)
+        ->Arg(2)
+        ->Arg(4)
+        ->UseRealTime();
@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "compression_pipeline.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include <lz4.h>
+
+#include "adb_io.h"
+
+size_t compression_threads(uint64_t file_size) {
+    static const size_t max_threads =
+            std::clamp<size_t>(std::thread::hardware_concurrency(), 1, kMaxCompressionThreads);
+    return file_size < kParallelCompressionMinSize ? 1 : max_threads;
+}
+
+LZ4ParallelEncoder::LZ4ParallelEncoder(size_t output_block_size, size_t threads)
+    : Encoder(output_block_size), max_jobs_(2 * threads) {
+    LZ4F_preferences_t preferences = {};
+    preferences.frameInfo.blockSizeID = LZ4F_max256KB;
+    preferences.frameInfo.blockMode = LZ4F_blockIndependent;
+
+    LZ4F_cctx* cctx;
+    if (LZ4F_createCompressionContext(&cctx, LZ4F_VERSION) != 0) {
+        LOG(FATAL) << "failed to initialize LZ4 compression context";
+    }
+    Block header(LZ4F_HEADER_SIZE_MAX);
+    size_t rc = LZ4F_compressBegin(cctx, header.data(), header.size(), &preferences);
+    LZ4F_freeCompressionContext(cctx);
+    if (LZ4F_isError(rc)) {
+        LOG(FATAL) << "LZ4F_compressBegin failed: " << LZ4F_getErrorName(rc);
+    }
+    header.resize(rc);
+    output_buffer_.append(std::move(header));
+
+    for (size_t i = 0; i < threads; ++i) {
+        workers_.emplace_back([this]() { Run(); });
+    }
+}
+
+LZ4ParallelEncoder::~LZ4ParallelEncoder() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+void LZ4ParallelEncoder::Run() {
+    while (true) {
+        Job* job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            work_cv_.wait(lock, [this]() { return stopping_ || !pending_.empty(); });
+            if (stopping_) return;
+            job = pending_.front();
+            pending_.pop_front();
+        }
+
+        // Each block is a little-endian size, with the top bit set if the block is stored
+        // uncompressed because compressing it didn't help.
+        const int input_size = job->input.size();
+        const int bound = LZ4_compressBound(input_size);
+        Block output(sizeof(uint32_t) + bound);
+        int rc = LZ4_compress_default(job->input.data(), output.data() + sizeof(uint32_t),
+                                      input_size, bound);
+        uint32_t block_header;
+        if (rc > 0 && rc < input_size) {
+            block_header = rc;
+        } else {
+            block_header = input_size | 0x80000000;
+            memcpy(output.data() + sizeof(uint32_t), job->input.data(), input_size);
+            rc = input_size;
+        }
+        memcpy(output.data(), &block_header, sizeof(block_header));
+        output.resize(sizeof(uint32_t) + rc);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job->output = std::move(output);
+            job->done = true;
+        }
+        done_cv_.notify_all();
+    }
+}
+
+EncodeResult LZ4ParallelEncoder::Encode(Block* output) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!OutputReady()) {
+        // Hand out every complete block of input, and whatever's left at the end.
+        while (jobs_.size() < max_jobs_ &&
+               (input_buffer_.size() >= kBlockSize || (finished_ && !input_buffer_.empty()))) {
+            auto job = std::make_unique<Job>();
+            job->input = input_buffer_.take_front(std::min(kBlockSize, input_buffer_.size()))
+                                 .coalesce();
+            pending_.push_back(job.get());
+            jobs_.push_back(std::move(job));
+            work_cv_.notify_one();
+        }
+
+        if (jobs_.empty()) {
+            if (finished_) {
+                // An end mark of zero finishes the frame.
+                Block end_mark(sizeof(uint32_t));
+                memset(end_mark.data(), 0, end_mark.size());
+                output_buffer_.append(std::move(end_mark));
+                lz4_finalized_ = true;
+            }
+            break;
+        }
+
+        // Only wait for the oldest block if there's nothing else to do.
+        Job* job = jobs_.front().get();
+        if (!job->done) {
+            if (jobs_.size() < max_jobs_ && !finished_) break;
+            done_cv_.wait(lock, [job]() { return job->done; });
+        }
+        output_buffer_.append(std::move(job->output));
+        jobs_.pop_front();
+    }
+    lock.unlock();
+
+    if (OutputReady()) {
+        size_t len = std::min(output_block_size_, output_buffer_.size());
+        *output = output_buffer_.take_front(len).coalesce();
+    } else {
+        output->clear();
+    }
+
+    if (lz4_finalized_ && output_buffer_.empty()) {
+        return EncodeResult::Done;
+    } else if (OutputReady() || finished_) {
+        return EncodeResult::MoreOutput;
+    }
+    return EncodeResult::NeedInput;
+}
+
+AsyncWriter::~AsyncWriter() {
+    Finish();
+}
+
+bool AsyncWriter::Write(const char* data, size_t size) {
+    if (!thread_.joinable()) {
+        if (error_ != 0) {
+            errno = error_;
+            return false;
+        }
+        if (bytes_written_ < kMinAsyncBytes) {
+            bytes_written_ += size;
+            if (!WriteFdExactly(fd_, data, size)) {
+                error_ = errno;
+                return false;
+            }
+            return true;
+        }
+        thread_ = std::thread([this]() { Run(); });
+    }
+
+    Block block(data, data + size);
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return queued_bytes_ < kMaxQueuedBytes || error_ != 0; });
+    if (error_ != 0) {
+        errno = error_;
+        return false;
+    }
+    queued_bytes_ += block.size();
+    queue_.push_back(std::move(block));
+    cv_.notify_all();
+    return true;
+}
+
+void AsyncWriter::Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cv_.wait(lock, [this]() { return finishing_ || !queue_.empty(); });
+        if (queue_.empty()) return;
+
+        Block block = std::move(queue_.front());
+        queue_.pop_front();
+        lock.unlock();
+        bool written = error_ != 0 || WriteFdExactly(fd_, block.data(), block.size());
+        int saved_errno = errno;
+        lock.lock();
+        if (!written) {
+            error_ = saved_errno;
+        }
+        queued_bytes_ -= block.size();
+        cv_.notify_all();
+    }
+}
+
+bool AsyncWriter::Finish() {
+    if (thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            finishing_ = true;
+        }
+        cv_.notify_all();
+        thread_.join();
+    }
+    if (error_ != 0) {
+        errno = error_;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "adb_unique_fd.h"
+#include "compression_utils.h"
+#include "types.h"
+
+// Files smaller than this are compressed on the calling thread: starting workers costs more than
+// they'd save.
+static constexpr uint64_t kParallelCompressionMinSize = 1024 * 1024;
+static constexpr size_t kMaxCompressionThreads = 4;
+
+// The number of threads to compress a file of |file_size| bytes with.
+size_t compression_threads(uint64_t file_size);
+
+// Compresses independent LZ4 blocks on a pool of worker threads. The output is a single LZ4 frame,
+// just like LZ4Encoder's, so LZ4Decoder doesn't need to know the difference.
+struct LZ4ParallelEncoder final : public Encoder {
+    static constexpr size_t kBlockSize = 256 * 1024;
+
+    LZ4ParallelEncoder(size_t output_block_size, size_t threads);
+    ~LZ4ParallelEncoder();
+
+    EncodeResult Encode(Block* output) final;
+
+  private:
+    struct Job {
+        Block input;
+        Block output;
+        bool done = false;
+    };
+
+    bool OutputReady() const {
+        return output_buffer_.size() >= output_block_size_ || lz4_finalized_;
+    }
+
+    void Run();
+
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+
+    // Every block that hasn't been collected yet, in order, and the ones no worker has started.
+    std::deque<std::unique_ptr<Job>> jobs_;
+    std::deque<Job*> pending_;
+    size_t max_jobs_;
+    bool stopping_ = false;
+    std::vector<std::thread> workers_;
+
+    bool lz4_finalized_ = false;
+    IOVector output_buffer_;
+};
+
+// Writes data to a file on a background thread, so that the caller can get on with receiving and
+// decoding the next block. Small files are written synchronously, without starting a thread.
+class AsyncWriter {
+  public:
+    static constexpr size_t kMaxQueuedBytes = 4 * 1024 * 1024;
+    static constexpr size_t kMinAsyncBytes = 1024 * 1024;
+
+    explicit AsyncWriter(borrowed_fd fd) : fd_(fd) {}
+    ~AsyncWriter();
+
+    AsyncWriter(const AsyncWriter& copy) = delete;
+    AsyncWriter& operator=(const AsyncWriter& copy) = delete;
+
+    // Queues |size| bytes to be written. Returns false with errno set if an earlier write failed.
+    bool Write(const char* data, size_t size);
+
+    // Waits for everything to be written. Returns false with errno set if anything failed.
+    bool Finish();
+
+  private:
+    void Run();
+
+    borrowed_fd fd_;
+    uint64_t bytes_written_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Block> queue_;
+    size_t queued_bytes_ = 0;
+    bool finishing_ = false;
+    int error_ = 0;
+    std::thread thread_;
+};
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "compression_pipeline.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include "adb_unique_fd.h"
+#include "sysdeps.h"
+
+// Data that compresses a little, like most of what gets pushed.
+static std::string TestData(size_t size) {
+    std::mt19937 rng(42);
+    std::string data(size, '\0');
+    for (char& c : data) {
+        c = "abcdefgh"[rng() % 8];
+    }
+    return data;
+}
+
+// Feeds |data| through |encoder| in SYNC_DATA_MAX reads, the way push does.
+static std::string Encode(Encoder* encoder, const std::string& data) {
+    std::string result;
+    size_t offset = 0;
+    bool sending = true;
+    while (sending) {
+        size_t len = std::min<size_t>(64 * 1024, data.size() - offset);
+        if (len == 0) {
+            encoder->Finish();
+        } else {
+            encoder->Append(Block(data.begin() + offset, data.begin() + offset + len));
+            offset += len;
+        }
+
+        while (true) {
+            Block output;
+            EncodeResult rc = encoder->Encode(&output);
+            EXPECT_NE(EncodeResult::Error, rc);
+            if (rc == EncodeResult::Error) return "";
+            result.append(output.data(), output.size());
+            if (rc == EncodeResult::Done) {
+                sending = false;
+                break;
+            } else if (rc == EncodeResult::NeedInput) {
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+static std::string Decode(Decoder* decoder, std::string_view data) {
+    std::string result;
+    while (true) {
+        size_t len = std::min<size_t>(64 * 1024, data.size());
+        if (len == 0) {
+            decoder->Finish();
+        } else {
+            decoder->Append(Block(data.begin(), data.begin() + len));
+            data.remove_prefix(len);
+        }
+
+        while (true) {
+            std::span<char> output;
+            DecodeResult rc = decoder->Decode(&output);
+            EXPECT_NE(DecodeResult::Error, rc);
+            if (rc == DecodeResult::Error) return "";
+            result.append(output.data(), output.size());
+            if (rc == DecodeResult::Done) {
+                return result;
+            } else if (rc == DecodeResult::NeedInput) {
+                break;
+            }
+        }
+    }
+}
+
+TEST(CompressionPipeline, lz4_parallel) {
+    Block buffer(64 * 1024);
+    for (size_t size : std::vector<size_t>{0, 1, LZ4ParallelEncoder::kBlockSize, 5 * 1024 * 1024}) {
+        std::string data = TestData(size);
+        LZ4ParallelEncoder encoder(64 * 1024, 4);
+        std::string compressed = Encode(&encoder, data);
+        if (size > 1024) {
+            EXPECT_LT(compressed.size(), data.size());
+        }
+
+        LZ4Decoder decoder(std::span(buffer.data(), buffer.size()));
+        EXPECT_TRUE(Decode(&decoder, compressed) == data) << size;
+    }
+}
+
+TEST(CompressionPipeline, lz4_parallel_incompressible) {
+    std::mt19937 rng(1);
+    std::string data(3 * LZ4ParallelEncoder::kBlockSize, '\0');
+    for (char& c : data) {
+        c = static_cast<char>(rng());
+    }
+
+    LZ4ParallelEncoder encoder(64 * 1024, 2);
+    std::string compressed = Encode(&encoder, data);
+
+    Block buffer(64 * 1024);
+    LZ4Decoder decoder(std::span(buffer.data(), buffer.size()));
+    EXPECT_TRUE(Decode(&decoder, compressed) == data);
+}
+
+TEST(CompressionPipeline, zstd_threads) {
+    std::string data = TestData(9 * 1024 * 1024);
+    ZstdEncoder encoder(64 * 1024, 4);
+    std::string compressed = Encode(&encoder, data);
+    EXPECT_LT(compressed.size(), data.size());
+
+    Block buffer(64 * 1024);
+    ZstdDecoder decoder(std::span(buffer.data(), buffer.size()));
+    EXPECT_TRUE(Decode(&decoder, compressed) == data);
+}
+
+TEST(CompressionPipeline, async_writer) {
+    TemporaryFile tf;
+    std::string data = TestData(3 * AsyncWriter::kMaxQueuedBytes + 5);
+    {
+        AsyncWriter writer(tf.fd);
+        for (size_t offset = 0; offset < data.size(); offset += 64 * 1024) {
+            ASSERT_TRUE(writer.Write(data.data() + offset,
+                                     std::min<size_t>(64 * 1024, data.size() - offset)));
+        }
+        ASSERT_TRUE(writer.Finish());
+    }
+
+    std::string contents;
+    ASSERT_TRUE(android::base::ReadFileToString(tf.path, &contents));
+    EXPECT_TRUE(contents == data);
+}
+
+TEST(CompressionPipeline, async_writer_error) {
+    // Writes to a read-only fd fail with EBADF, whether or not they happen on the writer's thread.
+    TemporaryFile tf;
+    unique_fd fd(adb_open(tf.path, O_RDONLY));
+    ASSERT_GE(fd.get(), 0);
+
+    std::string data = TestData(64 * 1024);
+    AsyncWriter writer(fd);
+    bool failed = false;
+    for (size_t i = 0; i < 1000 && !failed; ++i) {
+        failed = !writer.Write(data.data(), data.size());
+    }
+    EXPECT_TRUE(failed || !writer.Finish());
+}
@@ -328,7 +328,7 @@ struct LZ4Encoder final : public Encoder {
             available_in = std::min(available_in, max_input_size);
 
             Block encode_block(encode_block_size);
-            size_t available_out = encode_block.capacity();
+            size_t available_out = encode_block.size();
             char* next_out = encode_block.data();
 
             size_t rc = LZ4F_compressUpdate(encoder_.get(), next_out, available_out, next_in,
@@ -434,12 +434,17 @@ struct ZstdDecoder final : public Decoder {
 };
 
 struct ZstdEncoder final : public Encoder {
-    explicit ZstdEncoder(size_t output_block_size)
+    // With more than one thread, zstd compresses in the background while we read and write. This
+    // silently does nothing if libzstd was built without multithreading support.
+    explicit ZstdEncoder(size_t output_block_size, size_t threads = 1, int level = 1)
         : Encoder(output_block_size), encoder_(ZSTD_createCStream(), ZSTD_freeCStream) {
         if (!encoder_) {
             LOG(FATAL) << "failed to initialize Zstd compression context";
         }
-        ZSTD_CCtx_setParameter(encoder_.get(), ZSTD_c_compressionLevel, 1);
+        ZSTD_CCtx_setParameter(encoder_.get(), ZSTD_c_compressionLevel, level);
+        if (threads > 1) {
+            ZSTD_CCtx_setParameter(encoder_.get(), ZSTD_c_nbWorkers, threads);
+        }
     }
 
     EncodeResult Encode(Block* output) final {
@@ -476,6 +481,10 @@ struct ZstdEncoder final : public Encoder {
             } else {
                 return input_buffer_.empty() ? EncodeResult::NeedInput : EncodeResult::MoreOutput;
             }
+        } else if (!finished_ && input_buffer_.empty() && out.pos < out.size) {
+            // Zstd is holding on to data that it hasn't finished compressing, which will come out
+            // with later input. Asking again now would just spin while its workers catch up.
+            return EncodeResult::NeedInput;
         } else {
             return EncodeResult::MoreOutput;
         }
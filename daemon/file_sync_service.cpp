@@ -31,10 +31,15 @@
 #include <unistd.h>
 #include <utime.h>
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <span>
 #include <string>
+#include <thread>
 #include <variant>
 #include <vector>
 
@@ -58,7 +63,10 @@
 #include "adb_io.h"
 #include "adb_trace.h"
 #include "adb_utils.h"
+#include "compression_pipeline.h"
 #include "compression_utils.h"
+#include "file_hash.h"
+#include "file_sync_delta.h"
 #include "file_sync_protocol.h"
 #include "security_log_tags.h"
 #include "sysdeps/errno.h"
@@ -259,6 +267,154 @@ static bool do_list_v2(int s, const char* path) {
     return do_list<true>(s, path);
 }
 
+// list_recursive reads directories on up to this many threads. Most of the time goes on waiting for
+// the filesystem to stat each entry, so a few threads help even on a device with few cores.
+static constexpr size_t kListRecursiveThreads = 4;
+
+// Walks a directory tree for list_recursive, writing each directory's entries to the socket as soon
+// as it has been read. Each thread takes a directory from the queue, reads it, and only queues its
+// subdirectories once their entries have been written, so that a directory's entry always comes
+// before its contents.
+class RecursiveLister {
+  public:
+    RecursiveLister(int s, const char* root) : s_(s), root_(root) {}
+
+    bool Run(size_t threads) {
+        struct stat st;
+        if (stat(root_.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            pending_.push_back({"", {{st.st_dev, st.st_ino}}});
+        }
+
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < threads; ++i) {
+            workers.emplace_back(&RecursiveLister::Work, this);
+        }
+        Work();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        if (failed_) return false;
+
+        sync_dent_v2 done = {.id = ID_DONE};
+        return WriteFdExactly(s_, &done, sizeof(done));
+    }
+
+  private:
+    struct Directory {
+        // Relative to root_, and ending in a slash unless it's the root itself.
+        std::string path;
+
+        // The directories from the root to this one, to avoid following a symbolic link in a loop.
+        std::vector<std::pair<dev_t, ino_t>> ancestors;
+    };
+
+    void Work() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cv_.wait(lock, [this]() { return failed_ || !pending_.empty() || busy_ == 0; });
+            if (failed_ || pending_.empty()) return;
+
+            Directory dir = std::move(pending_.front());
+            pending_.pop_front();
+            ++busy_;
+            lock.unlock();
+            bool success = List(dir);
+            lock.lock();
+            --busy_;
+            if (!success) failed_ = true;
+            cv_.notify_all();
+        }
+    }
+
+    bool List(const Directory& dir) {
+        std::string dir_path = root_ + "/" + dir.path;
+        std::unique_ptr<DIR, int (*)(DIR*)> d(opendir(dir_path.c_str()), closedir);
+        if (!d) return true;
+
+        std::string out;
+        std::vector<Directory> subdirs;
+        while (dirent* de = readdir(d.get())) {
+            if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+
+            std::string name = dir.path + de->d_name;
+            std::string path = dir_path + de->d_name;
+            sync_dent_v2 dent = {.id = ID_DENT_V2};
+            struct stat st;
+            if (lstat(path.c_str(), &st) == -1) {
+                dent.error = errno_to_wire(errno);
+            } else {
+                struct stat target;
+                if (S_ISLNK(st.st_mode)) {
+                    if (stat(path.c_str(), &target) == 0) {
+                        st = target;
+                    } else {
+                        dent.error = errno_to_wire(errno);
+                    }
+                }
+                dent.dev = st.st_dev;
+                dent.ino = st.st_ino;
+                dent.mode = st.st_mode;
+                dent.nlink = st.st_nlink;
+                dent.uid = st.st_uid;
+                dent.gid = st.st_gid;
+                dent.size = st.st_size;
+                dent.atime = st.st_atime;
+                dent.mtime = st.st_mtime;
+                dent.ctime = st.st_ctime;
+            }
+            dent.namelen = name.size();
+            out.append(reinterpret_cast<const char*>(&dent), sizeof(dent));
+            out.append(name);
+
+            if (dent.error == 0 && S_ISDIR(st.st_mode)) {
+                std::pair<dev_t, ino_t> id(st.st_dev, st.st_ino);
+                if (std::find(dir.ancestors.begin(), dir.ancestors.end(), id) ==
+                    dir.ancestors.end()) {
+                    Directory& subdir = subdirs.emplace_back(name + "/", dir.ancestors);
+                    subdir.ancestors.push_back(id);
+                }
+            }
+
+            if (out.size() >= SYNC_DATA_MAX && !Flush(&out, &subdirs)) return false;
+        }
+        return Flush(&out, &subdirs);
+    }
+
+    // Writes |out|, and then queues |subdirs|.
+    bool Flush(std::string* out, std::vector<Directory>* subdirs) {
+        {
+            std::lock_guard<std::mutex> lock(write_mutex_);
+            if (!WriteFdExactly(s_, out->data(), out->size())) return false;
+        }
+        out->clear();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (Directory& subdir : *subdirs) {
+            pending_.push_back(std::move(subdir));
+        }
+        subdirs->clear();
+        cv_.notify_all();
+        return true;
+    }
+
+    const int s_;
+    const std::string root_;
+
+    std::mutex write_mutex_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Directory> pending_;
+    size_t busy_ = 0;
+    bool failed_ = false;
+};
+
+static bool do_list_recursive(int s, const char* path) {
+    // A recursive listing is how a pull of a directory starts, so log it like one.
+    __android_log_security_bswrite(SEC_TAG_ADB_RECV_FILE, path);
+    return RecursiveLister(s, path).Run(kListRecursiveThreads);
+}
+
 // Make sure that SendFail from adb_io.cpp isn't accidentally used in this file.
 #pragma GCC poison SendFail
 
@@ -275,10 +431,134 @@ static bool SendSyncFailErrno(borrowed_fd fd, const std::string& reason) {
     return SendSyncFail(fd, StringPrintf("%s: %s", reason.c_str(), strerror(errno)));
 }
 
+// Moves uncompressed file data between a file and the sync socket. The data goes through a pipe
+// with splice(2), so adbd never copies it itself. If either end doesn't support splice, it falls
+// back to copying through a single reused buffer.
+class SyncDataMover {
+  public:
+    explicit SyncDataMover(std::vector<char>& buffer) : buffer_(buffer) {
+        if (android::base::Pipe(&pipe_read_, &pipe_write_)) {
+            int size = fcntl(pipe_write_.get(), F_SETPIPE_SZ, SYNC_DATA_MAX);
+            if (size == -1) size = fcntl(pipe_write_.get(), F_GETPIPE_SZ);
+            if (size > 0) capacity_ = std::min<size_t>(size, buffer_.size());
+        }
+        if (capacity_ == 0) ClosePipe();
+    }
+
+    // The most that Fill reads at once.
+    size_t capacity() const { return capacity_; }
+
+    // Reads up to |size| bytes from |fd|, and at most capacity(). Returns the number of bytes read,
+    // 0 at EOF, or -1 with errno set.
+    ssize_t Fill(borrowed_fd fd, size_t size) {
+        size = std::min(size, capacity_);
+        if (pipe_write_ != -1) {
+            ssize_t rc = TEMP_FAILURE_RETRY(
+                    splice(fd.get(), nullptr, pipe_write_.get(), nullptr, size, SPLICE_F_MOVE));
+            if (rc != -1 || (errno != EINVAL && errno != ENOSYS)) {
+                held_ = std::max<ssize_t>(rc, 0);
+                return rc;
+            }
+            ClosePipe();
+        }
+        ssize_t rc = adb_read(fd, buffer_.data(), size);
+        held_ = std::max<ssize_t>(rc, 0);
+        return rc;
+    }
+
+    // Writes |header_size| bytes of |header| to |fd|, followed by everything that the last Fill
+    // read. If |fd| is -1, the data is thrown away instead.
+    bool Drain(borrowed_fd fd, const void* header = nullptr, size_t header_size = 0) {
+        size_t size = std::exchange(held_, 0);
+        if (pipe_read_ != -1) {
+            if (header_size != 0 && !WriteFdExactly(fd, header, header_size)) return false;
+            while (size > 0 && fd.get() != -1) {
+                ssize_t rc = TEMP_FAILURE_RETRY(
+                        splice(pipe_read_.get(), nullptr, fd.get(), nullptr, size, SPLICE_F_MOVE));
+                if (rc == -1 && (errno == EINVAL || errno == ENOSYS)) {
+                    // |fd| can't be spliced to, so copy the rest, and don't use the pipe again.
+                    if (!ReadFdExactly(pipe_read_, buffer_.data(), size)) return false;
+                    ClosePipe();
+                    return WriteFdExactly(fd, buffer_.data(), size);
+                } else if (rc <= 0) {
+                    // Empty the pipe, so that it's ready for the next Fill.
+                    int saved_errno = errno;
+                    ReadFdExactly(pipe_read_, buffer_.data(), size);
+                    errno = saved_errno;
+                    return false;
+                }
+                size -= rc;
+            }
+            return size == 0 || ReadFdExactly(pipe_read_, buffer_.data(), size);
+        }
+
+        if (fd.get() == -1) return true;
+        adb_iovec iov[2] = {
+                {.iov_base = const_cast<void*>(header), .iov_len = header_size},
+                {.iov_base = buffer_.data(), .iov_len = size},
+        };
+        return WritevFdExactly(fd, iov, 2);
+    }
+
+  private:
+    void ClosePipe() {
+        pipe_read_.reset();
+        pipe_write_.reset();
+        capacity_ = buffer_.size();
+    }
+
+    std::vector<char>& buffer_;
+    unique_fd pipe_read_;
+    unique_fd pipe_write_;
+    size_t capacity_ = 0;
+    size_t held_ = 0;
+};
+
+// The uncompressed case of handle_send_file_data, which moves the data straight from the socket to
+// the file.
+static bool handle_send_file_data_uncompressed(borrowed_fd s, borrowed_fd fd, uint32_t* timestamp,
+                                               std::vector<char>& buffer) {
+    SyncDataMover mover(buffer);
+    syncmsg msg;
+    while (true) {
+        if (!ReadFdExactly(s, &msg.data, sizeof(msg.data))) return false;
+
+        if (msg.data.id == ID_DONE) {
+            *timestamp = msg.data.size;
+            return true;
+        } else if (msg.data.id != ID_DATA) {
+            SendSyncFail(s, "invalid data message");
+            return false;
+        }
+
+        for (size_t remaining = msg.data.size; remaining > 0;) {
+            ssize_t rc = mover.Fill(s, remaining);
+            if (rc <= 0) return false;
+            remaining -= rc;
+
+            if (!mover.Drain(fd)) {
+                // Read the rest of the message, so that the failure can be reported in step.
+                int saved_errno = errno;
+                while (remaining > 0) {
+                    rc = mover.Fill(s, remaining);
+                    if (rc <= 0 || !mover.Drain(-1)) return false;
+                    remaining -= rc;
+                }
+                errno = saved_errno;
+                SendSyncFailErrno(s, "write failed");
+                return false;
+            }
+        }
+    }
+}
+
 static bool handle_send_file_data(borrowed_fd s, unique_fd fd, uint32_t* timestamp,
-                                  CompressionType compression) {
+                                  CompressionType compression, std::vector<char>& buffer) {
+    if (compression == CompressionType::None) {
+        return handle_send_file_data_uncompressed(s, fd, timestamp, buffer);
+    }
+
     syncmsg msg;
-    Block buffer(SYNC_DATA_MAX);
     std::span<char> buffer_span(buffer.data(), buffer.size());
     std::variant<std::monostate, NullDecoder, BrotliDecoder, LZ4Decoder, ZstdDecoder>
             decoder_storage;
@@ -302,7 +582,14 @@ static bool handle_send_file_data(borrowed_fd s, unique_fd fd, uint32_t* timesta
             break;
 
         case CompressionType::Any:
-            LOG(FATAL) << "unexpected CompressionType::Any";
+        case CompressionType::Adaptive:
+            LOG(FATAL) << "unexpected unresolved CompressionType";
+    }
+
+    // fd is -1 if the client is pushing with --dry-run.
+    std::optional<AsyncWriter> writer;
+    if (fd != -1) {
+        writer.emplace(fd);
     }
 
     while (true) {
@@ -328,12 +615,9 @@ static bool handle_send_file_data(borrowed_fd s, unique_fd fd, uint32_t* timesta
                 return false;
             }
 
-            // fd is -1 if the client is pushing with --dry-run.
-            if (fd != -1) {
-                if (!WriteFdExactly(fd, output.data(), output.size())) {
-                    SendSyncFailErrno(s, "write failed");
-                    return false;
-                }
+            if (writer && !writer->Write(output.data(), output.size())) {
+                SendSyncFailErrno(s, "write failed");
+                return false;
             }
 
             if (result == DecodeResult::NeedInput) {
@@ -341,6 +625,10 @@ static bool handle_send_file_data(borrowed_fd s, unique_fd fd, uint32_t* timesta
             } else if (result == DecodeResult::MoreOutput) {
                 continue;
             } else if (result == DecodeResult::Done) {
+                if (writer && !writer->Finish()) {
+                    SendSyncFailErrno(s, "write failed");
+                    return false;
+                }
                 return true;
             } else {
                 LOG(FATAL) << "invalid DecodeResult: " << static_cast<int>(result);
@@ -351,12 +639,74 @@ static bool handle_send_file_data(borrowed_fd s, unique_fd fd, uint32_t* timesta
     __builtin_unreachable();
 }
 
+// Gives the file at |path| that's open as |fd| the owner and mode it should have after a push.
+// On failure, returns false with |error| set.
+static bool set_send_file_owner(borrowed_fd fd, const char* path, uid_t uid, gid_t gid,
+                                mode_t mode, std::string* error) {
+    if (fchown(fd.get(), uid, gid) == -1) {
+        struct stat st;
+        std::string real_path;
+
+        // Only return failure if parent directory does not have S_ISGID bit set,
+        // if S_ISGID is set then file will inherit groupid from directory.
+        if (!Realpath(path, &real_path) || lstat(Dirname(real_path).c_str(), &st) == -1 ||
+            (S_ISDIR(st.st_mode) && (st.st_mode & S_ISGID) == 0)) {
+            *error = StringPrintf("fchown() failed uid: %d gid: %d: %s", uid, gid,
+                                  strerror(errno));
+            return false;
+        }
+    }
+
+#if defined(__ANDROID__)
+    // Not all filesystems support setting SELinux labels. http://b/23530370.
+    selinux_android_restorecon(path, 0);
+#endif
+
+    // fchown clears the setuid bit - restore it if present.
+    // Ignore the result of calling fchmod. It's not supported
+    // by all filesystems, so we don't check for success. b/12441485
+    fchmod(fd.get(), mode);
+    return true;
+}
+
+// If there's a problem on the device, we'll send an ID_FAIL message and
+// close the socket. Unfortunately the kernel will sometimes throw that
+// data away if the other end keeps writing without reading (which is
+// the case with old versions of adb). To maintain compatibility, keep
+// reading and throwing away ID_DATA packets until the other side notices
+// that we've reported an error.
+static void discard_send_file_data(borrowed_fd s, std::vector<char>& buffer) {
+    syncmsg msg;
+    while (true) {
+        if (!ReadFdExactly(s, &msg.data, sizeof(msg.data))) break;
+
+        if (msg.data.id == ID_DONE) {
+            break;
+        } else if (msg.data.id != ID_DATA) {
+            char id[5];
+            memcpy(id, &msg.data.id, sizeof(msg.data.id));
+            id[4] = '\0';
+            D("handle_send_fail received unexpected id '%s' during failure", id);
+            break;
+        }
+
+        if (msg.data.size > buffer.size()) {
+            D("handle_send_fail received oversized packet of length '%u' during failure",
+              msg.data.size);
+            break;
+        }
+
+        if (!ReadFdExactly(s, &buffer[0], msg.data.size)) break;
+    }
+}
+
 static bool handle_send_file(borrowed_fd s, const char* path, uint32_t* timestamp, uid_t uid,
                              gid_t gid, uint64_t capabilities, mode_t mode,
                              CompressionType compression, bool dry_run, std::vector<char>& buffer,
                              bool do_unlink) {
     syncmsg msg;
     unique_fd fd;
+    std::string error;
 
     if (!dry_run) {
         __android_log_security_bswrite(SEC_TAG_ADB_SEND_FILE, path);
@@ -375,29 +725,9 @@ static bool handle_send_file(borrowed_fd s, const char* path, uint32_t* timestam
         if (fd < 0) {
             SendSyncFailErrno(s, "couldn't create file");
             goto fail;
-        } else {
-            if (fchown(fd.get(), uid, gid) == -1) {
-                struct stat st;
-                std::string real_path;
-
-                // Only return failure if parent directory does not have S_ISGID bit set,
-                // if S_ISGID is set then file will inherit groupid from directory.
-                if (!Realpath(path, &real_path) || lstat(Dirname(real_path).c_str(), &st) == -1 ||
-                    (S_ISDIR(st.st_mode) && (st.st_mode & S_ISGID) == 0)) {
-                    SendSyncFailErrno(s, StringPrintf("fchown() failed uid: %d gid: %d", uid, gid));
-                    goto fail;
-                }
-            }
-
-#if defined(__ANDROID__)
-            // Not all filesystems support setting SELinux labels. http://b/23530370.
-            selinux_android_restorecon(path, 0);
-#endif
-
-            // fchown clears the setuid bit - restore it if present.
-            // Ignore the result of calling fchmod. It's not supported
-            // by all filesystems, so we don't check for success. b/12441485
-            fchmod(fd.get(), mode);
+        } else if (!set_send_file_owner(fd, path, uid, gid, mode, &error)) {
+            SendSyncFail(s, error);
+            goto fail;
         }
 
         int rc = posix_fadvise(fd.get(), 0, 0,
@@ -407,7 +737,7 @@ static bool handle_send_file(borrowed_fd s, const char* path, uint32_t* timestam
         }
     }
 
-    if (!handle_send_file_data(s, std::move(fd), timestamp, compression)) {
+    if (!handle_send_file_data(s, std::move(fd), timestamp, compression, buffer)) {
         goto fail;
     }
 
@@ -421,34 +751,7 @@ static bool handle_send_file(borrowed_fd s, const char* path, uint32_t* timestam
     return WriteFdExactly(s, &msg.status, sizeof(msg.status));
 
 fail:
-    // If there's a problem on the device, we'll send an ID_FAIL message and
-    // close the socket. Unfortunately the kernel will sometimes throw that
-    // data away if the other end keeps writing without reading (which is
-    // the case with old versions of adb). To maintain compatibility, keep
-    // reading and throwing away ID_DATA packets until the other side notices
-    // that we've reported an error.
-    while (true) {
-        if (!ReadFdExactly(s, &msg.data, sizeof(msg.data))) break;
-
-        if (msg.data.id == ID_DONE) {
-            break;
-        } else if (msg.data.id != ID_DATA) {
-            char id[5];
-            memcpy(id, &msg.data.id, sizeof(msg.data.id));
-            id[4] = '\0';
-            D("handle_send_fail received unexpected id '%s' during failure", id);
-            break;
-        }
-
-        if (msg.data.size > buffer.size()) {
-            D("handle_send_fail received oversized packet of length '%u' during failure",
-              msg.data.size);
-            break;
-        }
-
-        if (!ReadFdExactly(s, &buffer[0], msg.data.size)) break;
-    }
-
+    discard_send_file_data(s, buffer);
     if (do_unlink) adb_unlink(path);
     return false;
 }
@@ -511,6 +814,22 @@ static bool handle_send_link(int s, const std::string& path, uint32_t* timestamp
 }
 #endif
 
+// Works out the mode, owner and capabilities of a regular file pushed to |path| with |mode|.
+static void get_send_file_attributes(const std::string& path, bool dry_run, mode_t* mode,
+                                     uid_t* uid, gid_t* gid, uint64_t* capabilities) {
+    // Copy user permission bits to "group" and "other" permissions.
+    *mode &= 0777;
+    *mode |= ((*mode >> 3) & 0070);
+    *mode |= ((*mode >> 3) & 0007);
+
+    *uid = -1;
+    *gid = -1;
+    *capabilities = 0;
+    if (!dry_run && should_use_fs_config(path)) {
+        adbd_fs_config(path.c_str(), false, nullptr, uid, gid, mode, capabilities);
+    }
+}
+
 static bool send_impl(int s, const std::string& path, mode_t mode, CompressionType compression,
                       bool dry_run, std::vector<char>& buffer) {
     // Don't delete files before copying if they are not "regular" or symlinks.
@@ -529,18 +848,10 @@ static bool send_impl(int s, const std::string& path, mode_t mode, CompressionTy
     if (S_ISLNK(mode)) {
         result = handle_send_link(s, path, &timestamp, dry_run, buffer);
     } else {
-        // Copy user permission bits to "group" and "other" permissions.
-        mode &= 0777;
-        mode |= ((mode >> 3) & 0070);
-        mode |= ((mode >> 3) & 0007);
-
-        uid_t uid = -1;
-        gid_t gid = -1;
-        uint64_t capabilities = 0;
-        if (!dry_run && should_use_fs_config(path)) {
-            adbd_fs_config(path.c_str(), false, nullptr, &uid, &gid, &mode, &capabilities);
-        }
-
+        uid_t uid;
+        gid_t gid;
+        uint64_t capabilities;
+        get_send_file_attributes(path, dry_run, &mode, &uid, &gid, &capabilities);
         result = handle_send_file(s, path.c_str(), &timestamp, uid, gid, capabilities, mode,
                                   compression, dry_run, buffer, do_unlink);
     }
@@ -578,62 +889,645 @@ static bool do_send_v1(int s, const std::string& spec, std::vector<char>& buffer
     return send_impl(s, path, mode, CompressionType::None, false, buffer);
 }
 
-static bool do_send_v2(int s, const std::string& path, std::vector<char>& buffer) {
-    // Read the setup packet.
-    syncmsg msg;
-    int rc = ReadFdExactly(s, &msg.send_v2_setup, sizeof(msg.send_v2_setup));
-    if (rc == 0) {
-        LOG(ERROR) << "failed to read send_v2 setup packet: EOF";
-        return false;
-    } else if (rc < 0) {
-        PLOG(ERROR) << "failed to read send_v2 setup packet";
-    }
-
-    bool dry_run = false;
+// Parses the flags of a send_v2, send_batch, recv_v2 or recv_range setup packet. Only sends can
+// be dry runs, so the dry run flag is rejected when |dry_run| is null.
+static bool parse_sync_flags(borrowed_fd s, uint32_t flags, CompressionType* compression_type,
+                             bool* dry_run) {
+    if (dry_run) *dry_run = false;
     std::optional<CompressionType> compression;
 
-    uint32_t orig_flags = msg.send_v2_setup.flags;
-    if (msg.send_v2_setup.flags & kSyncFlagBrotli) {
-        msg.send_v2_setup.flags &= ~kSyncFlagBrotli;
+    uint32_t orig_flags = flags;
+    if (flags & kSyncFlagBrotli) {
+        flags &= ~kSyncFlagBrotli;
         if (compression) {
             SendSyncFail(s, StringPrintf("multiple compression flags received: %d", orig_flags));
             return false;
         }
         compression = CompressionType::Brotli;
     }
-    if (msg.send_v2_setup.flags & kSyncFlagLZ4) {
-        msg.send_v2_setup.flags &= ~kSyncFlagLZ4;
+    if (flags & kSyncFlagLZ4) {
+        flags &= ~kSyncFlagLZ4;
         if (compression) {
             SendSyncFail(s, StringPrintf("multiple compression flags received: %d", orig_flags));
             return false;
         }
         compression = CompressionType::LZ4;
     }
-    if (msg.send_v2_setup.flags & kSyncFlagZstd) {
-        msg.send_v2_setup.flags &= ~kSyncFlagZstd;
+    if (flags & kSyncFlagZstd) {
+        flags &= ~kSyncFlagZstd;
         if (compression) {
             SendSyncFail(s, StringPrintf("multiple compression flags received: %d", orig_flags));
             return false;
         }
         compression = CompressionType::Zstd;
     }
-    if (msg.send_v2_setup.flags & kSyncFlagDryRun) {
-        msg.send_v2_setup.flags &= ~kSyncFlagDryRun;
-        dry_run = true;
+    if (dry_run && (flags & kSyncFlagDryRun)) {
+        flags &= ~kSyncFlagDryRun;
+        *dry_run = true;
+    }
+
+    if (flags) {
+        SendSyncFail(s, StringPrintf("unknown flags: %d", flags));
+        return false;
+    }
+
+    *compression_type = compression.value_or(CompressionType::None);
+    return true;
+}
+
+static bool do_send_v2(int s, const std::string& path, std::vector<char>& buffer) {
+    // Read the setup packet.
+    syncmsg msg;
+    int rc = ReadFdExactly(s, &msg.send_v2_setup, sizeof(msg.send_v2_setup));
+    if (rc == 0) {
+        LOG(ERROR) << "failed to read send_v2 setup packet: EOF";
+        return false;
+    } else if (rc < 0) {
+        PLOG(ERROR) << "failed to read send_v2 setup packet";
     }
 
-    if (msg.send_v2_setup.flags) {
-        SendSyncFail(s, StringPrintf("unknown flags: %d", msg.send_v2_setup.flags));
+    CompressionType compression;
+    bool dry_run;
+    if (!parse_sync_flags(s, msg.send_v2_setup.flags, &compression, &dry_run)) {
         return false;
     }
 
     errno = 0;
-    return send_impl(s, path, msg.send_v2_setup.mode, compression.value_or(CompressionType::None),
-                     dry_run, buffer);
+    return send_impl(s, path, msg.send_v2_setup.mode, compression, dry_run, buffer);
+}
+
+// Fails a send_v3 after the signatures have been sent. The rest of the client's data is read and
+// thrown away, unless it's all been read already.
+static bool fail_send_v3(borrowed_fd s, const std::string& reason, bool discard,
+                         const std::string& temp_path, std::vector<char>& buffer) {
+    adb_unlink(temp_path.c_str());
+    SendSyncFail(s, reason);
+    if (discard) {
+        discard_send_file_data(s, buffer);
+    }
+    return false;
+}
+
+// Builds the new file of a send_v3 from its uncompressed stream of literal data and copies of
+// blocks of the existing file.
+class SendDeltaWriter {
+  public:
+    SendDeltaWriter(borrowed_fd old_fd, borrowed_fd fd, uint32_t block_size, uint64_t block_count)
+        : old_fd_(old_fd), fd_(fd), block_count_(block_count), block_(block_size) {}
+
+    // Consumes the next part of the stream. Returns false, with error() set, if the stream is
+    // malformed or the file can't be written.
+    bool Write(std::span<const char> data) {
+        while (!data.empty()) {
+            if (remaining_ > 0) {
+                size_t size = std::min<uint64_t>(remaining_, data.size());
+                if (!WriteFdExactly(fd_, data.data(), size)) {
+                    return Fail(StringPrintf("write failed: %s", strerror(errno)));
+                }
+                data = data.subspan(size);
+                remaining_ -= size;
+                continue;
+            }
+
+            // Literal data has a sync_data header, and a copy is a sync_delta_copy, which starts
+            // the same way.
+            size_t header_size = sizeof(header_.data);
+            if (header_bytes_ >= sizeof(header_.data) && header_.data.id == ID_COPY) {
+                header_size = sizeof(header_.copy);
+            }
+            size_t size = std::min(header_size - header_bytes_, data.size());
+            memcpy(reinterpret_cast<char*>(&header_) + header_bytes_, data.data(), size);
+            data = data.subspan(size);
+            header_bytes_ += size;
+            if (header_bytes_ < sizeof(header_.data)) break;
+
+            if (header_.data.id == ID_DATA) {
+                header_bytes_ = 0;
+                remaining_ = header_.data.size;
+            } else if (header_.data.id != ID_COPY) {
+                return Fail("invalid data message");
+            } else if (header_bytes_ == sizeof(header_.copy)) {
+                header_bytes_ = 0;
+                if (!Copy(header_.copy.first_block, header_.copy.block_count)) return false;
+            }
+        }
+        return true;
+    }
+
+    // Whether the stream ended between two messages.
+    bool Finished() const { return header_bytes_ == 0 && remaining_ == 0; }
+
+    const std::string& error() const { return error_; }
+
+  private:
+    bool Copy(uint64_t first, uint32_t count) {
+        if (first > block_count_ || count > block_count_ - first) {
+            return Fail("invalid copy message");
+        }
+        for (uint64_t block = first; block < first + count; ++block) {
+            if (!android::base::ReadFullyAtOffset(old_fd_.get(), block_.data(), block_.size(),
+                                                  block * block_.size())) {
+                return Fail(StringPrintf("couldn't read existing file: %s", strerror(errno)));
+            }
+            if (!WriteFdExactly(fd_, block_.data(), block_.size())) {
+                return Fail(StringPrintf("write failed: %s", strerror(errno)));
+            }
+        }
+        return true;
+    }
+
+    bool Fail(const std::string& error) {
+        error_ = error;
+        return false;
+    }
+
+    borrowed_fd old_fd_;
+    borrowed_fd fd_;
+    uint64_t block_count_;
+    std::vector<char> block_;
+
+    union {
+        sync_data data;
+        sync_delta_copy copy;
+    } header_ = {};
+    size_t header_bytes_ = 0;
+    // How much literal data is left of the current message.
+    uint64_t remaining_ = 0;
+    std::string error_;
+};
+
+static bool do_send_v3(int s, const std::string& path, std::vector<char>& buffer) {
+    syncmsg msg;
+    if (!ReadFdExactly(s, &msg.send_v2_setup, sizeof(msg.send_v2_setup))) {
+        PLOG(ERROR) << "failed to read send_v3 setup packet";
+        return false;
+    }
+    CompressionType compression;
+    if (!parse_sync_flags(s, msg.send_v2_setup.flags, &compression, nullptr)) {
+        return false;
+    }
+    if (S_ISLNK(msg.send_v2_setup.mode)) {
+        SendSyncFail(s, "send_v3 doesn't support symlinks");
+        return false;
+    }
+
+    mode_t mode = msg.send_v2_setup.mode;
+    uid_t uid;
+    gid_t gid;
+    uint64_t capabilities;
+    get_send_file_attributes(path, false, &mode, &uid, &gid, &capabilities);
+
+    __android_log_security_bswrite(SEC_TAG_ADB_SEND_FILE, path.c_str());
+
+    // Only a regular file can be used as the basis of the delta. Anything else that's in the way
+    // is an error, as it would be for send_v2, except for a symlink, which gets replaced.
+    unique_fd old_fd;
+    uint32_t block_size = kDeltaMinBlockSize;
+    uint64_t block_count = 0;
+    std::vector<sync_delta_block> signatures;
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0) {
+        if (S_ISREG(st.st_mode)) {
+            // The signatures of the existing file are sent back to the host, so this reads the
+            // file as well as writing it.
+            __android_log_security_bswrite(SEC_TAG_ADB_RECV_FILE, path.c_str());
+            old_fd.reset(adb_open(path.c_str(), O_RDONLY | O_CLOEXEC));
+            if (old_fd < 0) {
+                SendSyncFailErrno(s, "couldn't open existing file");
+                return false;
+            }
+            block_size = delta_block_size(st.st_size);
+            block_count = std::min<uint64_t>(st.st_size / block_size, kDeltaMaxBlocks);
+            signatures.reserve(block_count);
+            bool read = compute_delta_signatures(
+                    old_fd, block_size, block_count,
+                    [&signatures](std::span<const sync_delta_block> batch) {
+                        signatures.insert(signatures.end(), batch.begin(), batch.end());
+                        return true;
+                    });
+            if (!read) {
+                SendSyncFailErrno(s, "couldn't read existing file");
+                return false;
+            }
+        } else if (S_ISDIR(st.st_mode)) {
+            errno = EISDIR;
+            SendSyncFailErrno(s, "couldn't replace existing file");
+            return false;
+        } else if (!S_ISLNK(st.st_mode)) {
+            SendSyncFail(s, "send_v3 can only replace regular files");
+            return false;
+        }
+    }
+
+    // Build the new file next to the old one, so it can be renamed over it.
+    std::string temp_path = Dirname(path) + "/.adb_send_XXXXXX";
+    unique_fd fd(mkostemp(temp_path.data(), O_CLOEXEC));
+    if (fd < 0 && errno == ENOENT) {
+        if (!secure_mkdirs(Dirname(path))) {
+            SendSyncFailErrno(s, "secure_mkdirs() failed");
+            return false;
+        }
+        temp_path = Dirname(path) + "/.adb_send_XXXXXX";
+        fd.reset(mkostemp(temp_path.data(), O_CLOEXEC));
+    }
+    if (fd < 0) {
+        SendSyncFailErrno(s, "couldn't create file");
+        return false;
+    }
+    std::string error;
+    if (!set_send_file_owner(fd, temp_path.c_str(), uid, gid, mode, &error)) {
+        SendSyncFail(s, error);
+        adb_unlink(temp_path.c_str());
+        return false;
+    }
+
+    msg.delta_signatures.id = ID_SIGS;
+    msg.delta_signatures.block_size = block_size;
+    msg.delta_signatures.block_count = block_count;
+    if (!WriteFdExactly(s, &msg.delta_signatures, sizeof(msg.delta_signatures)) ||
+        !WriteFdExactly(s, signatures.data(), signatures.size() * sizeof(sync_delta_block))) {
+        adb_unlink(temp_path.c_str());
+        return false;
+    }
+
+    Block output_buffer(SYNC_DATA_MAX);
+    std::span<char> output_span(output_buffer.data(), output_buffer.size());
+    std::variant<std::monostate, NullDecoder, BrotliDecoder, LZ4Decoder, ZstdDecoder>
+            decoder_storage;
+    Decoder* decoder = nullptr;
+
+    switch (compression) {
+        case CompressionType::None:
+            decoder = &decoder_storage.emplace<NullDecoder>(output_span);
+            break;
+
+        case CompressionType::Brotli:
+            decoder = &decoder_storage.emplace<BrotliDecoder>(output_span);
+            break;
+
+        case CompressionType::LZ4:
+            decoder = &decoder_storage.emplace<LZ4Decoder>(output_span);
+            break;
+
+        case CompressionType::Zstd:
+            decoder = &decoder_storage.emplace<ZstdDecoder>(output_span);
+            break;
+
+        case CompressionType::Any:
+        case CompressionType::Adaptive:
+            LOG(FATAL) << "unexpected unresolved CompressionType";
+    }
+
+    SendDeltaWriter writer(old_fd, fd, block_size, block_count);
+    uint32_t timestamp = 0;
+    bool finishing = false;
+    bool done = false;
+    while (!done) {
+        if (!ReadFdExactly(s, &msg.data, sizeof(msg.data))) {
+            adb_unlink(temp_path.c_str());
+            return false;
+        }
+
+        if (msg.data.id == ID_DONE) {
+            timestamp = msg.data.size;
+            finishing = true;
+            decoder->Finish();
+        } else if (msg.data.id == ID_DATA && msg.data.size <= buffer.size()) {
+            Block block(msg.data.size);
+            if (!ReadFdExactly(s, block.data(), msg.data.size)) {
+                adb_unlink(temp_path.c_str());
+                return false;
+            }
+            decoder->Append(std::move(block));
+        } else {
+            return fail_send_v3(s, "invalid data message", false, temp_path, buffer);
+        }
+
+        while (true) {
+            std::span<char> output;
+            DecodeResult result = decoder->Decode(&output);
+            if (result == DecodeResult::Error) {
+                return fail_send_v3(s, "decompress failed", !finishing, temp_path, buffer);
+            }
+
+            if (!writer.Write(output)) {
+                return fail_send_v3(s, writer.error(), !finishing, temp_path, buffer);
+            }
+
+            if (result == DecodeResult::NeedInput) {
+                break;
+            } else if (result == DecodeResult::MoreOutput) {
+                continue;
+            } else if (result == DecodeResult::Done) {
+                done = true;
+                break;
+            } else {
+                LOG(FATAL) << "invalid DecodeResult: " << static_cast<int>(result);
+            }
+        }
+    }
+    if (!writer.Finished()) {
+        return fail_send_v3(s, "truncated send_v3 stream", false, temp_path, buffer);
+    }
+
+    fd.reset();
+    if (!update_capabilities(temp_path.c_str(), capabilities)) {
+        SendSyncFailErrno(s, "update_capabilities failed");
+        adb_unlink(temp_path.c_str());
+        return false;
+    }
+    if (adb_rename(temp_path.c_str(), path.c_str()) != 0) {
+        SendSyncFailErrno(s, "rename failed");
+        adb_unlink(temp_path.c_str());
+        return false;
+    }
+
+#if defined(__ANDROID__)
+    // The temporary file was labelled for its own name.
+    selinux_android_restorecon(path.c_str(), 0);
+#endif
+
+    struct timeval tv[2];
+    tv[0].tv_sec = timestamp;
+    tv[0].tv_usec = 0;
+    tv[1].tv_sec = timestamp;
+    tv[1].tv_usec = 0;
+    lutimes(path.c_str(), tv);
+
+    msg.status.id = ID_OKAY;
+    msg.status.msglen = 0;
+    return WriteFdExactly(s, &msg.status, sizeof(msg.status));
+}
+
+// Creates the regular file |path| for a send_batch, replacing a regular file or symlink that's
+// already there. Other kinds of file are written to in place, as for send_v2.
+static unique_fd create_send_batch_file(const std::string& path, mode_t mode) {
+    unique_fd fd(adb_open_mode(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode));
+    if (fd < 0 && errno == ENOENT) {
+        if (!secure_mkdirs(Dirname(path))) return {};
+        fd.reset(adb_open_mode(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode));
+    }
+    if (fd < 0 && errno == EEXIST) {
+        struct stat st;
+        if (lstat(path.c_str(), &st) == 0 && (S_ISREG(st.st_mode) || S_ISLNK(st.st_mode))) {
+            adb_unlink(path.c_str());
+            fd.reset(adb_open_mode(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode));
+        } else {
+            fd.reset(adb_open_mode(path.c_str(), O_WRONLY | O_CLOEXEC, mode));
+        }
+    }
+    return fd;
+}
+
+// Writes out the files in a send_batch stream as it's decompressed. A file that can't be written
+// is recorded as a failure, and the rest of the batch carries on.
+class SendBatchWriter {
+  public:
+    SendBatchWriter(const std::string& root, uint32_t count, bool dry_run)
+        : root_(root), count_(count), dry_run_(dry_run) {
+        if (root_.empty() || root_.back() != '/') root_ += '/';
+    }
+
+    ~SendBatchWriter() {
+        if (fd_ != -1) {
+            fd_.reset();
+            adb_unlink(path_.c_str());
+        }
+    }
+
+    // Consumes the next part of the stream. Returns false if the stream is malformed.
+    bool Write(std::span<const char> data) {
+        while (!data.empty()) {
+            if (state_ == State::kEntry) {
+                size_t size = std::min(sizeof(entry_) - entry_bytes_, data.size());
+                memcpy(reinterpret_cast<char*>(&entry_) + entry_bytes_, data.data(), size);
+                data = data.subspan(size);
+                entry_bytes_ += size;
+                if (entry_bytes_ < sizeof(entry_)) break;
+
+                if (entry_.path_length == 0 || entry_.path_length > 1024 || files_ == count_) {
+                    return false;
+                }
+                ++files_;
+                entry_bytes_ = 0;
+                path_ = root_;
+                state_ = State::kPath;
+            } else if (state_ == State::kPath) {
+                size_t size = std::min(root_.size() + entry_.path_length - path_.size(),
+                                       data.size());
+                path_.append(data.data(), size);
+                data = data.subspan(size);
+                if (path_.size() < root_.size() + entry_.path_length) break;
+
+                StartFile();
+                remaining_ = entry_.size;
+                state_ = State::kData;
+            } else {
+                size_t size = std::min<uint64_t>(remaining_, data.size());
+                if (fd_ != -1 && !WriteFdExactly(fd_, data.data(), size)) {
+                    FailFile(StringPrintf("write failed: %s", strerror(errno)));
+                }
+                data = data.subspan(size);
+                remaining_ -= size;
+            }
+
+            if (state_ == State::kData && remaining_ == 0) {
+                FinishFile();
+                state_ = State::kEntry;
+            }
+        }
+        return true;
+    }
+
+    // Whether the stream ended with the last of the files it was meant to have.
+    bool Finished() const {
+        return state_ == State::kEntry && entry_bytes_ == 0 && files_ == count_;
+    }
+
+    uint32_t failures() const { return failures_; }
+    const std::string& first_failure() const { return first_failure_; }
+
+  private:
+    void StartFile() {
+        if (!S_ISREG(entry_.mode)) {
+            FailFile("not a regular file");
+            return;
+        }
+        if (dry_run_) return;
+
+        mode_ = entry_.mode;
+        get_send_file_attributes(path_, false, &mode_, &uid_, &gid_, &capabilities_);
+        __android_log_security_bswrite(SEC_TAG_ADB_SEND_FILE, path_.c_str());
+
+        fd_ = create_send_batch_file(path_, mode_);
+        if (fd_ < 0) {
+            FailFile(StringPrintf("couldn't create file: %s", strerror(errno)));
+            return;
+        }
+
+        std::string error;
+        if (!set_send_file_owner(fd_, path_.c_str(), uid_, gid_, mode_, &error)) {
+            FailFile(error);
+        }
+    }
+
+    void FinishFile() {
+        if (fd_ == -1) return;
+
+        if (!update_capabilities(path_.c_str(), capabilities_)) {
+            FailFile(StringPrintf("update_capabilities failed: %s", strerror(errno)));
+            return;
+        }
+
+        struct timespec times[2];
+        times[0].tv_sec = entry_.mtime;
+        times[0].tv_nsec = 0;
+        times[1] = times[0];
+        futimens(fd_.get(), times);
+        fd_.reset();
+    }
+
+    void FailFile(const std::string& reason) {
+        if (failures_++ == 0) {
+            first_failure_ = StringPrintf("'%s': %s", path_.c_str(), reason.c_str());
+        }
+        if (fd_ != -1) {
+            fd_.reset();
+            adb_unlink(path_.c_str());
+        }
+    }
+
+    enum class State { kEntry, kPath, kData };
+
+    std::string root_;
+    uint32_t count_;
+    bool dry_run_;
+
+    State state_ = State::kEntry;
+    sync_send_batch_entry entry_;
+    size_t entry_bytes_ = 0;
+    uint32_t files_ = 0;
+
+    // The file that's being written.
+    std::string path_;
+    unique_fd fd_;
+    uint64_t remaining_ = 0;
+    mode_t mode_;
+    uid_t uid_;
+    gid_t gid_;
+    uint64_t capabilities_;
+
+    uint32_t failures_ = 0;
+    std::string first_failure_;
+};
+
+static bool do_send_batch(int s, const std::string& root, std::vector<char>& buffer) {
+    syncmsg msg;
+    if (!ReadFdExactly(s, &msg.send_batch_setup, sizeof(msg.send_batch_setup))) {
+        PLOG(ERROR) << "failed to read send_batch setup packet";
+        return false;
+    }
+
+    CompressionType compression;
+    bool dry_run;
+    if (!parse_sync_flags(s, msg.send_batch_setup.flags, &compression, &dry_run)) {
+        return false;
+    }
+
+    Block output_buffer(SYNC_DATA_MAX);
+    std::span<char> output_span(output_buffer.data(), output_buffer.size());
+    std::variant<std::monostate, NullDecoder, BrotliDecoder, LZ4Decoder, ZstdDecoder>
+            decoder_storage;
+    Decoder* decoder = nullptr;
+
+    switch (compression) {
+        case CompressionType::None:
+            decoder = &decoder_storage.emplace<NullDecoder>(output_span);
+            break;
+
+        case CompressionType::Brotli:
+            decoder = &decoder_storage.emplace<BrotliDecoder>(output_span);
+            break;
+
+        case CompressionType::LZ4:
+            decoder = &decoder_storage.emplace<LZ4Decoder>(output_span);
+            break;
+
+        case CompressionType::Zstd:
+            decoder = &decoder_storage.emplace<ZstdDecoder>(output_span);
+            break;
+
+        case CompressionType::Any:
+        case CompressionType::Adaptive:
+            LOG(FATAL) << "unexpected unresolved CompressionType";
+    }
+
+    SendBatchWriter writer(root, msg.send_batch_setup.count, dry_run);
+    bool done = false;
+    while (!done) {
+        if (!ReadFdExactly(s, &msg.data, sizeof(msg.data))) return false;
+
+        if (msg.data.id == ID_DONE) {
+            decoder->Finish();
+        } else if (msg.data.id == ID_DATA && msg.data.size <= buffer.size()) {
+            Block block(msg.data.size);
+            if (!ReadFdExactly(s, block.data(), msg.data.size)) return false;
+            decoder->Append(std::move(block));
+        } else {
+            SendSyncFail(s, "invalid data message");
+            discard_send_file_data(s, buffer);
+            return false;
+        }
+
+        while (true) {
+            std::span<char> output;
+            DecodeResult result = decoder->Decode(&output);
+            if (result == DecodeResult::Error) {
+                SendSyncFail(s, "decompress failed");
+                discard_send_file_data(s, buffer);
+                return false;
+            }
+
+            if (!writer.Write(output)) {
+                SendSyncFail(s, "invalid send_batch stream");
+                discard_send_file_data(s, buffer);
+                return false;
+            }
+
+            if (result == DecodeResult::NeedInput) {
+                break;
+            } else if (result == DecodeResult::MoreOutput) {
+                continue;
+            } else if (result == DecodeResult::Done) {
+                done = true;
+                break;
+            } else {
+                LOG(FATAL) << "invalid DecodeResult: " << static_cast<int>(result);
+            }
+        }
+    }
+
+    if (!writer.Finished()) {
+        SendSyncFail(s, "truncated send_batch stream");
+        return false;
+    }
+    if (writer.failures() != 0) {
+        SendSyncFail(s, StringPrintf("%u of %u files failed, first %s",
+                                     writer.failures(), msg.send_batch_setup.count,
+                                     writer.first_failure().c_str()));
+        return false;
+    }
+
+    msg.status.id = ID_OKAY;
+    msg.status.msglen = 0;
+    return WriteFdExactly(s, &msg.status, sizeof(msg.status));
 }
 
+// Sends |length| bytes of |path| starting at |offset|, or as much as there is before the end of the
+// file.
 static bool recv_impl(borrowed_fd s, const char* path, CompressionType compression,
-                      std::vector<char>& buffer) {
+                      std::vector<char>& buffer, uint64_t offset = 0,
+                      uint64_t length = UINT64_MAX) {
     __android_log_security_bswrite(SEC_TAG_ADB_RECV_FILE, path);
 
     unique_fd fd(adb_open(path, O_RDONLY | O_CLOEXEC));
@@ -642,7 +1536,13 @@ static bool recv_impl(borrowed_fd s, const char* path, CompressionType compressi
         return false;
     }
 
-    int rc = posix_fadvise(fd.get(), 0, 0, POSIX_FADV_SEQUENTIAL | POSIX_FADV_NOREUSE);
+    if (offset != 0 && adb_lseek(fd, offset, SEEK_SET) == -1) {
+        SendSyncFailErrno(s, "seek failed");
+        return false;
+    }
+
+    int rc = posix_fadvise(fd.get(), offset, length > INT64_MAX ? 0 : length,
+                           POSIX_FADV_SEQUENTIAL | POSIX_FADV_NOREUSE);
     if (rc != 0) {
         D("[ Failed to fadvise: %s ]", strerror(rc));
     }
@@ -650,7 +1550,34 @@ static bool recv_impl(borrowed_fd s, const char* path, CompressionType compressi
     syncmsg msg;
     msg.data.id = ID_DATA;
 
-    std::variant<std::monostate, NullEncoder, BrotliEncoder, LZ4Encoder, ZstdEncoder>
+    if (compression == CompressionType::None) {
+        SyncDataMover mover(buffer);
+        while (length > 0) {
+            ssize_t rc = mover.Fill(fd, std::min<uint64_t>(mover.capacity(), length));
+            if (rc < 0) {
+                SendSyncFailErrno(s, "read failed");
+                return false;
+            } else if (rc == 0) {
+                break;
+            }
+
+            length -= rc;
+            msg.data.size = rc;
+            if (!mover.Drain(s, &msg.data, sizeof(msg.data))) return false;
+        }
+
+        msg.data.id = ID_DONE;
+        msg.data.size = 0;
+        return WriteFdExactly(s, &msg.data, sizeof(msg.data));
+    }
+
+    struct stat st;
+    size_t threads = 1;
+    if (fstat(fd.get(), &st) == 0 && static_cast<uint64_t>(st.st_size) > offset) {
+        threads = compression_threads(std::min<uint64_t>(st.st_size - offset, length));
+    }
+    std::variant<std::monostate, NullEncoder, BrotliEncoder, LZ4Encoder, LZ4ParallelEncoder,
+                 ZstdEncoder>
             encoder_storage;
     Encoder* encoder;
 
@@ -664,21 +1591,26 @@ static bool recv_impl(borrowed_fd s, const char* path, CompressionType compressi
             break;
 
         case CompressionType::LZ4:
-            encoder = &encoder_storage.emplace<LZ4Encoder>(SYNC_DATA_MAX);
+            if (threads > 1) {
+                encoder = &encoder_storage.emplace<LZ4ParallelEncoder>(SYNC_DATA_MAX, threads);
+            } else {
+                encoder = &encoder_storage.emplace<LZ4Encoder>(SYNC_DATA_MAX);
+            }
             break;
 
         case CompressionType::Zstd:
-            encoder = &encoder_storage.emplace<ZstdEncoder>(SYNC_DATA_MAX);
+            encoder = &encoder_storage.emplace<ZstdEncoder>(SYNC_DATA_MAX, threads);
             break;
 
         case CompressionType::Any:
-            LOG(FATAL) << "unexpected CompressionType::Any";
+        case CompressionType::Adaptive:
+            LOG(FATAL) << "unexpected unresolved CompressionType";
     }
 
     bool sending = true;
     while (sending) {
-        Block input(SYNC_DATA_MAX);
-        int r = adb_read(fd.get(), input.data(), input.size());
+        Block input(std::min<uint64_t>(SYNC_DATA_MAX, length));
+        int r = input.empty() ? 0 : adb_read(fd.get(), input.data(), input.size());
         if (r < 0) {
             SendSyncFailErrno(s, "read failed");
             return false;
@@ -687,6 +1619,7 @@ static bool recv_impl(borrowed_fd s, const char* path, CompressionType compressi
         if (r == 0) {
             encoder->Finish();
         } else {
+            length -= r;
             input.resize(r);
             encoder->Append(std::move(input));
         }
@@ -738,39 +1671,76 @@ static bool do_recv_v2(borrowed_fd s, const char* path, std::vector<char>& buffe
         PLOG(ERROR) << "failed to read recv_v2 setup packet";
     }
 
-    std::optional<CompressionType> compression;
-    uint32_t orig_flags = msg.recv_v2_setup.flags;
-    if (msg.recv_v2_setup.flags & kSyncFlagBrotli) {
-        msg.recv_v2_setup.flags &= ~kSyncFlagBrotli;
-        if (compression) {
-            SendSyncFail(s, StringPrintf("multiple compression flags received: %d", orig_flags));
+    CompressionType compression;
+    if (!parse_sync_flags(s, msg.recv_v2_setup.flags, &compression, nullptr)) {
+        return false;
+    }
+    return recv_impl(s, path, compression, buffer);
+}
+
+static bool do_recv_range(borrowed_fd s, const char* path, std::vector<char>& buffer) {
+    syncmsg msg;
+    if (!ReadFdExactly(s, &msg.recv_range_setup, sizeof(msg.recv_range_setup))) {
+        PLOG(ERROR) << "failed to read recv_range setup packet";
+        return false;
+    }
+
+    CompressionType compression;
+    if (!parse_sync_flags(s, msg.recv_range_setup.flags, &compression, nullptr)) {
+        return false;
+    }
+    return recv_impl(s, path, compression, buffer, msg.recv_range_setup.offset,
+                     msg.recv_range_setup.length);
+}
+
+static bool do_hash_v1(borrowed_fd s) {
+    syncmsg msg;
+    if (!ReadFdExactly(s, &msg.hash_v1_request, sizeof(msg.hash_v1_request))) {
+        SendSyncFailErrno(s, "failed to read hash request");
+        return false;
+    }
+    if (msg.hash_v1_request.id != ID_HASH_V1) {
+        SendSyncFail(s, StringPrintf("unexpected hash request id: %#x", msg.hash_v1_request.id));
+        return false;
+    }
+    if (msg.hash_v1_request.count > SYNC_HASH_MAX_PATHS) {
+        SendSyncFail(s, StringPrintf("too many paths to hash: %u", msg.hash_v1_request.count));
+        return false;
+    }
+
+    std::vector<std::string> paths(msg.hash_v1_request.count);
+    for (std::string& path : paths) {
+        SyncRequest request;
+        if (!ReadFdExactly(s, &request, sizeof(request))) {
+            SendSyncFailErrno(s, "failed to read hash path");
             return false;
         }
-        compression = CompressionType::Brotli;
-    }
-    if (msg.recv_v2_setup.flags & kSyncFlagLZ4) {
-        msg.recv_v2_setup.flags &= ~kSyncFlagLZ4;
-        if (compression) {
-            SendSyncFail(s, StringPrintf("multiple compression flags received: %d", orig_flags));
+        if (request.id != ID_HASH_V1 || request.path_length > 1024) {
+            SendSyncFail(s, "invalid hash path");
             return false;
         }
-        compression = CompressionType::LZ4;
-    }
-    if (msg.recv_v2_setup.flags & kSyncFlagZstd) {
-        msg.recv_v2_setup.flags &= ~kSyncFlagZstd;
-        if (compression) {
-            SendSyncFail(s, StringPrintf("multiple compression flags received: %d", orig_flags));
+        path.resize(request.path_length);
+        if (!ReadFdExactly(s, path.data(), path.size())) {
+            SendSyncFailErrno(s, "failed to read hash path");
             return false;
         }
-        compression = CompressionType::Zstd;
     }
 
-    if (msg.recv_v2_setup.flags) {
-        SendSyncFail(s, StringPrintf("unknown flags: %d", msg.recv_v2_setup.flags));
-        return false;
+    // A hash gives away as much about a file as reading it does, so log it like a pull.
+    for (const std::string& path : paths) {
+        __android_log_security_bswrite(SEC_TAG_ADB_RECV_FILE, path.c_str());
     }
 
-    return recv_impl(s, path, compression.value_or(CompressionType::None), buffer);
+    // Reading is usually much slower than hashing on a single core, so hash files on every core.
+    std::vector<FileHashResult> results = hash_files(paths, std::thread::hardware_concurrency());
+    std::vector<sync_hash_v1> response(results.size());
+    for (size_t i = 0; i < results.size(); ++i) {
+        response[i].id = ID_HASH_V1;
+        response[i].error = results[i].error ? errno_to_wire(results[i].error) : 0;
+        response[i].size = results[i].size;
+        memcpy(response[i].sha256, results[i].hash.data(), sizeof(response[i].sha256));
+    }
+    return WriteFdExactly(s, response.data(), response.size() * sizeof(sync_hash_v1));
 }
 
 static const char* sync_id_to_name(uint32_t id) {
@@ -785,14 +1755,24 @@ static const char* sync_id_to_name(uint32_t id) {
       return "list_v1";
     case ID_LIST_V2:
       return "list_v2";
+    case ID_LIST_RECURSIVE:
+        return "list_recursive";
     case ID_SEND_V1:
         return "send_v1";
     case ID_SEND_V2:
         return "send_v2";
+    case ID_SEND_V3:
+        return "send_v3";
+    case ID_SEND_BATCH:
+        return "send_batch";
     case ID_RECV_V1:
         return "recv_v1";
     case ID_RECV_V2:
         return "recv_v2";
+    case ID_RECV_RANGE:
+        return "recv_range";
+    case ID_HASH_V1:
+        return "hash_v1";
     case ID_QUIT:
         return "quit";
     default:
@@ -837,18 +1817,33 @@ static bool handle_sync_command(int fd, std::vector<char>& buffer) {
         case ID_LIST_V2:
             if (!do_list_v2(fd, name)) return false;
             break;
+        case ID_LIST_RECURSIVE:
+            if (!do_list_recursive(fd, name)) return false;
+            break;
         case ID_SEND_V1:
             if (!do_send_v1(fd, name, buffer)) return false;
             break;
         case ID_SEND_V2:
             if (!do_send_v2(fd, name, buffer)) return false;
             break;
+        case ID_SEND_V3:
+            if (!do_send_v3(fd, name, buffer)) return false;
+            break;
+        case ID_SEND_BATCH:
+            if (!do_send_batch(fd, name, buffer)) return false;
+            break;
         case ID_RECV_V1:
             if (!do_recv_v1(fd, name, buffer)) return false;
             break;
         case ID_RECV_V2:
             if (!do_recv_v2(fd, name, buffer)) return false;
             break;
+        case ID_RECV_RANGE:
+            if (!do_recv_range(fd, name, buffer)) return false;
+            break;
+        case ID_HASH_V1:
+            if (!do_hash_v1(fd)) return false;
+            break;
         case ID_QUIT:
             return false;
         default:
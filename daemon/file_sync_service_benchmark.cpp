@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Throughput of adbd's side of push and pull, for uncompressed and compressed transfers. The
+// service runs on a thread at the other end of a socketpair, so this measures how fast adbd moves
+// data between the socket and the filesystem when the link isn't the bottleneck.
+
+#include "daemon/file_sync_service.h"
+
+#include <signal.h>
+
+#include <random>
+#include <string>
+#include <thread>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+
+#include "adb_io.h"
+#include "file_sync_protocol.h"
+#include "sysdeps.h"
+
+static std::string RandomData(size_t size) {
+    std::mt19937 rng(42);
+    std::string data(size, '\0');
+    for (char& c : data) {
+        c = static_cast<char>(rng());
+    }
+    return data;
+}
+
+class SyncServiceFixture {
+  public:
+    SyncServiceFixture() {
+        // This is normally done in main.cpp.
+        signal(SIGPIPE, SIG_IGN);
+
+        int fds[2];
+        CHECK_EQ(0, adb_socketpair(fds));
+        client_.reset(fds[0]);
+        service_ = std::thread(file_sync_service, unique_fd(fds[1]));
+        path_ = std::string(dir_.path) + "/file";
+    }
+
+    ~SyncServiceFixture() {
+        SyncRequest quit = {.id = ID_QUIT, .path_length = 0};
+        WriteFdExactly(client_, &quit, sizeof(quit));
+        service_.join();
+    }
+
+    void Request(uint32_t id, const void* setup, size_t setup_size) {
+        SyncRequest request = {.id = id, .path_length = static_cast<uint32_t>(path_.size())};
+        CHECK(WriteFdExactly(client_, &request, sizeof(request)));
+        CHECK(WriteFdExactly(client_, path_.data(), path_.size()));
+        CHECK(WriteFdExactly(client_, setup, setup_size));
+    }
+
+    borrowed_fd client() const { return client_; }
+    const std::string& path() const { return path_; }
+
+  private:
+    TemporaryDir dir_;
+    std::string path_;
+    unique_fd client_;
+    std::thread service_;
+};
+
+static void BM_SyncSend(benchmark::State& state) {
+    const std::string data = RandomData(state.range(0));
+    SyncServiceFixture fixture;
+
+    for (auto _ : state) {
+        sync_send_v2 setup = {.id = ID_SEND_V2, .mode = S_IFREG | 0644, .flags = 0};
+        fixture.Request(ID_SEND_V2, &setup, sizeof(setup));
+        for (size_t offset = 0; offset < data.size(); offset += SYNC_DATA_MAX) {
+            size_t size = std::min<size_t>(SYNC_DATA_MAX, data.size() - offset);
+            sync_data packet = {.id = ID_DATA, .size = static_cast<uint32_t>(size)};
+            CHECK(WriteFdExactly(fixture.client(), &packet, sizeof(packet)));
+            CHECK(WriteFdExactly(fixture.client(), data.data() + offset, size));
+        }
+        sync_data done = {.id = ID_DONE, .size = 0};
+        CHECK(WriteFdExactly(fixture.client(), &done, sizeof(done)));
+
+        sync_status status;
+        CHECK(ReadFdExactly(fixture.client(), &status, sizeof(status)));
+        CHECK_EQ(static_cast<uint32_t>(ID_OKAY), status.id);
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_SyncSend)->Arg(1 << 20)->Arg(8 << 20)->Arg(64 << 20)->UseRealTime();
+
+static void BM_SyncRecv(benchmark::State& state) {
+    const size_t size = state.range(0);
+    SyncServiceFixture fixture;
+    CHECK(android::base::WriteStringToFile(RandomData(size), fixture.path()));
+
+    std::string buffer(SYNC_DATA_MAX, '\0');
+    for (auto _ : state) {
+        sync_recv_v2 setup = {.id = ID_RECV_V2, .flags = 0};
+        fixture.Request(ID_RECV_V2, &setup, sizeof(setup));
+
+        size_t received = 0;
+        while (true) {
+            sync_data packet;
+            CHECK(ReadFdExactly(fixture.client(), &packet, sizeof(packet)));
+            if (packet.id == ID_DONE) break;
+            CHECK_EQ(static_cast<uint32_t>(ID_DATA), packet.id);
+            CHECK_LE(packet.size, SYNC_DATA_MAX);
+            CHECK(ReadFdExactly(fixture.client(), buffer.data(), packet.size));
+            received += packet.size;
+        }
+        CHECK_EQ(size, received);
+    }
+    state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_SyncRecv)->Arg(1 << 20)->Arg(8 << 20)->Arg(64 << 20)->UseRealTime();
+
+BENCHMARK_MAIN();
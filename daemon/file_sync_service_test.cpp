@@ -0,0 +1,497 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "daemon/file_sync_service.h"
+
+#include <dirent.h>
+#include <signal.h>
+
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include "adb_io.h"
+#include "compression_utils.h"
+#include "file_sync_delta.h"
+#include "file_sync_protocol.h"
+#include "sysdeps.h"
+
+static std::string RandomData(size_t size, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::string data(size, '\0');
+    for (char& c : data) {
+        c = static_cast<char>(rng());
+    }
+    return data;
+}
+
+class FileSyncServiceTest : public ::testing::Test {
+  protected:
+    static void SetUpTestCase() {
+        // This is normally done in main.cpp. adbd closes the connection after a failed push, so
+        // TearDown's ID_QUIT may be written to a closed socket.
+        saved_sigpipe_handler_ = signal(SIGPIPE, SIG_IGN);
+    }
+
+    static void TearDownTestCase() { signal(SIGPIPE, saved_sigpipe_handler_); }
+
+    void SetUp() override {
+        int fds[2];
+        ASSERT_EQ(0, adb_socketpair(fds));
+        client_.reset(fds[0]);
+        service_ = std::thread(file_sync_service, unique_fd(fds[1]));
+        path_ = std::string(dir_.path) + "/file";
+    }
+
+    void TearDown() override {
+        SyncRequest quit = {.id = ID_QUIT, .path_length = 0};
+        WriteFdExactly(client_, &quit, sizeof(quit));
+        service_.join();
+    }
+
+    // Sends |contents| to path_ uncompressed with send_v2, in DATA messages of |packet_size| bytes,
+    // and returns adbd's response.
+    uint32_t SendV2(const std::string& contents, size_t packet_size) {
+        SyncRequest request = {.id = ID_SEND_V2,
+                               .path_length = static_cast<uint32_t>(path_.size())};
+        sync_send_v2 setup = {.id = ID_SEND_V2, .mode = S_IFREG | 0644, .flags = 0};
+        EXPECT_TRUE(WriteFdExactly(client_, &request, sizeof(request)));
+        EXPECT_TRUE(WriteFdExactly(client_, path_.data(), path_.size()));
+        EXPECT_TRUE(WriteFdExactly(client_, &setup, sizeof(setup)));
+        for (size_t offset = 0; offset < contents.size(); offset += packet_size) {
+            size_t size = std::min(packet_size, contents.size() - offset);
+            sync_data data = {.id = ID_DATA, .size = static_cast<uint32_t>(size)};
+            EXPECT_TRUE(WriteFdExactly(client_, &data, sizeof(data)));
+            EXPECT_TRUE(WriteFdExactly(client_, contents.data() + offset, size));
+        }
+        return FinishSendV3();
+    }
+
+    // Pulls path_ uncompressed with recv_v2.
+    std::string RecvV2() {
+        SyncRequest request = {.id = ID_RECV_V2,
+                               .path_length = static_cast<uint32_t>(path_.size())};
+        sync_recv_v2 setup = {.id = ID_RECV_V2, .flags = 0};
+        EXPECT_TRUE(WriteFdExactly(client_, &request, sizeof(request)));
+        EXPECT_TRUE(WriteFdExactly(client_, path_.data(), path_.size()));
+        EXPECT_TRUE(WriteFdExactly(client_, &setup, sizeof(setup)));
+
+        std::string contents;
+        while (true) {
+            sync_data data;
+            EXPECT_TRUE(ReadFdExactly(client_, &data, sizeof(data)));
+            if (data.id != ID_DATA) {
+                EXPECT_EQ(static_cast<uint32_t>(ID_DONE), data.id);
+                return contents;
+            }
+            EXPECT_LE(data.size, SYNC_DATA_MAX);
+            size_t offset = contents.size();
+            contents.resize(offset + data.size);
+            EXPECT_TRUE(ReadFdExactly(client_, contents.data() + offset, data.size));
+        }
+    }
+
+    // Pulls part of path_ with recv_range, and returns the data, decompressing it if need be.
+    std::string RecvRange(uint64_t offset, uint64_t length, uint32_t flags) {
+        SyncRequest request = {.id = ID_RECV_RANGE,
+                               .path_length = static_cast<uint32_t>(path_.size())};
+        sync_recv_range setup = {
+                .id = ID_RECV_RANGE, .flags = flags, .offset = offset, .length = length};
+        EXPECT_TRUE(WriteFdExactly(client_, &request, sizeof(request)));
+        EXPECT_TRUE(WriteFdExactly(client_, path_.data(), path_.size()));
+        EXPECT_TRUE(WriteFdExactly(client_, &setup, sizeof(setup)));
+
+        std::vector<char> buffer(SYNC_DATA_MAX);
+        ZstdDecoder decoder(std::span(buffer.data(), buffer.size()));
+        std::string contents;
+        while (true) {
+            sync_data data;
+            EXPECT_TRUE(ReadFdExactly(client_, &data, sizeof(data)));
+            if (data.id != ID_DATA) {
+                EXPECT_EQ(static_cast<uint32_t>(ID_DONE), data.id);
+                break;
+            }
+            Block block(data.size);
+            EXPECT_TRUE(ReadFdExactly(client_, block.data(), block.size()));
+            if (flags == kSyncFlagZstd) {
+                decoder.Append(std::move(block));
+                DecodeResult result;
+                do {
+                    std::span<char> output;
+                    result = decoder.Decode(&output);
+                    EXPECT_NE(DecodeResult::Error, result);
+                    contents.append(output.data(), output.size());
+                } while (result == DecodeResult::MoreOutput);
+            } else {
+                contents.append(block.data(), block.size());
+            }
+        }
+        return contents;
+    }
+
+    // Sends |stream| zstd-compressed as ID_DATA packets, a packet's worth at a time, as the client
+    // does for a send_batch or a send_v3.
+    void SendZstdStream(const std::string& stream) {
+        ZstdEncoder encoder(SYNC_DATA_MAX);
+        EncodeResult result = EncodeResult::NeedInput;
+        for (size_t offset = 0; result == EncodeResult::NeedInput; offset += SYNC_DATA_MAX) {
+            if (offset < stream.size()) {
+                Block input(std::min<size_t>(SYNC_DATA_MAX, stream.size() - offset));
+                memcpy(input.data(), stream.data() + offset, input.size());
+                encoder.Append(std::move(input));
+            } else {
+                encoder.Finish();
+            }
+
+            do {
+                Block output;
+                result = encoder.Encode(&output);
+                if (!output.empty()) {
+                    sync_data data = {.id = ID_DATA, .size = static_cast<uint32_t>(output.size())};
+                    EXPECT_TRUE(WriteFdExactly(client_, &data, sizeof(data)));
+                    EXPECT_TRUE(WriteFdExactly(client_, output.data(), output.size()));
+                }
+            } while (result == EncodeResult::MoreOutput);
+        }
+        EXPECT_EQ(EncodeResult::Done, result);
+    }
+
+    // Starts a send_v3 to path_, and reads the signatures of the file that's there.
+    void StartSendV3(uint32_t flags, uint32_t* block_size,
+                     std::vector<sync_delta_block>* signatures) {
+        SyncRequest request = {.id = ID_SEND_V3,
+                               .path_length = static_cast<uint32_t>(path_.size())};
+        sync_send_v2 setup = {.id = ID_SEND_V3, .mode = S_IFREG | 0644, .flags = flags};
+        ASSERT_TRUE(WriteFdExactly(client_, &request, sizeof(request)));
+        ASSERT_TRUE(WriteFdExactly(client_, path_.data(), path_.size()));
+        ASSERT_TRUE(WriteFdExactly(client_, &setup, sizeof(setup)));
+
+        sync_delta_signatures header;
+        ASSERT_TRUE(ReadFdExactly(client_, &header, sizeof(header)));
+        ASSERT_EQ(static_cast<uint32_t>(ID_SIGS), header.id);
+        *block_size = header.block_size;
+        signatures->resize(header.block_count);
+        ASSERT_TRUE(ReadFdExactly(client_, signatures->data(),
+                                  signatures->size() * sizeof(sync_delta_block)));
+    }
+
+    // Finishes a send_v2 or send_v3, and returns the id of adbd's response.
+    uint32_t FinishSendV3() {
+        sync_data done = {.id = ID_DONE, .size = 1234567890};
+        EXPECT_TRUE(WriteFdExactly(client_, &done, sizeof(done)));
+        sync_status status;
+        EXPECT_TRUE(ReadFdExactly(client_, &status, sizeof(status)));
+        std::string message(status.msglen, '\0');
+        EXPECT_TRUE(ReadFdExactly(client_, message.data(), message.size()));
+        return status.id;
+    }
+
+    // Sends |contents| to path_ as a delta against whatever is there, the way the client does.
+    void SendV3(const std::string& contents, uint64_t* literal_bytes) {
+        uint32_t block_size;
+        std::vector<sync_delta_block> signatures;
+        ASSERT_NO_FATAL_FAILURE(StartSendV3(kSyncFlagZstd, &block_size, &signatures));
+
+        TemporaryFile local;
+        ASSERT_TRUE(android::base::WriteStringToFile(contents, local.path));
+        unique_fd fd(adb_open(local.path, O_RDONLY));
+        ASSERT_GE(fd.get(), 0);
+
+        std::string stream;
+        DeltaEncoder encoder(block_size, std::move(signatures));
+        ASSERT_TRUE(encoder.Encode(
+                fd,
+                [&stream](const char* data, size_t size) {
+                    sync_data header = {.id = ID_DATA, .size = static_cast<uint32_t>(size)};
+                    stream.append(reinterpret_cast<const char*>(&header), sizeof(header));
+                    stream.append(data, size);
+                    return true;
+                },
+                [&stream](uint64_t first_block, uint32_t block_count) {
+                    sync_delta_copy copy = {.id = ID_COPY,
+                                            .block_count = block_count,
+                                            .first_block = first_block};
+                    stream.append(reinterpret_cast<const char*>(&copy), sizeof(copy));
+                    return true;
+                }));
+        *literal_bytes = encoder.literal_bytes();
+        SendZstdStream(stream);
+        ASSERT_EQ(static_cast<uint32_t>(ID_OKAY), FinishSendV3());
+    }
+
+    struct BatchFile {
+        std::string path;
+        std::string contents;
+        mode_t mode = S_IFREG | 0644;
+    };
+
+    // Sends |files| to dir_ as a zstd-compressed send_batch, and returns adbd's response.
+    uint32_t SendBatch(const std::vector<BatchFile>& files, std::string* message) {
+        std::string stream;
+        for (const BatchFile& file : files) {
+            sync_send_batch_entry entry = {.mode = static_cast<uint32_t>(file.mode),
+                                           .mtime = 1234567890,
+                                           .path_length = static_cast<uint32_t>(file.path.size()),
+                                           .size = static_cast<uint32_t>(file.contents.size())};
+            stream.append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+            stream += file.path;
+            stream += file.contents;
+        }
+
+        std::string root = dir_.path;
+        SyncRequest request = {.id = ID_SEND_BATCH,
+                               .path_length = static_cast<uint32_t>(root.size())};
+        sync_send_batch setup = {.id = ID_SEND_BATCH,
+                                 .flags = kSyncFlagZstd,
+                                 .count = static_cast<uint32_t>(files.size())};
+        EXPECT_TRUE(WriteFdExactly(client_, &request, sizeof(request)));
+        EXPECT_TRUE(WriteFdExactly(client_, root.data(), root.size()));
+        EXPECT_TRUE(WriteFdExactly(client_, &setup, sizeof(setup)));
+
+        SendZstdStream(stream);
+
+        sync_data done = {.id = ID_DONE, .size = 0};
+        EXPECT_TRUE(WriteFdExactly(client_, &done, sizeof(done)));
+        sync_status status;
+        EXPECT_TRUE(ReadFdExactly(client_, &status, sizeof(status)));
+        message->resize(status.msglen);
+        EXPECT_TRUE(ReadFdExactly(client_, message->data(), message->size()));
+        return status.id;
+    }
+
+    // Returns the names of everything in dir_.
+    std::vector<std::string> ListDir() {
+        std::vector<std::string> names;
+        std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(dir_.path), closedir);
+        while (dirent* entry = readdir(dir.get())) {
+            std::string name = entry->d_name;
+            if (name != "." && name != "..") names.push_back(name);
+        }
+        return names;
+    }
+
+    // Lists path_ with list_recursive, and returns the entries in the order they arrived.
+    std::vector<std::pair<std::string, sync_dent_v2>> ListRecursive() {
+        SyncRequest request = {.id = ID_LIST_RECURSIVE,
+                               .path_length = static_cast<uint32_t>(path_.size())};
+        EXPECT_TRUE(WriteFdExactly(client_, &request, sizeof(request)));
+        EXPECT_TRUE(WriteFdExactly(client_, path_.data(), path_.size()));
+
+        std::vector<std::pair<std::string, sync_dent_v2>> entries;
+        while (true) {
+            sync_dent_v2 dent;
+            EXPECT_TRUE(ReadFdExactly(client_, &dent, sizeof(dent)));
+            if (dent.id == ID_DONE) return entries;
+            EXPECT_EQ(static_cast<uint32_t>(ID_DENT_V2), dent.id);
+            std::string name(dent.namelen, '\0');
+            EXPECT_TRUE(ReadFdExactly(client_, name.data(), name.size()));
+            entries.emplace_back(name, dent);
+        }
+    }
+
+    static sig_t saved_sigpipe_handler_;
+
+    TemporaryDir dir_;
+    std::string path_;
+    unique_fd client_;
+    std::thread service_;
+};
+
+sig_t FileSyncServiceTest::saved_sigpipe_handler_ = nullptr;
+
+TEST_F(FileSyncServiceTest, send_recv_v2_uncompressed) {
+    std::string contents = RandomData(3 * 1024 * 1024 + 17, 6);
+    ASSERT_EQ(static_cast<uint32_t>(ID_OKAY), SendV2(contents, SYNC_DATA_MAX));
+
+    std::string pushed;
+    ASSERT_TRUE(android::base::ReadFileToString(path_, &pushed));
+    EXPECT_TRUE(pushed == contents);
+    EXPECT_TRUE(RecvV2() == contents);
+
+    // Messages needn't be the size of adbd's buffers.
+    contents = RandomData(1024 * 1024, 7);
+    ASSERT_EQ(static_cast<uint32_t>(ID_OKAY), SendV2(contents, 1000));
+    EXPECT_TRUE(RecvV2() == contents);
+}
+
+TEST_F(FileSyncServiceTest, send_v3_modified_file) {
+    std::string old_contents = RandomData(4 * 1024 * 1024, 1);
+    ASSERT_TRUE(android::base::WriteStringToFile(old_contents, path_));
+
+    std::string new_contents = old_contents;
+    new_contents.insert(0, "a few new bytes at the start");
+    new_contents.replace(2 * 1024 * 1024, 100, RandomData(100, 2));
+    new_contents.append("and some at the end");
+
+    uint64_t literal_bytes;
+    ASSERT_NO_FATAL_FAILURE(SendV3(new_contents, &literal_bytes));
+    EXPECT_LT(literal_bytes, 4 * kDeltaMaxBlockSize);
+
+    std::string contents;
+    ASSERT_TRUE(android::base::ReadFileToString(path_, &contents));
+    EXPECT_TRUE(contents == new_contents);
+    EXPECT_EQ(std::vector<std::string>{"file"}, ListDir());
+
+    struct stat st;
+    ASSERT_EQ(0, stat(path_.c_str(), &st));
+    EXPECT_EQ(1234567890, st.st_mtime);
+}
+
+TEST_F(FileSyncServiceTest, send_v3_new_file) {
+    std::string new_contents = RandomData(3 * 1024 * 1024 + 17, 3);
+
+    uint64_t literal_bytes;
+    ASSERT_NO_FATAL_FAILURE(SendV3(new_contents, &literal_bytes));
+    EXPECT_EQ(new_contents.size(), literal_bytes);
+
+    std::string contents;
+    ASSERT_TRUE(android::base::ReadFileToString(path_, &contents));
+    EXPECT_TRUE(contents == new_contents);
+}
+
+TEST_F(FileSyncServiceTest, send_v3_invalid_copy) {
+    std::string old_contents = RandomData(1024 * 1024, 4);
+    ASSERT_TRUE(android::base::WriteStringToFile(old_contents, path_));
+
+    uint32_t block_size;
+    std::vector<sync_delta_block> signatures;
+    ASSERT_NO_FATAL_FAILURE(StartSendV3(kSyncFlagNone, &block_size, &signatures));
+    ASSERT_FALSE(signatures.empty());
+
+    // Uncompressed, the stream is sent as it is.
+    std::string stream;
+    sync_data literal = {.id = ID_DATA, .size = 4};
+    stream.append(reinterpret_cast<const char*>(&literal), sizeof(literal));
+    stream += "data";
+    sync_delta_copy copy = {
+            .id = ID_COPY, .block_count = 2, .first_block = signatures.size() - 1};
+    stream.append(reinterpret_cast<const char*>(&copy), sizeof(copy));
+    sync_data data = {.id = ID_DATA, .size = static_cast<uint32_t>(stream.size())};
+    ASSERT_TRUE(WriteFdExactly(client_, &data, sizeof(data)));
+    ASSERT_TRUE(WriteFdExactly(client_, stream.data(), stream.size()));
+    ASSERT_EQ(static_cast<uint32_t>(ID_FAIL), FinishSendV3());
+
+    // The existing file is left alone, and the partial new one is cleaned up.
+    std::string contents;
+    ASSERT_TRUE(android::base::ReadFileToString(path_, &contents));
+    EXPECT_TRUE(contents == old_contents);
+    EXPECT_EQ(std::vector<std::string>{"file"}, ListDir());
+}
+
+TEST_F(FileSyncServiceTest, send_batch) {
+    ASSERT_TRUE(android::base::WriteStringToFile("old contents", path_));
+    std::string link = std::string(dir_.path) + "/link";
+    ASSERT_EQ(0, symlink(path_.c_str(), link.c_str()));
+
+    std::vector<BatchFile> files = {
+            {.path = "file", .contents = "new contents"},
+            {.path = "link", .contents = "no longer a link"},
+            {.path = "empty", .contents = ""},
+            {.path = "a/b/c", .contents = RandomData(100 * 1024, 5)},
+    };
+    for (int i = 0; i < 500; ++i) {
+        files.push_back({.path = "many/" + std::to_string(i), .contents = std::to_string(i)});
+    }
+
+    std::string message;
+    ASSERT_EQ(static_cast<uint32_t>(ID_OKAY), SendBatch(files, &message)) << message;
+
+    for (const BatchFile& file : files) {
+        std::string path = std::string(dir_.path) + "/" + file.path;
+        std::string contents;
+        ASSERT_TRUE(android::base::ReadFileToString(path, &contents, false)) << path;
+        EXPECT_TRUE(contents == file.contents) << path;
+
+        struct stat st;
+        ASSERT_EQ(0, lstat(path.c_str(), &st));
+        EXPECT_TRUE(S_ISREG(st.st_mode));
+        EXPECT_EQ(1234567890, st.st_mtime);
+    }
+}
+
+TEST_F(FileSyncServiceTest, send_batch_failure) {
+    ASSERT_EQ(0, adb_mkdir(path_, 0755));
+
+    // A file that can't be written doesn't stop the others, and the failure is reported once.
+    std::string message;
+    ASSERT_EQ(static_cast<uint32_t>(ID_FAIL),
+              SendBatch({{.path = "a", .contents = "a"},
+                         {.path = "file", .contents = "in the way of a directory"},
+                         {.path = "b", .contents = "b"}},
+                        &message));
+    EXPECT_NE(std::string::npos, message.find("1 of 3 files failed")) << message;
+    EXPECT_NE(std::string::npos, message.find(path_)) << message;
+
+    std::string contents;
+    ASSERT_TRUE(android::base::ReadFileToString(std::string(dir_.path) + "/a", &contents));
+    EXPECT_EQ("a", contents);
+    ASSERT_TRUE(android::base::ReadFileToString(std::string(dir_.path) + "/b", &contents));
+    EXPECT_EQ("b", contents);
+}
+
+TEST_F(FileSyncServiceTest, list_recursive) {
+    ASSERT_EQ(0, adb_mkdir(path_, 0755));
+    std::vector<std::string> dirs = {"a", "a/b", "a/b/c", "d"};
+    for (const std::string& dir : dirs) {
+        ASSERT_EQ(0, adb_mkdir(path_ + "/" + dir, 0755));
+        ASSERT_TRUE(android::base::WriteStringToFile(dir, path_ + "/" + dir + "/file"));
+    }
+    ASSERT_EQ(0, symlink("../..", (path_ + "/a/b/loop").c_str()));
+    ASSERT_EQ(0, symlink("file", (path_ + "/a/link").c_str()));
+    ASSERT_EQ(0, symlink("missing", (path_ + "/d/dangling").c_str()));
+
+    std::map<std::string, sync_dent_v2> entries;
+    for (const auto& [name, dent] : ListRecursive()) {
+        // Everything but the root comes after the directory that contains it.
+        std::string parent = android::base::Dirname(name);
+        if (parent != ".") EXPECT_EQ(1U, entries.count(parent)) << name;
+        EXPECT_TRUE(entries.emplace(name, dent).second) << name;
+    }
+
+    EXPECT_EQ(11U, entries.size());
+    for (const std::string& dir : dirs) {
+        EXPECT_TRUE(S_ISDIR(entries[dir].mode)) << dir;
+        EXPECT_TRUE(S_ISREG(entries[dir + "/file"].mode)) << dir;
+        EXPECT_EQ(dir.size(), entries[dir + "/file"].size) << dir;
+    }
+
+    // Links are followed, but not back up the tree.
+    EXPECT_TRUE(S_ISREG(entries["a/link"].mode));
+    EXPECT_EQ(1U, entries["a/link"].size);
+    EXPECT_TRUE(S_ISDIR(entries["a/b/loop"].mode));
+    EXPECT_EQ(0U, entries["a/b/loop"].error);
+    EXPECT_TRUE(S_ISLNK(entries["d/dangling"].mode));
+    EXPECT_NE(0U, entries["d/dangling"].error);
+}
+
+TEST_F(FileSyncServiceTest, recv_range) {
+    std::string contents = RandomData(1024 * 1024 + 17, 8);
+    ASSERT_TRUE(android::base::WriteStringToFile(contents, path_));
+
+    EXPECT_TRUE(RecvRange(0, 100, kSyncFlagNone) == contents.substr(0, 100));
+    EXPECT_TRUE(RecvRange(1000, 300000, kSyncFlagNone) == contents.substr(1000, 300000));
+    EXPECT_TRUE(RecvRange(5, 300000, kSyncFlagZstd) == contents.substr(5, 300000));
+
+    // Ranges stop at the end of the file.
+    EXPECT_TRUE(RecvRange(1024 * 1024, 100, kSyncFlagNone) == contents.substr(1024 * 1024));
+    EXPECT_TRUE(RecvRange(4096, UINT64_MAX, kSyncFlagZstd) == contents.substr(4096));
+    EXPECT_EQ("", RecvRange(contents.size() + 1, 100, kSyncFlagNone));
+}
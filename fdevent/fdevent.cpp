@@ -20,6 +20,8 @@
 
 #include <inttypes.h>
 
+#include <algorithm>
+
 #include <android-base/logging.h>
 #include <android-base/stringprintf.h>
 #include <android-base/threads.h>
@@ -33,7 +35,6 @@
 #endif
 
 using namespace std::chrono_literals;
-using std::chrono::duration_cast;
 
 void invoke_fde(struct fdevent* fde, unsigned events) {
     if (auto f = std::get_if<fd_func>(&fde->func)) {
@@ -45,6 +46,8 @@ void invoke_fde(struct fdevent* fde, unsigned events) {
     }
 }
 
+fdevent_event::fdevent_event(fdevent* pfde, unsigned ev) : fde(pfde), events(ev), id(pfde->id) {}
+
 std::string dump_fde(const fdevent* fde) {
     std::string state;
     if (fde->state & FDE_READ) {
@@ -122,42 +125,148 @@ void fdevent_context::SetTimeout(fdevent* fde, std::optional<std::chrono::millis
                           // initialized the looper thread instance variable.
     fde->timeout = timeout;
     fde->last_active = std::chrono::steady_clock::now();
+
+    // A later deadline is picked up lazily, when the existing entry reaches the top of the heap.
+    if (timeout) {
+        auto deadline = fde->last_active + *timeout;
+        if (!fde->timer_deadline || deadline < *fde->timer_deadline) {
+            ScheduleTimer(fde, deadline);
+        }
+    }
 }
 
-std::optional<std::chrono::milliseconds> fdevent_context::CalculatePollDuration() {
-    std::optional<std::chrono::milliseconds> result = std::nullopt;
-    auto now = std::chrono::steady_clock::now();
+void fdevent_context::ScheduleTimer(fdevent* fde, std::chrono::steady_clock::time_point deadline) {
+    fde->timer_deadline = deadline;
+    this->timers_.push({deadline, fde, fde->id});
+}
+
+void fdevent_context::NormalizeTimers() {
+    while (!this->timers_.empty()) {
+        Timer top = this->timers_.top();
+        fdevent* fde = top.fde;
+
+        // Check the fde is still installed before touching it, like HandleEvents does.
+        if (!this->fdevent_set_.contains(fde) || fde->id != top.id ||
+            fde->timer_deadline != top.deadline) {
+            this->timers_.pop();
+            continue;
+        }
+
+        if (!fde->timeout) {
+            fde->timer_deadline.reset();
+            this->timers_.pop();
+            continue;
+        }
 
+        auto deadline = fde->last_active + *fde->timeout;
+        if (deadline == top.deadline) {
+            return;
+        }
+
+        this->timers_.pop();
+        ScheduleTimer(fde, deadline);
+    }
+}
+
+std::optional<std::chrono::milliseconds> fdevent_context::CalculatePollDuration() {
     CheckLooperThread();
 
-    for (const auto& [fd, fde] : this->installed_fdevents_) {
-        UNUSED(fd);
-        auto timeout_opt = fde.timeout;
-        if (timeout_opt) {
-            auto deadline = fde.last_active + *timeout_opt;
-            auto time_left = duration_cast<std::chrono::milliseconds>(deadline - now);
-            if (time_left < 0ms) {
-                time_left = 0ms;
-            }
+    NormalizeTimers();
+    if (this->timers_.empty()) {
+        return std::nullopt;
+    }
 
-            if (!result) {
-                result = time_left;
-            } else {
-                result = std::min(*result, time_left);
-            }
+    // Round up, so that we don't wake up just before the deadline and spin until it passes.
+    auto now = std::chrono::steady_clock::now();
+    auto time_left = std::chrono::ceil<std::chrono::milliseconds>(this->timers_.top().deadline - now);
+    return std::max(time_left, 0ms);
+}
+
+void fdevent_context::CollectTimeouts(std::chrono::steady_clock::time_point now,
+                                      std::vector<fdevent_event>* events) {
+    while (true) {
+        NormalizeTimers();
+        if (this->timers_.empty() || !(this->timers_.top().deadline < now)) {
+            break;
         }
+
+        fdevent* fde = this->timers_.top().fde;
+        this->timers_.pop();
+
+        LOG(DEBUG) << dump_fde(fde) << " timed out";
+        events->emplace_back(fde, FDE_TIMEOUT);
+        fde->last_active = now;
+        ScheduleTimer(fde, now + *fde->timeout);
     }
+}
+
+void fdevent_context::SetDispatchOptions(fdevent_dispatch_options options) {
+    CheckLooperThread();
+    dispatch_options_ = options;
+}
 
+size_t fdevent_context::MaxEventsPerPoll() const {
+    size_t result = installed_fdevents_.size();
+    if (dispatch_options_.max_events_per_iteration != 0) {
+        result = std::min(result, dispatch_options_.max_events_per_iteration);
+    }
     return result;
 }
 
 void fdevent_context::HandleEvents(const std::vector<fdevent_event>& events) {
-    for (const auto& event : events) {
+    const size_t limit = dispatch_options_.max_events_per_iteration;
+    const size_t flush_interval = dispatch_options_.run_queue_flush_interval;
+
+    // Only rotate when the batch is going to be truncated, so that everything else is dispatched
+    // in the order that the backend reported it.
+    size_t start = 0;
+    if (limit != 0) {
+        size_t io_events = std::count_if(events.begin(), events.end(), [](const auto& event) {
+            return event.events != FDE_TIMEOUT;
+        });
+        if (io_events > limit) {
+            start = dispatch_rotation_ % events.size();
+        }
+    }
+
+    size_t io_dispatched = 0;
+    size_t since_flush = 0;
+    for (size_t i = 0; i < events.size(); ++i) {
+        const fdevent_event& event = events[(start + i) % events.size()];
+        bool timeout_only = event.events == FDE_TIMEOUT;
+        if (!timeout_only && limit != 0 && io_dispatched == limit) {
+            continue;
+        }
+
         // Verify the fde is still installed before invoking it.  It could have been unregistered
-        // and destroyed inside an earlier event handler.
-        if (this->fdevent_set_.contains(event.fde)) {
-            invoke_fde(event.fde, event.events);
-            break;
+        // and destroyed inside an earlier event handler, and possibly replaced by a new fdevent
+        // at the same address.
+        fdevent* fde = event.fde;
+        if (!this->fdevent_set_.contains(fde) || fde->id != event.id) {
+            continue;
+        }
+
+        // An earlier handler might also have changed what this fde is waiting for.
+        unsigned fde_events = event.events;
+        if (!(fde_events & FDE_ERROR)) {
+            fde_events &= fde->state | FDE_TIMEOUT;
+        }
+        if ((fde_events & FDE_TIMEOUT) && !fde->timeout) {
+            fde_events &= ~FDE_TIMEOUT;
+        }
+        if (fde_events == 0) {
+            continue;
+        }
+
+        if (!timeout_only && ++io_dispatched == limit) {
+            dispatch_rotation_ = start + i + 1;
+        }
+
+        invoke_fde(fde, fde_events);
+
+        if (flush_interval != 0 && ++since_flush == flush_interval) {
+            FlushRunQueue();
+            since_flush = 0;
         }
     }
     FlushRunQueue();
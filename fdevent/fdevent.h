@@ -27,8 +27,10 @@
 #include <map>
 #include <mutex>
 #include <optional>
+#include <queue>
 #include <set>
 #include <variant>
+#include <vector>
 
 #include <android-base/thread_annotations.h>
 #include <android-base/threads.h>
@@ -52,7 +54,25 @@ std::string dump_fde(const fdevent* fde);
 struct fdevent_event {
     fdevent* fde;
     unsigned events;
-    fdevent_event(fdevent* pfde, unsigned ev) : fde(pfde), events(ev) {}
+
+    // The id of |fde| when the event was observed, to tell it apart from an fdevent that was
+    // created at the same address by an earlier handler in the same batch.
+    uint64_t id;
+
+    fdevent_event(fdevent* pfde, unsigned ev);
+};
+
+// Controls how a batch of ready events is dispatched on each iteration of the loop.
+struct fdevent_dispatch_options {
+    // Maximum number of fdevents with I/O events to dispatch per iteration, or 0 for no limit.
+    // Events are level-triggered, so whatever is left over gets reported again by the next poll.
+    // When a batch has to be truncated, the starting point rotates so that the same fdevents
+    // aren't always the ones left over. Timeouts are always dispatched.
+    size_t max_events_per_iteration = 0;
+
+    // Number of handlers to invoke between flushes of the run queue, or 0 to only flush after the
+    // whole batch. This keeps functions queued via Run() from waiting behind a large batch.
+    size_t run_queue_flush_interval = 64;
 };
 
 struct fdevent final {
@@ -64,6 +84,9 @@ struct fdevent final {
     std::optional<std::chrono::milliseconds> timeout;
     std::chrono::steady_clock::time_point last_active;
 
+    // Deadline of this fdevent's live entry in its context's timer heap, if it has one.
+    std::optional<std::chrono::steady_clock::time_point> timer_deadline;
+
     std::variant<fd_func, fd_func2> func;
     void* arg = nullptr;
 };
@@ -96,14 +119,31 @@ struct fdevent_context {
     // trigger repeatedly every |timeout| ms.
     void SetTimeout(fdevent* fde, std::optional<std::chrono::milliseconds> timeout);
 
+    // Change how ready events are dispatched. Must be called before Loop() or on the looper thread.
+    void SetDispatchOptions(fdevent_dispatch_options options);
+
   protected:
+    // Returns how long to wait for the next timeout, or nullopt if there are none.
     std::optional<std::chrono::milliseconds> CalculatePollDuration();
+
+    // Append an FDE_TIMEOUT event to |events| for every fdevent whose deadline is before |now|.
+    // Backends must have updated last_active for fdevents with I/O events first.
+    void CollectTimeouts(std::chrono::steady_clock::time_point now,
+                         std::vector<fdevent_event>* events);
+
+    // Dispatch every event in |events| whose fdevent is still installed, in order.
     void HandleEvents(const std::vector<fdevent_event>& events);
 
+    // The maximum number of events a backend needs to gather per poll.
+    size_t MaxEventsPerPoll() const;
+
   private:
     // Run all pending functions enqueued via Run().
     void FlushRunQueue() EXCLUDES(run_queue_mutex_);
 
+    void ScheduleTimer(fdevent* fde, std::chrono::steady_clock::time_point deadline);
+    void NormalizeTimers();
+
   public:
     // Loop until TerminateLoop is called, handling events.
     // Implementations should call FlushRunQueue on every iteration, and check the value of
@@ -131,12 +171,29 @@ struct fdevent_context {
 
     std::map<int, fdevent> installed_fdevents_;
 
+    fdevent_dispatch_options dispatch_options_;
+
   private:
     uint64_t fdevent_id_ = 0;
     std::mutex run_queue_mutex_;
     std::deque<std::function<void()>> run_queue_ GUARDED_BY(run_queue_mutex_);
 
     std::set<fdevent*> fdevent_set_;
+
+    // Min-heap of timeout deadlines. Entries aren't removed when an fdevent is active, destroyed
+    // or has its timeout changed: they're checked against the fdevent when they reach the top,
+    // and are then either dropped or pushed back with the fdevent's current deadline.
+    struct Timer {
+        std::chrono::steady_clock::time_point deadline;
+        fdevent* fde;
+        uint64_t id;
+
+        bool operator>(const Timer& rhs) const { return deadline > rhs.deadline; }
+    };
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers_;
+
+    // Where to start dispatching the next batch that has to be truncated.
+    size_t dispatch_rotation_ = 0;
 };
 
 // Backwards compatibility shims that forward to the global fdevent_context.
@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "fdevent.h"
+
+#include <sys/resource.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+
+#include "adb_io.h"
+#include "adb_unique_fd.h"
+#include "sysdeps.h"
+
+namespace {
+
+// Run |fn| on the looper thread, and wait for it to finish.
+void RunOnLooper(std::function<void()> fn) {
+    std::promise<void> done;
+    fdevent_run_on_looper([&]() {
+        fn();
+        done.set_value();
+    });
+    done.get_future().wait();
+}
+
+// A set of sockets that all become readable at once, each of which is drained by its own fdevent.
+class ReadySockets {
+  public:
+    explicit ReadySockets(size_t count) : count_(count) {}
+
+    static void OnRead(fdevent* fde, unsigned, void* arg) {
+        auto self = static_cast<ReadySockets*>(arg);
+        char buf[16];
+        CHECK_EQ(1, adb_read(fde->fd, buf, sizeof(buf)));
+        if (++self->handled_ == self->count_) {
+            std::lock_guard<std::mutex> lock(self->mutex_);
+            self->cv_.notify_one();
+        }
+    }
+
+    void Install() {
+        RunOnLooper([this]() {
+            for (size_t i = 0; i < count_; ++i) {
+                int fds[2];
+                CHECK_EQ(0, adb_socketpair(fds));
+                writers_.emplace_back(fds[1]);
+                fdevent* fde = fdevent_create(fds[0], OnRead, this);
+                fdevent_add(fde, FDE_READ);
+                fdes_.push_back(fde);
+            }
+        });
+    }
+
+    void Uninstall() {
+        RunOnLooper([this]() {
+            for (fdevent* fde : fdes_) {
+                fdevent_destroy(fde);
+            }
+            fdes_.clear();
+        });
+        writers_.clear();
+    }
+
+    // Make every socket readable, and wait for all of the events to be handled.
+    void Round() {
+        handled_ = 0;
+        for (auto& writer : writers_) {
+            CHECK_EQ(1, adb_write(writer.get(), "x", 1));
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return handled_ == count_; });
+    }
+
+  private:
+    const size_t count_;
+    std::vector<unique_fd> writers_;
+    std::vector<fdevent*> fdes_;
+    std::atomic<size_t> handled_ = 0;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
+
+}  // namespace
+
+// Arguments are the number of active fds, and the maximum number of events per loop iteration.
+static void BM_FdeventDispatch(benchmark::State& state) {
+    size_t fd_count = state.range(0);
+
+    struct rlimit limit;
+    CHECK_EQ(0, getrlimit(RLIMIT_NOFILE, &limit));
+    if (limit.rlim_cur < 2 * fd_count + 64) {
+        limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, 2 * fd_count + 64);
+        CHECK_EQ(0, setrlimit(RLIMIT_NOFILE, &limit));
+    }
+
+    fdevent_reset();
+    fdevent_get_ambient()->SetDispatchOptions(
+            {.max_events_per_iteration = static_cast<size_t>(state.range(1))});
+    std::thread looper([]() { fdevent_loop(); });
+
+    ReadySockets sockets(fd_count);
+    sockets.Install();
+
+    for (auto _ : state) {
+        sockets.Round();
+    }
+    state.counters["events/s"] = benchmark::Counter(
+            static_cast<double>(state.iterations() * fd_count), benchmark::Counter::kIsRate);
+
+    sockets.Uninstall();
+    fdevent_terminate_loop();
+    looper.join();
+}
+BENCHMARK(BM_FdeventDispatch)
+        ->ArgNames({"fds", "max_events"})
+        ->Args({1000, 0})
+        ->Args({1000, 64})
+        ->Args({1000, 1})
+        ->UseRealTime();
+
+// Round trips through a socket with lots of idle fdevents installed, one in every hundred of which
+// has a timeout. This is dominated by the per-iteration overhead of the loop.
+static void BM_FdeventIdleLoop(benchmark::State& state) {
+    size_t fd_count = state.range(0);
+
+    struct rlimit limit;
+    CHECK_EQ(0, getrlimit(RLIMIT_NOFILE, &limit));
+    if (limit.rlim_cur < fd_count + 64) {
+        limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, fd_count + 64);
+        CHECK_EQ(0, setrlimit(RLIMIT_NOFILE, &limit));
+    }
+
+    fdevent_reset();
+    std::thread looper([]() { fdevent_loop(); });
+
+    // The fdevents don't wait for anything, so they can all share one socket.
+    int fds[2];
+    CHECK_EQ(0, adb_socketpair(fds));
+    unique_fd reader(fds[0]), writer(fds[1]);
+
+    std::vector<fdevent*> fdes;
+    RunOnLooper([&]() {
+        for (size_t i = 0; i < fd_count; ++i) {
+            int fd = dup(reader.get());
+            CHECK_NE(-1, fd);
+            fdevent* fde = fdevent_create(fd, [](fdevent*, unsigned, void*) {}, nullptr);
+            if (i % 100 == 0) {
+                fdevent_set_timeout(fde, std::chrono::hours(1));
+            }
+            fdes.push_back(fde);
+        }
+    });
+
+    ReadySockets ping(1);
+    ping.Install();
+
+    for (auto _ : state) {
+        ping.Round();
+    }
+
+    ping.Uninstall();
+    RunOnLooper([&]() {
+        for (fdevent* fde : fdes) {
+            fdevent_destroy(fde);
+        }
+    });
+    fdevent_terminate_loop();
+    looper.join();
+}
+BENCHMARK(BM_FdeventIdleLoop)->ArgName("fds")->Arg(100)->Arg(1000)->Arg(10000)->UseRealTime();
@@ -111,7 +111,6 @@ void fdevent_context_epoll::Loop() {
     looper_thread_id_ = android::base::GetThreadId();
 
     std::vector<fdevent_event> fde_events;
-    std::unordered_map<fdevent*, fdevent_event*> event_map;
     std::vector<epoll_event> epoll_events;
 
     while (true) {
@@ -133,16 +132,17 @@ void fdevent_context_epoll::Loop() {
                 timeout_ms = timeout->count();
             }
 
-            rc = epoll_wait(epoll_fd_.get(), epoll_events.data(), epoll_events.size(), timeout_ms);
+            // When the number of events per iteration is limited, the kernel keeps the rest on
+            // its ready list and hands them out first on the next call.
+            rc = epoll_wait(epoll_fd_.get(), epoll_events.data(), this->MaxEventsPerPoll(),
+                            timeout_ms);
             if (rc == -1 && errno != EINTR) {
                 PLOG(FATAL) << "epoll_wait failed";
             }
         }
 
         auto post_poll = std::chrono::steady_clock::now();
-        fde_events.reserve(installed_fdevents_.size());
         fde_events.clear();
-        event_map.clear();
 
         for (int i = 0; i < rc; ++i) {
             fdevent* fde = static_cast<fdevent*>(epoll_events[i].data.ptr);
@@ -163,29 +163,11 @@ void fdevent_context_epoll::Loop() {
             }
 
             D("%s got events 0x%X", dump_fde(fde).c_str(), events);
-            auto& fde_event = fde_events.emplace_back(fde, events);
-            event_map[fde] = &fde_event;
+            fde_events.emplace_back(fde, events);
             fde->last_active = post_poll;
         }
 
-        for (auto& [fd, fde] : installed_fdevents_) {
-            unsigned events = 0;
-            if (auto it = event_map.find(&fde); it != event_map.end()) {
-                events = it->second->events;
-            }
-
-            if (events == 0) {
-                if (fde.timeout) {
-                    auto deadline = fde.last_active + *fde.timeout;
-                    if (deadline < post_poll) {
-                        events |= FDE_TIMEOUT;
-                        LOG(DEBUG) << dump_fde(&fde) << " timed out";
-                        fde_events.emplace_back(&fde, events);
-                        fde.last_active = post_poll;
-                    }
-                }
-            }
-        }
+        this->CollectTimeouts(post_poll, &fde_events);
         this->HandleEvents(fde_events);
         fde_events.clear();
     }
@@ -170,25 +170,17 @@ void fdevent_context_poll::Loop() {
             }
 #endif
 
-            auto it = this->installed_fdevents_.find(pollfd.fd);
-            CHECK(it != this->installed_fdevents_.end());
-            fdevent* fde = &it->second;
-
-            if (events == 0) {
-                if (fde->timeout) {
-                    auto deadline = fde->last_active + *fde->timeout;
-                    if (deadline < post_poll) {
-                        events |= FDE_TIMEOUT;
-                    }
-                }
-            }
-
             if (events != 0) {
+                auto it = this->installed_fdevents_.find(pollfd.fd);
+                CHECK(it != this->installed_fdevents_.end());
+                fdevent* fde = &it->second;
+
                 D("%s got events %x", dump_fde(fde).c_str(), events);
                 poll_events.push_back({fde, events});
                 fde->last_active = post_poll;
             }
         }
+        this->CollectTimeouts(post_poll, &poll_events);
         this->HandleEvents(poll_events);
         poll_events.clear();
     }
@@ -19,9 +19,12 @@
 #include <gtest/gtest.h>
 
 #include <unistd.h>
+#include <algorithm>
 #include <chrono>
+#include <future>
 #include <limits>
 #include <memory>
+#include <optional>
 #include <queue>
 #include <string>
 #include <thread>
@@ -325,6 +328,58 @@ TEST_F(FdeventTest, timeout) {
     ASSERT_LT(diff[2], delta.count() * 0.5);
 }
 
+TEST_F(FdeventTest, timeout_changes) {
+    PrepareThread();
+
+    struct TimeoutChangesTest {
+        std::vector<unique_fd> peers;
+        fdevent* fdes[3] = {};
+        size_t timeouts[3] = {};
+    };
+    TimeoutChangesTest test;
+
+    static constexpr auto delta = 50ms;
+    fdevent_run_on_looper([&]() {
+        for (size_t i = 0; i < 3; ++i) {
+            int fds[2];
+            ASSERT_EQ(0, adb_socketpair(fds));
+            test.peers.emplace_back(fds[1]);
+            test.fdes[i] = fdevent_create(
+                    fds[0],
+                    [](fdevent* fde, unsigned events, void* arg) {
+                        auto test = static_cast<TimeoutChangesTest*>(arg);
+                        CHECK_EQ(unsigned(FDE_TIMEOUT), events);
+                        size_t index = std::find(test->fdes, test->fdes + 3, fde) - test->fdes;
+                        CHECK_LT(index, 3U);
+                        ++test->timeouts[index];
+                    },
+                    &test);
+        }
+
+        // The first one is shortened, the second one is cleared, and the third is destroyed.
+        fdevent_set_timeout(test.fdes[0], 1h);
+        fdevent_set_timeout(test.fdes[0], delta);
+        fdevent_set_timeout(test.fdes[1], delta);
+        fdevent_set_timeout(test.fdes[1], std::nullopt);
+        fdevent_set_timeout(test.fdes[2], delta);
+        fdevent_destroy(test.fdes[2]);
+        test.fdes[2] = nullptr;
+    });
+
+    std::this_thread::sleep_for(delta * 3.5);
+    fdevent_run_on_looper([&]() {
+        fdevent_destroy(test.fdes[0]);
+        fdevent_destroy(test.fdes[1]);
+    });
+    WaitForFdeventLoop();
+    TerminateThread();
+
+    ASSERT_GE(test.timeouts[0], 2U);
+    ASSERT_LE(test.timeouts[0], 4U);
+    ASSERT_EQ(0U, test.timeouts[1]);
+    ASSERT_EQ(0U, test.timeouts[2]);
+}
+
 TEST_F(FdeventTest, unregister_with_pending_event) {  // Remains broken on _WIN32
     // since poll() (Loop()/fdevent_poll.cpp) fails with `Invalid areg` causing
     // a hang on Windows 10.
@@ -411,3 +466,198 @@ TEST_F(FdeventTest, unregister_with_pending_event) {  // Remains broken on _WIN3
 
     ASSERT_FALSE(test.should_not_happen);
 }
+
+// Make the looper thread wait inside a queued function until |ready| returns, so that everything
+// that happens in |ready| is observed by a single poll.
+static void WithLooperPaused(std::function<void()> ready) {
+    std::promise<void> paused;
+    std::promise<void> resume;
+    fdevent_run_on_looper([&paused, resumed = resume.get_future().share()]() {
+        paused.set_value();
+        resumed.wait();
+    });
+    paused.get_future().wait();
+    ready();
+    resume.set_value();
+}
+
+TEST_F(FdeventTest, dispatch_all_ready_events) {
+    constexpr size_t kSocketCount = 16;
+
+    struct Test {
+        std::vector<fdevent*> fdes;
+        std::vector<unique_fd> writers;
+        size_t handled = 0;
+        std::optional<size_t> handled_before_run;
+    };
+    Test test;
+
+    PrepareThread();
+    fdevent_run_on_looper([&]() {
+        for (size_t i = 0; i < kSocketCount; ++i) {
+            int fds[2];
+            ASSERT_EQ(0, adb_socketpair(fds));
+            test.writers.emplace_back(fds[1]);
+            fdevent* fde = fdevent_create(
+                    fds[0],
+                    [](fdevent* fde, unsigned, void* arg) {
+                        auto test = static_cast<Test*>(arg);
+                        char c;
+                        ASSERT_EQ(1, adb_read(fde->fd, &c, 1));
+                        if (test->handled++ == 0) {
+                            // Functions queued by a handler run after the rest of the batch.
+                            fdevent_run_on_looper(
+                                    [test]() { test->handled_before_run = test->handled; });
+                        }
+                    },
+                    &test);
+            fdevent_add(fde, FDE_READ);
+            test.fdes.push_back(fde);
+        }
+    });
+    WaitForFdeventLoop();
+
+    WithLooperPaused([&]() {
+        for (auto& writer : test.writers) {
+            ASSERT_EQ(1, adb_write(writer.get(), "x", 1));
+        }
+    });
+    WaitForFdeventLoop();
+
+    ASSERT_EQ(kSocketCount, test.handled);
+    ASSERT_EQ(kSocketCount, test.handled_before_run);
+
+    fdevent_run_on_looper([&]() {
+        for (fdevent* fde : test.fdes) {
+            fdevent_destroy(fde);
+        }
+    });
+    WaitForFdeventLoop();
+    TerminateThread();
+}
+
+TEST_F(FdeventTest, dispatch_respects_earlier_handlers) {
+    struct Test {
+        unique_fd writers[3];
+        unique_fd replacement_writer;
+        fdevent* fdes[3] = {};
+        unsigned events[3] = {};
+        bool replacement_called = false;
+    };
+    Test test;
+
+    // Whichever of the first two fdevents gets dispatched first stops the other from reading, and
+    // replaces the third one with an idle fdevent, which likely ends up at the same address.
+    static auto handler = [](fdevent* fde, unsigned events, void* arg) {
+        auto test = static_cast<Test*>(arg);
+        size_t index = std::find(test->fdes, test->fdes + 3, fde) - test->fdes;
+        ASSERT_LT(index, 3U);
+        test->events[index] |= events;
+        if (index < 2 && !test->replacement_writer.ok()) {
+            fdevent_del(test->fdes[1 - index], FDE_READ);
+            fdevent_destroy(test->fdes[2]);
+
+            int fds[2];
+            ASSERT_EQ(0, adb_socketpair(fds));
+            test->replacement_writer.reset(fds[1]);
+            test->fdes[2] = fdevent_create(
+                    fds[0],
+                    [](fdevent*, unsigned, void* arg) {
+                        static_cast<Test*>(arg)->replacement_called = true;
+                    },
+                    arg);
+            fdevent_add(test->fdes[2], FDE_READ);
+        }
+    };
+
+    PrepareThread();
+    fdevent_run_on_looper([&]() {
+        for (size_t i = 0; i < 3; ++i) {
+            int fds[2];
+            ASSERT_EQ(0, adb_socketpair(fds));
+            test.writers[i].reset(fds[1]);
+            test.fdes[i] = fdevent_create(fds[0], +handler, &test);
+            fdevent_add(test.fdes[i], FDE_READ);
+        }
+    });
+    WaitForFdeventLoop();
+
+    WithLooperPaused([&]() {
+        for (auto& writer : test.writers) {
+            ASSERT_EQ(1, adb_write(writer.get(), "x", 1));
+        }
+    });
+    WaitForFdeventLoop();
+
+    // Exactly one of the first two got a read, and the replacement didn't get the old one's event.
+    ASSERT_EQ(unsigned(FDE_READ), test.events[0] | test.events[1]);
+    ASSERT_EQ(0U, test.events[0] & test.events[1]);
+    ASSERT_FALSE(test.replacement_called);
+
+    fdevent_run_on_looper([&]() {
+        for (fdevent* fde : test.fdes) {
+            fdevent_destroy(fde);
+        }
+    });
+    WaitForFdeventLoop();
+    TerminateThread();
+}
+
+TEST_F(FdeventTest, max_events_per_iteration) {
+    constexpr size_t kSocketCount = 8;
+
+    struct Test {
+        std::vector<fdevent*> fdes;
+        std::vector<unique_fd> writers;
+        std::vector<size_t> batches = {0};
+    };
+    Test test;
+
+    fdevent_get_ambient()->SetDispatchOptions({.max_events_per_iteration = 3});
+    PrepareThread();
+    fdevent_run_on_looper([&]() {
+        for (size_t i = 0; i < kSocketCount; ++i) {
+            int fds[2];
+            ASSERT_EQ(0, adb_socketpair(fds));
+            test.writers.emplace_back(fds[1]);
+            fdevent* fde = fdevent_create(
+                    fds[0],
+                    [](fdevent* fde, unsigned, void* arg) {
+                        auto test = static_cast<Test*>(arg);
+                        char c;
+                        ASSERT_EQ(1, adb_read(fde->fd, &c, 1));
+                        if (test->batches.back()++ == 0) {
+                            fdevent_run_on_looper([test]() { test->batches.push_back(0); });
+                        }
+                    },
+                    &test);
+            fdevent_add(fde, FDE_READ);
+            test.fdes.push_back(fde);
+        }
+    });
+    WaitForFdeventLoop();
+
+    WithLooperPaused([&]() {
+        for (auto& writer : test.writers) {
+            ASSERT_EQ(1, adb_write(writer.get(), "x", 1));
+        }
+    });
+    WaitForFdeventLoop();
+
+    // Every socket was read, in batches of no more than 3.
+    size_t total = 0;
+    for (size_t batch : test.batches) {
+        ASSERT_LE(batch, 3U);
+        total += batch;
+    }
+    ASSERT_EQ(kSocketCount, total);
+    ASSERT_GE(test.batches.size(), 3U);
+
+    fdevent_run_on_looper([&]() {
+        for (fdevent* fde : test.fdes) {
+            fdevent_destroy(fde);
+        }
+    });
+    WaitForFdeventLoop();
+    TerminateThread();
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "file_hash.h"
+
+#include <errno.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include <openssl/sha.h>
+
+#include "adb_unique_fd.h"
+#include "sysdeps.h"
+#include "sysdeps/stat.h"
+
+FileHashResult hash_file(const std::string& path) {
+    FileHashResult result;
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        result.error = errno;
+        return result;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        result.error = EINVAL;
+        return result;
+    }
+
+    unique_fd fd(adb_open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd < 0) {
+        result.error = errno;
+        return result;
+    }
+
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    std::vector<char> buf(256 * 1024);
+    while (true) {
+        int rc = adb_read(fd.get(), buf.data(), buf.size());
+        if (rc < 0) {
+            result.error = errno;
+            return result;
+        } else if (rc == 0) {
+            break;
+        }
+        SHA256_Update(&ctx, buf.data(), rc);
+        result.size += rc;
+    }
+    SHA256_Final(result.hash.data(), &ctx);
+    return result;
+}
+
+std::vector<FileHashResult> hash_files(const std::vector<std::string>& paths, size_t max_threads) {
+    std::vector<FileHashResult> results(paths.size());
+    std::atomic<size_t> next = 0;
+    auto worker = [&]() {
+        for (size_t i = next++; i < paths.size(); i = next++) {
+            results[i] = hash_file(paths[i]);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    size_t thread_count = std::min(std::max<size_t>(max_threads, 1), paths.size());
+    for (size_t i = 1; i < thread_count; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return results;
+}
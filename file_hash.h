@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <string>
+#include <vector>
+
+// The SHA-256 of a file's contents, as exchanged by the sync protocol's HSH1 request.
+using FileHash = std::array<uint8_t, 32>;
+
+struct FileHashResult {
+    // 0 on success, or the errno that hashing the file failed with.
+    int error = 0;
+    uint64_t size = 0;
+    FileHash hash = {};
+};
+
+// Hashes the contents of the regular file at |path|. Anything other than a regular file fails with
+// EINVAL.
+FileHashResult hash_file(const std::string& path);
+
+// Hashes each of |paths| on up to |max_threads| threads, returning the results in the same order.
+std::vector<FileHashResult> hash_files(const std::vector<std::string>& paths, size_t max_threads);
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "file_hash.h"
+
+#include <gtest/gtest.h>
+
+#include <errno.h>
+
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+
+TEST(file_hash, hash_file) {
+    TemporaryFile tf;
+    ASSERT_TRUE(android::base::WriteStringToFile("abc", tf.path));
+
+    FileHashResult result = hash_file(tf.path);
+    ASSERT_EQ(0, result.error);
+    EXPECT_EQ(3U, result.size);
+    FileHash expected = {0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40,
+                         0xde, 0x5d, 0xae, 0x22, 0x23, 0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17,
+                         0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad};
+    EXPECT_EQ(expected, result.hash);
+}
+
+TEST(file_hash, errors) {
+    TemporaryDir td;
+    EXPECT_EQ(EINVAL, hash_file(td.path).error);
+    EXPECT_EQ(ENOENT, hash_file(std::string(td.path) + "/missing").error);
+}
+
+TEST(file_hash, hash_files) {
+    TemporaryDir td;
+    std::vector<std::string> paths;
+    for (int i = 0; i < 64; ++i) {
+        paths.push_back(std::string(td.path) + "/" + std::to_string(i));
+        ASSERT_TRUE(android::base::WriteStringToFile(std::string(i * 1000, 'a' + i % 26),
+                                                     paths.back()));
+    }
+    paths.push_back(std::string(td.path) + "/missing");
+
+    std::vector<FileHashResult> results = hash_files(paths, 8);
+    ASSERT_EQ(paths.size(), results.size());
+    for (size_t i = 0; i < paths.size(); ++i) {
+        FileHashResult expected = hash_file(paths[i]);
+        EXPECT_EQ(expected.error, results[i].error) << paths[i];
+        EXPECT_EQ(expected.size, results[i].size) << paths[i];
+        EXPECT_EQ(expected.hash, results[i].hash) << paths[i];
+    }
+    EXPECT_EQ(ENOENT, results.back().error);
+    EXPECT_EQ(0U, results[0].size);
+    EXPECT_EQ(63000U, results[63].size);
+}
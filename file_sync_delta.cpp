@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "file_sync_delta.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include <openssl/sha.h>
+
+#include "adb_io.h"
+#include "sysdeps.h"
+
+uint32_t delta_block_size(uint64_t file_size) {
+    uint64_t size = static_cast<uint64_t>(sqrt(static_cast<double>(file_size)));
+    size = (size + 1023) & ~1023ULL;
+    return std::clamp<uint64_t>(size, kDeltaMinBlockSize, kDeltaMaxBlockSize);
+}
+
+void DeltaRollingChecksum::Reset(const uint8_t* data, size_t size) {
+    a_ = 0;
+    b_ = 0;
+    size_ = size;
+    for (size_t i = 0; i < size; ++i) {
+        a_ += data[i];
+        b_ += (size - i) * data[i];
+    }
+    a_ &= 0xffff;
+    b_ &= 0xffff;
+}
+
+uint32_t delta_weak_checksum(const uint8_t* data, size_t size) {
+    DeltaRollingChecksum sum;
+    sum.Reset(data, size);
+    return sum.value();
+}
+
+void delta_strong_hash(const uint8_t* data, size_t size, uint8_t (&hash)[16]) {
+    uint8_t digest[SHA256_DIGEST_LENGTH];
+    SHA256(data, size, digest);
+    memcpy(hash, digest, sizeof(hash));
+}
+
+bool compute_delta_signatures(
+        borrowed_fd fd, uint32_t block_size, uint64_t block_count,
+        const std::function<bool(std::span<const sync_delta_block>)>& callback) {
+    constexpr size_t kBatchSize = 1024;
+    std::vector<uint8_t> block(block_size);
+    std::vector<sync_delta_block> batch;
+    batch.reserve(kBatchSize);
+    for (uint64_t i = 0; i < block_count; ++i) {
+        if (!ReadFdExactly(fd, block.data(), block.size())) return false;
+
+        sync_delta_block& signature = batch.emplace_back();
+        signature.weak = delta_weak_checksum(block.data(), block.size());
+        delta_strong_hash(block.data(), block.size(), signature.strong);
+        if (batch.size() == kBatchSize) {
+            if (!callback(batch)) return false;
+            batch.clear();
+        }
+    }
+    return batch.empty() || callback(batch);
+}
+
+DeltaEncoder::DeltaEncoder(uint32_t block_size, std::vector<sync_delta_block> signatures)
+    : block_size_(block_size), signatures_(std::move(signatures)) {
+    for (size_t i = 0; i < signatures_.size(); ++i) {
+        blocks_by_weak_[signatures_[i].weak].push_back(i);
+    }
+}
+
+int64_t DeltaEncoder::FindBlock(uint32_t weak, const uint8_t* data, uint64_t preferred) const {
+    auto it = blocks_by_weak_.find(weak);
+    if (it == blocks_by_weak_.end()) return -1;
+
+    uint8_t strong[16];
+    delta_strong_hash(data, block_size_, strong);
+    int64_t result = -1;
+    for (uint32_t block : it->second) {
+        if (memcmp(signatures_[block].strong, strong, sizeof(strong)) == 0) {
+            // The block after the previous match lets us extend the current copy.
+            if (block == preferred) return block;
+            if (result == -1) result = block;
+        }
+    }
+    return result;
+}
+
+bool DeltaEncoder::Encode(borrowed_fd fd, const LiteralCallback& literal,
+                          const CopyCallback& copy) {
+    constexpr size_t kReadSize = 1024 * 1024;
+
+    // |buf| holds the file from the start of the pending literal data onwards. |pos| is the start
+    // of the window that's being matched against the old blocks.
+    std::vector<char> buf;
+    size_t literal_start = 0;
+    size_t pos = 0;
+    bool eof = false;
+
+    uint64_t copy_first = 0;
+    uint32_t copy_count = 0;
+
+    auto fill = [&](size_t needed) {
+        while (!eof && buf.size() < needed) {
+            size_t old_size = buf.size();
+            buf.resize(old_size + kReadSize);
+            int rc = adb_read(fd, buf.data() + old_size, kReadSize);
+            if (rc < 0) {
+                buf.resize(old_size);
+                return false;
+            }
+            buf.resize(old_size + rc);
+            eof = rc == 0;
+        }
+        return true;
+    };
+
+    auto flush_copy = [&]() {
+        if (copy_count == 0) return true;
+        copied_bytes_ += static_cast<uint64_t>(copy_count) * block_size_;
+        uint32_t count = copy_count;
+        copy_count = 0;
+        return copy(copy_first, count);
+    };
+
+    // Sends the literal data before |end|, which must be at most SYNC_DATA_MAX bytes.
+    auto flush_literal = [&](size_t end) {
+        if (end == literal_start) return true;
+        if (!flush_copy()) return false;
+        literal_bytes_ += end - literal_start;
+        size_t start = literal_start;
+        literal_start = end;
+        return literal(buf.data() + start, end - start);
+    };
+
+    DeltaRollingChecksum sum;
+    bool have_sum = false;
+    while (true) {
+        // Throw away data that's been dealt with, once there's enough of it to be worth moving.
+        if (literal_start >= kReadSize) {
+            buf.erase(buf.begin(), buf.begin() + literal_start);
+            pos -= literal_start;
+            literal_start = 0;
+        }
+
+        if (!fill(pos + block_size_ + 1)) return false;
+        if (signatures_.empty() || buf.size() - pos < block_size_) break;
+
+        const uint8_t* window = reinterpret_cast<const uint8_t*>(buf.data() + pos);
+        if (!have_sum) {
+            sum.Reset(window, block_size_);
+            have_sum = true;
+        }
+
+        int64_t block = FindBlock(sum.value(), window, copy_first + copy_count);
+        if (block != -1) {
+            if (!flush_literal(pos)) return false;
+            if (copy_count != 0 && static_cast<uint64_t>(block) == copy_first + copy_count &&
+                copy_count < UINT32_MAX) {
+                ++copy_count;
+            } else {
+                if (!flush_copy()) return false;
+                copy_first = block;
+                copy_count = 1;
+            }
+            pos += block_size_;
+            literal_start = pos;
+            have_sum = false;
+            continue;
+        }
+
+        if (buf.size() - pos == block_size_) {
+            // We're at the end of the file, so there's nothing to roll in.
+            break;
+        }
+        sum.Roll(window[0], window[block_size_]);
+        ++pos;
+        if (pos - literal_start == SYNC_DATA_MAX && !flush_literal(pos)) return false;
+    }
+
+    // Whatever's left can't match a block.
+    while (true) {
+        if (literal_start >= kReadSize) {
+            buf.erase(buf.begin(), buf.begin() + literal_start);
+            literal_start = 0;
+        }
+        if (!fill(literal_start + SYNC_DATA_MAX)) return false;
+        if (literal_start == buf.size()) break;
+        if (!flush_literal(std::min(buf.size(), literal_start + SYNC_DATA_MAX))) return false;
+    }
+    return flush_copy();
+}
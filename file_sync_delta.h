@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "adb_unique_fd.h"
+#include "file_sync_protocol.h"
+
+// Support for send_v3, which transfers a file as a delta against the version that's already on the
+// device, in the style of rsync: adbd sends a weak rolling checksum and a strong hash of each block
+// of the existing file, and the client scans the new file for blocks that match, sending only the
+// data in between.
+
+static constexpr uint32_t kDeltaMinBlockSize = 2 * 1024;
+static constexpr uint32_t kDeltaMaxBlockSize = 64 * 1024;
+
+// Signatures are only sent for up to this many blocks; anything after them is sent literally.
+static constexpr uint64_t kDeltaMaxBlocks = 1 << 20;
+
+// The block size to use for a file of |file_size| bytes: about sqrt(file_size), so that the size
+// of the signatures and the data sent for each change both grow with the square root of the size.
+uint32_t delta_block_size(uint64_t file_size);
+
+// rsync's weak checksum, which can be rolled forwards over a file one byte at a time.
+class DeltaRollingChecksum {
+  public:
+    void Reset(const uint8_t* data, size_t size);
+
+    // Moves the window forward by one byte: |out| leaves it and |in| joins it.
+    void Roll(uint8_t out, uint8_t in) {
+        a_ = (a_ - out + in) & 0xffff;
+        b_ = (b_ - size_ * out + a_) & 0xffff;
+    }
+
+    uint32_t value() const { return a_ | (b_ << 16); }
+
+  private:
+    uint32_t a_ = 0;
+    uint32_t b_ = 0;
+    uint32_t size_ = 0;
+};
+
+uint32_t delta_weak_checksum(const uint8_t* data, size_t size);
+void delta_strong_hash(const uint8_t* data, size_t size, uint8_t (&hash)[16]);
+
+// Reads |block_count| blocks of |block_size| bytes from |fd|, and passes their signatures to
+// |callback| in batches.
+bool compute_delta_signatures(
+        borrowed_fd fd, uint32_t block_size, uint64_t block_count,
+        const std::function<bool(std::span<const sync_delta_block>)>& callback);
+
+// Describes a new file in terms of the blocks of an old one, given the old file's signatures.
+class DeltaEncoder {
+  public:
+    using LiteralCallback = std::function<bool(const char* data, size_t size)>;
+    using CopyCallback = std::function<bool(uint64_t first_block, uint32_t block_count)>;
+
+    DeltaEncoder(uint32_t block_size, std::vector<sync_delta_block> signatures);
+
+    // Reads all of |fd|, and calls |literal| and |copy| with the data that has to be sent, in
+    // runs of at most SYNC_DATA_MAX bytes, and the runs of old blocks that can be reused. Returns
+    // false if reading fails, with errno set, or as soon as a callback returns false.
+    bool Encode(borrowed_fd fd, const LiteralCallback& literal, const CopyCallback& copy);
+
+    uint64_t literal_bytes() const { return literal_bytes_; }
+    uint64_t copied_bytes() const { return copied_bytes_; }
+
+  private:
+    // Returns the old block that |data| matches, preferring |preferred|, or -1 if none do.
+    int64_t FindBlock(uint32_t weak, const uint8_t* data, uint64_t preferred) const;
+
+    uint32_t block_size_;
+    std::vector<sync_delta_block> signatures_;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> blocks_by_weak_;
+
+    uint64_t literal_bytes_ = 0;
+    uint64_t copied_bytes_ = 0;
+};
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "file_sync_delta.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+
+#include "sysdeps.h"
+
+static std::string random_string(size_t size, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> dist(0, 255);
+    std::string result(size, '\0');
+    for (char& c : result) {
+        c = dist(rng);
+    }
+    return result;
+}
+
+static std::vector<sync_delta_block> signatures_of(const std::string& old_data,
+                                                   uint32_t block_size) {
+    TemporaryFile tf;
+    EXPECT_TRUE(android::base::WriteStringToFile(old_data, tf.path));
+    unique_fd fd(adb_open(tf.path, O_RDONLY));
+    std::vector<sync_delta_block> result;
+    EXPECT_TRUE(compute_delta_signatures(fd, block_size, old_data.size() / block_size,
+                                         [&](std::span<const sync_delta_block> batch) {
+                                             result.insert(result.end(), batch.begin(),
+                                                           batch.end());
+                                             return true;
+                                         }));
+    return result;
+}
+
+// Encodes |new_data| against |old_data| and checks that applying the delta gives back |new_data|.
+// Returns the number of literal bytes that were needed.
+static uint64_t round_trip(const std::string& old_data, const std::string& new_data,
+                           uint32_t block_size) {
+    DeltaEncoder encoder(block_size, signatures_of(old_data, block_size));
+
+    TemporaryFile tf;
+    EXPECT_TRUE(android::base::WriteStringToFile(new_data, tf.path));
+    unique_fd fd(adb_open(tf.path, O_RDONLY));
+
+    std::string result;
+    EXPECT_TRUE(encoder.Encode(
+            fd,
+            [&](const char* data, size_t size) {
+                EXPECT_LE(size, static_cast<size_t>(SYNC_DATA_MAX));
+                result.append(data, size);
+                return true;
+            },
+            [&](uint64_t first_block, uint32_t block_count) {
+                EXPECT_LE((first_block + block_count) * block_size, old_data.size());
+                result.append(old_data, first_block * block_size,
+                              static_cast<size_t>(block_count) * block_size);
+                return true;
+            }));
+    EXPECT_EQ(new_data.size(), result.size());
+    EXPECT_TRUE(new_data == result);
+    EXPECT_EQ(new_data.size(), encoder.literal_bytes() + encoder.copied_bytes());
+    return encoder.literal_bytes();
+}
+
+TEST(file_sync_delta, block_size) {
+    EXPECT_EQ(kDeltaMinBlockSize, delta_block_size(0));
+    EXPECT_EQ(10U * 1024, delta_block_size(100'000'000));
+    EXPECT_EQ(kDeltaMaxBlockSize, delta_block_size(100'000'000'000));
+}
+
+TEST(file_sync_delta, rolling_checksum) {
+    std::string data = random_string(10000, 1);
+    auto* bytes = reinterpret_cast<const uint8_t*>(data.data());
+    constexpr size_t kWindow = 2048;
+
+    DeltaRollingChecksum sum;
+    sum.Reset(bytes, kWindow);
+    for (size_t i = 0; i + kWindow < data.size(); ++i) {
+        ASSERT_EQ(delta_weak_checksum(bytes + i, kWindow), sum.value()) << i;
+        sum.Roll(bytes[i], bytes[i + kWindow]);
+    }
+}
+
+TEST(file_sync_delta, identical) {
+    std::string data = random_string(1024 * 1024 + 100, 2);
+    // Only the partial block at the end has to be sent.
+    EXPECT_EQ(100U, round_trip(data, data, 4096));
+}
+
+TEST(file_sync_delta, no_old_file) {
+    std::string data = random_string(300 * 1024 + 7, 3);
+    EXPECT_EQ(data.size(), round_trip("", data, 4096));
+}
+
+TEST(file_sync_delta, edits) {
+    std::string old_data = random_string(4 * 1024 * 1024, 4);
+    std::string new_data = old_data;
+    new_data.insert(1000, "inserted");
+    new_data.erase(2 * 1024 * 1024, 12345);
+    new_data[3 * 1024 * 1024] ^= 0xff;
+    new_data += random_string(5000, 5);
+
+    // Each edit costs at most a couple of blocks.
+    EXPECT_LT(round_trip(old_data, new_data, 4096), 6U * 4096 + 5000);
+}
+
+TEST(file_sync_delta, reordered) {
+    std::string a = random_string(64 * 1024, 6);
+    std::string b = random_string(64 * 1024, 7);
+    std::string zeros(64 * 1024, '\0');
+    EXPECT_EQ(0U, round_trip(a + zeros + b, b + a + zeros + zeros, 4096));
+}
+
+TEST(file_sync_delta, shorter_than_a_block) {
+    EXPECT_EQ(5U, round_trip("hello", "hello", 4096));
+    EXPECT_EQ(0U, round_trip("hello", "", 4096));
+}
@@ -28,17 +28,26 @@
 #define ID_LIST_V2 MKID('L', 'I', 'S', '2')
 #define ID_DENT_V1 MKID('D', 'E', 'N', 'T')
 #define ID_DENT_V2 MKID('D', 'N', 'T', '2')
+#define ID_LIST_RECURSIVE MKID('L', 'I', 'S', 'R')
 
 #define ID_SEND_V1 MKID('S', 'E', 'N', 'D')
 #define ID_SEND_V2 MKID('S', 'N', 'D', '2')
+#define ID_SEND_V3 MKID('S', 'N', 'D', '3')
+#define ID_SEND_BATCH MKID('S', 'N', 'D', 'B')
 #define ID_RECV_V1 MKID('R', 'E', 'C', 'V')
 #define ID_RECV_V2 MKID('R', 'C', 'V', '2')
+#define ID_RECV_RANGE MKID('R', 'C', 'V', 'R')
 #define ID_DONE MKID('D', 'O', 'N', 'E')
 #define ID_DATA MKID('D', 'A', 'T', 'A')
 #define ID_OKAY MKID('O', 'K', 'A', 'Y')
 #define ID_FAIL MKID('F', 'A', 'I', 'L')
 #define ID_QUIT MKID('Q', 'U', 'I', 'T')
 
+#define ID_SIGS MKID('S', 'I', 'G', 'S')
+#define ID_COPY MKID('C', 'O', 'P', 'Y')
+
+#define ID_HASH_V1 MKID('H', 'S', 'H', '1')
+
 struct SyncRequest {
     uint32_t id;           // ID_STAT, et cetera.
     uint32_t path_length;  // <= 1024
@@ -91,6 +100,12 @@ struct __attribute__((packed)) sync_dent_v2 {
     uint32_t namelen;
 };  // followed by `namelen` bytes of the name.
 
+// list_recursive lists everything under the path, with a sync_dent_v2 for each entry followed by
+// its path relative to the requested one, and then ID_DONE. A directory's entry always comes
+// before anything inside it, but the entries are otherwise in no particular order. Symbolic links
+// are followed, and the entry describes what they point to; |error| is set if that can't be
+// stat'ed. Directories that can't be opened are listed as empty, as with list_v2.
+
 enum SyncFlag : uint32_t {
     kSyncFlagNone = 0,
     kSyncFlagBrotli = 1,
@@ -105,6 +120,9 @@ enum class CompressionType {
     Brotli,
     LZ4,
     Zstd,
+
+    // Chosen by the client for each file, from how well it compresses and how fast the link is.
+    Adaptive,
 };
 
 // send_v1 sent the path in a buffer, followed by a comma and the mode as a string.
@@ -116,12 +134,80 @@ struct __attribute__((packed)) sync_send_v2 {
     uint32_t flags;
 };
 
+// send_v3 sends a delta against the file that's already on the device. It sends the same setup
+// packet as send_v2 (with ID_SEND_V3), with any of its compression flags. adbd responds with a
+// sync_delta_signatures describing the existing file, followed by a sync_delta_block for each of
+// its complete blocks. The client then sends the new file as a single stream of ID_DATA packets,
+// compressed as the flags say, followed by ID_DONE as for send_v2. Uncompressed, the stream is the
+// new file in order, as sync_data headers each followed by literal data, and sync_delta_copy
+// messages for runs of blocks to copy from the existing file. adbd builds the new file next to the
+// old one, and then renames it into place.
+struct __attribute__((packed)) sync_delta_signatures {
+    uint32_t id;
+    uint32_t block_size;
+    uint64_t block_count;
+};
+
+struct __attribute__((packed)) sync_delta_block {
+    uint32_t weak;
+    uint8_t strong[16];
+};
+
+struct __attribute__((packed)) sync_delta_copy {
+    uint32_t id;
+    uint32_t block_count;
+    uint64_t first_block;
+};
+
+// send_batch sends many small files in one stream. The path is the directory that the files'
+// paths are relative to, and is followed by a sync_send_batch with the same flags as send_v2 and
+// the number of files. The files then follow as a single stream of ID_DATA packets, compressed as
+// the flags say, and ID_DONE. Uncompressed, the stream is a sync_send_batch_entry for each file,
+// followed by its path and contents. adbd responds with a single ID_OKAY or ID_FAIL for the batch.
+struct __attribute__((packed)) sync_send_batch {
+    uint32_t id;
+    uint32_t flags;
+    uint32_t count;
+};
+
+struct __attribute__((packed)) sync_send_batch_entry {
+    uint32_t mode;
+    uint32_t mtime;
+    uint32_t path_length;  // <= 1024
+    uint32_t size;
+};  // followed by `path_length` bytes of path and `size` bytes of data.
+
 // Likewise, recv_v1 just sent the path without any accompanying data.
 struct __attribute__((packed)) sync_recv_v2 {
     uint32_t id;
     uint32_t flags;
 };
 
+// recv_range pulls part of a file, so that a large one can be pulled over several connections at
+// once. It's the same as recv_v2, but the setup packet also says where in the file to start and
+// how much to send. The response stops early at the end of the file.
+struct __attribute__((packed)) sync_recv_range {
+    uint32_t id;
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t length;
+};
+
+// hash_v1 sends an empty path, followed by a sync_hash_v1_request with the number of files to
+// hash. Each file's path follows as a SyncRequest with the same id and the path. The response is a
+// sync_hash_v1 for each file, in the same order.
+struct __attribute__((packed)) sync_hash_v1_request {
+    uint32_t id;
+    uint32_t count;  // <= SYNC_HASH_MAX_PATHS
+};
+
+struct __attribute__((packed)) sync_hash_v1 {
+    uint32_t id;
+    uint32_t error;
+    uint64_t size;
+    uint8_t sha256[32];
+};
+
 struct __attribute__((packed)) sync_data {
     uint32_t id;
     uint32_t size;
@@ -140,7 +226,14 @@ union syncmsg {
     sync_data data;
     sync_status status;
     sync_send_v2 send_v2_setup;
+    sync_send_batch send_batch_setup;
     sync_recv_v2 recv_v2_setup;
+    sync_recv_range recv_range_setup;
+    sync_hash_v1_request hash_v1_request;
+    sync_hash_v1 hash_v1;
+    sync_delta_signatures delta_signatures;
+    sync_delta_copy delta_copy;
 };
 
 #define SYNC_DATA_MAX (64 * 1024)
+#define SYNC_HASH_MAX_PATHS 256
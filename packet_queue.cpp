@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "packet_queue.h"
+
+#include <algorithm>
+#include <utility>
+
+static void update_max(std::atomic<uint64_t>& max, uint64_t value) {
+    uint64_t current = max.load(std::memory_order_relaxed);
+    while (current < value &&
+           !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+void PacketQueue::Counters::RecordPush(uint64_t depth) {
+    packets.fetch_add(1, std::memory_order_relaxed);
+    update_max(max_depth, depth);
+}
+
+void PacketQueue::Counters::RecordBatch(uint64_t size) {
+    batches.fetch_add(1, std::memory_order_relaxed);
+    update_max(max_batch_size, size);
+}
+
+PacketQueueStats PacketQueue::Counters::Get() const {
+    PacketQueueStats result;
+    result.packets = packets.load(std::memory_order_relaxed);
+    result.batches = batches.load(std::memory_order_relaxed);
+    result.max_batch_size = max_batch_size.load(std::memory_order_relaxed);
+    result.max_depth = max_depth.load(std::memory_order_relaxed);
+    return result;
+}
+
+PacketQueue::Counters& PacketQueue::GlobalCounters() {
+    static auto& counters = *new Counters();
+    return counters;
+}
+
+PacketQueue::~PacketQueue() {
+    apacket* packet = head_.exchange(nullptr, std::memory_order_acquire);
+    while (packet) {
+        delete std::exchange(packet, packet->queue_next);
+    }
+}
+
+bool PacketQueue::Push(std::unique_ptr<apacket> packet) {
+    // Count the packet before publishing it, so that the consumer can't take it out first.
+    uint64_t depth = depth_.fetch_add(1, std::memory_order_relaxed) + 1;
+    counters_.RecordPush(depth);
+    GlobalCounters().RecordPush(depth);
+
+    // The consumer owns the packet as soon as the CAS succeeds, so don't touch it afterwards.
+    apacket* node = packet.release();
+    apacket* head = head_.load(std::memory_order_relaxed);
+    do {
+        node->queue_next = head;
+    } while (!head_.compare_exchange_weak(head, node, std::memory_order_release,
+                                          std::memory_order_relaxed));
+    return head == nullptr;
+}
+
+void PacketQueue::Drain(std::vector<std::unique_ptr<apacket>>* packets) {
+    apacket* head = head_.exchange(nullptr, std::memory_order_acquire);
+    if (!head) {
+        return;
+    }
+
+    size_t begin = packets->size();
+    while (head) {
+        apacket* next = std::exchange(head->queue_next, nullptr);
+        packets->emplace_back(head);
+        head = next;
+    }
+    std::reverse(packets->begin() + begin, packets->end());
+
+    uint64_t batch_size = packets->size() - begin;
+    depth_.fetch_sub(batch_size, std::memory_order_relaxed);
+    counters_.RecordBatch(batch_size);
+    GlobalCounters().RecordBatch(batch_size);
+}
+
+PacketQueueStats PacketQueue::stats() const {
+    return counters_.Get();
+}
+
+PacketQueueStats PacketQueue::global_stats() {
+    return GlobalCounters().Get();
+}
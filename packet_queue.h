@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "types.h"
+
+struct PacketQueueStats {
+    // Number of packets that went through the queue.
+    uint64_t packets = 0;
+
+    // Number of times the consumer took packets out of the queue. packets / batches is the average
+    // batch size.
+    uint64_t batches = 0;
+    uint64_t max_batch_size = 0;
+
+    // The most packets that have been waiting in the queue at once.
+    uint64_t max_depth = 0;
+};
+
+// A lock-free queue of apackets with any number of producers and a single consumer, which always
+// takes everything in the queue at once. This is how packets read by a transport's threads get
+// to the looper: only the packet that makes the queue non-empty needs to wake the looper up.
+//
+// Producers push onto an intrusive singly-linked stack with a CAS, and the consumer swaps the whole
+// stack out and reverses it to restore the order the packets were pushed in.
+class PacketQueue {
+  public:
+    PacketQueue() = default;
+    ~PacketQueue();
+
+    PacketQueue(const PacketQueue& copy) = delete;
+    PacketQueue& operator=(const PacketQueue& copy) = delete;
+
+    // Returns true if the queue was empty, in which case the caller is responsible for making sure
+    // that the consumer calls Drain later.
+    bool Push(std::unique_ptr<apacket> packet);
+
+    // Append every packet in the queue to |packets|, oldest first. Must only be called by one
+    // thread at a time.
+    void Drain(std::vector<std::unique_ptr<apacket>>* packets);
+
+    PacketQueueStats stats() const;
+
+    // Stats for every PacketQueue in the process, including ones that have been destroyed.
+    static PacketQueueStats global_stats();
+
+  private:
+    std::atomic<apacket*> head_ = nullptr;
+    std::atomic<uint64_t> depth_ = 0;
+
+    struct Counters {
+        std::atomic<uint64_t> packets = 0;
+        std::atomic<uint64_t> batches = 0;
+        std::atomic<uint64_t> max_batch_size = 0;
+        std::atomic<uint64_t> max_depth = 0;
+
+        void RecordPush(uint64_t depth);
+        void RecordBatch(uint64_t size);
+        PacketQueueStats Get() const;
+    };
+    Counters counters_;
+
+    static Counters& GlobalCounters();
+};
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "packet_queue.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+static std::unique_ptr<apacket> make_packet(uint32_t arg0, uint32_t arg1 = 0) {
+    auto p = std::make_unique<apacket>();
+    p->msg.arg0 = arg0;
+    p->msg.arg1 = arg1;
+    return p;
+}
+
+TEST(PacketQueue, fifo) {
+    PacketQueue queue;
+    ASSERT_TRUE(queue.Push(make_packet(0)));
+    ASSERT_FALSE(queue.Push(make_packet(1)));
+    ASSERT_FALSE(queue.Push(make_packet(2)));
+
+    std::vector<std::unique_ptr<apacket>> packets;
+    queue.Drain(&packets);
+    ASSERT_EQ(3U, packets.size());
+    for (size_t i = 0; i < packets.size(); ++i) {
+        ASSERT_EQ(i, packets[i]->msg.arg0);
+        ASSERT_EQ(nullptr, packets[i]->queue_next);
+    }
+
+    // The queue is empty again, so the next push has to schedule a drain.
+    ASSERT_TRUE(queue.Push(make_packet(3)));
+    queue.Drain(&packets);
+    ASSERT_EQ(4U, packets.size());
+    ASSERT_EQ(3U, packets[3]->msg.arg0);
+
+    queue.Drain(&packets);
+    ASSERT_EQ(4U, packets.size());
+
+    PacketQueueStats stats = queue.stats();
+    ASSERT_EQ(4U, stats.packets);
+    ASSERT_EQ(2U, stats.batches);
+    ASSERT_EQ(3U, stats.max_batch_size);
+    ASSERT_EQ(3U, stats.max_depth);
+}
+
+TEST(PacketQueue, destroy_with_packets) {
+    PacketQueue queue;
+    queue.Push(make_packet(0));
+    queue.Push(make_packet(1));
+}
+
+// Packets from each producer come out in the order that producer pushed them, and every push that
+// found the queue empty corresponds to a drain that finds something.
+TEST(PacketQueue, multiple_producers) {
+    constexpr uint32_t kProducers = 4;
+    constexpr uint32_t kPacketsPerProducer = 20000;
+
+    PacketQueue queue;
+    std::atomic<uint32_t> wakeups = 0;
+    std::vector<std::thread> producers;
+    for (uint32_t producer = 0; producer < kProducers; ++producer) {
+        producers.emplace_back([&, producer]() {
+            for (uint32_t i = 0; i < kPacketsPerProducer; ++i) {
+                if (queue.Push(make_packet(producer, i))) {
+                    ++wakeups;
+                }
+            }
+        });
+    }
+
+    std::vector<uint32_t> next(kProducers, 0);
+    uint32_t received = 0;
+    uint32_t nonempty_drains = 0;
+    std::vector<std::unique_ptr<apacket>> packets;
+    while (received < kProducers * kPacketsPerProducer) {
+        packets.clear();
+        queue.Drain(&packets);
+        if (!packets.empty()) {
+            ++nonempty_drains;
+        }
+        for (const auto& packet : packets) {
+            ASSERT_LT(packet->msg.arg0, kProducers);
+            ASSERT_EQ(next[packet->msg.arg0]++, packet->msg.arg1);
+        }
+        received += packets.size();
+    }
+
+    for (auto& producer : producers) {
+        producer.join();
+    }
+
+    ASSERT_EQ(wakeups, nonempty_drains);
+    ASSERT_EQ(nonempty_drains, queue.stats().batches);
+    ASSERT_EQ(received, queue.stats().packets);
+}
@@ -24,6 +24,7 @@
 #include <optional>
 #include <string>
 
+#include "ack_window.h"
 #include "adb_unique_fd.h"
 #include "fdevent/fdevent.h"
 #include "types.h"
@@ -128,6 +129,9 @@ struct asocket {
     // we'll send out a full packet.
     std::optional<int64_t> available_send_bytes;
 
+    // If delayed acks are available, how much of available_send_bytes we actually use.
+    std::unique_ptr<AckWindow> send_window;
+
     // Start Smart socket fields
     // A temporary buffer used to hold a partially-read service string for smartsockets.
     std::string smart_socket_data;
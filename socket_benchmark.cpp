@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "socket.h"
+
+namespace {
+
+// A set of installed local sockets, as if we had |count| forwarded connections open.
+class InstalledSockets {
+  public:
+    explicit InstalledSockets(size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            auto peer = std::make_unique<asocket>();
+            peer->id = i + 1;
+            auto s = std::make_unique<asocket>();
+            s->peer = peer.get();
+            install_local_socket(s.get());
+            peers_.push_back(std::move(peer));
+            sockets_.push_back(std::move(s));
+        }
+    }
+
+    ~InstalledSockets() {
+        for (const auto& s : sockets_) {
+            remove_socket(s.get());
+        }
+    }
+
+    const std::vector<std::unique_ptr<asocket>>& sockets() const { return sockets_; }
+
+  private:
+    std::vector<std::unique_ptr<asocket>> sockets_;
+    std::vector<std::unique_ptr<asocket>> peers_;
+};
+
+}  // namespace
+
+// The lookup done by handle_packet for every A_OKAY, A_WRTE and A_CLSE, with packets arriving for
+// sockets in random order.
+static void BM_FindLocalSocket(benchmark::State& state) {
+    InstalledSockets installed(state.range(0));
+
+    std::mt19937 rng(42);
+    std::vector<std::pair<unsigned, unsigned>> ids;
+    for (size_t i = 0; i < 4096; ++i) {
+        const auto& s = installed.sockets()[rng() % installed.sockets().size()];
+        ids.emplace_back(s->id, s->peer->id);
+    }
+
+    size_t i = 0;
+    for (auto _ : state) {
+        auto [local_id, peer_id] = ids[i++ % ids.size()];
+        benchmark::DoNotOptimize(find_local_socket(local_id, peer_id));
+    }
+}
+BENCHMARK(BM_FindLocalSocket)->ArgName("sockets")->Arg(10)->Arg(1000)->Arg(10000);
+
+// Opening and closing a connection while lots of others are open.
+static void BM_InstallRemoveSocket(benchmark::State& state) {
+    InstalledSockets installed(state.range(0));
+
+    asocket s;
+    for (auto _ : state) {
+        install_local_socket(&s);
+        remove_socket(&s);
+    }
+}
+BENCHMARK(BM_InstallRemoveSocket)->ArgName("sockets")->Arg(10)->Arg(1000)->Arg(10000);
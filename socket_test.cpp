@@ -20,6 +20,7 @@
 
 #include <array>
 #include <limits>
+#include <memory>
 #include <queue>
 #include <string>
 #include <thread>
@@ -312,6 +313,40 @@ TEST_F(LocalSocketTest, close_socket_in_CLOSE_WAIT_state) {
 
 #endif  // defined(__linux__)
 
+TEST(socket_test, find_local_socket) {
+    asocket peer;
+    peer.id = 1234;
+
+    std::vector<std::unique_ptr<asocket>> sockets;
+    for (size_t i = 0; i < 100; ++i) {
+        sockets.push_back(std::make_unique<asocket>());
+        install_local_socket(sockets.back().get());
+    }
+    sockets[50]->peer = &peer;
+
+    for (const auto& s : sockets) {
+        ASSERT_EQ(s.get(), find_local_socket(s->id, 0));
+    }
+    ASSERT_EQ(sockets[50].get(), find_local_socket(sockets[50]->id, peer.id));
+    ASSERT_EQ(nullptr, find_local_socket(sockets[50]->id, peer.id + 1));
+    ASSERT_EQ(nullptr, find_local_socket(sockets[49]->id, peer.id));
+
+    // Ids are never reused, so a removed socket can't be found, even after more are installed.
+    unsigned removed_id = sockets[10]->id;
+    remove_socket(sockets[10].get());
+    ASSERT_EQ(nullptr, find_local_socket(removed_id, 0));
+    auto replacement = std::make_unique<asocket>();
+    install_local_socket(replacement.get());
+    ASSERT_NE(removed_id, replacement->id);
+    ASSERT_EQ(nullptr, find_local_socket(removed_id, 0));
+    remove_socket(replacement.get());
+
+    for (const auto& s : sockets) {
+        remove_socket(s.get());
+        ASSERT_EQ(nullptr, find_local_socket(s->id, 0));
+    }
+}
+
 #if ADB_HOST
 
 #define VerifyParseHostServiceFailed(s)                                         \
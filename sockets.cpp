@@ -30,6 +30,8 @@
 #include <chrono>
 #include <mutex>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <android-base/strings.h>
@@ -50,32 +52,31 @@ using namespace std::chrono_literals;
 static std::recursive_mutex& local_socket_list_lock = *new std::recursive_mutex();
 static unsigned local_socket_next_id = 1;
 
-static auto& local_socket_list = *new std::vector<asocket*>();
+// Installed local sockets, indexed by id. Ids are never reused, so there's no need to worry about
+// a stale id finding a newer socket.
+static auto& local_socket_list = *new std::unordered_map<unsigned, asocket*>();
 
 /* the the list of currently closing local sockets.
 ** these have no peer anymore, but still packets to
 ** write to their fd.
 */
-static auto& local_socket_closing_list = *new std::vector<asocket*>();
+static auto& local_socket_closing_list = *new std::unordered_set<asocket*>();
 
-// Parse the global list of sockets to find one with id |local_id|.
+// Look up the socket with id |local_id| in the global table.
 // If |peer_id| is not 0, also check that it is connected to a peer
 // with id |peer_id|. Returns an asocket handle on success, NULL on failure.
 asocket* find_local_socket(unsigned local_id, unsigned peer_id) {
-    asocket* result = nullptr;
-
     std::lock_guard<std::recursive_mutex> lock(local_socket_list_lock);
-    for (asocket* s : local_socket_list) {
-        if (s->id != local_id) {
-            continue;
-        }
-        if (peer_id == 0 || (s->peer && s->peer->id == peer_id)) {
-            result = s;
-        }
-        break;
+    auto it = local_socket_list.find(local_id);
+    if (it == local_socket_list.end()) {
+        return nullptr;
     }
 
-    return result;
+    asocket* s = it->second;
+    if (peer_id == 0 || (s->peer && s->peer->id == peer_id)) {
+        return s;
+    }
+    return nullptr;
 }
 
 void install_local_socket(asocket* s) {
@@ -88,27 +89,37 @@ void install_local_socket(asocket* s) {
         LOG(FATAL) << "local socket id overflow";
     }
 
-    local_socket_list.push_back(s);
+    local_socket_list.emplace(s->id, s);
 }
 
 void remove_socket(asocket* s) {
     std::lock_guard<std::recursive_mutex> lock(local_socket_list_lock);
-    for (auto list : { &local_socket_list, &local_socket_closing_list }) {
-        list->erase(std::remove_if(list->begin(), list->end(), [s](asocket* x) { return x == s; }),
-                    list->end());
+    if (auto it = local_socket_list.find(s->id); it != local_socket_list.end() && it->second == s) {
+        local_socket_list.erase(it);
     }
+    local_socket_closing_list.erase(s);
 }
 
 void close_all_sockets(atransport* t) {
-    /* this is a little gross, but since s->close() *will* modify
-    ** the list out from under you, your options are limited.
-    */
     std::lock_guard<std::recursive_mutex> lock(local_socket_list_lock);
-restart:
-    for (asocket* s : local_socket_list) {
-        if (s->transport == t || (s->peer && s->peer->transport == t)) {
+
+    auto uses_transport = [t](asocket* s) {
+        return s->transport == t || (s->peer && s->peer->transport == t);
+    };
+
+    // Closing a socket can close others (e.g. its peer), so collect the ids first, and look each
+    // one up again before closing it.
+    std::vector<unsigned> ids;
+    for (const auto& [id, s] : local_socket_list) {
+        if (uses_transport(s)) {
+            ids.push_back(id);
+        }
+    }
+
+    for (unsigned id : ids) {
+        asocket* s = find_local_socket(id, 0);
+        if (s && uses_transport(s)) {
             s->close(s);
-            goto restart;
         }
     }
 }
@@ -213,6 +224,9 @@ static bool local_socket_flush_outgoing(asocket* s) {
         if (s->available_send_bytes) {
             *s->available_send_bytes -= data.size();
         }
+        if (s->send_window) {
+            s->send_window->OnSend(data.size(), std::chrono::steady_clock::now());
+        }
 
         r = s->peer->enqueue(s->peer, std::move(data));
         D("LS(%u): fd=%d post peer->enqueue(). r=%d", saved_id, saved_fd, r);
@@ -232,6 +246,10 @@ static bool local_socket_flush_outgoing(asocket* s) {
                 if (*s->available_send_bytes <= 0) {
                     D("LS(%u): send buffer full (%" PRId64 ")", saved_id, *s->available_send_bytes);
                     fdevent_del(s->fde, FDE_READ);
+                } else if (s->send_window && !s->send_window->CanSend()) {
+                    D("LS(%u): send window full (%" PRId64 ")", saved_id,
+                      s->send_window->window());
+                    fdevent_del(s->fde, FDE_READ);
                 }
             } else {
                 D("LS(%u): acks not deferred, blocking", saved_id);
@@ -358,6 +376,9 @@ static void local_socket_close(asocket* s) {
         s->peer = nullptr;
     }
 
+    // Nothing more will be sent, and the transport might go away before we're destroyed.
+    s->send_window.reset();
+
     /* If we are already closing, or if there are no
     ** pending packets, destroy immediately
     */
@@ -375,7 +396,7 @@ static void local_socket_close(asocket* s) {
     fdevent_del(s->fde, FDE_READ);
     remove_socket(s);
     D("LS(%d): put on socket_closing_list fd=%d", s->id, s->fd);
-    local_socket_closing_list.push_back(s);
+    local_socket_closing_list.insert(s);
     CHECK_EQ(FDE_WRITE, s->fde->state & FDE_WRITE);
 }
 
@@ -432,7 +453,10 @@ void local_socket_ack(asocket* s, std::optional<int32_t> acked_bytes) {
 
         // This can't (reasonably) overflow: available_send_bytes is 64-bit.
         *s->available_send_bytes += *acked_bytes;
-        if (*s->available_send_bytes > 0) {
+        if (s->send_window) {
+            s->send_window->OnAck(*acked_bytes, std::chrono::steady_clock::now());
+        }
+        if (*s->available_send_bytes > 0 && (!s->send_window || s->send_window->CanSend())) {
             s->ready(s);
         }
     } else {
@@ -572,8 +596,11 @@ void connect_to_remote(asocket* s, std::string_view destination) {
     p->msg.arg0 = s->id;
 
     if (s->transport->SupportsDelayedAck()) {
+        // As in handle_packet's A_OPEN, the full credit is advertised, since the window is only
+        // limited on the sending side, by the other end's AckWindow.
         p->msg.arg1 = INITIAL_DELAYED_ACK_BYTES;
         s->available_send_bytes = 0;
+        s->send_window = std::make_unique<AckWindow>(s->transport->ack_window_budget());
     }
 
     // adbd used to expect a null-terminated string.
@@ -97,6 +97,11 @@ const char* const kFeatureSendRecv2LZ4 = "sendrecv_v2_lz4";
 const char* const kFeatureSendRecv2Zstd = "sendrecv_v2_zstd";
 const char* const kFeatureSendRecv2DryRunSend = "sendrecv_v2_dry_run_send";
 const char* const kFeatureDelayedAck = "delayed_ack";
+const char* const kFeatureSyncHash = "sync_hash";
+const char* const kFeatureSendV3Delta = "send_v3_delta";
+const char* const kFeatureSendBatch = "send_batch";
+const char* const kFeatureLsRecursive = "ls_recursive";
+const char* const kFeatureRecvRange = "recv_range";
 // TODO(joshuaduong): Bump to v2 when openscreen discovery is enabled by default
 const char* const kFeatureOpenscreenMdns = "openscreen_mdns";
 const char* const kFeatureDeviceTrackerProtoFormat = "devicetracker_proto_format";
@@ -296,6 +301,15 @@ std::string Connection::Serial() const {
     return transport_ ? transport_->serial_name() : "<unknown>";
 }
 
+bool BlockingConnection::WritePackets(std::span<apacket* const> packets) {
+    for (apacket* packet : packets) {
+        if (!Write(packet)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 BlockingConnectionAdapter::BlockingConnectionAdapter(std::unique_ptr<BlockingConnection> connection)
     : underlying_(std::move(connection)) {}
 
@@ -314,6 +328,8 @@ bool BlockingConnectionAdapter::Start() {
 
     write_thread_ = std::thread([this]() {
         VLOG(ADB) << Serial() << ": write thread spawning";
+        std::vector<std::unique_ptr<apacket>> batch;
+        std::vector<apacket*> packets;
         while (true) {
             std::unique_lock<std::mutex> lock(mutex_);
             ScopedLockAssertion assume_locked(mutex_);
@@ -325,11 +341,22 @@ bool BlockingConnectionAdapter::Start() {
                 return;
             }
 
-            std::unique_ptr<apacket> packet = std::move(this->write_queue_.front());
-            this->write_queue_.pop_front();
+            size_t batch_bytes = 0;
+            while (!this->write_queue_.empty() && batch.size() < kMaxWriteBatchPackets &&
+                   batch_bytes < kMaxWriteBatchBytes) {
+                batch_bytes += sizeof(amessage) + this->write_queue_.front()->payload.size();
+                batch.push_back(std::move(this->write_queue_.front()));
+                this->write_queue_.pop_front();
+            }
             lock.unlock();
 
-            if (!this->underlying_->Write(packet.get())) {
+            packets.clear();
+            for (const auto& packet : batch) {
+                packets.push_back(packet.get());
+            }
+            bool written = this->underlying_->WritePackets(packets);
+            batch.clear();
+            if (!written) {
                 break;
             }
         }
@@ -446,7 +473,8 @@ bool BlockingConnectionAdapter::Write(std::unique_ptr<apacket> packet) {
     return true;
 }
 
-FdConnection::FdConnection(unique_fd fd) : fd_(std::move(fd)) {}
+FdConnection::FdConnection(unique_fd fd, TlsRole tls_role)
+    : fd_(std::move(fd)), tls_role_(tls_role) {}
 
 FdConnection::~FdConnection() {}
 
@@ -462,18 +490,6 @@ bool FdConnection::DispatchRead(void* buf, size_t len) {
     return ReadFdExactly(fd_.get(), buf, len);
 }
 
-bool FdConnection::DispatchWrite(void* buf, size_t len) {
-    if (tls_ != nullptr) {
-        // The TlsConnection doesn't allow 0 byte writes
-        if (len == 0) {
-            return true;
-        }
-        return tls_->WriteFully(std::string_view(reinterpret_cast<const char*>(buf), len));
-    }
-
-    return WriteFdExactly(fd_.get(), buf, len);
-}
-
 bool FdConnection::Read(apacket* packet) {
     if (!DispatchRead(&packet->msg, sizeof(amessage))) {
         D("remote local: read terminated (message)");
@@ -496,18 +512,56 @@ bool FdConnection::Read(apacket* packet) {
 }
 
 bool FdConnection::Write(apacket* packet) {
-    if (!DispatchWrite(&packet->msg, sizeof(packet->msg))) {
-        D("remote local: write terminated");
-        return false;
-    }
+    return WritePackets({&packet, 1});
+}
+
+// Over TLS, payloads smaller than this are copied in with the packet headers around them, so that
+// runs of small packets share TLS records. Larger payloads are written as they are.
+static constexpr size_t kTlsCoalescedPayloadMax = 4096;
 
-    if (packet->msg.data_length) {
-        if (!DispatchWrite(&packet->payload[0], packet->msg.data_length)) {
+bool FdConnection::WritePackets(std::span<apacket* const> packets) {
+    if (tls_ != nullptr) {
+        std::string buf;
+        for (apacket* packet : packets) {
+            buf.append(reinterpret_cast<const char*>(&packet->msg), sizeof(packet->msg));
+            if (packet->msg.data_length < kTlsCoalescedPayloadMax) {
+                buf.append(packet->payload.data(), packet->msg.data_length);
+                continue;
+            }
+            if (!tls_->WriteFully(buf) ||
+                !tls_->WriteFully(
+                        std::string_view(packet->payload.data(), packet->msg.data_length))) {
+                D("remote local: write terminated");
+                return false;
+            }
+            buf.clear();
+        }
+        if (!buf.empty() && !tls_->WriteFully(buf)) {
             D("remote local: write terminated");
             return false;
         }
+        return true;
+    }
+
+    std::vector<adb_iovec> iovs;
+    iovs.reserve(packets.size() * 2);
+    auto append = [&iovs](void* base, size_t len) {
+        adb_iovec iov;
+        iov.iov_base = base;
+        iov.iov_len = len;
+        iovs.push_back(iov);
+    };
+    for (apacket* packet : packets) {
+        append(&packet->msg, sizeof(packet->msg));
+        if (packet->msg.data_length) {
+            append(packet->payload.data(), packet->msg.data_length);
+        }
     }
 
+    if (!WritevFdExactly(fd_.get(), iovs.data(), iovs.size())) {
+        D("remote local: write terminated");
+        return false;
+    }
     return true;
 }
 
@@ -522,31 +576,37 @@ bool FdConnection::DoTlsHandshake(RSA* key, std::string* auth_key) {
     auto evp_str = Key::ToPEMString(evp_pkey.get());
 
     int osh = cast_handle_to_int(adb_get_os_handle(fd_));
+    if (tls_role_ == TlsRole::Client) {
+        tls_ = TlsConnection::Create(TlsConnection::Role::Client, x509_str, evp_str, osh);
+        CHECK(tls_);
+        // TLS 1.3 gives the client no message if the server rejected the
+        // certificate. This will enable a check in the tls connection to check
+        // whether the client certificate got rejected. Note that this assumes
+        // that, on handshake success, the server speaks first.
+        tls_->EnableClientPostHandshakeCheck(true);
 #if ADB_HOST
-    tls_ = TlsConnection::Create(TlsConnection::Role::Client, x509_str, evp_str, osh);
-#else
-    tls_ = TlsConnection::Create(TlsConnection::Role::Server, x509_str, evp_str, osh);
+        // Add callback to set the certificate when server issues the
+        // CertificateRequest.
+        tls_->SetCertificateCallback(adb_tls_set_certificate);
 #endif
-    CHECK(tls_);
+        // Allow any server certificate
+        tls_->SetCertVerifyCallback([](X509_STORE_CTX*) { return 1; });
+    } else {
+        tls_ = TlsConnection::Create(TlsConnection::Role::Server, x509_str, evp_str, osh);
+        CHECK(tls_);
 #if ADB_HOST
-    // TLS 1.3 gives the client no message if the server rejected the
-    // certificate. This will enable a check in the tls connection to check
-    // whether the client certificate got rejected. Note that this assumes
-    // that, on handshake success, the server speaks first.
-    tls_->EnableClientPostHandshakeCheck(true);
-    // Add callback to set the certificate when server issues the
-    // CertificateRequest.
-    tls_->SetCertificateCallback(adb_tls_set_certificate);
-    // Allow any server certificate
-    tls_->SetCertVerifyCallback([](X509_STORE_CTX*) { return 1; });
+        // The host has no list of known keys, and only benchmarks take the server's end here,
+        // with the client in the same process.
+        tls_->SetCertVerifyCallback([](X509_STORE_CTX*) { return 1; });
 #else
-    // Add callback to check certificate against a list of known public keys
-    tls_->SetCertVerifyCallback(
-            [auth_key](X509_STORE_CTX* ctx) { return adbd_tls_verify_cert(ctx, auth_key); });
-    // Add the list of allowed client CA issuers
-    auto ca_list = adbd_tls_client_ca_list();
-    tls_->SetClientCAList(ca_list.get());
+        // Add callback to check certificate against a list of known public keys
+        tls_->SetCertVerifyCallback(
+                [auth_key](X509_STORE_CTX* ctx) { return adbd_tls_verify_cert(ctx, auth_key); });
+        // Add the list of allowed client CA issuers
+        auto ca_list = adbd_tls_client_ca_list();
+        tls_->SetClientCAList(ca_list.get());
 #endif
+    }
 
     auto err = tls_->DoHandshake();
     if (err == TlsError::Success) {
@@ -1158,15 +1218,25 @@ bool atransport::HandleRead(std::unique_ptr<apacket> p) {
     }
 
     VLOG(TRANSPORT) << dump_packet(serial.c_str(), "from remote", p.get());
-    apacket* packet = p.release();
 
     // This needs to run on the looper thread since the associated fdevent
-    // message pump exists in that context.
-    fdevent_run_on_looper([packet, this]() { handle_packet(packet, this); });
+    // message pump exists in that context. Packets that arrive while the looper is busy are
+    // batched up, and only the first one of a batch needs to wake it up.
+    if (read_queue_.Push(std::move(p))) {
+        fdevent_run_on_looper([this]() { HandleQueuedPackets(); });
+    }
 
     return true;
 }
 
+void atransport::HandleQueuedPackets() {
+    std::vector<std::unique_ptr<apacket>> packets;
+    read_queue_.Drain(&packets);
+    for (auto& packet : packets) {
+        handle_packet(packet.release(), this);
+    }
+}
+
 void atransport::HandleError(const std::string& error) {
     LOG(INFO) << serial_name() << ": connection terminated: " << error;
     fdevent_run_on_looper([this]() {
@@ -1231,6 +1301,11 @@ const FeatureSet& supported_features() {
             kFeatureAppInfo,
             kFeatureServerStatus,
             kFeatureTrackMdns,
+            kFeatureSyncHash,
+            kFeatureSendV3Delta,
+            kFeatureSendBatch,
+            kFeatureLsRecursive,
+            kFeatureRecvRange,
         };
         // clang-format on
 
@@ -28,6 +28,7 @@
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <span>
 #include <string>
 #include <string_view>
 #include <thread>
@@ -38,8 +39,10 @@
 #include <android-base/thread_annotations.h>
 #include <openssl/rsa.h>
 
+#include "ack_window.h"
 #include "adb.h"
 #include "adb_unique_fd.h"
+#include "packet_queue.h"
 #include "types.h"
 
 // Even though the feature set is used as a set, we only have a dozen or two
@@ -101,6 +104,16 @@ extern const char* const kFeatureSendRecv2Zstd;
 extern const char* const kFeatureSendRecv2DryRunSend;
 // adbd supports delayed acks.
 extern const char* const kFeatureDelayedAck;
+// adbd supports hashing files with the sync service's HSH1 request.
+extern const char* const kFeatureSyncHash;
+// adbd supports sending files as deltas against the existing file with the sync service's SND3.
+extern const char* const kFeatureSendV3Delta;
+// adbd supports sending many small files at once with the sync service's SNDB.
+extern const char* const kFeatureSendBatch;
+// adbd supports listing a whole directory tree in one request with the sync service's LISR.
+extern const char* const kFeatureLsRecursive;
+// adbd supports pulling part of a file with the sync service's RCVR.
+extern const char* const kFeatureRecvRange;
 // adbd supports `dev-raw` service
 extern const char* const kFeatureDevRaw;
 
@@ -160,6 +173,10 @@ struct BlockingConnection {
     virtual bool Read(apacket* packet) = 0;
     virtual bool Write(apacket* packet) = 0;
 
+    // Write several packets, in order. Connections that can coalesce writes should override this;
+    // by default, the packets are written one at a time.
+    virtual bool WritePackets(std::span<apacket* const> packets);
+
     virtual bool DoTlsHandshake(RSA* key, std::string* auth_key = nullptr) = 0;
 
     // Terminate a connection.
@@ -184,6 +201,11 @@ struct BlockingConnectionAdapter : public Connection {
 
     virtual void Reset() override final;
 
+    // The writer thread hands everything that's queued to the underlying connection at once,
+    // up to these limits, so that a long queue doesn't hold up the packets at its front.
+    static constexpr size_t kMaxWriteBatchPackets = 64;
+    static constexpr size_t kMaxWriteBatchBytes = 256 * 1024;
+
   private:
     void StartReadThread() REQUIRES(mutex_);
     bool started_ GUARDED_BY(mutex_) = false;
@@ -201,11 +223,24 @@ struct BlockingConnectionAdapter : public Connection {
 };
 
 struct FdConnection : public BlockingConnection {
-    explicit FdConnection(unique_fd fd);
+    // The end of the TLS handshake a connection takes. adb is the client and adbd the server, but
+    // benchmarks hold both ends of a connection in one process.
+    enum class TlsRole {
+        Client,
+        Server,
+    };
+#if ADB_HOST
+    static constexpr TlsRole kDefaultTlsRole = TlsRole::Client;
+#else
+    static constexpr TlsRole kDefaultTlsRole = TlsRole::Server;
+#endif
+
+    explicit FdConnection(unique_fd fd, TlsRole tls_role = kDefaultTlsRole);
     ~FdConnection();
 
     bool Read(apacket* packet) override final;
     bool Write(apacket* packet) override final;
+    bool WritePackets(std::span<apacket* const> packets) override final;
     bool DoTlsHandshake(RSA* key, std::string* auth_key) override final;
 
     void Close() override;
@@ -213,9 +248,9 @@ struct FdConnection : public BlockingConnection {
 
   private:
     bool DispatchRead(void* buf, size_t len);
-    bool DispatchWrite(void* buf, size_t len);
 
     unique_fd fd_;
+    TlsRole tls_role_;
     std::unique_ptr<adb::tls::TlsConnection> tls_;
 };
 
@@ -364,6 +399,9 @@ class atransport : public enable_weak_from_this<atransport> {
         return delayed_ack_;
     }
 
+    // Shared by the send windows of all sockets on this transport.
+    AckWindowBudget* ack_window_budget() { return &ack_window_budget_; }
+
     // Loads the transport's feature set from the given string.
     void SetFeatures(const std::string& features_string);
 
@@ -437,9 +475,14 @@ class atransport : public enable_weak_from_this<atransport> {
     // A callback that will be invoked when the atransport needs to reconnect.
     ReconnectCallback reconnect_;
 
+    // Packets read by the connection's threads, waiting to be handled on the looper.
+    PacketQueue read_queue_;
+    void HandleQueuedPackets();
+
     std::mutex mutex_;
 
     bool delayed_ack_ = false;
+    AckWindowBudget ack_window_budget_{DELAYED_ACK_WINDOW_BUDGET};
 
 #if ADB_HOST
     // Track remote addresses against local addresses (configured)
@@ -14,177 +14,416 @@
  * limitations under the License.
  */
 
+// End-to-end benchmarks for the transport layer.
+//
+// Each benchmark connects two atransports back to back over a socketpair, and opens adb streams
+// between them: bytes written to a local socket on one side go through the sockets layer,
+// the transport's Connection and the fdevent looper before arriving at the other side, which is
+// the same path that `adb push`/`adb shell` traffic takes.
+//
+// Use --benchmark_format=json (or --benchmark_out=<file> --benchmark_out_format=json) to get
+// results that can be compared between builds.
+
+#if defined(__linux__)
 #include <malloc.h>
+#endif
+#include <signal.h>
 #include <stdio.h>
-
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <adb/crypto/rsa_2048_key.h>
 #include <android-base/logging.h>
 #include <benchmark/benchmark.h>
+#include <openssl/evp.h>
 
+#include "adb.h"
+#include "adb_io.h"
 #include "adb_trace.h"
+#include "fdevent/fdevent.h"
+#include "socket.h"
 #include "sysdeps.h"
+#include "sysdeps/chrono.h"
 #include "transport.h"
 
-#define ADB_CONNECTION_BENCHMARK(benchmark_name, ...)                          \
-    BENCHMARK_TEMPLATE(benchmark_name, FdConnection, ##__VA_ARGS__)            \
-        ->Arg(1)                                                               \
-        ->Arg(16384)                                                           \
-        ->Arg(MAX_PAYLOAD)                                                     \
-        ->UseRealTime();                                                       \
-    BENCHMARK_TEMPLATE(benchmark_name, NonblockingFdConnection, ##__VA_ARGS__) \
-        ->Arg(1)                                                               \
-        ->Arg(16384)                                                           \
-        ->Arg(MAX_PAYLOAD)                                                     \
-        ->UseRealTime()
-
 struct NonblockingFdConnection;
+
+namespace {
+
+// FdConnection over TLS.
+struct TlsFdConnection;
+
 template <typename ConnectionType>
-std::unique_ptr<Connection> MakeConnection(unique_fd fd);
+std::pair<std::shared_ptr<Connection>, std::shared_ptr<Connection>> MakeConnectionPair(
+        unique_fd host_fd, unique_fd device_fd);
 
 template <>
-std::unique_ptr<Connection> MakeConnection<FdConnection>(unique_fd fd) {
-    auto fd_connection = std::make_unique<FdConnection>(std::move(fd));
-    return std::make_unique<BlockingConnectionAdapter>(std::move(fd_connection));
+std::pair<std::shared_ptr<Connection>, std::shared_ptr<Connection>>
+MakeConnectionPair<FdConnection>(unique_fd host_fd, unique_fd device_fd) {
+    return {std::make_shared<BlockingConnectionAdapter>(
+                    std::make_unique<FdConnection>(std::move(host_fd))),
+            std::make_shared<BlockingConnectionAdapter>(
+                    std::make_unique<FdConnection>(std::move(device_fd)))};
 }
 
 template <>
-std::unique_ptr<Connection> MakeConnection<NonblockingFdConnection>(unique_fd fd) {
-    return Connection::FromFd(std::move(fd));
+std::pair<std::shared_ptr<Connection>, std::shared_ptr<Connection>>
+MakeConnectionPair<NonblockingFdConnection>(unique_fd host_fd, unique_fd device_fd) {
+    return {Connection::FromFd(std::move(host_fd)), Connection::FromFd(std::move(device_fd))};
 }
 
-template <typename ConnectionType>
-void BM_Connection_Unidirectional(benchmark::State& state) {
-    int fds[2];
-    if (adb_socketpair(fds) != 0) {
-        LOG(FATAL) << "failed to create socketpair";
-    }
-
-    auto client = MakeConnection<ConnectionType>(unique_fd(fds[0]));
-    auto server = MakeConnection<ConnectionType>(unique_fd(fds[1]));
-
-    std::atomic<size_t> received_bytes;
+template <>
+std::pair<std::shared_ptr<Connection>, std::shared_ptr<Connection>>
+MakeConnectionPair<TlsFdConnection>(unique_fd host_fd, unique_fd device_fd) {
+    auto host = std::make_unique<FdConnection>(std::move(host_fd), FdConnection::TlsRole::Client);
+    auto device =
+            std::make_unique<FdConnection>(std::move(device_fd), FdConnection::TlsRole::Server);
+    auto key = adb::crypto::CreateRSA2048Key();
+    CHECK(key);
+    RSA* rsa = EVP_PKEY_get0_RSA(key->GetEvpPkey());
+
+    // Both sides of the handshake block until they hear from the other, and the client's until
+    // the server has sent something after it, as adbd does with its CNXN. The host reads that
+    // packet here, before its transport starts.
+    auto host_handshake = std::async(std::launch::async,
+                                     [&]() { return host->DoTlsHandshake(rsa, nullptr); });
+    CHECK(device->DoTlsHandshake(rsa, nullptr));
+    apacket hello = {};
+    hello.msg.command = A_CNXN;
+    CHECK(device->Write(&hello));
+    CHECK(host_handshake.get());
+    CHECK(host->Read(&hello));
+
+    return {std::make_shared<BlockingConnectionAdapter>(std::move(host)),
+            std::make_shared<BlockingConnectionAdapter>(std::move(device))};
+}
 
-    client->SetReadCallback([](Connection*, std::unique_ptr<apacket>) -> bool { return true; });
-    server->SetReadCallback([&received_bytes](Connection*, std::unique_ptr<apacket> packet) -> bool {
-        received_bytes += packet->payload.size();
-        return true;
+void RunOnLooper(std::function<void()> fn) {
+    std::promise<void> promise;
+    fdevent_run_on_looper([&]() {
+        fn();
+        promise.set_value();
     });
+    promise.get_future().wait();
+}
+
+// The application ends of an adb stream: bytes written to |host| come out of |device| and vice
+// versa.
+struct Stream {
+    unique_fd host;
+    unique_fd device;
+};
 
-    client->SetErrorCallback(
-        [](Connection*, const std::string& error) { LOG(INFO) << "client closed: " << error; });
-    server->SetErrorCallback(
-        [](Connection*, const std::string& error) { LOG(INFO) << "server closed: " << error; });
+// A pair of online transports talking to each other through a Connection of type ConnectionType.
+// The fdevent looper must be running.
+template <typename ConnectionType>
+class TransportPair {
+  public:
+    explicit TransportPair(bool delayed_ack) {
+        int fds[2];
+        CHECK_EQ(0, adb_socketpair(fds));
+        auto [host_connection, device_connection] =
+                MakeConnectionPair<ConnectionType>(unique_fd(fds[0]), unique_fd(fds[1]));
+
+        RunOnLooper([&]() {
+            host_ = CreateTransport("host", std::move(host_connection), delayed_ack);
+            device_ = CreateTransport("device", std::move(device_connection), delayed_ack);
+        });
+    }
 
-    client->Start();
-    server->Start();
+    ~TransportPair() {
+        // Kicking a transport eventually destroys it on the looper; wait for that to happen so
+        // that nothing outlives the benchmark.
+        // weak_ptr can only be touched on the looper, including its destruction.
+        std::vector<weak_ptr<atransport>> transports;
+        RunOnLooper([&]() {
+            transports.push_back(host_->weak());
+            transports.push_back(device_->weak());
+            host_->Kick();
+            device_->Kick();
+        });
+
+        while (true) {
+            bool destroyed;
+            RunOnLooper([&]() {
+                destroyed = std::all_of(transports.begin(), transports.end(),
+                                        [](const auto& t) { return t.get() == nullptr; });
+                if (destroyed) transports.clear();
+            });
+            if (destroyed) break;
+            std::this_thread::sleep_for(1ms);
+        }
+    }
 
-    for (auto _ : state) {
-        size_t data_size = state.range(0);
-        std::unique_ptr<apacket> packet = std::make_unique<apacket>();
-        memset(&packet->msg, 0, sizeof(packet->msg));
-        packet->msg.command = A_WRTE;
-        packet->msg.data_length = data_size;
-        packet->payload.resize(data_size);
+    Stream OpenStream() {
+        int host_fds[2];
+        int device_fds[2];
+        CHECK_EQ(0, adb_socketpair(host_fds));
+        CHECK_EQ(0, adb_socketpair(device_fds));
 
-        memset(&packet->payload[0], 0xff, data_size);
+        RunOnLooper([&]() {
+            asocket* host_socket = create_local_socket(unique_fd(host_fds[1]));
+            asocket* device_socket = create_local_socket(unique_fd(device_fds[1]));
+            Connect(host_socket, device_socket->id, host_);
+            Connect(device_socket, host_socket->id, device_);
+        });
 
-        received_bytes = 0;
-        client->Write(std::move(packet));
-        while (received_bytes < data_size) {
-            continue;
-        }
+        return {unique_fd(host_fds[0]), unique_fd(device_fds[0])};
     }
-    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
 
-    client->Stop();
-    server->Stop();
-}
+  private:
+    static atransport* CreateTransport(const char* serial, std::shared_ptr<Connection> connection,
+                                       bool delayed_ack) {
+        atransport* t = new atransport(kTransportLocal, kCsDevice);
+        t->serial = serial;
+        t->update_version(A_VERSION, MAX_PAYLOAD);
+        t->SetFeatures(delayed_ack ? kFeatureDelayedAck : "");
+        t->online = true;
+        connection->SetTransport(t);
+        t->SetConnection(connection);
+        CHECK(connection->Start());
+        return t;
+    }
 
-ADB_CONNECTION_BENCHMARK(BM_Connection_Unidirectional);
+    // Wire up |s| as though it had been opened and acknowledged by the other side.
+    static void Connect(asocket* s, unsigned peer_id, atransport* t) {
+        s->transport = t;
+        s->peer = create_remote_socket(peer_id, t);
+        s->peer->peer = s;
+        if (t->SupportsDelayedAck()) {
+            s->available_send_bytes = INITIAL_DELAYED_ACK_BYTES;
+            s->send_window = std::make_unique<AckWindow>(t->ack_window_budget());
+        }
+        s->ready(s);
+    }
 
-enum class ThreadPolicy {
-    MainThread,
-    SameThread,
+    atransport* host_ = nullptr;
+    atransport* device_ = nullptr;
 };
 
-template <typename ConnectionType, enum ThreadPolicy Policy>
-void BM_Connection_Echo(benchmark::State& state) {
-    int fds[2];
-    if (adb_socketpair(fds) != 0) {
-        LOG(FATAL) << "failed to create socketpair";
+// Drains a set of fds on a separate thread, keeping count of the number of bytes read.
+class Sink {
+  public:
+    explicit Sink(std::vector<int> fds) {
+        int wake_fds[2];
+        CHECK_EQ(0, adb_socketpair(wake_fds));
+        wake_read_.reset(wake_fds[0]);
+        wake_write_.reset(wake_fds[1]);
+        thread_ = std::thread([this, fds = std::move(fds)]() { Run(fds); });
     }
 
-    auto client = MakeConnection<ConnectionType>(unique_fd(fds[0]));
-    auto server = MakeConnection<ConnectionType>(unique_fd(fds[1]));
+    ~Sink() {
+        WriteFdExactly(wake_write_.get(), "", 1);
+        thread_.join();
+    }
 
-    std::atomic<size_t> received_bytes;
+    // Wait until a total of |bytes| bytes have been read since the Sink was created.
+    void WaitFor(uint64_t bytes) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&]() { return received_ >= bytes; });
+    }
 
-    fdevent_reset();
-    std::thread fdevent_thread([]() { fdevent_loop(); });
+  private:
+    void Run(const std::vector<int>& fds) {
+        std::vector<adb_pollfd> pfds;
+        for (int fd : fds) {
+            pfds.push_back({.fd = fd, .events = POLLIN});
+        }
+        pfds.push_back({.fd = wake_read_.get(), .events = POLLIN});
+
+        std::vector<char> buf(MAX_PAYLOAD);
+        while (true) {
+            CHECK_GE(adb_poll(pfds.data(), pfds.size(), -1), 0);
+            if (pfds.back().revents) {
+                return;
+            }
+
+            size_t total = 0;
+            for (size_t i = 0; i + 1 < pfds.size(); ++i) {
+                if (!pfds[i].revents) continue;
+                ssize_t rc = adb_read(pfds[i].fd, buf.data(), buf.size());
+                if (rc <= 0) {
+                    // Stop polling closed fds.
+                    pfds[i].fd = -1;
+                    continue;
+                }
+                total += rc;
+            }
+
+            if (total) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                received_ += total;
+                cv_.notify_all();
+            }
+        }
+    }
 
-    client->SetReadCallback([&received_bytes](Connection*, std::unique_ptr<apacket> packet) -> bool {
-        received_bytes += packet->payload.size();
-        return true;
-    });
+    unique_fd wake_read_;
+    unique_fd wake_write_;
+    std::thread thread_;
 
-    static const auto handle_packet = [](Connection* connection, std::unique_ptr<apacket> packet) {
-        connection->Write(std::move(packet));
-    };
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    uint64_t received_ = 0;
+};
 
-    server->SetReadCallback([](Connection* connection, std::unique_ptr<apacket> packet) -> bool {
-        if (Policy == ThreadPolicy::MainThread) {
-            auto raw_packet = packet.release();
-            fdevent_run_on_main_thread([connection, raw_packet]() {
-                std::unique_ptr<apacket> packet(raw_packet);
-                handle_packet(connection, std::move(packet));
-            });
-        } else {
-            handle_packet(connection, std::move(packet));
-        }
-        return true;
-    });
+// Runs the fdevent looper for the duration of a benchmark.
+class Looper {
+  public:
+    Looper() {
+        fdevent_reset();
+        thread_ = std::thread([]() { fdevent_loop(); });
+    }
 
-    client->SetErrorCallback(
-        [](Connection*, const std::string& error) { LOG(INFO) << "client closed: " << error; });
-    server->SetErrorCallback(
-        [](Connection*, const std::string& error) { LOG(INFO) << "server closed: " << error; });
+    ~Looper() {
+        fdevent_terminate_loop();
+        thread_.join();
+    }
 
-    client->Start();
-    server->Start();
+  private:
+    std::thread thread_;
+};
 
-    for (auto _ : state) {
-        size_t data_size = state.range(0);
-        std::unique_ptr<apacket> packet = std::make_unique<apacket>();
-        memset(&packet->msg, 0, sizeof(packet->msg));
-        packet->msg.command = A_WRTE;
-        packet->msg.data_length = data_size;
-        packet->payload.resize(data_size);
+void SetPercentileCounters(benchmark::State& state, std::vector<double> latencies_us) {
+    if (latencies_us.empty()) return;
+    std::sort(latencies_us.begin(), latencies_us.end());
+    auto percentile = [&](double p) {
+        size_t index = static_cast<size_t>(p * (latencies_us.size() - 1));
+        return latencies_us[index];
+    };
+    state.counters["p50_us"] = percentile(0.50);
+    state.counters["p90_us"] = percentile(0.90);
+    state.counters["p99_us"] = percentile(0.99);
+    state.counters["max_us"] = latencies_us.back();
+}
 
-        memset(&packet->payload[0], 0xff, data_size);
+}  // namespace
 
-        received_bytes = 0;
-        client->Write(std::move(packet));
-        while (received_bytes < data_size) {
-            continue;
+// Arguments: bytes written per iteration, delayed ack enabled.
+template <typename ConnectionType>
+void BM_Transport_Unidirectional(benchmark::State& state) {
+    const size_t data_size = state.range(0);
+    Looper looper;
+    {
+        TransportPair<ConnectionType> transports(state.range(1));
+        Stream stream = transports.OpenStream();
+        Sink sink({stream.device.get()});
+
+        std::vector<char> data(data_size, 0xff);
+        uint64_t sent = 0;
+        for (auto _ : state) {
+            CHECK(WriteFdExactly(stream.host.get(), data.data(), data.size()));
+            sent += data.size();
+            sink.WaitFor(sent);
         }
+        state.SetBytesProcessed(sent);
     }
-    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+}
 
-    client->Stop();
-    server->Stop();
+// Arguments: bytes written per iteration, delayed ack enabled.
+template <typename ConnectionType>
+void BM_Transport_Echo(benchmark::State& state) {
+    const size_t data_size = state.range(0);
+    Looper looper;
+    {
+        TransportPair<ConnectionType> transports(state.range(1));
+        Stream stream = transports.OpenStream();
+
+        std::thread echo([fd = stream.device.get()]() {
+            std::vector<char> buf(MAX_PAYLOAD);
+            while (true) {
+                ssize_t rc = adb_read(fd, buf.data(), buf.size());
+                if (rc <= 0 || !WriteFdExactly(fd, buf.data(), rc)) {
+                    return;
+                }
+            }
+        });
+
+        std::vector<char> data(data_size, 0xff);
+        std::vector<char> reply(data_size);
+        std::vector<double> latencies_us;
+        for (auto _ : state) {
+            auto start = std::chrono::steady_clock::now();
+            CHECK(WriteFdExactly(stream.host.get(), data.data(), data.size()));
+            CHECK(ReadFdExactly(stream.host.get(), reply.data(), reply.size()));
+            std::chrono::duration<double, std::micro> elapsed =
+                    std::chrono::steady_clock::now() - start;
+            latencies_us.push_back(elapsed.count());
+        }
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * data_size * 2);
+        SetPercentileCounters(state, std::move(latencies_us));
 
-    // TODO: Make it so that you don't need to poke the fdevent loop to make it terminate?
-    fdevent_terminate_loop();
-    fdevent_run_on_main_thread([]() {});
+        adb_shutdown(stream.device.get());
+        echo.join();
+    }
+}
 
-    fdevent_thread.join();
+// Arguments: number of concurrent streams, delayed ack enabled.
+// Every iteration writes a 16KiB chunk to each stream.
+template <typename ConnectionType>
+void BM_Transport_FanOut(benchmark::State& state) {
+    constexpr size_t kChunkSize = 16 * 1024;
+    const size_t stream_count = state.range(0);
+    Looper looper;
+    {
+        TransportPair<ConnectionType> transports(state.range(1));
+        std::vector<Stream> streams;
+        std::vector<int> device_fds;
+        for (size_t i = 0; i < stream_count; ++i) {
+            streams.push_back(transports.OpenStream());
+            device_fds.push_back(streams.back().device.get());
+        }
+        Sink sink(std::move(device_fds));
+
+        std::vector<char> data(kChunkSize, 0xff);
+        uint64_t sent = 0;
+        for (auto _ : state) {
+            for (const Stream& stream : streams) {
+                CHECK(WriteFdExactly(stream.host.get(), data.data(), data.size()));
+            }
+            sent += data.size() * streams.size();
+            sink.WaitFor(sent);
+        }
+        state.SetBytesProcessed(sent);
+        state.counters["streams"] = stream_count;
+    }
 }
 
-ADB_CONNECTION_BENCHMARK(BM_Connection_Echo, ThreadPolicy::SameThread);
-ADB_CONNECTION_BENCHMARK(BM_Connection_Echo, ThreadPolicy::MainThread);
+#define ADB_TRANSPORT_BENCHMARK(benchmark_name, ...)                \
+    BENCHMARK_TEMPLATE(benchmark_name, FdConnection)                \
+            ->ArgsProduct(__VA_ARGS__)                              \
+            ->UseRealTime();                                        \
+    BENCHMARK_TEMPLATE(benchmark_name, NonblockingFdConnection)     \
+            ->ArgsProduct(__VA_ARGS__)                              \
+            ->UseRealTime();                                        \
+    BENCHMARK_TEMPLATE(benchmark_name, TlsFdConnection)             \
+            ->ArgsProduct(__VA_ARGS__)                              \
+            ->UseRealTime()
+
+ADB_TRANSPORT_BENCHMARK(BM_Transport_Unidirectional,
+                        {{1, 16384, MAX_PAYLOAD, 8 * 1024 * 1024}, {0, 1}});
+ADB_TRANSPORT_BENCHMARK(BM_Transport_Echo, {{1, 16384, MAX_PAYLOAD}, {0, 1}});
+ADB_TRANSPORT_BENCHMARK(BM_Transport_FanOut, {{1, 16, 256}, {0, 1}});
 
 int main(int argc, char** argv) {
+#if defined(M_DECAY_TIME)
     // Set M_DECAY_TIME so that our allocations aren't immediately purged on free.
     mallopt(M_DECAY_TIME, 1);
+#endif
+
+    // Like adbd, get EPIPE instead of dying when writing to a stream whose other end went away.
+    signal(SIGPIPE, SIG_IGN);
+
+    // The host only advertises delayed acks in burst mode.
+    setenv("ADB_BURST_MODE", "1", 0);
 
     android::base::SetMinimumLogSeverity(android::base::WARNING);
     adb_trace_init(argv);
@@ -85,14 +85,15 @@ struct NonblockingFdConnection : public Connection {
             if (pfds[0].revents) {
                 if ((pfds[0].revents & POLLOUT)) {
                     std::lock_guard<std::mutex> lock(this->write_mutex_);
-                    if (DispatchWrites() == WriteResult::Error) {
+                    // Write() may have flushed the buffer between the poll and taking the lock.
+                    if (!write_buffer_.empty() && DispatchWrites() == WriteResult::Error) {
                         *error = "write failed";
                         return;
                     }
                 }
 
                 if (pfds[0].revents & POLLIN) {
-                    // TODO: Should we be getting blocks from a free list?
+                    // Blocks come from (and go back to) the MAX_PAYLOAD free list.
                     auto block = IOVector::block_type(MAX_PAYLOAD);
                     rc = adb_read(fd_.get(), &block[0], block.size());
                     if (rc == -1) {
@@ -105,21 +106,25 @@ struct NonblockingFdConnection : public Connection {
                     block.resize(rc);
                     read_buffer_.append(std::move(block));
 
-                    if (!read_header_ && read_buffer_.size() >= sizeof(amessage)) {
-                        auto header_buf = read_buffer_.take_front(sizeof(amessage)).coalesce();
-                        CHECK_EQ(sizeof(amessage), header_buf.size());
-                        read_header_ = std::make_unique<amessage>();
-                        memcpy(read_header_.get(), header_buf.data(), sizeof(amessage));
-                    }
-
-                    if (read_header_ && read_buffer_.size() >= read_header_->data_length) {
+                    // A single read can contain any number of packets.
+                    while (true) {
+                        if (!read_header_ && read_buffer_.size() >= sizeof(amessage)) {
+                            auto header_buf = read_buffer_.take_front(sizeof(amessage)).coalesce();
+                            CHECK_EQ(sizeof(amessage), header_buf.size());
+                            read_header_ = std::make_unique<amessage>();
+                            memcpy(read_header_.get(), header_buf.data(), sizeof(amessage));
+                        }
+
+                        if (!read_header_ || read_buffer_.size() < read_header_->data_length) {
+                            break;
+                        }
+
+                        // take_front() splits blocks without copying, so this only has to copy
+                        // when the payload straddles two reads.
                         auto data_chain = read_buffer_.take_front(read_header_->data_length);
-
-                        // TODO: Make apacket carry around a IOVector instead of coalescing.
-                        auto payload = std::move(data_chain).coalesce();
                         auto packet = std::make_unique<apacket>();
                         packet->msg = *read_header_;
-                        packet->payload = std::move(payload);
+                        packet->payload = std::move(data_chain).coalesce();
                         read_header_ = nullptr;
                         transport_->HandleRead(std::move(packet));
                     }
@@ -153,7 +158,11 @@ struct NonblockingFdConnection : public Connection {
     void Stop() override final {
         SetRunning(false);
         WakeThread();
-        thread_.join();
+
+        // Stop is called both by Kick and when the transport is destroyed.
+        if (thread_.joinable()) {
+            thread_.join();
+        }
     }
 
     bool DoTlsHandshake(RSA* key, std::string* auth_key) override final {
@@ -16,6 +16,9 @@
 
 #include "transport.h"
 
+#include <thread>
+#include <vector>
+
 #include <gtest/gtest.h>
 
 #include "adb.h"
@@ -36,6 +39,43 @@ TEST(ConnectionStateTest, to_string) {
 
 struct TransportTest : public FdeventTest {};
 
+TEST(FdConnectionTest, WritePackets) {
+    int fds[2];
+    ASSERT_EQ(0, adb_socketpair(fds));
+    FdConnection writer((unique_fd(fds[0])));
+    FdConnection reader((unique_fd(fds[1])));
+
+    // Include a packet with no payload, and one large enough that writev comes up short.
+    std::vector<std::unique_ptr<apacket>> packets;
+    for (size_t size : {size_t(0), size_t(5), size_t(MAX_PAYLOAD), size_t(1)}) {
+        auto packet = std::make_unique<apacket>();
+        packet->msg.command = A_WRTE;
+        packet->msg.arg0 = packets.size();
+        packet->msg.data_length = size;
+        packet->payload.resize(size);
+        memset(packet->payload.data(), 'a' + packets.size(), size);
+        packets.push_back(std::move(packet));
+    }
+
+    std::thread thread([&]() {
+        std::vector<apacket*> raw;
+        for (const auto& packet : packets) {
+            raw.push_back(packet.get());
+        }
+        ASSERT_TRUE(writer.WritePackets(raw));
+    });
+
+    for (const auto& expected : packets) {
+        apacket received;
+        ASSERT_TRUE(reader.Read(&received));
+        EXPECT_EQ(expected->msg.arg0, received.msg.arg0);
+        ASSERT_EQ(expected->payload.size(), received.payload.size());
+        EXPECT_EQ(0, memcmp(expected->payload.data(), received.payload.data(),
+                            received.payload.size()));
+    }
+    thread.join();
+}
+
 static void DisconnectFunc(void* arg, atransport*) {
     int* count = reinterpret_cast<int*>(arg);
     ++*count;
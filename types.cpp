@@ -16,6 +16,296 @@
 
 #include "types.h"
 
+#include <array>
+#include <atomic>
+#include <bit>
+#include <mutex>
+#include <optional>
+
+#include <android-base/thread_annotations.h>
+
+namespace {
+
+// Block storage is pooled in power of two size classes from MAX_PAYLOAD_V1 to MAX_PAYLOAD.
+// Smaller allocations are cheap enough to get from malloc, and larger ones are rare.
+constexpr size_t kMinSizeClassShift = 12;
+constexpr size_t kMaxSizeClassShift = 20;
+constexpr size_t kSizeClassCount = kMaxSizeClassShift - kMinSizeClassShift + 1;
+
+// apackets get a free list of their own, after the Block size classes.
+constexpr size_t kApacketFreeList = kSizeClassCount;
+constexpr size_t kFreeListCount = kSizeClassCount + 1;
+
+// Upper bound on the memory held by the shared free lists. Anything freed beyond this goes back
+// to the system allocator.
+#if ADB_HOST
+constexpr size_t kMaxCachedBytes = 16 * 1024 * 1024;
+#else
+constexpr size_t kMaxCachedBytes = 4 * 1024 * 1024;
+#endif
+
+// Each thread keeps a few recently freed allocations for itself, so that a thread that frees and
+// allocates in a loop (e.g. the looper reading from a local socket) doesn't need to take a lock.
+constexpr size_t kThreadCacheEntries = 4;
+constexpr size_t kThreadCacheMaxBytes = 1024 * 1024;
+
+struct FreeList {
+    std::mutex mutex;
+    std::vector<char*> entries GUARDED_BY(mutex);
+};
+
+struct PoolCounters {
+    std::atomic<uint64_t> hits = 0;
+    std::atomic<uint64_t> misses = 0;
+};
+
+auto& free_lists = *new std::array<FreeList, kFreeListCount>();
+std::atomic<size_t> free_lists_bytes = 0;
+
+PoolCounters block_counters;
+PoolCounters apacket_counters;
+
+// Trivially destructible, so that it stays usable while other thread_locals are being destroyed.
+struct ThreadCache {
+    char* entries[kFreeListCount][kThreadCacheEntries];
+    size_t count[kFreeListCount];
+    size_t bytes;
+    bool disabled;
+};
+
+thread_local ThreadCache thread_cache;
+
+size_t free_list_allocation_size(size_t index) {
+    if (index == kApacketFreeList) {
+        return sizeof(apacket);
+    }
+    return size_t(1) << (kMinSizeClassShift + index);
+}
+
+void shared_free(size_t index, char* ptr) {
+    const size_t size = free_list_allocation_size(index);
+    FreeList& list = free_lists[index];
+    {
+        std::lock_guard<std::mutex> lock(list.mutex);
+        if (free_lists_bytes + size <= kMaxCachedBytes) {
+            list.entries.push_back(ptr);
+            free_lists_bytes += size;
+            return;
+        }
+    }
+    delete[] ptr;
+}
+
+// Returns the contents of a thread's cache to the shared free lists when the thread exits.
+struct ThreadCacheFlusher {
+    void arm() {}
+
+    ~ThreadCacheFlusher() {
+        ThreadCache& cache = thread_cache;
+        cache.disabled = true;
+        for (size_t i = 0; i < kFreeListCount; ++i) {
+            while (cache.count[i] > 0) {
+                shared_free(i, cache.entries[i][--cache.count[i]]);
+            }
+        }
+        cache.bytes = 0;
+    }
+};
+
+thread_local ThreadCacheFlusher thread_cache_flusher;
+
+char* pool_allocate(size_t index, PoolCounters& counters) {
+    const size_t size = free_list_allocation_size(index);
+    ThreadCache& cache = thread_cache;
+    if (cache.count[index] > 0) {
+        counters.hits.fetch_add(1, std::memory_order_relaxed);
+        cache.bytes -= size;
+        return cache.entries[index][--cache.count[index]];
+    }
+
+    {
+        FreeList& list = free_lists[index];
+        std::lock_guard<std::mutex> lock(list.mutex);
+        if (!list.entries.empty()) {
+            char* result = list.entries.back();
+            list.entries.pop_back();
+            free_lists_bytes -= size;
+            counters.hits.fetch_add(1, std::memory_order_relaxed);
+            return result;
+        }
+    }
+
+    counters.misses.fetch_add(1, std::memory_order_relaxed);
+
+    // This isn't std::make_unique because that's equivalent to `new char[size]()`, which
+    // value-initializes the array instead of leaving it uninitialized. As an optimization,
+    // call new without parentheses to avoid this costly initialization.
+    return new char[size];
+}
+
+void pool_free(size_t index, char* ptr) {
+    const size_t size = free_list_allocation_size(index);
+    ThreadCache& cache = thread_cache;
+    if (!cache.disabled && cache.count[index] < kThreadCacheEntries &&
+        cache.bytes + size <= kThreadCacheMaxBytes) {
+        // Make sure the cache gets flushed when this thread exits.
+        thread_cache_flusher.arm();
+        cache.entries[index][cache.count[index]++] = ptr;
+        cache.bytes += size;
+        return;
+    }
+    shared_free(index, ptr);
+}
+
+// Returns the free list for an allocation of at least |size| bytes, if it's poolable.
+std::optional<size_t> size_class_for_allocation(size_t size) {
+    if (size < (size_t(1) << kMinSizeClassShift) || size > (size_t(1) << kMaxSizeClassShift)) {
+        return std::nullopt;
+    }
+    return std::bit_width(size - 1) - kMinSizeClassShift;
+}
+
+// Returns the free list that storage with exactly |capacity| bytes came from, if any.
+std::optional<size_t> size_class_for_capacity(size_t capacity) {
+    if (!std::has_single_bit(capacity)) {
+        return std::nullopt;
+    }
+    return size_class_for_allocation(capacity);
+}
+
+AllocatorPoolStats collect_stats(const PoolCounters& counters, size_t first_list,
+                                 size_t last_list) {
+    AllocatorPoolStats stats;
+    stats.hits = counters.hits.load(std::memory_order_relaxed);
+    stats.misses = counters.misses.load(std::memory_order_relaxed);
+    for (size_t i = first_list; i <= last_list; ++i) {
+        FreeList& list = free_lists[i];
+        std::lock_guard<std::mutex> lock(list.mutex);
+        stats.cached_bytes += list.entries.size() * free_list_allocation_size(i);
+    }
+    return stats;
+}
+
+}  // namespace
+
+AllocatorPoolStats block_pool_stats() {
+    return collect_stats(block_counters, 0, kSizeClassCount - 1);
+}
+
+AllocatorPoolStats apacket_pool_stats() {
+    return collect_stats(apacket_counters, kApacketFreeList, kApacketFreeList);
+}
+
+// Splits smaller than this are copied out instead, so that a few bytes don't keep an entire
+// allocation alive after the rest of it has been consumed.
+static constexpr size_t kMinSharedSplitSize = 4096;
+
+struct Block::SharedStorage {
+    std::atomic<size_t> refcount;
+    char* allocation;
+    size_t capacity;
+};
+
+static void free_block_storage(char* ptr, size_t capacity) {
+    if (auto index = size_class_for_capacity(capacity)) {
+        pool_free(*index, ptr);
+    } else {
+        delete[] ptr;
+    }
+}
+
+void Block::allocate(size_t size) {
+    CHECK(data_ == nullptr);
+    CHECK_EQ(0ULL, capacity_);
+    CHECK_EQ(0ULL, size_);
+    if (size == 0) {
+        return;
+    }
+
+    if (auto index = size_class_for_allocation(size)) {
+        data_ = pool_allocate(*index, block_counters);
+        capacity_ = free_list_allocation_size(*index);
+    } else {
+        data_ = new char[size];
+        capacity_ = size;
+    }
+    size_ = size;
+}
+
+void Block::release() {
+    if (!data_) {
+        return;
+    }
+
+    if (!shared_) {
+        free_block_storage(data_, capacity_);
+    } else if (shared_->refcount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        free_block_storage(shared_->allocation, shared_->capacity);
+        delete shared_;
+    }
+    data_ = nullptr;
+    shared_ = nullptr;
+}
+
+void Block::share() {
+    if (!shared_) {
+        shared_ = new SharedStorage{1, data_, capacity_};
+    }
+}
+
+Block Block::split_front(size_t len) {
+    CHECK_LE(len, size_);
+    if (len == 0) {
+        return {};
+    }
+
+    if (len == size_) {
+        return std::move(*this);
+    }
+
+    Block front;
+    if (len < kMinSharedSplitSize) {
+        front.assign(data_, data_ + len);
+    } else {
+        share();
+        shared_->refcount.fetch_add(1, std::memory_order_relaxed);
+        front.data_ = data_;
+        front.shared_ = shared_;
+        front.capacity_ = len;
+        front.size_ = len;
+    }
+    drop_front(len);
+    return front;
+}
+
+void Block::drop_front(size_t len) {
+    CHECK_LE(len, size_);
+    if (len == 0) {
+        return;
+    }
+    if (len == size_) {
+        clear();
+        return;
+    }
+
+    share();
+    data_ += len;
+    capacity_ -= len;
+    size_ -= len;
+    position_ = position_ > len ? position_ - len : 0;
+}
+
+void* apacket::operator new(size_t size) {
+    CHECK_EQ(sizeof(apacket), size);
+    return pool_allocate(kApacketFreeList, apacket_counters);
+}
+
+void apacket::operator delete(void* ptr) {
+    if (ptr) {
+        pool_free(kApacketFreeList, static_cast<char*>(ptr));
+    }
+}
+
 IOVector& IOVector::operator=(IOVector&& move) noexcept {
     chain_ = std::move(move.chain_);
     chain_length_ = move.chain_length_;
@@ -90,23 +380,11 @@ IOVector IOVector::take_front(IOVector::size_type len) {
     if (len > 0) {
         // what's left is a single buffer that needs to be split between the |res| and |this|
         // we know that it has to be split - there was a check for the case when it has to
-        // go away as a whole.
-        if (begin_offset_ != 0 || len < chain_[start_index_].size() / 2) {
-            // let's memcpy the data out
-            block_type block(chain_[start_index_].begin() + begin_offset_,
-                             chain_[start_index_].begin() + begin_offset_ + len);
-            res.append(std::move(block));
-            begin_offset_ += len;
-        } else {
-            CHECK_EQ(begin_offset_, 0u);
-            // move out the internal buffer out and copy only the tail of it back in
-            block_type block(chain_[start_index_].begin() + len, chain_[start_index_].end());
-            chain_length_ -= chain_[start_index_].size();
-            chain_[start_index_].resize(len);
-            res.append(std::move(chain_[start_index_]));
-            chain_length_ += block.size();
-            chain_[start_index_] = std::move(block);
-        }
+        // go away as a whole. Splitting the block shares its storage instead of copying it.
+        block_type& block = chain_[start_index_];
+        chain_length_ -= begin_offset_ + len;
+        block.drop_front(std::exchange(begin_offset_, 0));
+        res.append(block.split_front(len));
     }
     return res;
 }
@@ -119,9 +397,7 @@ void IOVector::trim_front() {
     if (begin_offset_ == first_block.size()) {
         ++start_index_;
     } else {
-        memmove(first_block.data(), first_block.data() + begin_offset_,
-                first_block.size() - begin_offset_);
-        first_block.resize(first_block.size() - begin_offset_);
+        first_block.drop_front(begin_offset_);
     }
     chain_length_ -= begin_offset_;
     begin_offset_ = 0;
@@ -163,11 +439,7 @@ IOVector::block_type IOVector::coalesce() && {
         chain_length_ -= chain_.back().size();
         auto res = std::move(chain_.back());
         chain_.pop_back();
-        if (begin_offset_ != 0) {
-            memmove(res.data(), res.data() + begin_offset_, res.size() - begin_offset_);
-            res.resize(res.size() - begin_offset_);
-            begin_offset_ = 0;
-        }
+        res.drop_front(std::exchange(begin_offset_, 0));
         return res;
     }
     if (auto& firstBuffer = chain_[start_index_]; firstBuffer.capacity() >= size()) {
@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <stdint.h>
 #include <string.h>
 
 #include <algorithm>
@@ -30,8 +31,28 @@
 #include "fdevent/fdevent.h"
 #include "sysdeps/uio.h"
 
+// Counters for the free lists backing Block storage and apacket allocations.
+struct AllocatorPoolStats {
+    // Allocations satisfied from a free list.
+    uint64_t hits = 0;
+    // Allocations that had to go to the system allocator.
+    uint64_t misses = 0;
+    // Bytes currently held by the shared free lists (per-thread caches are not included).
+    uint64_t cached_bytes = 0;
+};
+
+AllocatorPoolStats block_pool_stats();
+AllocatorPoolStats apacket_pool_stats();
+
 // Essentially std::vector<char>, except without zero initialization or reallocation.
 // Features a position attribute to allow sequential read/writes for copying between Blocks.
+//
+// Storage of 4 KiB and up is rounded up to a power of two and recycled through a free list when
+// the Block is destroyed or cleared, so capacity() may be larger than the size requested.
+//
+// A Block can be split into several Blocks that refer to disjoint ranges of the same reference
+// counted allocation (see split_front), which lets packets be carved out of a large read without
+// copying them.
 struct Block {
     using iterator = char*;
 
@@ -43,12 +64,13 @@ struct Block {
 
     template <typename Iterator>
     Block(Iterator begin, Iterator end) : Block(end - begin) {
-        std::copy(begin, end, data_.get());
+        std::copy(begin, end, data_);
     }
 
     Block(const Block& copy) = delete;
     Block(Block&& move) noexcept
         : data_(std::exchange(move.data_, nullptr)),
+          shared_(std::exchange(move.shared_, nullptr)),
           capacity_(std::exchange(move.capacity_, 0)),
           size_(std::exchange(move.size_, 0)),
           position_(std::exchange(move.position_, 0)) {}
@@ -57,13 +79,14 @@ struct Block {
     Block& operator=(Block&& move) noexcept {
         clear();
         data_ = std::exchange(move.data_, nullptr);
+        shared_ = std::exchange(move.shared_, nullptr);
         capacity_ = std::exchange(move.capacity_, 0);
         size_ = std::exchange(move.size_, 0);
         position_ = std::exchange(move.size_, 0);
         return *this;
     }
 
-    ~Block() = default;
+    ~Block() { clear(); }
 
     void resize(size_t new_size) {
         if (!data_) {
@@ -78,11 +101,11 @@ struct Block {
     void assign(InputIt begin, InputIt end) {
         clear();
         allocate(end - begin);
-        std::copy(begin, end, data_.get());
+        std::copy(begin, end, data_);
     }
 
     void clear() {
-        data_.reset();
+        release();
         capacity_ = 0;
         size_ = 0;
         position_ = 0;
@@ -100,6 +123,13 @@ struct Block {
         return size;
     }
 
+    // Split the first |len| bytes off into their own Block, leaving the rest in this one. Unless
+    // |len| is small enough that copying is cheaper, both Blocks share the same allocation.
+    Block split_front(size_t len);
+
+    // Discard the first |len| bytes without copying the rest.
+    void drop_front(size_t len);
+
     void rewind() { position_ = 0; }
     size_t position() const { return position_; }
 
@@ -107,11 +137,11 @@ struct Block {
     size_t size() const { return size_; }
     bool empty() const { return size() == 0; }
 
-    char* data() { return data_.get(); }
-    const char* data() const { return data_.get(); }
+    char* data() { return data_; }
+    const char* data() const { return data_; }
 
-    char* begin() { return data_.get(); }
-    const char* begin() const { return data_.get(); }
+    char* begin() { return data_; }
+    const char* begin() const { return data_; }
 
     char* end() { return data() + size_; }
     const char* end() const { return data() + size_; }
@@ -125,21 +155,20 @@ struct Block {
     }
 
   private:
-    void allocate(size_t size) {
-        CHECK(data_ == nullptr);
-        CHECK_EQ(0ULL, capacity_);
-        CHECK_EQ(0ULL, size_);
-        if (size != 0) {
-            // This isn't std::make_unique because that's equivalent to `new char[size]()`, which
-            // value-initializes the array instead of leaving it uninitialized. As an optimization,
-            // call new without parentheses to avoid this costly initialization.
-            data_.reset(new char[size]);
-            capacity_ = size;
-            size_ = size;
-        }
-    }
+    void allocate(size_t size);
+
+    // Hand data_ back to the free list (or the system allocator) and reset it.
+    void release();
+
+    // Switch to reference counted ownership of the allocation, if we haven't already.
+    void share();
 
-    std::unique_ptr<char[]> data_;
+    struct SharedStorage;
+
+    // The first byte of this Block. When shared_ is null, this is also the start of an allocation
+    // of capacity_ bytes that the Block owns.
+    char* data_ = nullptr;
+    SharedStorage* shared_ = nullptr;
     size_t capacity_ = 0;
     size_t size_ = 0;
     size_t position_ = 0;
@@ -158,6 +187,14 @@ struct apacket {
     using payload_type = Block;
     amessage msg;
     payload_type payload;
+
+    // Link used by PacketQueue while the packet waits to be handled.
+    apacket* queue_next = nullptr;
+
+    // Every packet is allocated and freed once, usually on different threads, so apackets are
+    // recycled through a free list instead of going to the system allocator each time.
+    static void* operator new(size_t size);
+    static void operator delete(void* ptr);
 };
 
 struct IOVector {
@@ -176,6 +176,133 @@ TEST(IOVector, trim_front) {
     ASSERT_EQ(1ULL, vec.size());
 }
 
+TEST(Block, size_classes) {
+    Block small(100);
+    ASSERT_EQ(100ULL, small.size());
+    ASSERT_EQ(100ULL, small.capacity());
+
+    Block rounded(5000);
+    ASSERT_EQ(5000ULL, rounded.size());
+    ASSERT_EQ(8192ULL, rounded.capacity());
+
+    Block max(MAX_PAYLOAD);
+    ASSERT_EQ(MAX_PAYLOAD, max.size());
+    ASSERT_EQ(MAX_PAYLOAD, max.capacity());
+
+    // Callers can grow into the rounded up capacity.
+    rounded.resize(8192);
+    ASSERT_EQ(8192ULL, rounded.size());
+}
+
+TEST(Block, recycled) {
+    { Block warmup(64 * 1024); }
+
+    auto before = block_pool_stats();
+    {
+        Block block(64 * 1024);
+        memset(block.data(), 'x', block.size());
+    }
+    {
+        Block block(40 * 1024);
+        ASSERT_EQ(64ULL * 1024, block.capacity());
+    }
+    auto after = block_pool_stats();
+    ASSERT_EQ(before.hits + 2, after.hits);
+    ASSERT_EQ(before.misses, after.misses);
+}
+
+TEST(Block, recycled_through_iovector) {
+    IOVector vec;
+    vec.append(Block(MAX_PAYLOAD));
+    vec.append(Block(MAX_PAYLOAD));
+
+    auto before = block_pool_stats();
+    vec.clear();
+    Block a(MAX_PAYLOAD);
+    Block b(MAX_PAYLOAD);
+    auto after = block_pool_stats();
+    ASSERT_EQ(before.hits + 2, after.hits);
+    ASSERT_EQ(before.misses, after.misses);
+}
+
+TEST(Block, split_front_shares_storage) {
+    Block block = create_block('x', 64 * 1024);
+    memset(block.data() + 16 * 1024, 'y', 48 * 1024);
+    const char* storage = block.data();
+
+    Block front = block.split_front(16 * 1024);
+    ASSERT_EQ(storage, front.data());
+    ASSERT_EQ(16ULL * 1024, front.size());
+    ASSERT_EQ(create_block('x', 16 * 1024), front);
+
+    ASSERT_EQ(storage + 16 * 1024, block.data());
+    ASSERT_EQ(48ULL * 1024, block.size());
+    ASSERT_EQ(create_block('y', 48 * 1024), block);
+
+    // The storage outlives the Block it was split from.
+    block.clear();
+    ASSERT_EQ(create_block('x', 16 * 1024), front);
+
+    // And goes back to the free list when the last reference is gone.
+    front.clear();
+    auto before = block_pool_stats();
+    Block reused(64 * 1024);
+    ASSERT_EQ(before.hits + 1, block_pool_stats().hits);
+}
+
+TEST(Block, split_front_small) {
+    Block block = create_block("0123456789");
+    const char* storage = block.data();
+
+    Block front = block.split_front(4);
+    ASSERT_NE(storage, front.data());
+    ASSERT_EQ(create_block("0123"), front);
+    ASSERT_EQ(create_block("456789"), block);
+
+    Block rest = block.split_front(6);
+    ASSERT_EQ(create_block("456789"), rest);
+    ASSERT_TRUE(block.empty());
+}
+
+TEST(Block, drop_front) {
+    Block block = create_block("0123456789");
+    block.drop_front(3);
+    ASSERT_EQ(create_block("3456789"), block);
+    block.drop_front(7);
+    ASSERT_TRUE(block.empty());
+}
+
+TEST(IOVector, take_front_zero_copy) {
+    IOVector vec;
+    vec.append(create_block('x', 256 * 1024));
+    const char* storage = vec.front_data();
+
+    // Carve packets out of a single large read, the way NonblockingFdConnection does.
+    IOVector first = vec.take_front(100 * 1024);
+    vec.drop_front(24);
+    IOVector second = vec.take_front(100 * 1024);
+
+    Block first_block = std::move(first).coalesce();
+    Block second_block = std::move(second).coalesce();
+    ASSERT_EQ(storage, first_block.data());
+    ASSERT_EQ(storage + 100 * 1024 + 24, second_block.data());
+    ASSERT_EQ(create_block('x', 100 * 1024), second_block);
+    ASSERT_EQ(256ULL * 1024 - 200 * 1024 - 24, vec.size());
+}
+
+TEST(apacket, recycled) {
+    { auto warmup = std::make_unique<apacket>(); }
+
+    auto before = apacket_pool_stats();
+    for (int i = 0; i < 10; ++i) {
+        apacket* p = get_apacket();
+        put_apacket(p);
+    }
+    auto after = apacket_pool_stats();
+    ASSERT_EQ(before.hits + 10, after.hits);
+    ASSERT_EQ(before.misses, after.misses);
+}
+
 class weak_ptr_test : public FdeventTest {};
 
 struct Destructor : public enable_weak_from_this<Destructor> {